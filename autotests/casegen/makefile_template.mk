@@ -25,7 +25,10 @@ EXTRA_C_SOURCES = \
     $(TEX_ROOT)/src/tex/tex_measure.c \
     $(TEX_ROOT)/src/tex/tex_layout.c \
     $(TEX_ROOT)/src/tex/tex_renderer.c \
-    $(TEX_ROOT)/src/tex/tex_draw.c
+    $(TEX_ROOT)/src/tex/tex_draw.c \
+    $(TEX_ROOT)/src/tex/tex_document.c \
+    $(TEX_ROOT)/src/tex/tex_source.c \
+    $(TEX_ROOT)/src/tex/tex_alloc.c
 
 CFLAGS += -I$(TEX_ROOT)/src -I$(TEX_ROOT)/src/tex -I$(TEX_ROOT)/include
 CFLAGS += -I$(TEX_ROOT)/autotests
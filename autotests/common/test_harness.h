@@ -82,27 +82,19 @@ static inline int test_harness_init(void)
  */
 static inline int test_harness_render(const char *expr, int x, int y)
 {
-    // Copy to mutable buffer since tex_format modifies in place
-    size_t len = strlen(expr);
-    char *buf = (char *)malloc(len + 1);
-    if (!buf)
-        return y;
-    strcpy(buf, expr);
-
     TeX_Config cfg = {
         .color_fg = TEST_COL_FG,
         .color_bg = TEST_COL_BG,
         .font_pack = "TeXFonts"
     };
 
-    TeX_Layout *layout = tex_format(buf, TEST_WIDTH, &cfg);
+    TeX_Layout *layout = tex_format(expr, TEST_WIDTH, &cfg);
     if (layout)
     {
         tex_draw(g_test_renderer, layout, x, y, 0);
         y += tex_get_total_height(layout) + 5;
         tex_free(layout);
     }
-    free(buf);
     return y;
 }
 
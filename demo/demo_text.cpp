@@ -141,19 +141,8 @@ int main(void)
 	dbg_printf("fontlib configured\n");
 
 	// 4. Prepare Content
-	// We must copy the const string to a mutable buffer because tex_format
-	// modifies the input string in-place for tokenization.
+	// tex_format only reads the source, the demo text is passed in place without a RAM copy
 	const char* source_text = demo_texts_get(0);
-	size_t len = strlen(source_text);
-	char* input_buffer = static_cast<char*>(malloc(len + 1));
-	dbg_printf("input buffer allocated\n");
-	if (!input_buffer)
-	{
-		dbg_printf("input buffer allocation failed\n");
-		return 1; // OOM check
-	}
-	strncpy(input_buffer, source_text, len + 1);
-	dbg_printf("input buffer copied\n");
 
 	// 5. Format Layout
 	TeX_Config cfg = {
@@ -170,7 +159,7 @@ int main(void)
 
 	// Format
 	dbg_printf("formatting layout\n");
-	TeX_Layout* layout = tex_format(input_buffer, content_width, &cfg);
+	TeX_Layout* layout = tex_format(source_text, content_width, &cfg);
 	dbg_printf("layout formatted\n");
 
 	// Create renderer for windowed drawing
@@ -179,7 +168,6 @@ int main(void)
 	{
 		dbg_printf("renderer creation failed\n");
 		tex_free(layout);
-		free(input_buffer);
 		gfx_End();
 		return 1;
 	}
@@ -239,7 +227,6 @@ int main(void)
 	tex_renderer_destroy(renderer);
 	if (layout)
 		tex_free(layout);
-	free(input_buffer); // Free buffer AFTER layout is freed
 	gfx_End();
 
 #ifndef __TICE__
@@ -21,44 +21,52 @@ typedef enum
 typedef struct
 {
 	ChatRole role;
-	TeX_Layout* layout;
-	char* source_buffer; // <--- FIX: Keep reference to the buffer
-	int width;
-	int height;
-	int y_pos;
+	const char* source; // layout reads from it in place, must outlive the document
 } ChatMessage;
 
 #define MAX_MESSAGES 10
+#define HEADER_H 14
+#define MESSAGE_GAP 20
 ChatMessage thread[MAX_MESSAGES];
 int msg_count = 0;
-int total_thread_height = 20;
 
-void add_message(const char* text, ChatRole role, int screen_width, TeX_Config* cfg)
+void add_message(TeX_Document* doc, TeX_Formatter* fmt, const char* text, ChatRole role, int screen_width,
+                 TeX_Config* cfg)
 {
 	if (msg_count >= MAX_MESSAGES)
 		return;
 
-	// 1. Allocate buffer and KEEP it (do not free until end of program)
-	char* buf = (char*)malloc(strlen(text) + 1);
-	if (!buf)
-		return;
-	strcpy(buf, text);
-
-	// 2. Format
+	// 1. Format, the text is a string literal that lives for the whole program so no copy is needed
+	// the shared formatter measures every message in the same scratch pool, no per message heap churn
 	int bubble_width = (role == ROLE_USER) ? (screen_width - 40) : screen_width;
-	TeX_Layout* l = tex_format(buf, bubble_width, cfg);
+	TeX_Layout* l = tex_formatter_format(fmt, text, -1, bubble_width, cfg);
 
-	// 3. Store
-	ChatMessage* msg = &thread[msg_count++];
+	// 2. Store, the document owns the layout and keeps the y bookkeeping
+	ChatMessage* msg = &thread[msg_count];
 	msg->role = role;
-	msg->layout = l;
-	msg->source_buffer = buf; // Store pointer so we can free it later
-	msg->width = bubble_width;
-	msg->height = tex_get_total_height(l) + 14;
-
-	// 4. Stack
-	msg->y_pos = total_thread_height;
-	total_thread_height += msg->height + 20;
+	msg->source = text;
+	if (!l || tex_document_append(doc, l, HEADER_H, MESSAGE_GAP, msg) < 0)
+	{
+		tex_free(l);
+		return;
+	}
+	msg_count++;
+}
+
+static void draw_header(void* userdata, int index, void* entry_userdata, int x, int y)
+{
+	(void)userdata;
+	(void)index;
+	const ChatMessage* m = (const ChatMessage*)entry_userdata;
+
+	// Draw header only if on-screen
+	if (y >= 0 && y < GFX_LCD_HEIGHT)
+	{
+		gfx_SetTextFGColor(0);
+		gfx_SetTextXY(x, y);
+		gfx_PrintString(m->role == ROLE_USER ? "User:" : "Assistant:");
+	}
+	gfx_SetColor(0);
 }
 
 int main(void)
@@ -78,8 +86,8 @@ int main(void)
 	tex_draw_set_fonts(f_main, f_script);
 	fontlib_SetTransparency(true);
 
-	// Create one shared renderer for all messages (stateless mode)
-	TeX_Renderer* renderer = tex_renderer_create();
+	// One shared renderer that keeps a hydrated window per visible message, 8KB each
+	TeX_Renderer* renderer = tex_renderer_create_multi(32 * 1024, 4);
 	if (!renderer)
 	{
 		gfx_End();
@@ -90,17 +98,28 @@ int main(void)
 
 	const int screen_w = GFX_LCD_WIDTH - 20;
 
+	TeX_Document* doc = tex_document_create();
+	TeX_Formatter* fmt = tex_formatter_create(0, 8 * 1024, NULL);
+	if (!doc || !fmt)
+	{
+		tex_formatter_destroy(fmt);
+		tex_document_destroy(doc);
+		tex_renderer_destroy(renderer);
+		gfx_End();
+		return 1;
+	}
+
 	// --- Build Chat ---
-	add_message("Hello! Can you help me with a physics problem?", ROLE_USER, screen_w, &cfg);
+	add_message(doc, fmt, "Hello! Can you help me with a physics problem?", ROLE_USER, screen_w, &cfg);
 
-	add_message("Certainly. I can help you calculate properties of mass distributions. "
+	add_message(doc, fmt, "Certainly. I can help you calculate properties of mass distributions. "
 	            "For example, the Center of Mass is defined as:\n"
 	            "$$x_{cm} = \\frac{1}{M} \\int x \\lambda(x) dx$$",
 	            ROLE_ASSISTANT, screen_w, &cfg);
 
-	add_message("What if the density $\\lambda(x)$ is constant?", ROLE_USER, screen_w, &cfg);
+	add_message(doc, fmt, "What if the density $\\lambda(x)$ is constant?", ROLE_USER, screen_w, &cfg);
 
-	add_message("If $\\lambda$ is constant, it factors out:\n"
+	add_message(doc, fmt, "If $\\lambda$ is constant, it factors out:\n"
 	            "$$x_{cm} = \\frac{\\lambda}{M} [ \\frac{1}{2}x^2 ]_0^L = \\frac{L}{2}$$",
 	            ROLE_ASSISTANT, screen_w, &cfg);
 
@@ -122,6 +141,7 @@ int main(void)
 
 		// Clamp scroll AFTER input
 		int view_h = GFX_LCD_HEIGHT;
+		int total_thread_height = tex_document_total_height(doc) + 20;
 		int max_scroll = total_thread_height - view_h;
 		if (max_scroll < 0)
 			max_scroll = 0;
@@ -134,38 +154,9 @@ int main(void)
 
 		gfx_FillScreen(255);
 
-		for (int i = 0; i < msg_count; i++)
-		{
-			ChatMessage* m = &thread[i];
-
-			// FIX 2: Calculate absolute screen Y.
-			// We do the math here so we have full control.
-			int screen_y = m->y_pos - scroll_y;
-
-			// Culling: Check if message is visible
-			if (screen_y + m->height < 0 || screen_y > GFX_LCD_HEIGHT)
-				continue;
-
-			int draw_x = 10; // Left align all messages
-
-			// FIX 3: Draw Header with Safety Check
-			// header_y is where the text starts
-			int header_y = screen_y; // Header starts at message top
-			int content_y = screen_y + 14; // Content below header
-
-			// Draw header only if on-screen
-			if (header_y >= 0 && header_y < GFX_LCD_HEIGHT)
-			{
-				gfx_SetTextFGColor(0);
-				gfx_SetTextXY(draw_x, header_y);
-				gfx_PrintString(m->role == ROLE_USER ? "User:" : "Assistant:");
-			}
-
-			gfx_SetColor(0);
-
-			// Draw TeX content
-			tex_draw(renderer, m->layout, draw_x, content_y, 0);
-		}
+		// Only messages intersecting the screen are visited, content starts 20px down
+		TeX_Viewport screen = { 0, 0, GFX_LCD_WIDTH, GFX_LCD_HEIGHT };
+		tex_document_draw(doc, renderer, 10, scroll_y - 20, &screen, draw_header, NULL);
 
 
 		// Scrollbar
@@ -181,13 +172,10 @@ int main(void)
 		gfx_SwapDraw();
 	}
 
-	// Cleanup: Free renderer, layouts, and source buffers
+	// Cleanup: Free renderer, then document (and its layouts)
+	tex_formatter_destroy(fmt);
 	tex_renderer_destroy(renderer);
-	for (int i = 0; i < msg_count; i++)
-	{
-		tex_free(thread[i].layout);
-		free(thread[i].source_buffer); // <--- Memory safety restored
-	}
+	tex_document_destroy(doc);
 	gfx_End();
 	return 0;
 }
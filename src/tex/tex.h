@@ -14,19 +14,67 @@ typedef struct TeX_Renderer TeX_Renderer;
 
 
 // Parse input, calculate layout, return handle
-// Input string is modified during parsing
+// Input is never written to but must stay valid (same address) for the lifetime of the layout
 // Returns NULL only on catastrophic failure; check tex_get_last_error() for errors
-TeX_Layout* tex_format(char* input, int width, TeX_Config* config);
+TeX_Layout* tex_format(const char* input, int width, const TeX_Config* config);
+
+// Same as tex_format for input that is not NUL terminated (e.g. archived AppVar data)
+TeX_Layout* tex_format_n(const char* input, int len, int width, const TeX_Config* config);
+
+// Format a block compressed document (tools/pack_source.py) without decompressing it as a whole
+// The dry run decompresses one block at a time, tex_draw only the blocks around the visible window.
+// data is read in place (e.g. an archived AppVar) and must outlive the layout; tex_append is not supported
+TeX_Layout* tex_format_packed(const void* data, int size, int width, const TeX_Config* config);
+
+// Resumable formatting: begin returns a layout with no lines measured yet,
+// each step measures up to budget tokens and returns nonzero while input remains.
+// The layout is drawable at any point; total height grows as steps complete
+// len < 0 means input is NUL terminated
+TeX_Layout* tex_format_begin(const char* input, int len, int width, const TeX_Config* config);
+int tex_format_step(TeX_Layout* layout, int budget);
+
+// Run the remaining steps to completion and release formatter scratch memory
+TeX_Layout* tex_format_end(TeX_Layout* layout);
+
+// Extend a layout with more text (streamed chat output)
+// source holds the previously formatted text as its unchanged prefix followed by the new
+// text, it may be a different (reallocated) buffer; len < 0 means NUL terminated.
+// Only the last open line is measured again. A '$' or '$$' that is not closed yet is
+// measured as plain text and measured again once more input arrives. Returns 0 on success
+int tex_append(TeX_Layout* layout, const char* source, int len);
 
 // Total rendered height in pixels (for scrollbar sizing)
 int tex_get_total_height(TeX_Layout* layout);
 
+// Document y of the top of the line holding a source offset (clamped to the source), -1 on error
+// Replays only the lines between the nearest checkpoint and the target
+int tex_offset_to_y(TeX_Layout* layout, int offset);
+
+// Source offset where the line covering document y starts (y is clamped), -1 on error
+int tex_y_to_offset(TeX_Layout* layout, int y);
+
+// Headings indexed by the dry run: paragraphs starting with TeX_Config.outline_marker
+int tex_outline_count(TeX_Layout* layout);
+
+// Source offset and document y of heading index (pass NULL for either). Returns 0, or -1 if out of range
+int tex_outline_get(TeX_Layout* layout, int index, int* src_offset, int* y);
+
 // Create a renderer with default slab size (40KB)
 TeX_Renderer* tex_renderer_create(void);
 
 // Create a renderer with custom slab size
 TeX_Renderer* tex_renderer_create_sized(size_t slab_size);
 
+// Create a renderer that keeps hydrated windows for up to slot_count layouts at once
+// The slab is split evenly between slots; the least recently drawn layout is evicted first
+// Each slot must hold a whole hydrated window: a screen of formula-dense text takes about 6KB, so keep
+// slab_size / slot_count at 8KB or more. A window that does not fit sets TEX_ERR_OOM on its layout
+TeX_Renderer* tex_renderer_create_multi(size_t slab_size, int slot_count);
+
+// Same as tex_renderer_create_multi with the renderer and its slab taken from allocator (NULL = malloc)
+// Drawing never allocates, all transient memory lives in the slab
+TeX_Renderer* tex_renderer_create_alloc(size_t slab_size, int slot_count, const TeX_Allocator* allocator);
+
 // Destroy renderer and free slab
 void tex_renderer_destroy(TeX_Renderer* r);
 
@@ -34,6 +82,18 @@ void tex_renderer_destroy(TeX_Renderer* r);
 // Uses windowed rendering: only parses visible portion + padding
 void tex_draw(TeX_Renderer* r, TeX_Layout* layout, int x, int y, int scroll_y);
 
+// Same as tex_draw, clipped to a viewport rectangle (screen coordinates): shapes through the graphx clip
+// region, text to the glyphs that fit whole. The clip region is the full screen again on return
+// Hydration padding is sized from the viewport height, so small panes hydrate less
+void tex_draw_viewport(TeX_Renderer* r, TeX_Layout* layout, int x, int y, int scroll_y, const TeX_Viewport* viewport);
+
+// Innermost node under screen point (px, py) for a layout drawn with tex_draw(r, layout, x, y, scroll_y)
+// Walks only the boxes holding the point in the window hydrated by the last draw (hydrated around the
+// point if it is not there). A point left or right of a line lands on its first or last item.
+// The walk reaches any node a draw reaches, its path is the draw walk stack in the renderer pool
+// Returns 0 and fills out, or -1 when no line is under the point
+int tex_hit_test(TeX_Renderer* r, TeX_Layout* layout, int x, int y, int scroll_y, int px, int py, TeX_HitResult* out);
+
 // Free all resources
 void tex_free(TeX_Layout* layout);
 
@@ -41,6 +101,10 @@ void tex_free(TeX_Layout* layout);
 void tex_renderer_get_stats(TeX_Renderer* r, size_t* peak_used, size_t* capacity, size_t* alloc_count,
                             size_t* reset_count);
 
+// Get draw walk stack statistics: deepest walk in nodes and its size in bytes (the walk stack is kept in
+// the slot pool, no C stack recursion), and subtrees skipped because the pool could not hold the stack
+void tex_renderer_get_stack_stats(TeX_Renderer* r, size_t* peak_depth, size_t* peak_bytes, size_t* overflow_count);
+
 // Get error code from last operation
 TeX_Error tex_get_last_error(TeX_Layout* layout);
 
@@ -51,6 +115,90 @@ const char* tex_get_error_message(TeX_Layout* layout);
 int tex_get_error_value(TeX_Layout* layout);
 
 
+// ================================
+// formatter (reusable formatting memory)
+// ================================
+typedef struct TeX_Formatter TeX_Formatter;
+
+// Create a formatter owning a scratch pool of scratch_size bytes (0 = default, 8KB host / 4KB device)
+// A formula that does not fit grows the pool up to max_scratch_size (at most 64KB, <= scratch_size never grows)
+// before it is reported as TEX_ERR_OOM with the formula's source offset as the error value
+// allocator may be NULL (malloc/free)
+TeX_Formatter* tex_formatter_create(size_t scratch_size, size_t max_scratch_size, const TeX_Allocator* allocator);
+void tex_formatter_destroy(TeX_Formatter* f);
+
+// Current scratch pool size (grows with retries)
+size_t tex_formatter_scratch_size(TeX_Formatter* f);
+
+// Same as tex_format_n, measuring in the formatter's scratch pool instead of allocating one per call
+TeX_Layout* tex_formatter_format(TeX_Formatter* f, const char* input, int len, int width, const TeX_Config* config);
+
+// Same as tex_offset_to_y / tex_y_to_offset, replaying lines in the formatter's scratch pool (grown up to its
+// max_scratch_size) instead of allocating a scratch pool per lookup. f may be NULL
+int tex_formatter_offset_to_y(TeX_Formatter* f, TeX_Layout* layout, int offset);
+int tex_formatter_y_to_offset(TeX_Formatter* f, TeX_Layout* layout, int y);
+
+// Format input into an existing layout, replacing its content and reusing its allocations
+// f may be NULL (a scratch pool is allocated for the call). The layout keeps the allocator it was
+// created with, config->allocator is ignored. Returns 0 on success
+int tex_format_into(TeX_Formatter* f, TeX_Layout* layout, const char* input, int len, int width,
+                    const TeX_Config* config);
+
+
+// ================================
+// document (ordered list of layouts)
+// ================================
+typedef struct TeX_Document TeX_Document;
+
+// Called for every entry tex_document_draw finds on screen, before its layout (also when only its padding
+// is, the layout is then not drawn). y is the screen position of the entry top (pad_top area included)
+typedef void (*TeX_DocumentDrawFn)(void* userdata, int index, void* entry_userdata, int x, int y);
+
+// Create an empty document
+TeX_Document* tex_document_create(void);
+
+// Same as tex_document_create with the document bookkeeping taken from allocator (NULL = malloc)
+// Layouts keep their own allocator (TeX_Config.allocator)
+TeX_Document* tex_document_create_alloc(const TeX_Allocator* allocator);
+
+// Destroy document and free every layout it owns
+void tex_document_destroy(TeX_Document* doc);
+
+// Insert layout at index (0..count), the document takes ownership of it
+// pad_top/pad_bottom add spacing around the layout (headers, gaps)
+// Returns index, or -1 on failure (layout is not taken)
+int tex_document_insert(TeX_Document* doc, int index, TeX_Layout* layout, int pad_top, int pad_bottom, void* userdata);
+
+// Insert layout after the last entry
+int tex_document_append(TeX_Document* doc, TeX_Layout* layout, int pad_top, int pad_bottom, void* userdata);
+
+// Remove entry and free its layout
+void tex_document_remove(TeX_Document* doc, int index);
+
+// Re-read the height of an entry after its layout changed
+void tex_document_refresh(TeX_Document* doc, int index);
+
+// Number of entries / total height including padding
+int tex_document_count(TeX_Document* doc);
+int tex_document_total_height(TeX_Document* doc);
+
+// Entry accessors (NULL if index is out of range)
+TeX_Layout* tex_document_get_layout(TeX_Document* doc, int index);
+void* tex_document_get_userdata(TeX_Document* doc, int index);
+
+// Document y of an entry top, and the entry covering a document y (clamped, -1 if empty)
+int tex_document_entry_y(TeX_Document* doc, int index);
+int tex_document_index_at(TeX_Document* doc, int y);
+
+// Draw the entries intersecting the viewport; document y == scroll_y lands on viewport->y
+void tex_document_draw(TeX_Document* doc, TeX_Renderer* r, int x, int scroll_y, const TeX_Viewport* viewport,
+                       TeX_DocumentDrawFn on_entry, void* userdata);
+
+
+// Forget the cached font handles and glyph metrics, the next format or draw reloads them.
+// Call after the font pack was replaced or the archive was garbage collected (font pointers move)
+void tex_font_cache_invalidate(void);
+
 struct fontlib_font_t;
 typedef struct fontlib_font_t fontlib_font_t;
 void tex_draw_set_fonts(fontlib_font_t* main, fontlib_font_t* script);
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: AGPL-3.0-only
+#include "tex_alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void* tex_mem_alloc(const TeX_Allocator* a, size_t size)
+{
+	if (!a)
+		return malloc(size);
+	return a->alloc(a->userdata, size);
+}
+
+void* tex_mem_calloc(const TeX_Allocator* a, size_t size)
+{
+	if (!a)
+		return calloc(1, size);
+	void* p = a->alloc(a->userdata, size);
+	if (p)
+		memset(p, 0, size);
+	return p;
+}
+
+void* tex_mem_realloc(const TeX_Allocator* a, void* ptr, size_t old_size, size_t new_size)
+{
+	if (!a)
+		return realloc(ptr, new_size);
+	if (a->realloc)
+		return a->realloc(a->userdata, ptr, old_size, new_size);
+
+	void* p = a->alloc(a->userdata, new_size);
+	if (p && ptr)
+	{
+		memcpy(p, ptr, old_size < new_size ? old_size : new_size);
+		a->free(a->userdata, ptr, old_size);
+	}
+	return p;
+}
+
+void tex_mem_free(const TeX_Allocator* a, void* ptr, size_t size)
+{
+	if (!ptr)
+		return;
+	if (!a)
+	{
+		free(ptr);
+		return;
+	}
+	a->free(a->userdata, ptr, size);
+}
@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: AGPL-3.0-only
+#ifndef TEX_TEX_ALLOC_H
+#define TEX_TEX_ALLOC_H
+
+#include <stddef.h>
+#include "tex_types.h"
+
+// every engine heap allocation goes through these, a NULL allocator means malloc/free
+
+void* tex_mem_alloc(const TeX_Allocator* a, size_t size);
+
+// zero initialized
+void* tex_mem_calloc(const TeX_Allocator* a, size_t size);
+
+// like realloc, returns NULL and keeps ptr on failure
+void* tex_mem_realloc(const TeX_Allocator* a, void* ptr, size_t old_size, size_t new_size);
+
+// size is the size ptr was allocated (or last reallocated) with, NULL ptr is a no-op
+void tex_mem_free(const TeX_Allocator* a, void* ptr, size_t size);
+
+#endif // TEX_TEX_ALLOC_H
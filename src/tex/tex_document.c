@@ -0,0 +1,318 @@
+// SPDX-License-Identifier: AGPL-3.0-only
+#include "tex.h"
+#include "tex_alloc.h"
+#include "tex_internal.h"
+
+// entries live in an implicit treap ordered by position. every node caches the
+// height and entry count of its subtree, which makes y <-> index queries,
+// insert and remove O(log n)
+typedef struct DocNode
+{
+	struct DocNode* left;
+	struct DocNode* right;
+	TeX_Layout* layout;
+	void* userdata;
+	int pad_top;
+	int pad_bottom;
+	int height; // pad_top + layout height + pad_bottom
+	int sum; // total height of this subtree
+	int size; // entry count of this subtree
+	unsigned prio;
+} DocNode;
+
+struct TeX_Document
+{
+	DocNode* root;
+	unsigned seed;
+	const TeX_Allocator* allocator; // the document and its tree nodes, not the layouts
+};
+
+static int node_sum(const DocNode* n) { return n ? n->sum : 0; }
+static int node_size(const DocNode* n) { return n ? n->size : 0; }
+
+static void node_update(DocNode* n)
+{
+	n->sum = node_sum(n->left) + n->height + node_sum(n->right);
+	n->size = node_size(n->left) + 1 + node_size(n->right);
+}
+
+static unsigned next_prio(TeX_Document* doc)
+{
+	// xorshift32
+	unsigned x = doc->seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	doc->seed = x;
+	return x;
+}
+
+// split t into the first k entries and the rest
+static void split(DocNode* t, int k, DocNode** left, DocNode** right)
+{
+	if (!t)
+	{
+		*left = NULL;
+		*right = NULL;
+		return;
+	}
+	if (node_size(t->left) < k)
+	{
+		split(t->right, k - node_size(t->left) - 1, &t->right, right);
+		*left = t;
+	}
+	else
+	{
+		split(t->left, k, left, &t->left);
+		*right = t;
+	}
+	node_update(t);
+}
+
+static DocNode* merge(DocNode* a, DocNode* b)
+{
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	if (a->prio > b->prio)
+	{
+		a->right = merge(a->right, b);
+		node_update(a);
+		return a;
+	}
+	b->left = merge(a, b->left);
+	node_update(b);
+	return b;
+}
+
+static void free_tree(const TeX_Allocator* a, DocNode* t)
+{
+	if (!t)
+		return;
+	free_tree(a, t->left);
+	free_tree(a, t->right);
+	tex_free(t->layout);
+	tex_mem_free(a, t, sizeof(DocNode));
+}
+
+static DocNode* node_at(DocNode* t, int index)
+{
+	while (t)
+	{
+		int left = node_size(t->left);
+		if (index < left)
+		{
+			t = t->left;
+		}
+		else if (index == left)
+		{
+			return t;
+		}
+		else
+		{
+			index -= left + 1;
+			t = t->right;
+		}
+	}
+	return NULL;
+}
+
+// re-read the layout height of one entry and fix up the sums on its path
+static void refresh_at(DocNode* t, int index)
+{
+	int left = node_size(t->left);
+	if (index < left)
+	{
+		refresh_at(t->left, index);
+	}
+	else if (index > left)
+	{
+		refresh_at(t->right, index - left - 1);
+	}
+	else
+	{
+		t->height = t->pad_top + tex_get_total_height(t->layout) + t->pad_bottom;
+	}
+	node_update(t);
+}
+
+TeX_Document* tex_document_create(void) { return tex_document_create_alloc(NULL); }
+
+TeX_Document* tex_document_create_alloc(const TeX_Allocator* allocator)
+{
+	TeX_Document* doc = (TeX_Document*)tex_mem_calloc(allocator, sizeof(TeX_Document));
+	if (!doc)
+		return NULL;
+	doc->root = NULL;
+	doc->seed = 0x9E3779B9u;
+	doc->allocator = allocator;
+	return doc;
+}
+
+void tex_document_destroy(TeX_Document* doc)
+{
+	if (!doc)
+		return;
+	free_tree(doc->allocator, doc->root);
+	tex_mem_free(doc->allocator, doc, sizeof(TeX_Document));
+}
+
+int tex_document_count(TeX_Document* doc) { return doc ? node_size(doc->root) : 0; }
+
+int tex_document_total_height(TeX_Document* doc) { return doc ? node_sum(doc->root) : 0; }
+
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+int tex_document_insert(TeX_Document* doc, int index, TeX_Layout* layout, int pad_top, int pad_bottom, void* userdata)
+{
+	if (!doc || !layout || index < 0 || index > node_size(doc->root))
+		return -1;
+
+	DocNode* n = (DocNode*)tex_mem_calloc(doc->allocator, sizeof(DocNode));
+	if (!n)
+		return -1;
+
+	n->layout = layout;
+	n->userdata = userdata;
+	n->pad_top = pad_top;
+	n->pad_bottom = pad_bottom;
+	n->height = pad_top + tex_get_total_height(layout) + pad_bottom;
+	n->prio = next_prio(doc);
+	node_update(n);
+
+	DocNode* left;
+	DocNode* right;
+	split(doc->root, index, &left, &right);
+	doc->root = merge(merge(left, n), right);
+	return index;
+}
+
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+int tex_document_append(TeX_Document* doc, TeX_Layout* layout, int pad_top, int pad_bottom, void* userdata)
+{
+	return tex_document_insert(doc, tex_document_count(doc), layout, pad_top, pad_bottom, userdata);
+}
+
+void tex_document_remove(TeX_Document* doc, int index)
+{
+	if (!doc || index < 0 || index >= node_size(doc->root))
+		return;
+
+	DocNode* left;
+	DocNode* mid;
+	DocNode* right;
+	split(doc->root, index, &left, &right);
+	split(right, 1, &mid, &right);
+	doc->root = merge(left, right);
+
+	tex_free(mid->layout);
+	tex_mem_free(doc->allocator, mid, sizeof(DocNode));
+}
+
+void tex_document_refresh(TeX_Document* doc, int index)
+{
+	if (!doc || index < 0 || index >= node_size(doc->root))
+		return;
+	refresh_at(doc->root, index);
+}
+
+TeX_Layout* tex_document_get_layout(TeX_Document* doc, int index)
+{
+	DocNode* n = doc ? node_at(doc->root, index) : NULL;
+	return n ? n->layout : NULL;
+}
+
+void* tex_document_get_userdata(TeX_Document* doc, int index)
+{
+	DocNode* n = doc ? node_at(doc->root, index) : NULL;
+	return n ? n->userdata : NULL;
+}
+
+int tex_document_entry_y(TeX_Document* doc, int index)
+{
+	if (!doc || index < 0)
+		return 0;
+
+	int y = 0;
+	DocNode* t = doc->root;
+	while (t)
+	{
+		int left = node_size(t->left);
+		if (index < left)
+		{
+			t = t->left;
+		}
+		else
+		{
+			y += node_sum(t->left);
+			if (index == left)
+				return y;
+			y += t->height;
+			index -= left + 1;
+			t = t->right;
+		}
+	}
+	return y;
+}
+
+int tex_document_index_at(TeX_Document* doc, int y)
+{
+	if (!doc || !doc->root)
+		return -1;
+	if (y < 0)
+		return 0;
+	if (y >= doc->root->sum)
+		return doc->root->size - 1;
+
+	int index = 0;
+	DocNode* t = doc->root;
+	while (t)
+	{
+		int left_sum = node_sum(t->left);
+		if (y < left_sum)
+		{
+			t = t->left;
+			continue;
+		}
+		y -= left_sum;
+		index += node_size(t->left);
+		if (y < t->height)
+			return index;
+		y -= t->height;
+		index++;
+		t = t->right;
+	}
+	return index - 1;
+}
+
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+void tex_document_draw(TeX_Document* doc, TeX_Renderer* r, int x, int scroll_y, const TeX_Viewport* viewport,
+                       TeX_DocumentDrawFn on_entry, void* userdata)
+{
+	if (!doc || !r || !viewport || !doc->root || viewport->h <= 0)
+		return;
+
+	int count = doc->root->size;
+	int doc_bot = scroll_y + viewport->h;
+
+	// entries are walked by index, each lookup is O(log n) and only visible entries are touched
+	for (int i = tex_document_index_at(doc, scroll_y); i >= 0 && i < count; i++)
+	{
+		int entry_y = tex_document_entry_y(doc, i);
+		if (entry_y >= doc_bot)
+			break;
+
+		DocNode* n = node_at(doc->root, i);
+		if (!n)
+			break;
+
+		int screen_y = viewport->y + (entry_y - scroll_y);
+		if (on_entry)
+			on_entry(userdata, i, n->userdata, x, screen_y);
+
+		// an entry with only its padding on screen takes no renderer slot
+		int layout_y = screen_y + n->pad_top;
+		if (layout_y < viewport->y + viewport->h && layout_y + tex_get_total_height(n->layout) > viewport->y)
+			tex_draw_viewport(r, n->layout, x, layout_y, 0, viewport);
+	}
+}
@@ -1,3 +1,4 @@
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -32,9 +33,9 @@ static void dlb_push(UnifiedPool* pool, DrawListBuilder* lb, NodeRef item)
 		return;
 
 	// Need a new block?
-	if (lb->tail_block == NULL || lb->tail_block->count >= TEX_LIST_BLOCK_CAP)
+	if (lb->tail_block == NULL || lb->tail_block->count >= lb->tail_block->cap)
 	{
-		ListId new_id = pool_alloc_list_block(pool);
+		ListId new_id = pool_alloc_list_block(pool, lb->tail_block);
 		if (new_id == LIST_NULL)
 			return;
 		TexListBlock* new_block = pool_get_list_block(pool, new_id);
@@ -52,6 +53,16 @@ static void dlb_push(UnifiedPool* pool, DrawListBuilder* lb, NodeRef item)
 	lb->tail_block->items[lb->tail_block->count++] = item;
 }
 
+// push a line item with its source span, the first item of a line fixes the line's source offset
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static void push_item(UnifiedPool* pool, DrawListBuilder* lb, NodeRef item, int src, int len, int* line_src)
+{
+	if (lb->head == LIST_NULL)
+		*line_src = src;
+	node_set_span(pool_get_node(pool, item), src - *line_src, len);
+	dlb_push(pool, lb, item);
+}
+
 static UnifiedPool* g_draw_pool = NULL;
 
 #include <fontlibc.h>
@@ -62,89 +73,228 @@ static UnifiedPool* g_draw_pool = NULL;
 
 static fontlib_font_t* g_draw_font_main = NULL;
 static fontlib_font_t* g_draw_font_script = NULL;
-static FontRole g_draw_current_role = (FontRole)-1;
 static int g_draw_vis_top = 0;
 static int g_draw_vis_bot = TEX_VIEWPORT_H;
+static int g_draw_vis_left = 0;
+static int g_draw_vis_right = GFX_LCD_WIDTH;
+
+// hit test: the draw walk runs with the visible band shrunk to one pixel, so only boxes holding
+// the point are descended into, and records the deepest one instead of drawing. The path to it is
+// the walk's own frame stack, a hit test reaches as deep as a draw
+typedef struct
+{
+	int px, py; // the point, screen coordinates
+	Node* hit; // deepest node whose box holds the point
+	Node* hit_parent;
+	int hit_depth; // -1 when none
+	int hit_ordinal; // position of hit among its parent's children, in draw order
+	int box_x, box_y, box_w, box_h;
+} TexHitProbe;
+
+static TexHitProbe* g_draw_probe = NULL;
+
+// draw walk stack (see draw_node), bound to a slot around every walk
+static TexDrawFrame* g_draw_frames = NULL;
+static int g_draw_frame_cap = 0;
+static int g_draw_frame_peak = 0;
+static int g_draw_frame_overflows = 0;
+
+// the slot's stack once recorded, before that the free gap between its nodes and strings
+// (only walks that allocate nothing may run on the gap)
+static void frames_bind(TeX_RenderSlot* slot)
+{
+	UnifiedPool* pool = &slot->pool;
+	g_draw_frame_peak = 0;
+	g_draw_frame_overflows = 0;
+	if (slot->frames)
+	{
+		g_draw_frames = slot->frames;
+		g_draw_frame_cap = slot->frame_cap;
+		return;
+	}
+	size_t start = pool->node_count * sizeof(Node);
+	size_t end = pool->string_cursor & ~((size_t)1);
+	g_draw_frames = (end > start) ? (TexDrawFrame*)(pool->slab + start) : NULL;
+	g_draw_frame_cap = (end > start) ? (int)TEX_MIN((end - start) / sizeof(TexDrawFrame), (size_t)INT16_MAX) : 0;
+}
+
+// a walk that skipped subtrees left content out, the layout is told (the pool could not hold the stack)
+static void frames_unbind(TeX_RenderSlot* slot)
+{
+	slot->frame_peak = TEX_MAX(slot->frame_peak, g_draw_frame_peak);
+	slot->frame_overflows += g_draw_frame_overflows;
+	if (g_draw_frame_overflows > 0)
+		TEX_SET_ERROR(slot->cached_layout, TEX_ERR_OOM, "Draw stack does not fit in the renderer pool",
+		              g_draw_frame_overflows);
+	g_draw_frames = NULL;
+	g_draw_frame_cap = 0;
+}
 
 void tex_draw_set_fonts(fontlib_font_t* main, fontlib_font_t* script)
 {
 	g_draw_font_main = main;
 	g_draw_font_script = script;
-	g_draw_current_role = (FontRole)-1;
+	tex_metrics_invalidate_font_state();
 }
 
 static inline void ensure_font(FontRole role)
 {
-	if (role != g_draw_current_role)
+	fontlib_font_t* font = role ? g_draw_font_script : g_draw_font_main;
+	if (font != g_tex_active_font)
 	{
-		fontlib_SetFont(role ? g_draw_font_script : g_draw_font_main, (fontlib_load_options_t)0);
-		g_draw_current_role = (FontRole)role;
+		fontlib_SetFont(font, (fontlib_load_options_t)0);
+		g_tex_active_font = font;
 	}
 }
 
 // -------------------------
 // drawing primitives
 // -------------------------
-static void rec_text(int x, int y_top, const char* s, int len, FontRole role)
+// the node walk calls the rec_* primitives; at hydration they record the window's display list
+// (see record_display_list), otherwise (probe aside) they emit directly
+typedef struct
+{
+	TeX_RenderSlot* slot;
+	UnifiedPool* pool;
+	TexDisplayOp* ops; // NULL while counting
+	int count;
+} TexDisplayRecorder;
+
+static TexDisplayRecorder* g_draw_rec = NULL;
+
+#if TEX_DRAW_LOG
+static TexDrawOp g_draw_log[TEX_DRAW_LOG_CAP];
+static int g_draw_log_count = 0;
+#endif
+
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static void log_op(TexDrawOpType type, int x1, int y1, int x2, int y2, int glyph, const char* text, int len,
+                   FontRole role)
+{
+#if TEX_DRAW_LOG
+	if (g_draw_log_count >= TEX_DRAW_LOG_CAP)
+		return;
+	TexDrawOp* op = &g_draw_log[g_draw_log_count++];
+	memset(op, 0, sizeof(*op));
+	op->type = type;
+	op->x1 = x1;
+	op->y1 = y1;
+	op->x2 = x2;
+	op->y2 = y2;
+	op->glyph = glyph;
+	op->text = text;
+	op->text_len = len;
+	op->role = (int)role;
+	if (type == DOP_RULE)
+		op->w = x2 - x1;
+	else if (type == DOP_SPRITE)
+	{
+		op->w = x2 - x1;
+		op->h = y2 - y1;
+	}
+	else if (type == DOP_ELLIPSE)
+	{
+		op->w = x2;
+		op->h = y2;
+		op->x2 = x1;
+		op->y2 = y1;
+	}
+#else
+	(void)type;
+	(void)x1;
+	(void)y1;
+	(void)x2;
+	(void)y2;
+	(void)glyph;
+	(void)text;
+	(void)len;
+	(void)role;
+#endif
+}
+
+// fontlib does not clip, a run of width w crossing a side of the visible band loses the glyphs that do
+// not fit whole (graphx clips everything else)
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static void emit_text(int x, int y_top, const char* s, int len, int w, FontRole role)
 {
 	int asc = tex_metrics_asc(role);
 	int desc = tex_metrics_desc(role);
 	int h = asc + desc;
 
-	if (y_top < g_draw_vis_top || (y_top + h) > g_draw_vis_bot)
+	if (y_top < g_draw_vis_top || (y_top + h) > g_draw_vis_bot || !s || len <= 0)
 	{
 		return;
 	}
+	if (x < g_draw_vis_left || x + w > g_draw_vis_right)
+	{
+		while (len > 0 && x < g_draw_vis_left)
+		{
+			x += tex_metrics_text_width_n(s++, 1, role);
+			len--;
+		}
+		int fit = 0;
+		w = 0;
+		while (fit < len && x + w + tex_metrics_text_width_n(s + fit, 1, role) <= g_draw_vis_right)
+			w += tex_metrics_text_width_n(s + fit++, 1, role);
+		len = fit;
+		if (len <= 0)
+			return;
+	}
 	ensure_font(role);
 	fontlib_SetCursorPosition((uint24_t)x, (uint8_t)y_top);
-	if (s && len > 0)
-		fontlib_DrawStringL(s, (size_t)len);
+	fontlib_DrawStringL(s, (size_t)len);
+	log_op(DOP_TEXT, x, y_top, x + w, y_top, 0, s, len, role);
 }
 
-static void rec_glyph(int x, int y_top, int glyph, FontRole role)
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static void emit_glyph(int x, int y_top, int glyph, int w, FontRole role)
 {
 	int asc = tex_metrics_asc(role);
 	int desc = tex_metrics_desc(role);
 	int h = asc + desc;
 
-	if (y_top < g_draw_vis_top || (y_top + h) > g_draw_vis_bot)
+	if (y_top < g_draw_vis_top || (y_top + h) > g_draw_vis_bot || x < g_draw_vis_left ||
+	    x + w > g_draw_vis_right)
 	{
 		return;
 	}
 	ensure_font(role);
 	fontlib_SetCursorPosition((uint24_t)x, (uint8_t)y_top);
 	fontlib_DrawGlyph((uint8_t)glyph);
+	log_op(DOP_GLYPH, x, y_top, x + w, y_top, glyph, NULL, 0, role);
 }
 
-static void rec_rule(int x, int y, int w)
+static void emit_rule(int x, int y, int w)
 {
 	if (y < g_draw_vis_top || y >= g_draw_vis_bot)
 	{
 		return;
 	}
 	gfx_HorizLine(x, y, w);
+	log_op(DOP_RULE, x, y, x + w, y, 0, NULL, 0, FONTROLE_MAIN);
 }
 
-static void rec_line(int x1, int y1, int x2, int y2)
+static void emit_line(int x1, int y1, int x2, int y2)
 {
-
 	if ((y1 < g_draw_vis_top && y2 < g_draw_vis_top) || (y1 >= g_draw_vis_bot && y2 >= g_draw_vis_bot))
 	{
 		return;
 	}
 	gfx_Line(x1, y1, x2, y2);
+	log_op(DOP_LINE, x1, y1, x2, y2, 0, NULL, 0, FONTROLE_MAIN);
 }
 
-static void rec_dot(int cx, int cy)
+static void emit_dot(int cx, int cy)
 {
 	if (cy < g_draw_vis_top || cy >= g_draw_vis_bot)
 	{
 		return;
 	}
 	gfx_FillCircle(cx, cy, 1);
+	log_op(DOP_DOT, cx, cy, cx, cy, 0, NULL, 0, FONTROLE_MAIN);
 }
 
-static void rec_ellipse(int cx, int cy, int rx, int ry)
+static void emit_ellipse(int cx, int cy, int rx, int ry)
 {
 	if ((cy + ry) < g_draw_vis_top || (cy - ry) >= g_draw_vis_bot)
 	{
@@ -153,8 +303,279 @@ static void rec_ellipse(int cx, int cy, int rx, int ry)
 	if (rx < 0 || ry < 0)
 		return;
 	gfx_Ellipse(cx, cy, (uint24_t)rx, (uint24_t)ry);
+	log_op(DOP_ELLIPSE, cx, cy, rx, ry, 0, NULL, 0, FONTROLE_MAIN);
+}
+
+static void emit_sprite(UnifiedPool* pool, TexSpriteEntry* e, int x, int y)
+{
+	gfx_sprite_t* sp = (gfx_sprite_t*)(pool->slab + e->sprite);
+	if (y + sp->height <= g_draw_vis_top || y >= g_draw_vis_bot)
+	{
+		return;
+	}
+	// baked in the color of the hydrating draw, repainted when the caller changed it since
+	uint8_t color = gfx_SetColor(e->color);
+	gfx_SetColor(color);
+	if (color != e->color)
+	{
+		uint8_t transparent = (uint8_t)(color + 1);
+		for (int i = 0; i < sp->width * sp->height; i++)
+			sp->data[i] = (sp->data[i] == e->transparent) ? transparent : color;
+		e->color = color;
+		e->transparent = transparent;
+	}
+	uint8_t prev = gfx_SetTransparentColor(e->transparent);
+	gfx_TransparentSprite(sp, x, y);
+	gfx_SetTransparentColor(prev);
+	log_op(DOP_SPRITE, x, y, x + sp->width, y + sp->height, 0, NULL, 0, FONTROLE_MAIN);
+}
+
+// append one op, only counted on the counting pass
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static TexDisplayOp* rec_push(TexDrawOpType type, int x1, int y1, int x2, int y2)
+{
+	int i = g_draw_rec->count++;
+	if (!g_draw_rec->ops)
+		return NULL;
+	TexDisplayOp* op = &g_draw_rec->ops[i];
+	op->type = (uint8_t)type;
+	op->role = FONTROLE_MAIN;
+	op->x1 = (int16_t)x1;
+	op->y1 = (int16_t)y1;
+	op->x2 = (int16_t)x2;
+	op->y2 = (int16_t)y2;
+	op->data = 0;
+	op->len = 0;
+	return op;
+}
+
+// draw the shape's lines with gfx_Line_NoClip into the top left corner of the draw buffer and read them
+// back, so sprite pixels are graphx's own. save holds the corner meanwhile and puts it back after
+static void raster_shape(gfx_sprite_t* sp, gfx_sprite_t* save, const TexDisplayOp* ops, int count, int x0, int y0,
+                         uint8_t transparent)
+{
+	save->width = sp->width;
+	save->height = sp->height;
+	gfx_GetSprite(save, 0, 0);
+	uint8_t color = gfx_SetColor(transparent);
+	gfx_FillRectangle_NoClip(0, 0, sp->width, sp->height);
+	gfx_SetColor(color);
+	for (int i = 0; i < count; i++)
+		gfx_Line_NoClip((uint24_t)(ops[i].x1 - x0), (uint8_t)(ops[i].y1 - y0), (uint24_t)(ops[i].x2 - x0),
+		                (uint8_t)(ops[i].y2 - y0));
+	gfx_GetSprite(sp, 0, 0);
+	gfx_Sprite_NoClip(save, 0, 0);
+}
+
+// stretchy shapes are recorded as lines between rec_shape_begin and rec_shape_end, which swaps
+// them for one blit of a sprite rasterized on first use. The sprite is reused by every shape of
+// the same kind and size in the window (matrix brackets, repeated \left( \right) pairs)
+static int rec_shape_begin(void) { return (g_draw_rec && g_draw_rec->ops) ? g_draw_rec->count : -1; }
+
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static void rec_shape_end(int first, int kind, int side, int size)
+{
+	if (first < 0 || g_draw_rec->count - first < TEX_SPRITE_MIN_LINES)
+		return;
+
+	TexDisplayOp* ops = g_draw_rec->ops;
+	int x0 = ops[first].x1, y0 = ops[first].y1;
+	int x1 = x0, y1 = y0;
+	for (int i = first; i < g_draw_rec->count; i++)
+	{
+		if (ops[i].type != DOP_LINE)
+			return;
+		x0 = TEX_MIN(x0, TEX_MIN(ops[i].x1, ops[i].x2));
+		y0 = TEX_MIN(y0, TEX_MIN(ops[i].y1, ops[i].y2));
+		x1 = TEX_MAX(x1, TEX_MAX(ops[i].x1, ops[i].x2));
+		y1 = TEX_MAX(y1, TEX_MAX(ops[i].y1, ops[i].y2));
+	}
+	int w = x1 - x0 + 1;
+	int h = y1 - y0 + 1;
+	if (w > 255 || h > GFX_LCD_HEIGHT || w * h > TEX_SPRITE_MAX_BYTES)
+		return;
+
+	TeX_RenderSlot* slot = g_draw_rec->slot;
+	UnifiedPool* pool = g_draw_rec->pool;
+	int index = 0;
+	while (index < slot->sprite_count && !(slot->sprites[index].kind == kind && slot->sprites[index].side == side &&
+	                                       slot->sprites[index].size == size))
+		index++;
+	if (index == slot->sprite_count)
+	{
+		if (index >= TEX_RENDERER_MAX_SPRITES)
+			return;
+		// the corner is saved in a block freed once the sprite is read back
+		PoolMark before = pool_mark(pool);
+		StringId sid = pool_alloc_block(pool, sizeof(gfx_sprite_t) + (size_t)(w * h));
+		PoolMark kept = pool_mark(pool);
+		StringId save = pool_alloc_block(pool, sizeof(gfx_sprite_t) + (size_t)(w * h));
+		if (sid == STRING_NULL || save == STRING_NULL)
+		{
+			pool_release(pool, before);
+			return;
+		}
+		TexSpriteEntry* e = &slot->sprites[index];
+		e->kind = (uint8_t)kind;
+		e->side = (uint8_t)side;
+		e->size = (int16_t)size;
+		e->color = gfx_SetColor(0);
+		gfx_SetColor(e->color);
+		e->transparent = (uint8_t)(e->color + 1);
+		e->sprite = sid;
+		gfx_sprite_t* sp = (gfx_sprite_t*)(pool->slab + sid);
+		sp->width = (uint8_t)w;
+		sp->height = (uint8_t)h;
+		raster_shape(sp, (gfx_sprite_t*)(pool->slab + save), &ops[first], g_draw_rec->count - first, x0, y0,
+		             e->transparent);
+		pool_release(pool, kept);
+		slot->sprite_count++;
+	}
+
+	TexDisplayOp* op = &ops[first];
+	op->type = DOP_SPRITE;
+	op->x1 = (int16_t)x0;
+	op->y1 = (int16_t)y0;
+	op->x2 = (int16_t)w;
+	op->y2 = (int16_t)h;
+	op->data = (uint16_t)index;
+	g_draw_rec->count = first + 1;
+}
+
+static void rec_text(int x, int y_top, const char* s, int len, FontRole role)
+{
+	if (g_draw_probe)
+		return;
+	if (!g_draw_rec)
+	{
+		emit_text(x, y_top, s, len, (s && len > 0) ? tex_metrics_text_width_n(s, len, role) : 0, role);
+		return;
+	}
+	if (!s || len <= 0)
+		return;
+	TexDisplayOp* op = rec_push(DOP_TEXT, x, y_top, tex_metrics_text_width_n(s, len, role), 0);
+	if (!op)
+		return;
+	// text nodes point into the pool already, literals ("lim") are copied there
+	UnifiedPool* pool = g_draw_rec->pool;
+	uintptr_t p = (uintptr_t)s;
+	uintptr_t slab = (uintptr_t)pool->slab;
+	StringId sid = (p >= slab && p < slab + pool->capacity) ? (StringId)(p - slab)
+	                                                          : pool_alloc_string(pool, s, (size_t)len);
+	if (sid == STRING_NULL)
+		op->type = 0; // skipped on replay
+	op->role = (uint8_t)role;
+	op->data = sid;
+	op->len = (uint16_t)len;
+}
+
+static void rec_glyph(int x, int y_top, int glyph, FontRole role)
+{
+	if (g_draw_probe)
+		return;
+	if (!g_draw_rec)
+	{
+		emit_glyph(x, y_top, glyph, tex_metrics_glyph_width((unsigned int)glyph, role), role);
+		return;
+	}
+	TexDisplayOp* op = rec_push(DOP_GLYPH, x, y_top, tex_metrics_glyph_width((unsigned int)glyph, role), 0);
+	if (!op)
+		return;
+	op->role = (uint8_t)role;
+	op->data = (uint16_t)glyph;
+}
+
+static void rec_rule(int x, int y, int w)
+{
+	if (g_draw_probe)
+		return;
+	if (!g_draw_rec)
+		emit_rule(x, y, w);
+	else
+		rec_push(DOP_RULE, x, y, w, 0);
+}
+
+static void rec_line(int x1, int y1, int x2, int y2)
+{
+	if (g_draw_probe)
+		return;
+	if (!g_draw_rec)
+		emit_line(x1, y1, x2, y2);
+	else
+		rec_push(DOP_LINE, x1, y1, x2, y2);
+}
+
+static void rec_dot(int cx, int cy)
+{
+	if (g_draw_probe)
+		return;
+	if (!g_draw_rec)
+		emit_dot(cx, cy);
+	else
+		rec_push(DOP_DOT, cx, cy, 0, 0);
+}
+
+static void rec_ellipse(int cx, int cy, int rx, int ry)
+{
+	if (g_draw_probe)
+		return;
+	if (!g_draw_rec)
+		emit_ellipse(cx, cy, rx, ry);
+	else
+		rec_push(DOP_ELLIPSE, cx, cy, rx, ry);
 }
 
+// replay one recorded op moved by (dx, dy), ops wholly left or right of the band are skipped
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static void replay_op(TeX_RenderSlot* slot, const TexDisplayOp* op, int dx, int dy)
+{
+	UnifiedPool* pool = &slot->pool;
+	int x1 = op->x1 + dx;
+	int y1 = op->y1 + dy;
+	int left = x1;
+	int right = x1 + op->x2;
+	if (op->type == DOP_LINE)
+	{
+		left = TEX_MIN(x1, op->x2 + dx);
+		right = TEX_MAX(x1, op->x2 + dx);
+	}
+	else if (op->type == DOP_DOT)
+	{
+		left = x1 - 1;
+		right = x1 + 1;
+	}
+	else if (op->type == DOP_ELLIPSE)
+	{
+		left = x1 - op->x2;
+	}
+	if (left >= g_draw_vis_right || right < g_draw_vis_left)
+		return;
+
+	switch ((TexDrawOpType)op->type)
+	{
+	case DOP_TEXT:
+		emit_text(x1, y1, pool_get_string(pool, op->data), op->len, op->x2, (FontRole)op->role);
+		break;
+	case DOP_GLYPH:
+		emit_glyph(x1, y1, op->data, op->x2, (FontRole)op->role);
+		break;
+	case DOP_RULE:
+		emit_rule(x1, y1, op->x2);
+		break;
+	case DOP_LINE:
+		emit_line(x1, y1, op->x2 + dx, op->y2 + dy);
+		break;
+	case DOP_DOT:
+		emit_dot(x1, y1);
+		break;
+	case DOP_ELLIPSE:
+		emit_ellipse(x1, y1, op->x2, op->y2);
+		break;
+	case DOP_SPRITE:
+		emit_sprite(pool, &slot->sprites[op->data], x1, y1);
+		break;
+	}
+}
 
 // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
 static void rec_draw_paren(int x, int y_center, int w, int h, int is_left)
@@ -199,6 +620,19 @@ static void rec_draw_paren(int x, int y_center, int w, int h, int is_left)
 	}
 }
 
+#if TEX_DRAW_LOG
+void tex_draw_log_reset(void) { g_draw_log_count = 0; }
+int tex_draw_log_count(void) { return g_draw_log_count; }
+int tex_draw_log_get(TexDrawOp* out, int max) { return tex_draw_log_get_range(out, 0, max); }
+int tex_draw_log_get_range(TexDrawOp* out, int start, int count)
+{
+	if (!out || start < 0 || count <= 0 || start >= g_draw_log_count)
+		return 0;
+	int n = TEX_MIN(count, g_draw_log_count - start);
+	memcpy(out, g_draw_log + start, (size_t)n * sizeof(TexDrawOp));
+	return n;
+}
+#else
 void tex_draw_log_reset(void) {}
 int tex_draw_log_count(void) { return 0; }
 int tex_draw_log_get(TexDrawOp* out, int max)
@@ -214,43 +648,145 @@ int tex_draw_log_get_range(TexDrawOp* out, int start, int count)
 	(void)count;
 	return 0;
 }
+#endif
 
 // -------------------------
 // Node draw routines
 // -------------------------
 static int g_axis_y = 0;
-static void draw_node(Node* n, TexCoord x, TexBaseline baseline_y, FontRole role);
 
-static void draw_math_list(ListId head, TexCoord x, TexBaseline baseline_y, FontRole role)
+// big operator glyphs are centered on the math axis, shifted by this much
+static int glyph_axis_bias(unsigned int glyph)
+{
+	unsigned char g = (unsigned char)glyph;
+	// NOLINTBEGIN(bugprone-branch-clone) - Intentional separate branches for future differentiation
+	if (g == (unsigned char)TEXFONT_INTEGRAL_CHAR)
+		return TEX_AXIS_BIAS_INTEGRAL;
+	if (g == (unsigned char)TEXFONT_SUMMATION_CHAR)
+		return TEX_AXIS_BIAS_SUM;
+	if (g == (unsigned char)TEXFONT_PRODUCT_CHAR)
+		return TEX_AXIS_BIAS_PROD;
+	// NOLINTEND(bugprone-branch-clone)
+	return 0;
+}
+
+// big operators (and scripts hanging off them) are placed on the line axis rather
+// than their own baseline, so their box cannot be used to reject them
+static int node_is_axis_anchored(const Node* n)
 {
-	TexCoord cur_x = x;
-	for (ListId bid = head; bid != LIST_NULL;)
+	if (tex_node_is_big_operator(n))
+		return 1;
+	if (n->type == N_SCRIPT)
 	{
-		TexListBlock* block = pool_get_list_block(g_draw_pool, bid);
+		Node* base = pool_get_node(g_draw_pool, n->data.script.base);
+		return base && tex_node_is_big_operator(base);
+	}
+	return 0;
+}
+
+// reject a whole subtree when its box lies entirely outside the visible band
+static int node_outside_band(const Node* n, TexCoord x, TexBaseline baseline_y)
+{
+	if (x.v >= g_draw_vis_right || x.v + n->w < g_draw_vis_left)
+		return 1;
+	if (baseline_y.v - n->asc >= g_draw_vis_bot || baseline_y.v + n->desc < g_draw_vis_top)
+		return !node_is_axis_anchored(n);
+	return 0;
+}
+
+// top of a node's box as drawn, big operators sit on the math axis rather than the baseline
+static int node_box_top(const Node* n, TexBaseline baseline_y)
+{
+	int half = (n->asc + n->desc) / 2;
+	if (n->type == N_GLYPH && tex_is_big_operator(n->data.glyph))
+		return (g_axis_y + glyph_axis_bias(n->data.glyph)) - half;
+	if (n->type == N_MULTIOP)
+		return (g_axis_y + TEX_AXIS_BIAS_INTEGRAL) - half;
+	return baseline_y.v - n->asc;
+}
+
+// a node that passed the band test is entered at depth d under parent, it becomes the hit when its box
+// holds the point (deeper nodes are entered later and win)
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static void probe_enter(Node* n, Node* parent, TexCoord x, TexBaseline baseline_y, int d, int ordinal)
+{
+	TexHitProbe* hp = g_draw_probe;
+	int top = node_box_top(n, baseline_y);
+	int h = n->asc + n->desc;
+	if (d < hp->hit_depth || hp->px < x.v || hp->px >= x.v + n->w || hp->py < top || hp->py >= top + h)
+		return;
+	hp->hit = n;
+	hp->hit_parent = parent;
+	hp->hit_depth = d;
+	hp->hit_ordinal = ordinal;
+	hp->box_x = x.v;
+	hp->box_y = top;
+	hp->box_w = n->w;
+	hp->box_h = h;
+}
+
+// start walking a list at pen x, the node continues at step 2
+static void list_begin(TexDrawFrame* f, ListId head, int x)
+{
+	f->step = 2;
+	f->at.block = head;
+	f->i = 0;
+	f->pen_x = (int16_t)x;
+}
+
+static int draw_child(TexDrawFrame* child, NodeRef ref, int x, int baseline_y, FontRole role)
+{
+	if (!pool_get_node(g_draw_pool, ref))
+		return 0;
+	child->ref = ref;
+	child->x = (int16_t)x;
+	child->bl = (int16_t)baseline_y;
+	child->role = (uint8_t)role;
+	child->step = 0;
+	child->seen = 0;
+	return 1;
+}
+
+// next item of the list, set side by side from pen x on the node's baseline
+static int walk_list(TexDrawFrame* f, TexDrawFrame* child)
+{
+	while (f->at.block != LIST_NULL)
+	{
+		TexListBlock* block = pool_get_list_block(g_draw_pool, f->at.block);
 		if (!block)
 			break;
-		for (uint16_t i = 0; i < block->count; i++)
+		if (f->i >= block->count)
 		{
-			Node* n = pool_get_node(g_draw_pool, block->items[i]);
-			if (!n)
-				continue;
-			draw_node(n, cur_x, baseline_y, role);
-			cur_x.v += n->w;
+			f->at.block = block->next;
+			f->i = 0;
+			continue;
 		}
-		bid = block->next;
+		NodeRef ref = block->items[f->i++];
+		Node* n = pool_get_node(g_draw_pool, ref);
+		if (!n)
+			continue;
+		int x = f->pen_x;
+		f->pen_x = (int16_t)(f->pen_x + n->w);
+		return draw_child(child, ref, x, f->bl, (FontRole)f->role);
 	}
+	f->at.block = LIST_NULL;
+	return 0;
 }
 
-static void draw_script(Node* n, TexCoord x, TexBaseline baseline_y, FontRole role)
+static int step_script(Node* n, TexDrawFrame* f, TexDrawFrame* child)
 {
-	Node* base = pool_get_node(g_draw_pool, n->data.script.base);
-	Node* sub = pool_get_node(g_draw_pool, n->data.script.sub);
-	Node* sup = pool_get_node(g_draw_pool, n->data.script.sup);
-
-	if (base)
-		draw_node(base, x, baseline_y, role);
+	FontRole role = (FontRole)f->role;
+	if (f->step == 1)
+	{
+		f->step = 2;
+		if (draw_child(child, n->data.script.base, f->x, f->bl, role))
+			return 1;
+	}
+	if (f->step > 3)
+		return 0;
 
-	TexCoord script_x = { x.v + (base ? base->w : 0) + TEX_SCRIPT_XPAD };
+	Node* base = pool_get_node(g_draw_pool, n->data.script.base);
+	int script_x = f->x + (base ? base->w : 0) + TEX_SCRIPT_XPAD;
 	int is_bigop = base && tex_node_is_big_operator(base);
 
 	// precalculate big operator vertical bounds using the math axis
@@ -266,15 +802,7 @@ static void draw_script(Node* n, TexCoord x, TexBaseline baseline_y, FontRole ro
 		}
 		else if (base->type == N_GLYPH)
 		{
-			unsigned char g = (unsigned char)base->data.glyph;
-			// NOLINTBEGIN(bugprone-branch-clone)
-			if (g == (unsigned char)TEXFONT_INTEGRAL_CHAR)
-				op_bias = TEX_AXIS_BIAS_INTEGRAL;
-			else if (g == (unsigned char)TEXFONT_SUMMATION_CHAR)
-				op_bias = TEX_AXIS_BIAS_SUM;
-			else if (g == (unsigned char)TEXFONT_PRODUCT_CHAR)
-				op_bias = TEX_AXIS_BIAS_PROD;
-			// NOLINTEND(bugprone-branch-clone)
+			op_bias = glyph_axis_bias(base->data.glyph);
 		}
 
 		int half = (base->asc + base->desc) / 2;
@@ -300,64 +828,65 @@ static void draw_script(Node* n, TexCoord x, TexBaseline baseline_y, FontRole ro
 	int shift_up = TEX_MAX(def_up, base_asc - off_up);
 	int shift_down = TEX_MAX(def_down, base_desc - off_down);
 
-	if (sup)
+	if (f->step == 2)
 	{
-		TexBaseline sup_bl;
-		if (is_bigop)
-		{
-			sup_bl.v = (op_top + TEX_BIGOP_OVERLAP) - sup->desc;
-		}
-		else
+		f->step = 3;
+		Node* sup = pool_get_node(g_draw_pool, n->data.script.sup);
+		if (sup)
 		{
-			sup_bl.v = baseline_y.v - shift_up;
+			int sup_bl = is_bigop ? (op_top + TEX_BIGOP_OVERLAP) - sup->desc : f->bl - shift_up;
+			if (draw_child(child, n->data.script.sup, script_x, sup_bl, FONTROLE_SCRIPT))
+				return 1;
 		}
-		draw_node(sup, script_x, sup_bl, FONTROLE_SCRIPT);
 	}
 
+	f->step = 4;
+	Node* sub = pool_get_node(g_draw_pool, n->data.script.sub);
 	if (sub)
 	{
-		TexBaseline sub_bl;
-		if (is_bigop)
-		{
-			sub_bl.v = (op_bot - TEX_BIGOP_OVERLAP) + sub->asc;
-		}
-		else
-		{
-			sub_bl.v = baseline_y.v + shift_down;
-		}
-		draw_node(sub, script_x, sub_bl, FONTROLE_SCRIPT);
+		int sub_bl = is_bigop ? (op_bot - TEX_BIGOP_OVERLAP) + sub->asc : f->bl + shift_down;
+		return draw_child(child, n->data.script.sub, script_x, sub_bl, FONTROLE_SCRIPT);
 	}
+	return 0;
 }
 
-static void draw_frac(Node* n, TexCoord x, TexBaseline baseline_y)
+static int step_frac(Node* n, TexDrawFrame* f, TexDrawFrame* child)
 {
-	Node* num = pool_get_node(g_draw_pool, n->data.frac.num);
-	Node* den = pool_get_node(g_draw_pool, n->data.frac.den);
-
 	int axis = tex_metrics_math_axis();
-	int rule_y = baseline_y.v - axis;
-
-	int rule_x = x.v + TEX_FRAC_OUTER_PAD;
-	int rule_w = n->w - (2 * TEX_FRAC_OUTER_PAD);
-
-	rec_rule(rule_x, rule_y, rule_w);
+	int rule_y = f->bl - axis;
 
-	if (num)
+	if (f->step == 1)
 	{
-		TexCoord num_x = { x.v + (n->w - num->w) / 2 };
-		TexBaseline num_bl = { rule_y - TEX_FRAC_YPAD - num->desc };
-		draw_node(num, num_x, num_bl, FONTROLE_SCRIPT);
+		f->step = 2;
+		int rule_x = f->x + TEX_FRAC_OUTER_PAD;
+		int rule_w = n->w - (2 * TEX_FRAC_OUTER_PAD);
+		rec_rule(rule_x, rule_y, rule_w);
+
+		Node* num = pool_get_node(g_draw_pool, n->data.frac.num);
+		if (num)
+		{
+			int num_x = f->x + (n->w - num->w) / 2;
+			int num_bl = rule_y - TEX_FRAC_YPAD - num->desc;
+			return draw_child(child, n->data.frac.num, num_x, num_bl, FONTROLE_SCRIPT);
+		}
 	}
-	if (den)
+	if (f->step == 2)
 	{
-		TexCoord den_x = { x.v + (n->w - den->w) / 2 };
-		TexBaseline den_bl = { rule_y + TEX_RULE_THICKNESS + TEX_FRAC_YPAD + den->asc };
-		draw_node(den, den_x, den_bl, FONTROLE_SCRIPT);
+		f->step = 3;
+		Node* den = pool_get_node(g_draw_pool, n->data.frac.den);
+		if (den)
+		{
+			int den_x = f->x + (n->w - den->w) / 2;
+			int den_bl = rule_y + TEX_RULE_THICKNESS + TEX_FRAC_YPAD + den->asc;
+			return draw_child(child, n->data.frac.den, den_x, den_bl, FONTROLE_SCRIPT);
+		}
 	}
+	return 0;
 }
 
-static void draw_sqrt(Node* n, TexCoord x, TexBaseline baseline_y, FontRole role)
+static int step_sqrt(Node* n, TexDrawFrame* f, TexDrawFrame* child)
 {
+	FontRole role = (FontRole)f->role;
 	Node* rad = pool_get_node(g_draw_pool, n->data.sqrt.rad);
 	Node* idx = pool_get_node(g_draw_pool, n->data.sqrt.index);
 
@@ -372,40 +901,34 @@ static void draw_sqrt(Node* n, TexCoord x, TexBaseline baseline_y, FontRole role
 			idx_offset = 0;
 	}
 
-	int head_x = x.v + idx_offset;
-	int head_y_top = baseline_y.v - tex_metrics_asc(role);
-	rec_glyph(head_x, head_y_top, (unsigned char)TEXFONT_SQRT_HEAD_CHAR, role);
-
-	if (idx)
+	int head_x = f->x + idx_offset;
+	if (f->step == 1)
 	{
-		TexCoord idx_x = { x.v };
-		TexBaseline idx_bl = { baseline_y.v - (tex_metrics_asc(role) / 2) };
-		draw_node(idx, idx_x, idx_bl, FONTROLE_SCRIPT);
+		f->step = 2;
+		int head_y_top = f->bl - tex_metrics_asc(role);
+		rec_glyph(head_x, head_y_top, (unsigned char)TEXFONT_SQRT_HEAD_CHAR, role);
+
+		if (idx && draw_child(child, n->data.sqrt.index, f->x, f->bl - (tex_metrics_asc(role) / 2), FONTROLE_SCRIPT))
+			return 1;
 	}
 
 	int bar_x = head_x + head_w + TEX_SQRT_HEAD_XPAD;
-	if (rad)
+	if (f->step == 2 && rad)
 	{
-		int bar_y = baseline_y.v - rad->asc - TEX_ACCENT_GAP;
+		f->step = 3;
+		int bar_y = f->bl - rad->asc - TEX_ACCENT_GAP;
 
-		int width = (x.v + n->w) - bar_x;
+		int width = (f->x + n->w) - bar_x;
 		rec_line(bar_x, bar_y, bar_x + width, bar_y);
-		TexCoord rad_x = { bar_x };
-		draw_node(rad, rad_x, baseline_y, role);
+		return draw_child(child, n->data.sqrt.rad, bar_x, f->bl, role);
 	}
+	return 0;
 }
 
-static void draw_overlay(Node* n, TexCoord x, TexBaseline baseline_y, FontRole role)
+// accent over (or under) the base b of an overlay
+static void draw_accent(Node* n, Node* b, int x, int baseline_y, FontRole role)
 {
-	Node* b = pool_get_node(g_draw_pool, n->data.overlay.base);
-
-	if (b)
-		draw_node(b, x, baseline_y, role);
-
-	if (!b)
-		return;
-
-	int top = baseline_y.v - b->asc - TEX_ACCENT_GAP;
+	int top = baseline_y - b->asc - TEX_ACCENT_GAP;
 
 	switch (n->data.overlay.type)
 	{
@@ -413,7 +936,7 @@ static void draw_overlay(Node* n, TexCoord x, TexBaseline baseline_y, FontRole r
 		{
 			int bar_y = top - 1;
 			int pad = (b->w > 2) ? 1 : 0;
-			rec_line(x.v + pad, bar_y, x.v + b->w - 1 - pad, bar_y);
+			rec_line(x + pad, bar_y, x + b->w - 1 - pad, bar_y);
 		}
 		break;
 
@@ -421,28 +944,28 @@ static void draw_overlay(Node* n, TexCoord x, TexBaseline baseline_y, FontRole r
 		{
 			int line_y = top - 1;
 			int pad = (b->w > 2) ? 1 : 0;
-			rec_line(x.v + pad, line_y, x.v + b->w - 1 - pad, line_y);
+			rec_line(x + pad, line_y, x + b->w - 1 - pad, line_y);
 		}
 		break;
 
 	case ACC_UNDERLINE:
 		{
-			int line_y = baseline_y.v + b->desc + TEX_ACCENT_GAP;
+			int line_y = baseline_y + b->desc + TEX_ACCENT_GAP;
 			int pad = (b->w > 2) ? 1 : 0;
-			rec_line(x.v + pad, line_y, x.v + b->w - 1 - pad, line_y);
+			rec_line(x + pad, line_y, x + b->w - 1 - pad, line_y);
 		}
 		break;
 
 	case ACC_DOT:
 		{
-			int cx = x.v + b->w / 2;
+			int cx = x + b->w / 2;
 			rec_dot(cx, top - 1);
 		}
 		break;
 
 	case ACC_HAT:
 		{
-			int cx = x.v + b->w / 2;
+			int cx = x + b->w / 2;
 			int dy = 3;
 			rec_line(cx - dy, top, cx, top - dy);
 			rec_line(cx, top - dy, cx + dy, top);
@@ -452,7 +975,7 @@ static void draw_overlay(Node* n, TexCoord x, TexBaseline baseline_y, FontRole r
 	case ACC_VEC:
 		{
 			int len = TEX_MAX(5, b->w);
-			int x_end = x.v + b->w;
+			int x_end = x + b->w;
 			int x_start = x_end - len;
 			int y = top - 2;
 
@@ -464,7 +987,7 @@ static void draw_overlay(Node* n, TexCoord x, TexBaseline baseline_y, FontRole r
 
 	case ACC_DDOT:
 		{
-			int cx = x.v + b->w / 2;
+			int cx = x + b->w / 2;
 			int sep = 2;
 			rec_dot(cx - sep, top - 1);
 			rec_dot(cx + sep, top - 1);
@@ -474,7 +997,7 @@ static void draw_overlay(Node* n, TexCoord x, TexBaseline baseline_y, FontRole r
 	case ACC_TILDE:
 		{
 			int glyph_w = tex_metrics_glyph_width('~', role);
-			int cx = x.v + (b->w - glyph_w) / 2;
+			int cx = x + (b->w - glyph_w) / 2;
 			rec_glyph(cx, top - 3, '~', role);
 		}
 		break;
@@ -484,6 +1007,24 @@ static void draw_overlay(Node* n, TexCoord x, TexBaseline baseline_y, FontRole r
 	}
 }
 
+static int step_overlay(Node* n, TexDrawFrame* f, TexDrawFrame* child)
+{
+	if (f->step == 1)
+	{
+		f->step = 2;
+		if (draw_child(child, n->data.overlay.base, f->x, f->bl, (FontRole)f->role))
+			return 1;
+	}
+	if (f->step == 2)
+	{
+		f->step = 3;
+		Node* b = pool_get_node(g_draw_pool, n->data.overlay.base);
+		if (b)
+			draw_accent(n, b, f->x, f->bl, (FontRole)f->role);
+	}
+	return 0;
+}
+
 static void draw_hbrace(int x, int y, int w, int is_over)
 {
 	if (w <= 0)
@@ -496,6 +1037,7 @@ static void draw_hbrace(int x, int y, int w, int is_over)
 	int mid = x + w / 2;
 	int arm_h = 2;
 	int top_y = y;
+	int shape = rec_shape_begin();
 	if (is_over)
 	{
 		int base_y = top_y + arm_h;
@@ -512,39 +1054,49 @@ static void draw_hbrace(int x, int y, int w, int is_over)
 		rec_line(mid, base_y + arm_h + (TEX_BRACE_HEIGHT - arm_h), mid + 2, base_y);
 		rec_line(mid + 2, base_y, x + w - 1, base_y);
 	}
+	rec_shape_end(shape, TEX_SPRITE_HBRACE, is_over, w);
 }
 
-static void draw_spandeco(Node* n, TexCoord x, TexBaseline baseline_y, FontRole role)
+static int step_spandeco(Node* n, TexDrawFrame* f, TexDrawFrame* child)
 {
+	if (f->step == 1)
+	{
+		f->step = 2;
+		if (draw_child(child, n->data.spandeco.content, f->x, f->bl, (FontRole)f->role))
+			return 1;
+	}
+	if (f->step != 2)
+		return 0;
+	f->step = 3;
+
 	Node* content = pool_get_node(g_draw_pool, n->data.spandeco.content);
 	Node* label = pool_get_node(g_draw_pool, n->data.spandeco.label);
-	if (content)
-		draw_node(content, x, baseline_y, role);
 	int w = content ? content->w : 0;
 	int bh = TEX_BRACE_HEIGHT;
 	if (n->data.spandeco.deco_type == DECO_OVERBRACE)
 	{
-		int brace_y = baseline_y.v - (content ? content->asc : 0) - TEX_ACCENT_GAP - bh + 1;
-		draw_hbrace(x.v, brace_y, w, 1);
+		int brace_y = f->bl - (content ? content->asc : 0) - TEX_ACCENT_GAP - bh + 1;
+		draw_hbrace(f->x, brace_y, w, 1);
 		if (label)
 		{
-			TexCoord label_x = { x.v + (w - label->w) / 2 };
-			TexBaseline label_bl = { brace_y - TEX_ACCENT_GAP - label->desc };
-			draw_node(label, label_x, label_bl, FONTROLE_SCRIPT);
+			int label_x = f->x + (w - label->w) / 2;
+			int label_bl = brace_y - TEX_ACCENT_GAP - label->desc;
+			return draw_child(child, n->data.spandeco.label, label_x, label_bl, FONTROLE_SCRIPT);
 		}
 	}
 	else if (n->data.spandeco.deco_type == DECO_UNDERBRACE)
 	{
 		int ub_gap = TEX_ACCENT_GAP + 2; // extra space above underbrace for tall delimiters
-		int brace_y = baseline_y.v + (content ? content->desc : 0) + ub_gap;
-		draw_hbrace(x.v, brace_y, w, 0);
+		int brace_y = f->bl + (content ? content->desc : 0) + ub_gap;
+		draw_hbrace(f->x, brace_y, w, 0);
 		if (label)
 		{
-			TexCoord label_x = { x.v + (w - label->w) / 2 };
-			TexBaseline label_bl = { brace_y + bh + TEX_ACCENT_GAP + label->asc };
-			draw_node(label, label_x, label_bl, FONTROLE_SCRIPT);
+			int label_x = f->x + (w - label->w) / 2;
+			int label_bl = brace_y + bh + TEX_ACCENT_GAP + label->asc;
+			return draw_child(child, n->data.spandeco.label, label_x, label_bl, FONTROLE_SCRIPT);
 		}
 	}
+	return 0;
 }
 
 static void draw_multiop(Node* n, TexCoord x)
@@ -582,18 +1134,22 @@ static void draw_multiop(Node* n, TexCoord x)
 	}
 }
 
-static void draw_func_lim(Node* n, TexCoord x, TexBaseline baseline_y)
+static int step_func_lim(Node* n, TexDrawFrame* f, TexDrawFrame* child)
 {
-	int y_top = baseline_y.v - tex_metrics_asc(FONTROLE_MAIN);
-	rec_text(x.v, y_top, "lim", 3, FONTROLE_MAIN);
+	if (f->step != 1)
+		return 0;
+	f->step = 2;
+	int y_top = f->bl - tex_metrics_asc(FONTROLE_MAIN);
+	rec_text(f->x, y_top, "lim", 3, FONTROLE_MAIN);
 	Node* lim = pool_get_node(g_draw_pool, n->data.func_lim.limit);
 	if (lim)
 	{
 		int lim_text_w = tex_metrics_text_width("lim", FONTROLE_MAIN);
-		TexCoord lim_x = { x.v + (lim_text_w - lim->w) / 2 };
-		TexBaseline lim_bl = { baseline_y.v + TEX_FRAC_YPAD + TEX_RULE_THICKNESS + lim->asc };
-		draw_node(lim, lim_x, lim_bl, FONTROLE_SCRIPT);
+		int lim_x = f->x + (lim_text_w - lim->w) / 2;
+		int lim_bl = f->bl + TEX_FRAC_YPAD + TEX_RULE_THICKNESS + lim->asc;
+		return draw_child(child, n->data.func_lim.limit, lim_x, lim_bl, FONTROLE_SCRIPT);
 	}
+	return 0;
 }
 
 // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
@@ -606,6 +1162,7 @@ static void draw_proc_delim(int x, int y_center, int h, DelimType type, int is_l
 	int top = y_center - h / 2;
 	int bot = y_center + h / 2;
 
+	int shape = rec_shape_begin();
 	switch (type)
 	{
 	case DELIM_NONE:
@@ -719,210 +1276,174 @@ static void draw_proc_delim(int x, int y_center, int h, DelimType type, int is_l
 	default:
 		break;
 	}
+	rec_shape_end(shape, (int)type, is_left, h);
 }
 
-static void draw_auto_delim(Node* n, TexCoord x, TexBaseline baseline_y, FontRole role)
+static int step_auto_delim(Node* n, TexDrawFrame* f, TexDrawFrame* child)
 {
 	int h = n->data.auto_delim.delim_h;
 	int axis = tex_metrics_math_axis();
-	int y_center = baseline_y.v - axis;
+	int y_center = f->bl - axis;
 
 	int delim_w = h / TEX_DELIM_WIDTH_FACTOR;
 	delim_w = TEX_CLAMP(delim_w, TEX_DELIM_MIN_WIDTH, TEX_DELIM_MAX_WIDTH);
 
-	int l_w = (n->data.auto_delim.left_type == DELIM_NONE) ? 0 : delim_w;
-	int r_w = (n->data.auto_delim.right_type == DELIM_NONE) ? 0 : delim_w;
-
 	int kern = delim_w / 2;
-	int l_kern = (n->data.auto_delim.left_type == DELIM_PAREN) ? kern : 0;
-	int r_kern = (n->data.auto_delim.right_type == DELIM_PAREN) ? kern : 0;
-
-	if (l_w > 0)
-		draw_proc_delim(x.v, y_center, h, (DelimType)n->data.auto_delim.left_type, 1);
-
-	ListId content_list = n->data.auto_delim.content;
-	if (content_list != LIST_NULL)
+	if (f->step == 1)
 	{
+		int l_w = (n->data.auto_delim.left_type == DELIM_NONE) ? 0 : delim_w;
+		int l_kern = (n->data.auto_delim.left_type == DELIM_PAREN) ? kern : 0;
+		if (l_w > 0)
+			draw_proc_delim(f->x, y_center, h, (DelimType)n->data.auto_delim.left_type, 1);
+
 		// shift things left by kerning amount (into the hollow of the parenthesis)
-		TexCoord content_x = { x.v + l_w - l_kern };
-		draw_math_list(content_list, content_x, baseline_y, role);
+		list_begin(f, n->data.auto_delim.content, f->x + l_w - l_kern);
 	}
-
-	if (r_w > 0)
+	if (f->step == 2)
 	{
-		int c_w = 0;
-		for (ListId bid = content_list; bid != LIST_NULL;)
+		if (walk_list(f, child))
+			return 1;
+		f->step = 3;
+
+		// right delim start = (start of content) + (width of content) - (right kerning)
+		if (n->data.auto_delim.right_type != DELIM_NONE)
 		{
-			TexListBlock* block = pool_get_list_block(g_draw_pool, bid);
-			if (!block)
-				break;
-			for (uint16_t i = 0; i < block->count; i++)
-			{
-				Node* cn = pool_get_node(g_draw_pool, block->items[i]);
-				if (cn)
-					c_w += cn->w;
-			}
-			bid = block->next;
+			int r_kern = (n->data.auto_delim.right_type == DELIM_PAREN) ? kern : 0;
+			draw_proc_delim(f->pen_x - r_kern, y_center, h, (DelimType)n->data.auto_delim.right_type, 0);
 		}
-		// right delim start = (start of content) + (width of content) - (right kerning)
-		int rx = (x.v + l_w - l_kern) + c_w - r_kern;
-		draw_proc_delim(rx, y_center, h, (DelimType)n->data.auto_delim.right_type, 0);
 	}
+	return 0;
 }
 
-static void draw_matrix(Node* n, TexCoord x, TexBaseline baseline_y)
+// width and height of a matrix's cell area, separators included
+static void matrix_extent(const Node* n, const int16_t* col_widths, int16_t* total_w, int16_t* total_h)
 {
-	int16_t col_widths[TEX_MATRIX_MAX_DIMS] = { 0 };
-	int16_t row_ascs[TEX_MATRIX_MAX_DIMS] = { 0 };
-	int16_t row_descs[TEX_MATRIX_MAX_DIMS] = { 0 };
-
-	uint8_t rows = n->data.matrix.rows;
-	uint8_t cols = n->data.matrix.cols;
-
-	if (rows > TEX_MATRIX_MAX_DIMS)
-		rows = TEX_MATRIX_MAX_DIMS;
-	if (cols > TEX_MATRIX_MAX_DIMS)
-		cols = TEX_MATRIX_MAX_DIMS;
-	if (cols == 0)
-		cols = 1; // avoid division by zero
+	int rows = n->data.matrix.rows;
+	int cols = n->data.matrix.cols;
+	const int16_t* row_ascs = col_widths + cols;
+	const int16_t* row_descs = row_ascs + rows;
+
+	int16_t w = 0;
+	for (int c = 0; c < cols; c++)
+		TEX_COORD_ASSIGN(w, w + col_widths[c]);
+	if (cols > 1)
+		TEX_COORD_ASSIGN(w, w + (cols - 1) * TEX_MATRIX_COL_SPACING);
 
-	// Collect metrics (same as measurement)
-	uint8_t cell_idx = 0;
-	for (ListId bid = n->data.matrix.cells; bid != LIST_NULL;)
+	// add extra width for column separators
+	uint8_t sep_mask = n->data.matrix.col_separators;
+	while (sep_mask)
 	{
-		TexListBlock* block = pool_get_list_block(g_draw_pool, bid);
-		if (!block)
-			break;
+		if (sep_mask & 1)
+			TEX_COORD_ASSIGN(w, w + 2 * TEX_MATRIX_SEP_PAD);
+		sep_mask >>= 1;
+	}
 
-		for (uint16_t i = 0; i < block->count; i++)
-		{
-			uint8_t r = (uint8_t)(cell_idx / cols);
-			uint8_t c = (uint8_t)(cell_idx % cols);
-			if (r >= rows)
-				break;
-
-			Node* cell = pool_get_node(g_draw_pool, block->items[i]);
-			if (cell)
-			{
-				if (cell->w > col_widths[c])
-					col_widths[c] = cell->w;
-				if (cell->asc > row_ascs[r])
-					row_ascs[r] = cell->asc;
-				if (cell->desc > row_descs[r])
-					row_descs[r] = cell->desc;
-			}
-			cell_idx++;
-		}
-		bid = block->next;
-	}
-
-	// total dimensions
-	int16_t total_w = 0;
-	for (uint8_t c = 0; c < cols; c++)
-		TEX_COORD_ASSIGN(total_w, total_w + col_widths[c]);
-	if (cols > 1)
-		TEX_COORD_ASSIGN(total_w, total_w + (cols - 1) * TEX_MATRIX_COL_SPACING);
-
-	// add extra width for column separators
-	uint8_t sep_mask = n->data.matrix.col_separators;
-	while (sep_mask)
-	{
-		if (sep_mask & 1)
-			TEX_COORD_ASSIGN(total_w, total_w + 2 * TEX_MATRIX_SEP_PAD);
-		sep_mask >>= 1;
-	}
-
-	int16_t total_h = 0;
-	for (uint8_t r = 0; r < rows; r++)
-		TEX_COORD_ASSIGN(total_h, total_h + row_ascs[r] + row_descs[r]);
+	int16_t h = 0;
+	for (int r = 0; r < rows; r++)
+		TEX_COORD_ASSIGN(h, h + row_ascs[r] + row_descs[r]);
 	if (rows > 1)
-		TEX_COORD_ASSIGN(total_h, total_h + (rows - 1) * TEX_MATRIX_ROW_SPACING);
+		TEX_COORD_ASSIGN(h, h + (rows - 1) * TEX_MATRIX_ROW_SPACING);
 
-	// delimiter dimensions
-	int16_t delim_h = total_h;
-	int16_t delim_w = 0;
-	if (n->data.matrix.delim_type != DELIM_NONE)
-	{
-		TEX_COORD_ASSIGN(delim_w, delim_h / TEX_DELIM_WIDTH_FACTOR);
-		TEX_COORD_ASSIGN(delim_w, TEX_CLAMP(delim_w, TEX_DELIM_MIN_WIDTH, TEX_DELIM_MAX_WIDTH));
-	}
+	*total_w = w;
+	*total_h = h;
+}
+
+// step 1 draws the delimiters, step 2 yields the cells row by row (pen_y is the top of the row at i),
+// step 3 draws the column separators
+static int step_matrix(Node* n, TexDrawFrame* f, TexDrawFrame* child)
+{
+	// metrics were kept by measure
+	int rows = n->data.matrix.rows;
+	int cols = n->data.matrix.cols;
+	int16_t* col_widths = matrix_grid(g_draw_pool, n);
+	if (!col_widths)
+		return 0;
+	int16_t* row_ascs = col_widths + cols;
+	int16_t* row_descs = row_ascs + rows;
+
+	int16_t total_w, total_h;
+	matrix_extent(n, col_widths, &total_w, &total_h);
 
 	int16_t axis = tex_metrics_math_axis();
-	int16_t y_center = (int16_t)(baseline_y.v - axis);
+	int16_t y_center = (int16_t)(f->bl - axis);
+	int16_t content_y_top = (int16_t)(y_center - total_h / 2);
 
-	// left delimiter
-	if (n->data.matrix.delim_type != DELIM_NONE)
+	if (f->step == 1)
 	{
-		draw_proc_delim(x.v, y_center, delim_h, (DelimType)n->data.matrix.delim_type, 1);
-	}
+		f->step = 2;
 
-	// right delimiter
-	if (n->data.matrix.delim_type != DELIM_NONE)
-	{
-		int16_t rx = (int16_t)(x.v + delim_w + total_w);
-		draw_proc_delim(rx, y_center, delim_h, (DelimType)n->data.matrix.delim_type, 0);
-	}
+		// delimiter dimensions
+		int16_t delim_h = total_h;
+		int16_t delim_w = 0;
+		if (n->data.matrix.delim_type != DELIM_NONE)
+		{
+			TEX_COORD_ASSIGN(delim_w, delim_h / TEX_DELIM_WIDTH_FACTOR);
+			TEX_COORD_ASSIGN(delim_w, TEX_CLAMP(delim_w, TEX_DELIM_MIN_WIDTH, TEX_DELIM_MAX_WIDTH));
 
-	// cells
-	int16_t content_x = (int16_t)(x.v + delim_w);
-	int16_t content_y_top = (int16_t)(y_center - total_h / 2);
+			draw_proc_delim(f->x, y_center, delim_h, (DelimType)n->data.matrix.delim_type, 1);
+			int16_t rx = (int16_t)(f->x + delim_w + total_w);
+			draw_proc_delim(rx, y_center, delim_h, (DelimType)n->data.matrix.delim_type, 0);
+		}
 
-	int16_t cur_y = content_y_top;
+		f->at.left = (int16_t)(f->x + delim_w);
+		f->pen_y = content_y_top;
+		f->i = 0;
+	}
 
-	for (uint8_t r = 0; r < rows; r++)
+	if (f->step == 2)
 	{
-		int16_t row_baseline = (int16_t)(cur_y + row_ascs[r]);
-		int16_t cur_x = content_x;
-
-		for (uint8_t c = 0; c < cols; c++)
+		NodeRef* cells = matrix_cells(col_widths, n);
+		int count = rows * cols;
+		while (f->i < count)
 		{
-			// get cell from list by index
-			uint8_t target_idx = (uint8_t)(r * cols + c);
-			NodeRef cell_ref = NODE_NULL;
-
-			uint8_t search_idx = 0;
-			for (ListId bid = n->data.matrix.cells; bid != LIST_NULL && cell_ref == NODE_NULL;)
+			int r = f->i / cols;
+			int c = f->i % cols;
+			if (c == 0)
 			{
-				TexListBlock* block = pool_get_list_block(g_draw_pool, bid);
-				if (!block)
+				// rows below the band end the walk, rows above it are skipped
+				// (not while hit testing, which counts every cell to know the position of the one hit)
+				int16_t row_bot = (int16_t)(f->pen_y + row_ascs[r] + row_descs[r]);
+				if (f->pen_y >= g_draw_vis_bot && !g_draw_probe)
 					break;
-
-				for (uint16_t i = 0; i < block->count && cell_ref == NODE_NULL; i++)
+				if (row_bot < g_draw_vis_top && !g_draw_probe)
 				{
-					if (search_idx == target_idx)
-					{
-						cell_ref = block->items[i];
-					}
-					search_idx++;
+					f->pen_y = (int16_t)(row_bot + TEX_MATRIX_ROW_SPACING);
+					f->i = (uint16_t)(f->i + cols);
+					continue;
 				}
-				bid = block->next;
+				f->pen_x = f->at.left;
 			}
 
-			Node* cell = pool_get_node(g_draw_pool, cell_ref);
+			int16_t row_baseline = (int16_t)(f->pen_y + row_ascs[r]);
+			int16_t cell_x = f->pen_x;
+			f->pen_x = (int16_t)(f->pen_x + col_widths[c] + TEX_MATRIX_COL_SPACING);
+			// add extra padding if there's a separator after this column
+			if (matrix_sep_after(n, c))
+				f->pen_x = (int16_t)(f->pen_x + 2 * TEX_MATRIX_SEP_PAD);
+			if (c == cols - 1)
+				f->pen_y = (int16_t)(f->pen_y + row_ascs[r] + row_descs[r] + TEX_MATRIX_ROW_SPACING);
+			f->i++;
+
+			Node* cell = pool_get_node(g_draw_pool, cells[r * cols + c]);
 			if (cell)
 			{
 				// center cell horizontally within column
-				int16_t cell_x = (int16_t)(cur_x + (col_widths[c] - cell->w) / 2);
-				draw_node(cell, (TexCoord){ cell_x }, (TexBaseline){ row_baseline }, FONTROLE_MAIN);
+				cell_x = (int16_t)(cell_x + (col_widths[c] - cell->w) / 2);
+				return draw_child(child, cells[r * cols + c], cell_x, row_baseline, FONTROLE_MAIN);
 			}
-
-			cur_x = (int16_t)(cur_x + col_widths[c] + TEX_MATRIX_COL_SPACING);
-			// add extra padding if there's a separator after this column
-			if (n->data.matrix.col_separators & (1 << c))
-				cur_x = (int16_t)(cur_x + 2 * TEX_MATRIX_SEP_PAD);
 		}
-
-		cur_y = (int16_t)(cur_y + row_ascs[r] + row_descs[r] + TEX_MATRIX_ROW_SPACING);
+		f->step = 3;
 	}
 
 	// draw column separators (for array environment)
-	if (n->data.matrix.col_separators != 0)
+	if (f->step == 3 && n->data.matrix.col_separators != 0)
 	{
-		int16_t sep_x = content_x;
-		for (uint8_t c = 0; c < cols; c++)
+		f->step = 4;
+		int16_t sep_x = f->at.left;
+		for (int c = 0; c < cols; c++)
 		{
 			sep_x = (int16_t)(sep_x + col_widths[c]);
-			if (n->data.matrix.col_separators & (1 << c))
+			if (matrix_sep_after(n, c))
 			{
 				// draw vertical line centered in the gap (normal spacing + separator padding)
 				int16_t line_x = (int16_t)(sep_x + TEX_MATRIX_COL_SPACING / 2 + TEX_MATRIX_SEP_PAD);
@@ -935,17 +1456,19 @@ static void draw_matrix(Node* n, TexCoord x, TexBaseline baseline_y)
 			}
 		}
 	}
+	return 0;
 }
 
-static void draw_node(Node* n, TexCoord x, TexBaseline baseline_y, FontRole role)
+// draw what comes next in node n (entered at step 0), 1 with the child to draw before resuming n,
+// 0 once n is done
+static int draw_step(Node* n, TexDrawFrame* f, TexDrawFrame* child)
 {
-	if (!n)
-		return;
+	FontRole role = (FontRole)f->role;
 	switch (n->type)
 	{
 	case N_TEXT:
 		{
-			int y_top = baseline_y.v - n->asc;
+			int y_top = f->bl - n->asc;
 			const char* s = pool_get_string(g_draw_pool, n->data.text.sid);
 			int len = n->data.text.len;
 			if (!s || len <= 0)
@@ -953,9 +1476,9 @@ static void draw_node(Node* n, TexCoord x, TexBaseline baseline_y, FontRole role
 				s = "";
 				len = 0;
 			}
-			rec_text(x.v, y_top, s, len, role);
+			rec_text(f->x, y_top, s, len, role);
 		}
-		break;
+		return 0;
 	case N_GLYPH:
 		{
 			FontRole effective_role = role;
@@ -964,109 +1487,126 @@ static void draw_node(Node* n, TexCoord x, TexBaseline baseline_y, FontRole role
 			{
 				effective_role = FONTROLE_MAIN;
 				int half = (n->asc + n->desc) / 2;
-				int bias = 0;
-				unsigned char g = (unsigned char)n->data.glyph;
-				// NOLINTBEGIN(bugprone-branch-clone) - Intentional separate branches for future differentiation
-				if (g == (unsigned char)TEXFONT_INTEGRAL_CHAR)
-					bias = TEX_AXIS_BIAS_INTEGRAL;
-				else if (g == (unsigned char)TEXFONT_SUMMATION_CHAR)
-					bias = TEX_AXIS_BIAS_SUM;
-				else if (g == (unsigned char)TEXFONT_PRODUCT_CHAR)
-					bias = TEX_AXIS_BIAS_PROD;
-				// NOLINTEND(bugprone-branch-clone)
-				int y_top = (g_axis_y + bias) - half;
-				rec_glyph(x.v, y_top, (int)n->data.glyph, effective_role);
+				int y_top = (g_axis_y + glyph_axis_bias(n->data.glyph)) - half;
+				rec_glyph(f->x, y_top, (int)n->data.glyph, effective_role);
 			}
 			else
 			{
-				int y_top = baseline_y.v - n->asc;
-				rec_glyph(x.v, y_top, (int)n->data.glyph, effective_role);
+				int y_top = f->bl - n->asc;
+				rec_glyph(f->x, y_top, (int)n->data.glyph, effective_role);
 			}
 		}
-		break;
-	case N_SPACE:
-		break;
+		return 0;
 	case N_MATH:
-		draw_math_list(n->data.list.head, x, baseline_y, role);
-		break;
+		if (f->step == 1)
+			list_begin(f, n->data.list.head, f->x);
+		return walk_list(f, child);
 	case N_SCRIPT:
-		draw_script(n, x, baseline_y, role);
-		break;
+		return step_script(n, f, child);
 	case N_FRAC:
-		draw_frac(n, x, baseline_y);
-		break;
+		return step_frac(n, f, child);
 	case N_SQRT:
-		draw_sqrt(n, x, baseline_y, role);
-		break;
+		return step_sqrt(n, f, child);
 	case N_OVERLAY:
-		draw_overlay(n, x, baseline_y, role);
-		break;
+		return step_overlay(n, f, child);
 	case N_SPANDECO:
-		draw_spandeco(n, x, baseline_y, role);
-		break;
+		return step_spandeco(n, f, child);
 	case N_FUNC_LIM:
-		draw_func_lim(n, x, baseline_y);
-		break;
+		return step_func_lim(n, f, child);
 	case N_MULTIOP:
-		draw_multiop(n, x);
-		break;
+		draw_multiop(n, (TexCoord){ f->x });
+		return 0;
 	case N_AUTO_DELIM:
-		draw_auto_delim(n, x, baseline_y, role);
-		break;
+		return step_auto_delim(n, f, child);
 	case N_MATRIX:
-		draw_matrix(n, x, baseline_y);
-		break;
+		return step_matrix(n, f, child);
 	default:
-		break;
+		return 0;
 	}
 }
 
-static int find_checkpoint_index(TeX_Layout* L, int target_y)
+// draw the subtree at ref depth first on the frame stack bound by frames_bind, without recursion.
+// A child that finds the stack full is skipped (and counted, frames_unbind raises TEX_ERR_OOM) instead of
+// overrunning it
+static void draw_node(NodeRef ref, TexCoord x, TexBaseline baseline_y, FontRole role)
 {
-	if (!L->checkpoints || L->checkpoint_count == 0)
-		return -1;
-
-	int lo = 0, hi = L->checkpoint_count;
-	while (lo < hi)
+	TexDrawFrame* stack = g_draw_frames;
+	if (!pool_get_node(g_draw_pool, ref))
+		return;
+	if (!stack || g_draw_frame_cap <= 0)
 	{
-		int mid = (lo + hi) / 2;
-		if (L->checkpoints[mid].y_pos <= target_y)
-			lo = mid + 1;
-		else
-			hi = mid;
+		g_draw_frame_overflows++;
+		return;
 	}
 
-	return (lo > 0) ? (lo - 1) : -1;
+	int top = 0;
+	draw_child(&stack[0], ref, x.v, baseline_y.v, role);
+	if (g_draw_frame_peak < 1)
+		g_draw_frame_peak = 1;
+	while (top >= 0)
+	{
+		TexDrawFrame* f = &stack[top];
+		Node* n = pool_get_node(g_draw_pool, f->ref);
+		if (f->step == 0)
+		{
+			// children are counted before culling, flyweight hits are told apart by their position
+			int ordinal = (top > 0) ? stack[top - 1].seen++ : 0;
+			if (node_outside_band(n, (TexCoord){ f->x }, (TexBaseline){ f->bl }))
+			{
+				top--;
+				continue;
+			}
+			if (g_draw_probe)
+				probe_enter(n, (top > 0) ? pool_get_node(g_draw_pool, stack[top - 1].ref) : NULL,
+				            (TexCoord){ f->x }, (TexBaseline){ f->bl }, top, ordinal);
+			f->step = 1;
+		}
+
+		TexDrawFrame child;
+		if (draw_step(n, f, &child))
+		{
+			if (top + 1 < g_draw_frame_cap)
+			{
+				stack[++top] = child;
+				if (top + 1 > g_draw_frame_peak)
+					g_draw_frame_peak = top + 1;
+			}
+			else
+			{
+				g_draw_frame_overflows++;
+			}
+			continue;
+		}
+		top--;
+	}
 }
 
-static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
+static void record_display_list(TeX_RenderSlot* slot);
+
+static void rehydrate_window(TeX_RenderSlot* slot, TeX_Layout* layout, int band_top, int band_h)
 {
-	tex_metrics_invalidate_font_state();
+	// selects the layout's font pack, free when it is the one already loaded
+	tex_metrics_init(layout);
 
-	int padded_top = scroll_y - TEX_RENDERER_PADDING;
-	int padded_bot = scroll_y + TEX_VIEWPORT_H + TEX_RENDERER_PADDING;
+	int padding = TEX_MAX(band_h, TEX_RENDERER_MIN_PADDING);
+	int padded_top = band_top - padding;
+	int padded_bot = band_top + band_h + padding;
 	if (padded_top < 0)
 		padded_top = 0;
 	if (padded_bot > layout->total_height)
 		padded_bot = layout->total_height;
 
-	pool_reset(&r->pool);
-	r->line_count = 0;
+	pool_reset(&slot->pool);
+	slot->line_count = 0;
+	slot->ops = NULL;
+	slot->op_count = 0;
+	slot->frames = NULL;
+	slot->frame_cap = 0;
 
-	int cp_idx = find_checkpoint_index(layout, padded_top);
-	const char* src_start;
-	int y_start;
-
-	if (cp_idx >= 0 && layout->checkpoints)
-	{
-		src_start = layout->checkpoints[cp_idx].src_ptr;
-		y_start = layout->checkpoints[cp_idx].y_pos;
-	}
-	else
-	{
-		src_start = layout->source;
-		y_start = 0;
-	}
+	TeX_Checkpoint cp;
+	tex_checkpoint_find(layout, padded_top, &cp, NULL);
+	int src_start = cp.src_offset;
+	int y_start = cp.y_pos;
 
 	DrawListBuilder line_lb;
 	dlb_init(&line_lb);
@@ -1075,22 +1615,65 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 	int16_t line_desc = 0;
 	int current_y = y_start;
 	int pending_space = 0;
+	int line_src = src_start;
+	int space_src = 0;
+	int space_len = 0;
 
 	TeX_Stream stream;
-	tex_stream_init(&stream, src_start, -1);
+	if (layout->packed.data)
+	{
+		// only the blocks up to the first checkpoint past the window are decompressed, into the slot pool
+		TeX_Checkpoint end_cp;
+		tex_checkpoint_find(layout, padded_bot - 1, NULL, &end_cp);
+		int src_end = end_cp.src_offset;
+		if (src_end < src_start)
+			src_end = src_start;
+		const char* text = tex_source_window(&layout->packed, &slot->pool, src_start, src_end);
+		if (!text)
+		{
+			TEX_SET_ERROR(layout, TEX_ERR_OOM, "Failed to decompress source window", src_end - src_start);
+			slot->cached_layout = NULL;
+			return;
+		}
+		tex_stream_init(&stream, text, src_end - src_start);
+	}
+	else
+	{
+		tex_stream_init(&stream, layout->source + src_start, layout->source_len - src_start);
+	}
+	// kept for hit testing, maps spans back to the source text
+	const char* text_base = stream.cursor;
+	slot->text = text_base;
+	slot->text_offset = src_start;
+	slot->text_len = (int)(stream.end - text_base);
+
+	// formulas are parsed with the layout's error held back, as the dry run measured them: the error is
+	// raised again from the token the dry run raised it at, one raised after formatting blanks nothing
+	TexErrorState held = layout->error;
+	memset(&layout->error, 0, sizeof(layout->error));
 
 	TeX_Token t;
-	while (tex_stream_next(&stream, &t, &r->pool, layout))
+	const char* tok_at = stream.cursor;
+	while (tex_stream_next(&stream, &t, &slot->pool, layout))
 	{
+		// raw source range, t.start may point at an unescaped copy
+		int tok_src = src_start + (int)(tok_at - text_base);
+		int tok_len = (int)(stream.cursor - tok_at);
+		tok_at = stream.cursor;
+		if (layout->error_offset >= 0 && tok_src >= layout->error_offset && layout->error.code == TEX_OK)
+			layout->error = held;
+
 		if (current_y >= padded_bot)
 			break;
-		if (r->line_count >= TEX_RENDERER_MAX_LINES)
+		if (slot->line_count >= TEX_RENDERER_MAX_LINES)
 			break;
 
 		switch (t.type)
 		{
 		case T_NEWLINE:
 			{
+				if (line_lb.head == LIST_NULL)
+					line_src = tok_src; // blank line, hit tests land on its newline
 				int eff_asc = line_asc;
 				int eff_desc = line_desc;
 				if (line_lb.head == LIST_NULL && eff_asc == 0 && eff_desc == 0)
@@ -1105,15 +1688,16 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 					if (h <= 0)
 						h = 1;
 
-					if (r->line_count < TEX_RENDERER_MAX_LINES)
+					if (slot->line_count < TEX_RENDERER_MAX_LINES)
 					{
-						TeX_Line* ln = &r->lines[r->line_count];
+						TeX_Line* ln = &slot->lines[slot->line_count];
 						memset(ln, 0, sizeof(TeX_Line));
 						ln->content = line_lb.head;
+						ln->src_offset = line_src;
 						ln->y = current_y;
 						ln->h = h;
 						ln->next = NULL;
-						r->line_count++;
+						slot->line_count++;
 					}
 
 					current_y += h;
@@ -1128,6 +1712,8 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 
 		case T_SPACE:
 			pending_space = 1;
+			space_src = tok_src;
+			space_len = tok_len;
 			break;
 
 		case T_TEXT:
@@ -1144,14 +1730,15 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 						int h = line_asc + line_desc + TEX_LINE_LEADING;
 						if (h <= 0)
 							h = 1;
-						if (r->line_count < TEX_RENDERER_MAX_LINES)
+						if (slot->line_count < TEX_RENDERER_MAX_LINES)
 						{
-							TeX_Line* ln = &r->lines[r->line_count];
+							TeX_Line* ln = &slot->lines[slot->line_count];
 							memset(ln, 0, sizeof(TeX_Line));
 							ln->content = line_lb.head;
+							ln->src_offset = line_src;
 							ln->y = current_y;
 							ln->h = h;
-							r->line_count++;
+							slot->line_count++;
 						}
 						current_y += h;
 						dlb_init(&line_lb);
@@ -1161,12 +1748,12 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 					}
 					else
 					{
-						NodeRef sp_ref = pool_alloc_node(&r->pool);
+						NodeRef sp_ref = pool_alloc_node(&slot->pool);
 						if (sp_ref != NODE_NULL)
 						{
-							Node* sp = pool_get_node(&r->pool, sp_ref);
+							Node* sp = pool_get_node(&slot->pool, sp_ref);
 							sp->type = N_TEXT;
-							StringId sid = pool_alloc_string(&r->pool, " ", 1);
+							StringId sid = pool_alloc_string(&slot->pool, " ", 1);
 							sp->data.text.sid = sid;
 							sp->data.text.len = 1;
 							sp->w = space_w;
@@ -1174,7 +1761,7 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 							sp->desc = text_desc;
 							// x position calculated during drawing
 
-							dlb_push(&r->pool, &line_lb, sp_ref);
+							push_item(&slot->pool, &line_lb, sp_ref, space_src, space_len, &line_src);
 							x_cursor = (int16_t)(x_cursor + space_w);
 							line_asc = TEX_MAX(line_asc, text_asc);
 							line_desc = TEX_MAX(line_desc, text_desc);
@@ -1188,14 +1775,15 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 					int h = line_asc + line_desc + TEX_LINE_LEADING;
 					if (h <= 0)
 						h = 1;
-					if (r->line_count < TEX_RENDERER_MAX_LINES)
+					if (slot->line_count < TEX_RENDERER_MAX_LINES)
 					{
-						TeX_Line* ln = &r->lines[r->line_count];
+						TeX_Line* ln = &slot->lines[slot->line_count];
 						memset(ln, 0, sizeof(TeX_Line));
 						ln->content = line_lb.head;
+						ln->src_offset = line_src;
 						ln->y = current_y;
 						ln->h = h;
-						r->line_count++;
+						slot->line_count++;
 					}
 					current_y += h;
 					dlb_init(&line_lb);
@@ -1204,12 +1792,12 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 					line_desc = 0;
 				}
 
-				NodeRef node_ref = pool_alloc_node(&r->pool);
+				NodeRef node_ref = pool_alloc_node(&slot->pool);
 				if (node_ref != NODE_NULL)
 				{
-					Node* node = pool_get_node(&r->pool, node_ref);
+					Node* node = pool_get_node(&slot->pool, node_ref);
 					node->type = N_TEXT;
-					StringId sid = pool_alloc_string(&r->pool, t.start, (size_t)t.len);
+					StringId sid = pool_alloc_string(&slot->pool, t.start, (size_t)t.len);
 					node->data.text.sid = sid;
 					node->data.text.len = (uint16_t)t.len;
 					node->w = text_w;
@@ -1217,7 +1805,7 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 					node->desc = text_desc;
 					// x position calculated during drawing
 
-					dlb_push(&r->pool, &line_lb, node_ref);
+					push_item(&slot->pool, &line_lb, node_ref, tok_src, tok_len, &line_src);
 					x_cursor = (int16_t)(x_cursor + text_w);
 					line_asc = TEX_MAX(line_asc, text_asc);
 					line_desc = TEX_MAX(line_desc, text_desc);
@@ -1227,12 +1815,10 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 
 		case T_MATH_INLINE:
 			{
-				NodeRef start_node = (NodeRef)r->pool.node_count;
-				NodeRef math_ref = tex_parse_math(t.start, t.len, &r->pool, layout);
+				NodeRef math_ref = tex_parse_math_measured(t.start, t.len, &slot->pool, layout);
 				if (math_ref != NODE_NULL)
 				{
-					Node* math = pool_get_node(&r->pool, math_ref);
-					tex_measure_range(&r->pool, start_node, (NodeRef)r->pool.node_count);
+					Node* math = pool_get_node(&slot->pool, math_ref);
 
 					if (pending_space && line_lb.head != LIST_NULL)
 					{
@@ -1242,14 +1828,15 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 							int h = line_asc + line_desc + TEX_LINE_LEADING;
 							if (h <= 0)
 								h = 1;
-							if (r->line_count < TEX_RENDERER_MAX_LINES)
+							if (slot->line_count < TEX_RENDERER_MAX_LINES)
 							{
-								TeX_Line* ln = &r->lines[r->line_count];
+								TeX_Line* ln = &slot->lines[slot->line_count];
 								memset(ln, 0, sizeof(TeX_Line));
 								ln->content = line_lb.head;
+								ln->src_offset = line_src;
 								ln->y = current_y;
 								ln->h = h;
-								r->line_count++;
+								slot->line_count++;
 							}
 							current_y += h;
 							dlb_init(&line_lb);
@@ -1259,19 +1846,19 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 						}
 						else
 						{
-							NodeRef sp_ref = pool_alloc_node(&r->pool);
+							NodeRef sp_ref = pool_alloc_node(&slot->pool);
 							if (sp_ref != NODE_NULL)
 							{
-								Node* sp = pool_get_node(&r->pool, sp_ref);
+								Node* sp = pool_get_node(&slot->pool, sp_ref);
 								sp->type = N_TEXT;
-								StringId sid = pool_alloc_string(&r->pool, " ", 1);
+								StringId sid = pool_alloc_string(&slot->pool, " ", 1);
 								sp->data.text.sid = sid;
 								sp->data.text.len = 1;
 								sp->w = space_w;
 								sp->asc = tex_metrics_asc(FONTROLE_MAIN);
 								sp->desc = tex_metrics_desc(FONTROLE_MAIN);
 
-								dlb_push(&r->pool, &line_lb, sp_ref);
+								push_item(&slot->pool, &line_lb, sp_ref, space_src, space_len, &line_src);
 								x_cursor = (int16_t)(x_cursor + space_w);
 								line_asc = TEX_MAX(line_asc, sp->asc);
 								line_desc = TEX_MAX(line_desc, sp->desc);
@@ -1285,14 +1872,15 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 						int h = line_asc + line_desc + TEX_LINE_LEADING;
 						if (h <= 0)
 							h = 1;
-						if (r->line_count < TEX_RENDERER_MAX_LINES)
+						if (slot->line_count < TEX_RENDERER_MAX_LINES)
 						{
-							TeX_Line* ln = &r->lines[r->line_count];
+							TeX_Line* ln = &slot->lines[slot->line_count];
 							memset(ln, 0, sizeof(TeX_Line));
 							ln->content = line_lb.head;
+							ln->src_offset = line_src;
 							ln->y = current_y;
 							ln->h = h;
-							r->line_count++;
+							slot->line_count++;
 						}
 						current_y += h;
 						dlb_init(&line_lb);
@@ -1301,8 +1889,9 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 						line_desc = 0;
 					}
 
-					// x position calculated during drawing
-					dlb_push(&r->pool, &line_lb, math_ref);
+					// x position calculated during drawing, the formula spans its content (nested spans are relative to it)
+					push_item(&slot->pool, &line_lb, math_ref, src_start + (int)(t.start - text_base), t.len,
+					          &line_src);
 					x_cursor = (int16_t)(x_cursor + math->w);
 					line_asc = TEX_MAX(line_asc, math->asc);
 					line_desc = TEX_MAX(line_desc, math->desc);
@@ -1317,14 +1906,15 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 					int h = line_asc + line_desc + TEX_LINE_LEADING;
 					if (h <= 0)
 						h = 1;
-					if (r->line_count < TEX_RENDERER_MAX_LINES)
+					if (slot->line_count < TEX_RENDERER_MAX_LINES)
 					{
-						TeX_Line* ln = &r->lines[r->line_count];
+						TeX_Line* ln = &slot->lines[slot->line_count];
 						memset(ln, 0, sizeof(TeX_Line));
 						ln->content = line_lb.head;
+						ln->src_offset = line_src;
 						ln->y = current_y;
 						ln->h = h;
-						r->line_count++;
+						slot->line_count++;
 					}
 					current_y += h;
 					dlb_init(&line_lb);
@@ -1333,34 +1923,34 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 					line_desc = 0;
 				}
 
-				NodeRef start_node = (NodeRef)r->pool.node_count;
-				NodeRef math_ref = tex_parse_math(t.start, t.len, &r->pool, layout);
+				NodeRef math_ref = tex_parse_math_measured(t.start, t.len, &slot->pool, layout);
 				if (math_ref != NODE_NULL)
 				{
-					Node* math = pool_get_node(&r->pool, math_ref);
-					tex_measure_range(&r->pool, start_node, (NodeRef)r->pool.node_count);
+					Node* math = pool_get_node(&slot->pool, math_ref);
 
 					// Center display math
 					int16_t center_x = (int16_t)((layout->width - math->w) / 2);
 					if (center_x < 0)
 						center_x = 0;
 					// x position calculated during drawing (centered via x_offset in TeX_Line)
-					dlb_push(&r->pool, &line_lb, math_ref);
+					push_item(&slot->pool, &line_lb, math_ref, src_start + (int)(t.start - text_base), t.len,
+					          &line_src);
 					line_asc = math->asc;
 					line_desc = math->desc;
 
 					int h = line_asc + line_desc + TEX_LINE_LEADING;
 					if (h <= 0)
 						h = 1;
-					if (r->line_count < TEX_RENDERER_MAX_LINES)
+					if (slot->line_count < TEX_RENDERER_MAX_LINES)
 					{
-						TeX_Line* ln = &r->lines[r->line_count];
+						TeX_Line* ln = &slot->lines[slot->line_count];
 						memset(ln, 0, sizeof(TeX_Line));
 						ln->content = line_lb.head;
+						ln->src_offset = line_src;
 						ln->x_offset = center_x; // center display math
 						ln->y = current_y;
 						ln->h = h;
-						r->line_count++;
+						slot->line_count++;
 					}
 					current_y += h;
 					dlb_init(&line_lb);
@@ -1377,58 +1967,273 @@ static void rehydrate_window(TeX_Renderer* r, TeX_Layout* layout, int scroll_y)
 		}
 	}
 
-	if (line_lb.head != LIST_NULL && r->line_count < TEX_RENDERER_MAX_LINES)
+	if (line_lb.head != LIST_NULL && slot->line_count < TEX_RENDERER_MAX_LINES)
 	{
 		int h = line_asc + line_desc + TEX_LINE_LEADING;
 		if (h <= 0)
 			h = 1;
-		TeX_Line* ln = &r->lines[r->line_count];
+		TeX_Line* ln = &slot->lines[slot->line_count];
 		memset(ln, 0, sizeof(TeX_Line));
 		ln->content = line_lb.head;
+		ln->src_offset = line_src;
 		ln->y = current_y;
 		ln->h = h;
-		r->line_count++;
+		slot->line_count++;
+	}
+
+	// the first error stays
+	if (held.code != TEX_OK)
+		layout->error = held;
+
+	slot->window_y_start = padded_top;
+	slot->window_y_end = padded_bot;
+	slot->cached_layout = layout;
+	slot->cached_revision = layout->revision;
+
+	record_display_list(slot);
+}
+
+// lines are drawn on the baseline of their tallest item
+static int line_ascent(const TeX_Line* ln)
+{
+	int asc = 0;
+	for (ListId bid = ln->content; bid != LIST_NULL;)
+	{
+		TexListBlock* block = pool_get_list_block(g_draw_pool, bid);
+		if (!block)
+			break;
+		for (uint16_t j = 0; j < block->count; j++)
+		{
+			Node* n = pool_get_node(g_draw_pool, block->items[j]);
+			if (n)
+				asc = TEX_MAX(asc, n->asc);
+		}
+		bid = block->next;
+	}
+	return asc;
+}
+
+// draw a line's items, line_top in the coordinates of the current band
+static void draw_line_nodes(const TeX_Line* ln, int x, int line_top)
+{
+	TexBaseline baseline_y = { line_top + line_ascent(ln) };
+	g_axis_y = baseline_y.v - tex_metrics_math_axis();
+
+	// x positions are calculated on the fly, x_offset centers display math
+	int cur_x = x + ln->x_offset;
+	for (ListId bid = ln->content; bid != LIST_NULL;)
+	{
+		TexListBlock* block = pool_get_list_block(g_draw_pool, bid);
+		if (!block)
+			break;
+		for (uint16_t j = 0; j < block->count; j++)
+		{
+			Node* n = pool_get_node(g_draw_pool, block->items[j]);
+			if (!n)
+				continue;
+			TexCoord node_x = { cur_x };
+			draw_node(block->items[j], node_x, baseline_y, FONTROLE_MAIN);
+			cur_x += n->w;
+		}
+		bid = block->next;
+	}
+}
+
+// a text or glyph op that fontlib can draw as part of a string, control codes below the first printable
+// code point (and the terminator) would end the string early
+static int op_in_run(const TexDisplayOp* op, unsigned char first_printable)
+{
+	if (op->type == DOP_TEXT)
+		return 1;
+	return op->type == DOP_GLYPH && op->data != 0 && op->data >= first_printable;
+}
+
+// b continues a: same font and top, starting where a's advance ends
+static int op_continues(const TexDisplayOp* a, const TexDisplayOp* b, unsigned char first_printable)
+{
+	return op_in_run(b, first_printable) && a->role == b->role && a->y1 == b->y1 && a->x1 + a->x2 == b->x1;
+}
+
+// merge runs of adjacent text and glyph ops into one text op each (copied into the pool), so a replay
+// draws "xy2" with one fontlib_DrawStringL instead of a cursor move and draw call per atom. Line ranges
+// are compacted in place; runs whose string does not fit are left as they are
+static void coalesce_runs(TeX_RenderSlot* slot)
+{
+	UnifiedPool* pool = &slot->pool;
+	TexDisplayOp* ops = slot->ops;
+	unsigned char first_printable = (unsigned char)fontlib_GetFirstPrintableCodePoint();
+	int out = 0;
+	for (int i = 0; i < slot->line_count; i++)
+	{
+		TeX_Line* ln = &slot->lines[i];
+		int end = ln->op_first + ln->op_count;
+		int line_first = out;
+		for (int k = ln->op_first; k < end;)
+		{
+			int run_end = k + 1;
+			int len = 0;
+			if (op_in_run(&ops[k], first_printable))
+			{
+				len = (ops[k].type == DOP_TEXT) ? ops[k].len : 1;
+				while (run_end < end && op_continues(&ops[run_end - 1], &ops[run_end], first_printable) &&
+				       len < 0xFFFF)
+				{
+					len += (ops[run_end].type == DOP_TEXT) ? ops[run_end].len : 1;
+					run_end++;
+				}
+			}
+
+			StringId sid = (run_end - k > 1) ? pool_alloc_string_space(pool, (size_t)len) : STRING_NULL;
+			if (sid == STRING_NULL)
+			{
+				for (; k < run_end; k++)
+					ops[out++] = ops[k];
+				continue;
+			}
+
+			char* dst = (char*)(pool->slab + sid);
+			TexDisplayOp run = ops[k];
+			run.type = DOP_TEXT;
+			run.x2 = 0;
+			for (; k < run_end; k++)
+			{
+				if (ops[k].type == DOP_TEXT)
+				{
+					memcpy(dst, pool_get_string(pool, ops[k].data), ops[k].len);
+					dst += ops[k].len;
+				}
+				else
+				{
+					*dst++ = (char)ops[k].data;
+				}
+				run.x2 = (int16_t)(run.x2 + ops[k].x2);
+			}
+			run.data = sid;
+			run.len = (uint16_t)len;
+			ops[out++] = run;
+		}
+		ln->op_first = line_first;
+		ln->op_count = out - line_first;
+	}
+	slot->op_count = out;
+}
+
+// walk the window's lines once with the primitives recording, x from the layout origin and y from
+// window_y_start. A counting pass sizes the list so it takes one pool block; when it does not fit
+// the ops stay NULL and the window is drawn from its nodes
+static void record_display_list(TeX_RenderSlot* slot)
+{
+	slot->ops = NULL;
+	slot->op_count = 0;
+	slot->sprite_count = 0;
+
+	int vis_top = g_draw_vis_top, vis_bot = g_draw_vis_bot;
+	int vis_left = g_draw_vis_left, vis_right = g_draw_vis_right;
+	// nothing in the window is culled while recording
+	g_draw_vis_top = INT16_MIN;
+	g_draw_vis_bot = INT16_MAX;
+	g_draw_vis_left = INT16_MIN;
+	g_draw_vis_right = INT16_MAX;
+
+	TexDisplayRecorder rec = { slot, &slot->pool, NULL, 0 };
+	g_draw_pool = &slot->pool;
+	g_draw_rec = &rec;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		rec.count = 0;
+		frames_bind(slot);
+		for (int i = 0; i < slot->line_count; i++)
+		{
+			TeX_Line* ln = &slot->lines[i];
+			ln->op_first = rec.count;
+			draw_line_nodes(ln, 0, ln->y - slot->window_y_start);
+			ln->op_count = rec.count - ln->op_first;
+		}
+		int depth = g_draw_frame_peak;
+		frames_unbind(slot);
+		if (pass > 0 || rec.count == 0)
+			break;
+		// the counting walk ran on the free gap, the filling walk allocates (strings, sprites) so its
+		// stack is taken first, exactly as deep as counting went (a full gap skips the same subtrees)
+		StringId frames = pool_alloc_block(&slot->pool, (size_t)TEX_MAX(depth, 1) * sizeof(TexDrawFrame));
+		if (frames == STRING_NULL)
+			break;
+		slot->frames = (TexDrawFrame*)(slot->pool.slab + frames);
+		slot->frame_cap = TEX_MAX(depth, 1);
+		StringId id = pool_alloc_block(&slot->pool, (size_t)rec.count * sizeof(TexDisplayOp));
+		if (id == STRING_NULL)
+			break;
+		rec.ops = (TexDisplayOp*)(slot->pool.slab + id);
+	}
+	if (rec.ops)
+	{
+		slot->ops = rec.ops;
+		slot->op_count = rec.count;
+		coalesce_runs(slot);
 	}
 
-	r->window_y_start = padded_top;
-	r->window_y_end = padded_bot;
-	r->cached_layout = layout;
+	g_draw_rec = NULL;
+	g_draw_pool = NULL;
+	g_draw_vis_top = vis_top;
+	g_draw_vis_bot = vis_bot;
+	g_draw_vis_left = vis_left;
+	g_draw_vis_right = vis_right;
 }
 
 // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
 void tex_draw(TeX_Renderer* r, TeX_Layout* layout, int x, int y, int scroll_y)
 {
-	if (!r || !layout)
+	TeX_Viewport screen = { 0, 0, GFX_LCD_WIDTH, TEX_VIEWPORT_H };
+	tex_draw_viewport(r, layout, x, y, scroll_y, &screen);
+}
+
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+void tex_draw_viewport(TeX_Renderer* r, TeX_Layout* layout, int x, int y, int scroll_y, const TeX_Viewport* viewport)
+{
+	if (!r || !layout || !viewport)
 		return;
 
-	g_draw_current_role = (FontRole)-1;
-	g_axis_y = 0;
+	// visible band is the viewport clipped to where the document starts
+	int vis_top = TEX_MAX(y, viewport->y);
+	int vis_bot = viewport->y + viewport->h;
+	if (vis_top >= vis_bot || viewport->w <= 0)
+		return;
 
-	int vis_top = y;
-	if (vis_top < 0)
-		vis_top = 0;
-	if (vis_top > TEX_VIEWPORT_H)
-		vis_top = TEX_VIEWPORT_H;
-	int vis_bot = TEX_VIEWPORT_H;
+	tex_metrics_invalidate_font_state();
+	g_axis_y = 0;
 	g_draw_vis_top = vis_top;
 	g_draw_vis_bot = vis_bot;
+	g_draw_vis_left = viewport->x;
+	g_draw_vis_right = viewport->x + viewport->w;
+	// graphx clips to the band, text is trimmed to it by emit_text (graphx has no getter, the region is
+	// put back to the full screen afterwards)
+	gfx_SetClipRegion(TEX_MAX(g_draw_vis_left, 0), TEX_MAX(vis_top, 0), TEX_MIN(g_draw_vis_right, GFX_LCD_WIDTH),
+	                  TEX_MIN(vis_bot, GFX_LCD_HEIGHT));
+
+	// same band in document coordinates
+	int viewport_top = scroll_y + (vis_top - y);
+	int viewport_bot = scroll_y + (vis_bot - y);
 
-	int viewport_top = scroll_y;
-	int viewport_bot = scroll_y + TEX_VIEWPORT_H;
+	TeX_RenderSlot* slot = tex_renderer_acquire_slot(r, layout);
 
-	int hit = (r->cached_layout == layout) && (viewport_top >= r->window_y_start) && (viewport_bot <= r->window_y_end);
+	// a window clamped to the document edge covers everything past that edge
+	int hit = slot->cached_layout == layout && (viewport_top >= slot->window_y_start || slot->window_y_start <= 0) &&
+	          (viewport_bot <= slot->window_y_end || slot->window_y_end >= layout->total_height);
 
 	if (!hit)
 	{
-		rehydrate_window(r, layout, scroll_y);
+		rehydrate_window(slot, layout, viewport_top, vis_bot - vis_top);
 	}
 
 	// pool context for draw functions
-	g_draw_pool = &r->pool;
+	g_draw_pool = &slot->pool;
+	// display list coordinates to the screen
+	int dx = x;
+	int dy = y + (slot->window_y_start - scroll_y);
 
-	for (int i = 0; i < r->line_count; i++)
+	for (int i = 0; i < slot->line_count; i++)
 	{
-		TeX_Line* ln = &r->lines[i];
+		TeX_Line* ln = &slot->lines[i];
 		int line_screen_top = y + (ln->y - scroll_y);
 		int line_screen_bot = line_screen_top + ln->h;
 
@@ -1437,53 +2242,401 @@ void tex_draw(TeX_Renderer* r, TeX_Layout* layout, int x, int y, int scroll_y)
 		if (line_screen_top >= vis_bot)
 			break;
 
-		int line_asc = 0;
-		int line_desc = 0;
-		for (ListId bid = ln->content; bid != LIST_NULL;)
+		if (slot->ops)
 		{
-			TexListBlock* block = pool_get_list_block(g_draw_pool, bid);
-			if (!block)
-				break;
-			for (uint16_t j = 0; j < block->count; j++)
-			{
-				Node* n = pool_get_node(g_draw_pool, block->items[j]);
-				if (n)
-				{
-					line_asc = TEX_MAX(line_asc, n->asc);
-					line_desc = TEX_MAX(line_desc, n->desc);
-				}
-			}
-			bid = block->next;
+			for (int k = 0; k < ln->op_count; k++)
+				replay_op(slot, &slot->ops[ln->op_first + k], dx, dy);
+		}
+		else
+		{
+			frames_bind(slot);
+			draw_line_nodes(ln, x, line_screen_top);
+			frames_unbind(slot);
 		}
-		int baseline = line_screen_top + line_asc;
-		TexBaseline baseline_y = { baseline };
 
-		g_axis_y = baseline - tex_metrics_math_axis();
+		if (ln->y + ln->h > slot->window_y_end)
+			break;
+	}
 
-		// draw all nodes in the line content, calculating x positions on-the-fly
-		int cur_x = x + ln->x_offset; // x_offset provides centering for display math
-		for (ListId bid = ln->content; bid != LIST_NULL;)
+	gfx_SetClipRegion(0, 0, GFX_LCD_WIDTH, GFX_LCD_HEIGHT);
+	g_draw_pool = NULL;
+	g_draw_vis_top = 0;
+	g_draw_vis_bot = TEX_VIEWPORT_H;
+	g_draw_vis_left = 0;
+	g_draw_vis_right = GFX_LCD_WIDTH;
+}
+
+// -------------------------
+// hit testing
+// -------------------------
+static int node_is_flyweight(const Node* n)
+{
+	uintptr_t p = (uintptr_t)n;
+	uintptr_t base = (uintptr_t)g_reserved_nodes;
+	return p >= base && p < base + sizeof(g_reserved_nodes);
+}
+
+// skip whitespace and the structure between atoms (group braces, cell and row separators),
+// args also skips the markers in front of command arguments
+static int span_skip(const char* s, int pos, int end, int args)
+{
+	while (pos < end)
+	{
+		char c = s[pos];
+		if (c == '\\' && pos + 1 < end && s[pos + 1] == '\\')
+			pos += 2;
+		else if (isspace((unsigned char)c) || c == '{' || c == '}' || c == '&')
+			pos++;
+		else if (args && (c == '^' || c == '_' || c == '[' || c == ']'))
+			pos++;
+		else
+			break;
+	}
+	return pos;
+}
+
+// end of the token at pos: a command name, an escaped character or a single character
+static int span_token_end(const char* s, int pos, int end)
+{
+	if (pos >= end)
+		return end;
+	if (s[pos] != '\\')
+		return pos + 1;
+	int e = pos + 1;
+	while (e < end && isalpha((unsigned char)s[e]))
+		e++;
+	return (e == pos + 1 && e < end) ? e + 1 : e;
+}
+
+typedef struct
+{
+	const char* s; // formula text
+	int end;
+	int pos; // scan position, formula relative like node spans
+	int start, len; // span of the last child passed
+} SpanScan;
+
+// pass one child, pool nodes by their span and flyweights by scanning their token
+static void scan_child(SpanScan* sc, const Node* child, int args)
+{
+	if (!node_is_flyweight(child))
+	{
+		sc->start = child->src;
+		sc->len = child->src_len;
+	}
+	else
+	{
+		sc->start = span_skip(sc->s, sc->pos, sc->end, args);
+		sc->len = span_token_end(sc->s, sc->start, sc->end) - sc->start;
+	}
+	sc->pos = sc->start + sc->len;
+}
+
+static void scan_token(SpanScan* sc)
+{
+	sc->pos = span_token_end(sc->s, span_skip(sc->s, sc->pos, sc->end, 0), sc->end);
+}
+
+// pass \begin{name} and the column spec of an array
+static void scan_env_begin(SpanScan* sc)
+{
+	while (sc->pos < sc->end && sc->s[sc->pos] != '{')
+		sc->pos++;
+	int name = sc->pos + 1;
+	while (sc->pos < sc->end && sc->s[sc->pos] != '}')
+		sc->pos++;
+	int is_array = (sc->pos - name == 5) && strncmp(sc->s + name, "array", 5) == 0;
+	sc->pos++;
+	if (!is_array)
+		return;
+	while (sc->pos < sc->end && isspace((unsigned char)sc->s[sc->pos]))
+		sc->pos++;
+	if (sc->pos < sc->end && sc->s[sc->pos] == '{')
+	{
+		while (sc->pos < sc->end && sc->s[sc->pos] != '}')
+			sc->pos++;
+		sc->pos++;
+	}
+}
+
+// flyweight glyphs are shared and carry no span, theirs is found by scanning the parent's source
+// child by child up to the one at ordinal (position among the children in draw order)
+// parent_src is the parent's start relative to the formula text s, returns 0 if the glyph was not found
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static int flyweight_span(const Node* parent, int parent_src, int ordinal, const char* s, int end, SpanScan* sc)
+{
+	sc->s = s;
+	sc->end = end;
+	sc->pos = parent_src;
+	const Node* kids[2] = { NULL, NULL }; // arguments of a command, in source order
+	ListId list = LIST_NULL;
+
+	switch ((NodeType)parent->type)
+	{
+	case N_MATH:
+		list = parent->data.list.head;
+		break;
+	case N_AUTO_DELIM:
+		scan_token(sc); // \left
+		scan_token(sc); // delimiter
+		list = parent->data.auto_delim.content;
+		break;
+	case N_MATRIX:
 		{
-			TexListBlock* block = pool_get_list_block(g_draw_pool, bid);
-			if (!block)
-				break;
-			for (uint16_t j = 0; j < block->count; j++)
+			// cells in row major order, the grid holds them in the same order as the source
+			scan_env_begin(sc);
+			int16_t* grid = matrix_grid(g_draw_pool, parent);
+			if (!grid)
+				return 0;
+			NodeRef* cells = matrix_cells(grid, parent);
+			int index = 0;
+			for (int i = 0; i < parent->data.matrix.rows * parent->data.matrix.cols; i++)
 			{
-				Node* n = pool_get_node(g_draw_pool, block->items[j]);
-				if (!n)
+				Node* child = pool_get_node(g_draw_pool, cells[i]);
+				if (!child)
 					continue;
-				TexCoord node_x = { cur_x };
-				draw_node(n, node_x, baseline_y, FONTROLE_MAIN);
-				cur_x += n->w;
+				scan_child(sc, child, 0);
+				if (index++ == ordinal)
+					return 1;
+			}
+			return 0;
+		}
+	case N_SCRIPT:
+		{
+			// drawn as base, sup, sub; written as base followed by the scripts in either order
+			Node* sub = pool_get_node(g_draw_pool, parent->data.script.sub);
+			Node* sup = pool_get_node(g_draw_pool, parent->data.script.sup);
+			char want = (ordinal == 0) ? 0 : ((ordinal == 1 && sup) ? '^' : '_');
+			Node* base = pool_get_node(g_draw_pool, parent->data.script.base);
+			if (base)
+				scan_child(sc, base, 0);
+			if (want == 0)
+				return base != NULL;
+			for (int i = 0; i < 2; i++)
+			{
+				int m = span_skip(s, sc->pos, end, 0);
+				if (m >= end || (s[m] != '^' && s[m] != '_'))
+					return 0;
+				Node* arg = (s[m] == '^') ? sup : sub;
+				if (!arg)
+					return 0;
+				sc->pos = m + 1;
+				scan_child(sc, arg, 0);
+				if (s[m] == want)
+					return 1;
 			}
-			bid = block->next;
+			return 0;
 		}
+	case N_FRAC:
+		kids[0] = pool_get_node(g_draw_pool, parent->data.frac.num);
+		kids[1] = pool_get_node(g_draw_pool, parent->data.frac.den);
+		break;
+	case N_SQRT:
+		kids[0] = pool_get_node(g_draw_pool, parent->data.sqrt.index);
+		kids[1] = pool_get_node(g_draw_pool, parent->data.sqrt.rad);
+		break;
+	case N_OVERLAY:
+		kids[0] = pool_get_node(g_draw_pool, parent->data.overlay.base);
+		break;
+	case N_SPANDECO:
+		kids[0] = pool_get_node(g_draw_pool, parent->data.spandeco.content);
+		kids[1] = pool_get_node(g_draw_pool, parent->data.spandeco.label);
+		break;
+	case N_FUNC_LIM:
+		kids[0] = pool_get_node(g_draw_pool, parent->data.func_lim.limit);
+		break;
+	case N_ROOT:
+	case N_LINE:
+	case N_TEXT:
+	case N_GLYPH:
+	case N_SPACE:
+	case N_MULTIOP:
+		return 0;
+	}
 
-		if (r->cached_layout && ln->y + ln->h > r->window_y_end)
+	int index = 0;
+	if (list == LIST_NULL)
+	{
+		scan_token(sc); // command name
+		for (int i = 0; i < 2; i++)
+		{
+			if (!kids[i])
+				continue;
+			scan_child(sc, kids[i], 1);
+			if (index++ == ordinal)
+				return 1;
+		}
+		return 0;
+	}
+	for (ListId bid = list; bid != LIST_NULL;)
+	{
+		TexListBlock* block = pool_get_list_block(g_draw_pool, bid);
+		if (!block)
 			break;
+		for (uint16_t i = 0; i < block->count; i++)
+		{
+			Node* child = pool_get_node(g_draw_pool, block->items[i]);
+			if (!child)
+				continue;
+			scan_child(sc, child, 0);
+			if (index++ == ordinal)
+				return 1;
+		}
+		bid = block->next;
 	}
+	return 0;
+}
 
-	g_draw_pool = NULL;
+// hydrated line covering document y (lines are sorted by y), NULL if none
+static TeX_Line* slot_line_at(TeX_RenderSlot* slot, int doc_y)
+{
+	int lo = 0;
+	int hi = slot->line_count - 1;
+	TeX_Line* found = NULL;
+	while (lo <= hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (slot->lines[mid].y <= doc_y)
+		{
+			found = &slot->lines[mid];
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid - 1;
+		}
+	}
+	return (found && doc_y < found->y + found->h) ? found : NULL;
+}
+
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+int tex_hit_test(TeX_Renderer* r, TeX_Layout* layout, int x, int y, int scroll_y, int px, int py, TeX_HitResult* out)
+{
+	if (!r || !layout || !out || py < y)
+		return -1;
+	int doc_y = scroll_y + (py - y);
+	if (doc_y < 0 || doc_y >= layout->total_height)
+		return -1;
+
+	// normally the window of the last draw, hydrated around the point otherwise
+	TeX_RenderSlot* slot = tex_renderer_acquire_slot(r, layout);
+	TeX_Line* ln = NULL;
+	if (slot->cached_layout == layout)
+		ln = slot_line_at(slot, doc_y);
+	if (!ln)
+	{
+		rehydrate_window(slot, layout, doc_y, 1);
+		if (slot->cached_layout != layout)
+			return -1;
+		ln = slot_line_at(slot, doc_y);
+		if (!ln)
+			return -1;
+	}
+
+	g_draw_pool = &slot->pool;
+	int line_top = y + (ln->y - scroll_y);
+	TexBaseline baseline_y = { line_top + line_ascent(ln) };
+	g_axis_y = baseline_y.v - tex_metrics_math_axis();
+
+	// item under px, points left or right of the line snap to its first or last item
+	Node* item = NULL;
+	NodeRef item_ref = NODE_NULL;
+	int item_x = x + ln->x_offset;
+	int cur_x = item_x;
+	for (ListId bid = ln->content; bid != LIST_NULL && !(item && px < item_x + item->w);)
+	{
+		TexListBlock* block = pool_get_list_block(g_draw_pool, bid);
+		if (!block)
+			break;
+		for (uint16_t j = 0; j < block->count; j++)
+		{
+			Node* n = pool_get_node(g_draw_pool, block->items[j]);
+			if (!n)
+				continue;
+			item = n;
+			item_ref = block->items[j];
+			item_x = cur_x;
+			if (px < cur_x + n->w)
+				break;
+			cur_x += n->w;
+		}
+		bid = block->next;
+	}
+
+	memset(out, 0, sizeof(*out));
+	if (!item)
+	{
+		// blank line
+		out->src_offset = ln->src_offset;
+		out->x = x + ln->x_offset;
+		out->y = line_top;
+		out->h = ln->h;
+		g_draw_pool = NULL;
+		return 0;
+	}
+
+	// walk the item like a draw clipped to the point
+	TexHitProbe hp;
+	memset(&hp, 0, sizeof(hp));
+	hp.px = px;
+	hp.py = py;
+	hp.hit_depth = -1;
+	g_draw_probe = &hp;
+	g_draw_vis_top = py;
+	g_draw_vis_bot = py + 1;
+	g_draw_vis_left = px;
+	g_draw_vis_right = px + 1;
+	frames_bind(slot);
+	draw_node(item_ref, (TexCoord){ item_x }, baseline_y, FONTROLE_MAIN);
+	frames_unbind(slot);
+	g_draw_probe = NULL;
 	g_draw_vis_top = 0;
 	g_draw_vis_bot = TEX_VIEWPORT_H;
+	g_draw_vis_left = 0;
+	g_draw_vis_right = GFX_LCD_WIDTH;
+
+	int item_src = ln->src_offset + item->src;
+	if (hp.hit_depth <= 0)
+	{
+		out->src_offset = item_src;
+		out->src_len = item->src_len;
+		out->x = item_x;
+		out->y = baseline_y.v - item->asc;
+		out->w = item->w;
+		out->h = item->asc + item->desc;
+		g_draw_pool = NULL;
+		return 0;
+	}
+
+	// nested nodes are formula relative, the formula (item) itself is line relative
+	out->x = hp.box_x;
+	out->y = hp.box_y;
+	out->w = hp.box_w;
+	out->h = hp.box_h;
+	out->depth = hp.hit_depth;
+	if (!node_is_flyweight(hp.hit))
+	{
+		out->src_offset = item_src + hp.hit->src;
+		out->src_len = hp.hit->src_len;
+	}
+	else
+	{
+		int parent_src = (hp.hit_depth == 1) ? 0 : hp.hit_parent->src;
+		int parent_len = (hp.hit_depth == 1) ? item->src_len : hp.hit_parent->src_len;
+		int text_at = item_src - slot->text_offset;
+		SpanScan sc;
+		if (slot->text && text_at >= 0 && text_at + item->src_len <= slot->text_len &&
+		    flyweight_span(hp.hit_parent, parent_src, hp.hit_ordinal, slot->text + text_at, item->src_len, &sc))
+		{
+			out->src_offset = item_src + sc.start;
+			out->src_len = sc.len;
+		}
+		else
+		{
+			out->src_offset = item_src + parent_src;
+			out->src_len = parent_len;
+		}
+	}
+	g_draw_pool = NULL;
+	return 0;
 }
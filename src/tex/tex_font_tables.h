@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: AGPL-3.0-only
+// Generated by tools/process_fonts.py, do not edit.
+// Glyph metrics of the stock font packs, used instead of fontlib queries when the loaded
+// packs produce the same stamp (see tex_metrics.c). Included by tex_metrics.c only.
+
+#ifndef TEX_TEX_FONT_TABLES_H
+#define TEX_TEX_FONT_TABLES_H
+
+#include <stdint.h>
+
+#define TEX_FONT_TABLES_VERSION 1
+#define TEX_FONT_TABLES_PROBE_COUNT 9
+static const uint8_t tex_font_tables_probes[TEX_FONT_TABLES_PROBE_COUNT] = { 0x30, 0x41, 0x57, 0x69, 0x6D, 0x7E, 0x80, 0x96, 0xBC };
+
+// TeXFonts (TeX Main)
+#define TEX_FONT_TABLES_MAIN_HEIGHT 16
+#define TEX_FONT_TABLES_MAIN_BASELINE 13
+#define TEX_FONT_TABLES_MAIN_X_HEIGHT 7
+#define TEX_FONT_TABLES_MAIN_STAMP 0x080A8CAFu
+static const uint8_t tex_font_tables_main_widths[256] = {
+	0, 10, 10, 9, 9, 12, 7, 10, 12, 8, 8, 11, 10, 6, 12, 12,
+	12, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+	4, 2, 6, 7, 8, 8, 8, 2, 4, 4, 8, 8, 3, 5, 3, 7,
+	7, 6, 7, 7, 7, 7, 7, 7, 7, 7, 3, 3, 6, 8, 6, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 8, 7, 7, 7, 7, 7,
+	7, 8, 7, 7, 8, 7, 8, 7, 7, 8, 7, 4, 7, 4, 7, 8,
+	4, 7, 7, 7, 7, 7, 6, 7, 7, 6, 6, 7, 6, 8, 7, 7,
+	7, 7, 7, 7, 6, 7, 7, 8, 7, 7, 7, 5, 2, 5, 8, 15,
+	7, 7, 7, 7, 7, 8, 7, 7, 5, 6, 7, 8, 7, 7, 7, 7,
+	7, 8, 7, 7, 8, 9, 8, 8, 7, 8, 7, 8, 7, 8, 7, 8,
+	8, 8, 7, 8, 8, 5, 7, 8, 5, 6, 10, 10, 8, 8, 3, 7,
+	7, 7, 7, 7, 7, 8, 8, 7, 7, 7, 5, 5, 6, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+// TeXScrpt (TeX Script)
+#define TEX_FONT_TABLES_SCRIPT_HEIGHT 12
+#define TEX_FONT_TABLES_SCRIPT_BASELINE 10
+#define TEX_FONT_TABLES_SCRIPT_X_HEIGHT 5
+#define TEX_FONT_TABLES_SCRIPT_STAMP 0x59E23C58u
+static const uint8_t tex_font_tables_script_widths[256] = {
+	0, 10, 10, 9, 8, 10, 7, 8, 8, 7, 6, 8, 8, 6, 10, 8,
+	8, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+	4, 2, 5, 8, 7, 9, 7, 2, 4, 4, 6, 6, 2, 6, 3, 8,
+	6, 5, 6, 6, 6, 6, 6, 6, 6, 6, 2, 2, 5, 7, 5, 6,
+	6, 6, 6, 6, 6, 6, 6, 6, 6, 5, 6, 6, 6, 6, 6, 6,
+	6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 4, 7, 4, 7, 6,
+	4, 6, 6, 6, 6, 6, 5, 5, 6, 2, 5, 6, 4, 8, 6, 6,
+	7, 7, 6, 6, 6, 6, 6, 6, 6, 7, 6, 5, 2, 5, 7, 12,
+	6, 6, 8, 6, 6, 6, 6, 6, 5, 5, 6, 6, 6, 6, 6, 6,
+	6, 7, 6, 6, 7, 7, 6, 6, 6, 8, 6, 8, 6, 7, 7, 6,
+	6, 8, 6, 12, 6, 5, 6, 10, 5, 6, 8, 7, 6, 6, 3, 6,
+	6, 7, 9, 6, 6, 7, 6, 6, 6, 6, 4, 4, 5, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+#endif // TEX_TEX_FONT_TABLES_H
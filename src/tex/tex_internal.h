@@ -5,6 +5,7 @@
 #include <stdint.h>
 
 #include "tex_pool.h"
+#include "tex_source.h"
 #include "tex_types.h"
 
 // ==================================
@@ -54,14 +55,19 @@
 #define TEX_MATRIX_SEP_PAD 2     // extra padding on each side of column separator line
 #define TEX_MATRIX_ROW_SPACING 2
 
-// safety limit for stack-allocated metric arrays during measure/draw
-#define TEX_MATRIX_MAX_DIMS 16
+// rows and columns are stored in 8 bits, array column separators in an 8 bit mask
+#define TEX_MATRIX_MAX_DIMS 255
+#define TEX_MATRIX_MAX_SEPARATORS 8
 
 
 // decorative braces height (vertical extent of the brace shape)
 #define TEX_BRACE_HEIGHT 4
 
 #define TEX_PARSE_MAX_DEPTH 32
+// math parser frame stack: chunks of TEX_PARSE_STACK_CHUNK frames, the default budget (TeX_Config.parse_stack_frames 0)
+// allows TEX_PARSE_MAX_DEPTH levels of arguments, which take about two frames each (\frac and its group)
+#define TEX_PARSE_STACK_CHUNK 8
+#define TEX_PARSE_STACK_FRAMES (TEX_PARSE_MAX_DEPTH * 2 + 1)
 #define TEX_MAX_TOTAL_HEIGHT 20000
 
 // Node.flags constants
@@ -134,6 +140,7 @@ typedef struct Node
 	int16_t asc, desc; // ascender/descender heights
 	uint8_t type; // NodeType
 	uint8_t flags;
+	uint16_t src, src_len; // source range, relative to the formula (math nodes) or the line (line items)
 	union
 	{
 		struct
@@ -194,7 +201,7 @@ typedef struct Node
 		} auto_delim;
 		struct
 		{
-			ListId cells; // flat list of all cell nodes in row major order
+			StringId grid; // pool block with the metrics and cells, see matrix_grid()
 			uint8_t rows; // number of rows
 			uint8_t cols; // number of columns
 			uint8_t delim_type; // delim type enum for brackets
@@ -203,11 +210,44 @@ typedef struct Node
 	} data;
 } Node;
 
+// N_MATRIX grid block: column widths, row ascents and row descents (filled in by measure, read by draw),
+// then the cells in row major order, NODE_NULL past the last one
+static inline size_t matrix_grid_size(int rows, int cols)
+{
+	return (size_t)(cols + 2 * rows) * sizeof(int16_t) + (size_t)(rows * cols) * sizeof(NodeRef);
+}
+
+// column widths of a matrix, NULL when it has no grid. row ascents and descents follow, then the cells
+static inline int16_t* matrix_grid(UnifiedPool* pool, const Node* n)
+{
+	if (n->data.matrix.grid == STRING_NULL)
+		return NULL;
+	return (int16_t*)(pool->slab + n->data.matrix.grid);
+}
+
+static inline NodeRef* matrix_cells(int16_t* grid, const Node* n)
+{
+	return (NodeRef*)(grid + n->data.matrix.cols + 2 * n->data.matrix.rows);
+}
+
+// array column separator after column c
+static inline int matrix_sep_after(const Node* n, int c)
+{
+	return c < TEX_MATRIX_MAX_SEPARATORS && (n->data.matrix.col_separators & (1u << c));
+}
+
+// source spans are 16 bit, longer formulas saturate
+static inline void node_set_span(Node* n, int start, int len)
+{
+	n->src = (uint16_t)(start < 0 ? 0 : (start > 0xFFFF ? 0xFFFF : start));
+	n->src_len = (uint16_t)(len < 0 ? 0 : (len > 0xFFFF ? 0xFFFF : len));
+}
+
 // =======================================
 // Pool Accessors (inline, sizeof(Node) visible)
 // =======================================
 
-// reserved nodes for ASCII glyphs (defined in tex_metrics.c)
+// reserved flyweight glyph nodes, both FontRoles (defined in tex_metrics.c)
 extern Node g_reserved_nodes[TEX_RESERVED_COUNT];
 
 static inline Node* pool_get_node(UnifiedPool* pool, NodeRef ref)
@@ -244,6 +284,8 @@ typedef struct TeX_Line
 	int x_offset; // horizontal offset for centered content (display math)
 	ListId content; // ListId for nodes in this line
 	int child_count;
+	int src_offset; // source offset of the first item, item spans are relative to it
+	int op_first, op_count; // range of the line in the window's display list
 	struct TeX_Line* next; // kept for now, will be array in renderer
 } TeX_Line;
 
@@ -264,14 +306,29 @@ typedef struct
 // ==================================
 // Checkpoint for Sparse Indexing
 // ==================================
-#define TEX_CHECKPOINT_INTERVAL 200 // pixels between checkpoints
-
+// a checkpoint is placed once the replay cost since the last one reaches TEX_CHECKPOINT_COST
+// (source bytes plus TEX_CHECKPOINT_NODE_COST per math node), or TEX_CHECKPOINT_INTERVAL pixels
+// pass, which keeps a replayed window within the renderer's line limit
+#define TEX_CHECKPOINT_INTERVAL 200 // max pixels between checkpoints
+#define TEX_CHECKPOINT_COST 1024
+#define TEX_CHECKPOINT_NODE_COST 16
+
+// decoded checkpoint, the table stores them as varint deltas from the previous one
 typedef struct
 {
 	int y_pos; // Vertical pixel coordinate at line start
-	const char* src_ptr; // Pointer into source buffer at this line
+	int src_offset; // Byte offset into the source buffer at this line
 } TeX_Checkpoint;
 
+// every TEX_CHECKPOINT_ANCHOR_EVERY-th entry is also kept whole, a lookup binary searches these and
+// decodes fewer than TEX_CHECKPOINT_ANCHOR_EVERY deltas after one
+#define TEX_CHECKPOINT_ANCHOR_EVERY 16
+typedef struct
+{
+	TeX_Checkpoint at; // the entry
+	int byte; // table offset just past it
+} TexCheckpointAnchor;
+
 // ==================================
 // Layout Structure
 // ==================================
@@ -284,26 +341,63 @@ typedef struct TeX_Layout
 		const char* pack;
 		TeX_ErrorLogFn error_callback;
 		void* error_userdata;
+		const char* outline_marker;
+		int parse_stack_frames;
 	} cfg;
 
 	int width;
 	int total_height;
 
-	// source buffer pointer (immutable after format)
+	// source buffer pointer (immutable after format, replaced by tex_append)
 	const char* source;
+	int source_len;
+
+	// block compressed source (tex_format_packed), source is NULL and blocks are decompressed on demand
+	TeX_PackedSource packed;
+
+	// start of the last line that later input cannot change, tex_append resumes here
+	int resume_offset;
+	int resume_y;
 
-	TeX_Checkpoint* checkpoints;
+	// unique per formatted content, renderers key their cached windows on it
+	unsigned revision;
+
+	// checkpoint table: (y, source offset) pairs as varint deltas from the previous entry
+	uint8_t* checkpoints;
+	int checkpoint_bytes; // used
+	int checkpoint_capacity; // allocated
 	int checkpoint_count;
-	int checkpoint_capacity;
+	TeX_Checkpoint checkpoint_last; // last entry, base of the next delta ({0, 0} when empty)
+	TexCheckpointAnchor* checkpoint_anchors; // one per TEX_CHECKPOINT_ANCHOR_EVERY entries, first entry first
+	int checkpoint_anchor_capacity; // allocated
+
+	// headings found by the dry run (cfg.outline_marker), in source order
+	TeX_Checkpoint* outline;
+	int outline_count;
+	int outline_capacity;
+
+	// the layout and everything it owns come from this allocator (TeX_Config.allocator at creation)
+	const TeX_Allocator* allocator;
+
+	// in-progress dry run (tex_format_begin/step), NULL once formatting is complete
+	struct TexFormatJob* job;
 
 	// Error state
 	TexErrorState error;
+	int error_offset; // source offset of the token the dry run raised the error at, -1 if raised elsewhere
+
+	// scratch size the dry run could grow to (a formatter's max_scratch), position lookups grow as far
+	size_t max_scratch;
 
 #if TEX_DEBUG
 	unsigned debug_flags;
 #endif
 } TeX_Layout;
 
+// last checkpoint at or above y (index, -1 and {0, 0} if none) and the entry after it
+// (next is {total_height, source_len} when there is none)
+int tex_checkpoint_find(const TeX_Layout* L, int y, TeX_Checkpoint* at, TeX_Checkpoint* next);
+
 
 // =======================================
 // debug / recorder mode structures
@@ -315,7 +409,8 @@ typedef enum
 	DOP_RULE,
 	DOP_LINE,
 	DOP_DOT,
-	DOP_ELLIPSE
+	DOP_ELLIPSE,
+	DOP_SPRITE // rasterized stretchy delimiter (x1, y1, w, h)
 } TexDrawOpType;
 
 typedef struct
@@ -329,7 +424,17 @@ typedef struct
 	int role;
 } TexDrawOp;
 
-// recorder functions (nops in direct mode)
+// drawn ops are logged for host tests, off on device (a static log of TEX_DRAW_LOG_CAP ops)
+#ifndef TEX_DRAW_LOG
+#if defined(__TICE__)
+#define TEX_DRAW_LOG 0
+#else
+#define TEX_DRAW_LOG 1
+#endif
+#endif
+#define TEX_DRAW_LOG_CAP 1024
+
+// log of the ops drawn since the last reset, in screen coordinates (nops when TEX_DRAW_LOG is 0)
 void tex_draw_log_reset(void);
 int tex_draw_log_count(void);
 int tex_draw_log_get(TexDrawOp* out, int max);
@@ -375,6 +480,10 @@ int tex_draw_log_get_range(TexDrawOp* out, int start_index, int count);
 		}                                                                                                              \
 	}                                                                                                                  \
 	while (0)
+
+// report the layout's error, for one raised while the callback was held back
+#define TEX_REPORT_ERROR(layout)                                                                                       \
+	TEX_INVOKE_CALLBACK_((layout), 2, (layout)->error.msg, (layout)->error.file, (layout)->error.line)
 #else
 #define TEX_SET_ERROR(layout, ecode, emsg, eval)                                                                       \
 	do                                                                                                                 \
@@ -398,6 +507,8 @@ int tex_draw_log_get_range(TexDrawOp* out, int start_index, int count);
 		}                                                                                                              \
 	}                                                                                                                  \
 	while (0)
+
+#define TEX_REPORT_ERROR(layout) TEX_INVOKE_CALLBACK_((layout), 2, (layout)->error.msg, NULL, 0)
 #endif
 
 #define TEX_HAS_ERROR(layout) ((layout) && (layout)->error.code != TEX_OK)
@@ -1,4 +1,4 @@
-#include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 
 #if defined(__TICE__)
@@ -6,6 +6,7 @@
 #endif
 
 #include "tex.h"
+#include "tex_alloc.h"
 #include "tex_internal.h"
 #include "tex_measure.h"
 #include "tex_metrics.h"
@@ -18,34 +19,229 @@
 #else
 #define TEX_LAYOUT_SCRATCH_SIZE ((size_t)8 * 1024)
 #endif
+// pool offsets are 16 bit, a larger scratch pool could not be addressed
+#define TEX_LAYOUT_SCRATCH_LIMIT ((size_t)0xFFFF)
+
+// source of layout revisions, so a freed and reallocated layout never matches a stale renderer window
+static unsigned g_layout_revision = 0;
 
 typedef struct
 {
 	TeX_Layout* L;
-	UnifiedPool scratch; // temporary pool for measuring math blocks
+	UnifiedPool* scratch; // temporary pool for measuring math blocks (the job's own or a formatter's)
 	int x_cursor;
 	int line_asc;
 	int line_desc;
 	int pending_space;
-	const char* stream_cursor;
+	int tok_start; // source offset of the current token
+	int tok_end; // source offset just past the current token
+	int tok_final; // current token cannot change when more input is appended
+	int provisional; // an unclosed '$' was seen, nothing after it is final
 	int last_checkpoint_y;
+	int cost; // replay cost (source bytes and weighted math nodes) since the last checkpoint
 	int has_content;
 	int width;
+	int para_start; // the next token starts a paragraph
+	int line_start; // source offset of the open line
+	struct TexLineProbe* probe; // replaying for a position lookup, the layout is a throwaway copy
 } DryRunState;
 
-static void maybe_record_checkpoint(DryRunState* S)
+// position lookup: replay stops at the line covering target_y, or target_offset when target_y < 0
+typedef struct TexLineProbe
+{
+	int target_y;
+	int target_offset;
+	TeX_Checkpoint line; // top y and start offset of the matching line (the last line while not found)
+	int found;
+} TexLineProbe;
+
+// -------------------------
+// Checkpoint table
+// -------------------------
+
+// worst case bytes of one entry: two varints of up to 5 bytes
+#define TEX_CHECKPOINT_MAX_ENTRY 10
+
+static int varint_put(uint8_t* p, unsigned v)
+{
+	int n = 0;
+	while (v >= 0x80)
+	{
+		p[n++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (uint8_t)v;
+	return n;
+}
+
+static unsigned varint_get(const uint8_t** p)
+{
+	unsigned v = 0;
+	int shift = 0;
+	uint8_t b;
+	do
+	{
+		b = *(*p)++;
+		v |= (unsigned)(b & 0x7F) << shift;
+		shift += 7;
+	}
+	while (b & 0x80);
+	return v;
+}
+
+// decode the entry at *p on top of cp
+static void checkpoint_next(const uint8_t** p, TeX_Checkpoint* cp)
+{
+	cp->y_pos += (int)varint_get(p);
+	cp->src_offset += (int)varint_get(p);
+}
+
+// last anchor whose y (src_offset when by_offset) is at or before key: *cur is its entry and *p the delta after
+// it. returns the entry index, -1 with {0, 0} and the table start when the first entry is past key
+static int checkpoint_seek(const TeX_Layout* L, int by_offset, int key, const uint8_t** p, TeX_Checkpoint* cur)
+{
+	int lo = 0;
+	int hi = (L->checkpoint_count + TEX_CHECKPOINT_ANCHOR_EVERY - 1) / TEX_CHECKPOINT_ANCHOR_EVERY - 1;
+	int found = -1;
+	while (lo <= hi)
+	{
+		int mid = (lo + hi) / 2;
+		const TeX_Checkpoint* a = &L->checkpoint_anchors[mid].at;
+		if ((by_offset ? a->src_offset : a->y_pos) <= key)
+		{
+			found = mid;
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid - 1;
+		}
+	}
+
+	if (found < 0)
+	{
+		*p = L->checkpoints;
+		cur->y_pos = 0;
+		cur->src_offset = 0;
+		return -1;
+	}
+	*p = L->checkpoints + L->checkpoint_anchors[found].byte;
+	*cur = L->checkpoint_anchors[found].at;
+	return found * TEX_CHECKPOINT_ANCHOR_EVERY;
+}
+
+int tex_checkpoint_find(const TeX_Layout* L, int y, TeX_Checkpoint* at, TeX_Checkpoint* next)
+{
+	TeX_Checkpoint cur;
+	const uint8_t* p;
+	int index = checkpoint_seek(L, 0, y, &p, &cur);
+	const uint8_t* end = L->checkpoints + L->checkpoint_bytes;
+
+	TeX_Checkpoint prev = cur;
+	while (p < end)
+	{
+		checkpoint_next(&p, &cur);
+		if (cur.y_pos > y)
+			break;
+		prev = cur;
+		index++;
+	}
+
+	if (at)
+		*at = prev;
+	if (next)
+	{
+		if (index + 1 < L->checkpoint_count)
+			*next = cur;
+		else
+		{
+			next->y_pos = L->total_height;
+			next->src_offset = L->source_len;
+		}
+	}
+	return index;
+}
+
+// drop every checkpoint further down than max_y
+static void checkpoints_truncate(TeX_Layout* L, int max_y)
+{
+	TeX_Checkpoint cur;
+	const uint8_t* p;
+	int count = checkpoint_seek(L, 0, max_y, &p, &cur) + 1;
+	TeX_Checkpoint kept = cur;
+	const uint8_t* end = L->checkpoints + L->checkpoint_bytes;
+	int bytes = (int)(p - L->checkpoints);
+	while (p < end)
+	{
+		checkpoint_next(&p, &cur);
+		if (cur.y_pos > max_y)
+			break;
+		kept = cur;
+		count++;
+		bytes = (int)(p - L->checkpoints);
+	}
+	L->checkpoint_count = count;
+	L->checkpoint_bytes = bytes;
+	L->checkpoint_last = kept;
+}
+
+// release the unused tail of the table and its anchors once formatting is done
+static void checkpoints_shrink(TeX_Layout* L)
+{
+	int anchors = (L->checkpoint_count + TEX_CHECKPOINT_ANCHOR_EVERY - 1) / TEX_CHECKPOINT_ANCHOR_EVERY;
+	if (anchors == 0)
+	{
+		tex_mem_free(L->allocator, L->checkpoint_anchors,
+		             (size_t)L->checkpoint_anchor_capacity * sizeof(TexCheckpointAnchor));
+		L->checkpoint_anchors = NULL;
+		L->checkpoint_anchor_capacity = 0;
+	}
+	else if (anchors < L->checkpoint_anchor_capacity)
+	{
+		TexCheckpointAnchor* shrunk = (TexCheckpointAnchor*)tex_mem_realloc(
+		    L->allocator, L->checkpoint_anchors, (size_t)L->checkpoint_anchor_capacity * sizeof(TexCheckpointAnchor),
+		    (size_t)anchors * sizeof(TexCheckpointAnchor));
+		if (shrunk)
+		{
+			L->checkpoint_anchors = shrunk;
+			L->checkpoint_anchor_capacity = anchors;
+		}
+	}
+
+	if (L->checkpoint_capacity <= L->checkpoint_bytes)
+		return;
+
+	if (L->checkpoint_bytes == 0)
+	{
+		tex_mem_free(L->allocator, L->checkpoints, (size_t)L->checkpoint_capacity);
+		L->checkpoints = NULL;
+		L->checkpoint_capacity = 0;
+		return;
+	}
+
+	uint8_t* shrunk = (uint8_t*)tex_mem_realloc(L->allocator, L->checkpoints, (size_t)L->checkpoint_capacity,
+	                                            (size_t)L->checkpoint_bytes);
+	if (shrunk)
+	{
+		L->checkpoints = shrunk;
+		L->checkpoint_capacity = L->checkpoint_bytes;
+	}
+}
+
+static void maybe_record_checkpoint(DryRunState* S, int next_offset)
 {
 	TeX_Layout* L = S->L;
 	if (!L)
 		return;
 
-	if (L->total_height - S->last_checkpoint_y < TEX_CHECKPOINT_INTERVAL)
+	if (L->total_height - S->last_checkpoint_y < TEX_CHECKPOINT_INTERVAL && S->cost < TEX_CHECKPOINT_COST)
 		return;
 
-	if (L->checkpoint_count >= L->checkpoint_capacity)
+	if (L->checkpoint_bytes + TEX_CHECKPOINT_MAX_ENTRY > L->checkpoint_capacity)
 	{
-		int new_cap = L->checkpoint_capacity ? L->checkpoint_capacity * 2 : 8;
-		TeX_Checkpoint* new_arr = (TeX_Checkpoint*)realloc(L->checkpoints, (size_t)new_cap * sizeof(TeX_Checkpoint));
+		int new_cap = L->checkpoint_capacity ? L->checkpoint_capacity * 2 : 32;
+		uint8_t* new_arr = (uint8_t*)tex_mem_realloc(L->allocator, L->checkpoints, (size_t)L->checkpoint_capacity,
+		                                             (size_t)new_cap);
 		if (!new_arr)
 		{
 			TEX_SET_ERROR(L, TEX_ERR_OOM, "Failed to grow checkpoint array", new_cap);
@@ -55,13 +251,42 @@ static void maybe_record_checkpoint(DryRunState* S)
 		L->checkpoint_capacity = new_cap;
 	}
 
-	L->checkpoints[L->checkpoint_count].y_pos = L->total_height;
-	L->checkpoints[L->checkpoint_count].src_ptr = S->stream_cursor;
+	int index = L->checkpoint_count;
+	int anchor = index / TEX_CHECKPOINT_ANCHOR_EVERY;
+	if (index % TEX_CHECKPOINT_ANCHOR_EVERY == 0 && anchor >= L->checkpoint_anchor_capacity)
+	{
+		int new_cap = L->checkpoint_anchor_capacity ? L->checkpoint_anchor_capacity * 2 : 4;
+		TexCheckpointAnchor* new_arr = (TexCheckpointAnchor*)tex_mem_realloc(
+		    L->allocator, L->checkpoint_anchors, (size_t)L->checkpoint_anchor_capacity * sizeof(TexCheckpointAnchor),
+		    (size_t)new_cap * sizeof(TexCheckpointAnchor));
+		if (!new_arr)
+		{
+			TEX_SET_ERROR(L, TEX_ERR_OOM, "Failed to grow checkpoint anchors", new_cap);
+			return;
+		}
+		L->checkpoint_anchors = new_arr;
+		L->checkpoint_anchor_capacity = new_cap;
+	}
+
+	uint8_t* p = L->checkpoints + L->checkpoint_bytes;
+	p += varint_put(p, (unsigned)(L->total_height - L->checkpoint_last.y_pos));
+	p += varint_put(p, (unsigned)(next_offset - L->checkpoint_last.src_offset));
+	L->checkpoint_bytes = (int)(p - L->checkpoints);
+	L->checkpoint_last.y_pos = L->total_height;
+	L->checkpoint_last.src_offset = next_offset;
 	L->checkpoint_count++;
+	if (index % TEX_CHECKPOINT_ANCHOR_EVERY == 0)
+	{
+		L->checkpoint_anchors[anchor].at = L->checkpoint_last;
+		L->checkpoint_anchors[anchor].byte = L->checkpoint_bytes;
+	}
 	S->last_checkpoint_y = L->total_height;
+	S->cost = 0;
 }
 
-static void finalize_line(DryRunState* S)
+// next_offset is where the following line starts: replaying from there with an empty line
+// reproduces the same layout (the wrapping token itself, or just past a newline/display block)
+static void finalize_line(DryRunState* S, int next_offset)
 {
 	if (!S->has_content && S->line_asc == 0 && S->line_desc == 0)
 		return;
@@ -86,7 +311,29 @@ static void finalize_line(DryRunState* S)
 	S->pending_space = 0;
 	S->has_content = 0;
 
-	maybe_record_checkpoint(S);
+	if (S->probe)
+	{
+		TexLineProbe* probe = S->probe;
+		if (!probe->found)
+		{
+			probe->line.y_pos = S->L->total_height - h;
+			probe->line.src_offset = S->line_start;
+			probe->found = (probe->target_y >= 0) ? (probe->target_y < S->L->total_height)
+			                                      : (probe->target_offset < next_offset);
+		}
+		S->line_start = next_offset;
+		return;
+	}
+	S->line_start = next_offset;
+
+	maybe_record_checkpoint(S, next_offset);
+
+	// lines ended by a token that appended input could still change stay open for tex_append
+	if (S->tok_final && !S->provisional)
+	{
+		S->L->resume_offset = next_offset;
+		S->L->resume_y = S->L->total_height;
+	}
 }
 
 // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
@@ -100,176 +347,700 @@ static void add_content(DryRunState* S, int w, int asc, int desc)
 
 static int check_wrap(DryRunState* S, int w) { return (S->x_cursor + w > S->width) && S->has_content; }
 
+// index a paragraph whose first token starts with the outline marker
+static void maybe_record_heading(DryRunState* S, const char* tok_begin, const char* end)
+{
+	TeX_Layout* L = S->L;
+	const char* marker = L->cfg.outline_marker;
+	size_t len = marker ? strlen(marker) : 0;
+	if (len == 0 || (size_t)(end - tok_begin) < len || memcmp(tok_begin, marker, len) != 0)
+		return;
+
+	if (L->outline_count >= L->outline_capacity)
+	{
+		int new_cap = L->outline_capacity ? L->outline_capacity * 2 : 8;
+		TeX_Checkpoint* new_arr = (TeX_Checkpoint*)tex_mem_realloc(
+		    L->allocator, L->outline, (size_t)L->outline_capacity * sizeof(TeX_Checkpoint),
+		    (size_t)new_cap * sizeof(TeX_Checkpoint));
+		if (!new_arr)
+		{
+			TEX_SET_ERROR(L, TEX_ERR_OOM, "Failed to grow outline index", new_cap);
+			return;
+		}
+		L->outline = new_arr;
+		L->outline_capacity = new_cap;
+	}
+
+	// a paragraph always opens a fresh line
+	L->outline[L->outline_count].y_pos = L->total_height;
+	L->outline[L->outline_count].src_offset = S->tok_start;
+	L->outline_count++;
+}
+
 // -------------------------
 // Core formatting
 // -------------------------
 
-TeX_Layout* tex_format(char* input, int width, TeX_Config* config)
+// reusable scratch memory, lent to one dry run at a time
+struct TeX_Formatter
 {
-	if (!input || width <= 0 || !config)
-		return NULL;
+	const TeX_Allocator* allocator;
+	UnifiedPool scratch;
+	size_t max_scratch; // the scratch pool may grow up to this size when a formula does not fit
+	char* block_buf; // packed sources: block buffer lent to position lookups, grown to the largest block
+	size_t block_buf_size;
+};
 
-	TeX_Layout* L = (TeX_Layout*)calloc(1, sizeof(TeX_Layout));
-	if (!L) {
+// in-progress dry run, owned by the layout until the stream is exhausted
+typedef struct TexFormatJob
+{
+	DryRunState st;
+	TeX_Stream stream;
+	const char* base; // text that source offset base_offset maps to
+	int base_offset;
+	char* block_buf; // packed sources: the block being measured
+	int next_block;
+	size_t block_buf_size;
+	uint8_t lent_block_buf; // block_buf belongs to a formatter
+	UnifiedPool own_scratch; // used when no formatter lends its pool
+	size_t max_scratch;
+	const TeX_Allocator* allocator; // the layout's
+} TexFormatJob;
+
+static void job_free(TexFormatJob* job)
+{
+	if (!job)
+		return;
+	pool_free(&job->own_scratch);
+	if (!job->lent_block_buf)
+		tex_mem_free(job->allocator, job->block_buf, job->block_buf_size);
+	tex_mem_free(job->allocator, job, sizeof(TexFormatJob));
+}
+
+// swap the scratch pool for a larger one, its contents are discarded. returns 0 when it cannot grow
+static int scratch_grow(TexFormatJob* job)
+{
+	UnifiedPool* pool = job->st.scratch;
+	size_t size = TEX_MIN(pool->capacity * 2, job->max_scratch);
+	UnifiedPool bigger;
+	if (size <= pool->capacity || pool_init_alloc(&bigger, size, pool->allocator) != 0)
+		return 0;
+
+	pool_free(pool);
+	*pool = bigger;
+	return 1;
+}
+
+// parse and measure one formula, retrying with a larger scratch pool when it does not fit
+// the error callback is held back during the parse, an OOM that a retry fixes is never reported
+static Node* measure_math(DryRunState* S, const TeX_Token* t, int display)
+{
+	int had_error = TEX_HAS_ERROR(S->L);
+	for (;;)
+	{
+		int nodes = 0;
+		TeX_ErrorLogFn callback = S->L->cfg.error_callback;
+		S->L->cfg.error_callback = NULL;
+		NodeRef ref = tex_parse_math_size(t->start, t->len, S->scratch, S->L, &nodes);
+		S->L->cfg.error_callback = callback;
+		if (!had_error && S->L->error.code == TEX_ERR_OOM)
+		{
+			TEX_CLEAR_ERROR(S->L);
+			pool_reset(S->scratch);
+			if (scratch_grow(S->L->job))
+				continue;
+			TEX_SET_ERROR(S->L, TEX_ERR_OOM, "Formula does not fit in the scratch pool", S->tok_start);
+			return NULL;
+		}
+		if (!had_error && TEX_HAS_ERROR(S->L))
+			TEX_REPORT_ERROR(S->L);
+		if (ref == NODE_NULL)
+			return NULL;
+
+		Node* n = pool_get_node(S->scratch, ref);
+		if (display)
+			n->flags |= TEX_FLAG_MATHF_DISPLAY;
+		else
+			n->flags &= (uint8_t)~TEX_FLAG_MATHF_DISPLAY;
+		S->cost += nodes * TEX_CHECKPOINT_NODE_COST;
+		return n;
+	}
+}
+
+static int job_has_more_blocks(const TexFormatJob* job, const TeX_Layout* L)
+{
+	return L->packed.data && job->next_block < L->packed.block_count;
+}
+
+// packed sources are measured one block at a time, blocks never split a token
+static int format_next_block(TeX_Layout* L)
+{
+	TexFormatJob* job = L->job;
+	if (!job_has_more_blocks(job, L))
+		return 0;
+
+	int n = tex_source_decode(&L->packed, job->next_block, job->block_buf);
+	if (n < 0)
+	{
+		TEX_SET_ERROR(L, TEX_ERR_INPUT, "Corrupt packed source block", job->next_block);
+		return 0;
+	}
+	job->base = job->block_buf;
+	job->base_offset = tex_source_block_start(&L->packed, job->next_block);
+	job->next_block++;
+	tex_stream_init(&job->stream, job->block_buf, n);
+	return 1;
+}
+
+static void format_token(DryRunState* S, const TeX_Token* t)
+{
+	switch (t->type)
+	{
+	case T_NEWLINE:
+		// For blank lines (no content), set default font height before finalize
+		if (!S->has_content && S->line_asc == 0 && S->line_desc == 0)
+		{
+			S->line_asc = tex_metrics_asc(FONTROLE_MAIN);
+			S->line_desc = tex_metrics_desc(FONTROLE_MAIN);
+		}
+		finalize_line(S, S->tok_end);
+		pool_reset(S->scratch);
+		break;
+
+	case T_SPACE:
+		S->pending_space = 1;
+		pool_reset(S->scratch);
+		break;
+
+	case T_TEXT:
+		{
+			int text_w = tex_metrics_text_width_n(t->start, t->len, FONTROLE_MAIN);
+			int text_asc = tex_metrics_asc(FONTROLE_MAIN);
+			int text_desc = tex_metrics_desc(FONTROLE_MAIN);
+
+			if (S->pending_space && S->has_content)
+			{
+				int space_w = tex_metrics_text_width_n(" ", 1, FONTROLE_MAIN);
+				if (check_wrap(S, space_w + text_w))
+				{
+					finalize_line(S, S->tok_start);
+				}
+				else
+				{
+					add_content(S, space_w, text_asc, text_desc);
+				}
+			}
+			S->pending_space = 0;
+
+			if (check_wrap(S, text_w))
+			{
+				finalize_line(S, S->tok_start);
+			}
+			add_content(S, text_w, text_asc, text_desc);
+		}
+
+		pool_reset(S->scratch);
+		break;
+
+	case T_MATH_INLINE:
+		{
+			Node* n = measure_math(S, t, 0);
+			if (n)
+			{
+				if (S->pending_space && S->has_content)
+				{
+					int space_w = tex_metrics_text_width_n(" ", 1, FONTROLE_MAIN);
+					if (check_wrap(S, space_w + n->w))
+					{
+						finalize_line(S, S->tok_start);
+					}
+					else
+					{
+						add_content(S, space_w, n->asc, n->desc);
+					}
+				}
+				S->pending_space = 0;
+
+				if (check_wrap(S, n->w))
+				{
+					finalize_line(S, S->tok_start);
+				}
+				add_content(S, n->w, n->asc, n->desc);
+			}
+			pool_reset(S->scratch);
+		}
+		break;
+
+	case T_MATH_DISPLAY:
+		{
+			finalize_line(S, S->tok_start);
+
+			Node* n = measure_math(S, t, 1);
+			if (n)
+			{
+				add_content(S, n->w, n->asc, n->desc);
+				finalize_line(S, S->tok_end);
+			}
+			pool_reset(S->scratch);
+		}
+		break;
+
+	case T_EOF:
+		break;
+	}
+}
+
+static void format_finish(TeX_Layout* L)
+{
+	TexFormatJob* job = L->job;
+	// the last line stays open for tex_append
+	job->st.tok_final = 0;
+	finalize_line(&job->st, L->source_len);
+	job_free(job);
+	L->job = NULL;
+	checkpoints_shrink(L);
+}
+
+// start a dry run at the resume point, dropping everything measured after it
+// a formatter lends its scratch pool, the job must then finish before the formatter is used again
+static int format_resume(TeX_Layout* L, TeX_Formatter* f)
+{
+	TexFormatJob* job = L->job;
+	if (!job)
+	{
+		job = (TexFormatJob*)tex_mem_calloc(L->allocator, sizeof(TexFormatJob));
+		if (job)
+			job->allocator = L->allocator;
+		if (job && f)
+		{
+			job->st.scratch = &f->scratch;
+			job->max_scratch = f->max_scratch;
+			L->max_scratch = f->max_scratch;
+		}
+		else if (job && pool_init_alloc(&job->own_scratch, TEX_LAYOUT_SCRATCH_SIZE, L->allocator) == 0)
+		{
+			// grows like the scratch the layout was last formatted in
+			job->st.scratch = &job->own_scratch;
+			job->max_scratch = L->max_scratch;
+		}
+		if (!job || !job->st.scratch)
+		{
+			TEX_SET_ERROR(L, TEX_ERR_OOM, "Failed to initialize scratch pool", 0);
 #if defined(__TICE__)
-		dbg_printf("[tex] tex_format OOM calloc(layout)\n");
+			dbg_printf("[tex] tex_format OOM pool_init(scratch,%u)\n", (unsigned)TEX_LAYOUT_SCRATCH_SIZE);
 #endif
-		return NULL;
+			tex_mem_free(L->allocator, job, sizeof(TexFormatJob));
+			return -1;
+		}
+		if (L->packed.data && f)
+		{
+			size_t need = (size_t)L->packed.max_block + 1;
+			if (f->block_buf_size < need)
+			{
+				tex_mem_free(f->allocator, f->block_buf, f->block_buf_size);
+				f->block_buf = (char*)tex_mem_alloc(f->allocator, need);
+				f->block_buf_size = f->block_buf ? need : 0;
+			}
+			job->block_buf = f->block_buf;
+			job->block_buf_size = f->block_buf_size;
+			job->lent_block_buf = 1;
+		}
+		else if (L->packed.data)
+		{
+			job->block_buf_size = (size_t)L->packed.max_block + 1;
+			job->block_buf = (char*)tex_mem_alloc(L->allocator, job->block_buf_size);
+		}
+		if (L->packed.data)
+		{
+			if (!job->block_buf)
+			{
+				TEX_SET_ERROR(L, TEX_ERR_OOM, "Failed to allocate source block buffer", L->packed.max_block);
+				job_free(job);
+				return -1;
+			}
+		}
+		L->job = job;
+	}
+
+	UnifiedPool* scratch = job->st.scratch;
+	memset(&job->st, 0, sizeof(job->st));
+	job->st.scratch = scratch;
+	pool_reset(job->st.scratch);
+	job->st.L = L;
+	job->st.width = L->width;
+
+	L->total_height = L->resume_y;
+	checkpoints_truncate(L, L->resume_y);
+	job->st.last_checkpoint_y = L->checkpoint_last.y_pos;
+	job->st.line_start = L->resume_offset;
+	job->st.para_start = L->resume_offset == 0 || (L->source && L->source[L->resume_offset - 1] == '\n');
+	while (L->outline_count > 0 && L->outline[L->outline_count - 1].src_offset >= L->resume_offset)
+		L->outline_count--;
+
+	if (L->packed.data)
+	{
+		// decompress the block holding the resume point, from the start the first step does it
+		job->next_block = tex_source_block_at(&L->packed, L->resume_offset);
+		tex_stream_init(&job->stream, job->block_buf, 0);
+		if (L->resume_offset > 0 && format_next_block(L))
+		{
+			int skip = L->resume_offset - job->base_offset;
+			tex_stream_init(&job->stream, job->block_buf + skip, (int)(job->stream.end - job->block_buf) - skip);
+		}
+		return 0;
 	}
 
+	job->base = L->source;
+	job->base_offset = 0;
+	tex_stream_init(&job->stream, L->source + L->resume_offset, L->source_len - L->resume_offset);
+	return 0;
+}
+
+// (re)initialize everything but the checkpoint storage, which is kept for reuse
+static void layout_configure(TeX_Layout* L, int width, const TeX_Config* config)
+{
 	L->cfg.fg = config->color_fg;
 	L->cfg.bg = config->color_bg;
 	L->cfg.pack = config->font_pack;
 	L->cfg.error_callback = config->error_callback;
 	L->cfg.error_userdata = config->error_userdata;
+	L->cfg.outline_marker = config->outline_marker;
+	L->cfg.parse_stack_frames = config->parse_stack_frames;
 	memset(&L->error, 0, sizeof(L->error));
+	L->error_offset = -1;
+	L->max_scratch = TEX_LAYOUT_SCRATCH_SIZE;
 	L->width = width;
 	L->total_height = 0;
-	L->source = input;
-	L->checkpoints = NULL;
+	L->resume_offset = 0;
+	L->resume_y = 0;
+	L->revision = ++g_layout_revision;
 	L->checkpoint_count = 0;
-	L->checkpoint_capacity = 0;
+	L->checkpoint_bytes = 0;
+	L->checkpoint_last.y_pos = 0;
+	L->checkpoint_last.src_offset = 0;
+	L->outline_count = 0;
+	memset(&L->packed, 0, sizeof(L->packed));
 
 #if defined(TEX_DEBUG) && TEX_DEBUG
 	L->debug_flags = 0u;
 #endif
+}
 
-	tex_metrics_init(L);
+static TeX_Layout* layout_create(int width, const TeX_Config* config)
+{
+	TeX_Layout* L = (TeX_Layout*)tex_mem_calloc(config->allocator, sizeof(TeX_Layout));
+	if (!L) {
+#if defined(__TICE__)
+		dbg_printf("[tex] tex_format OOM calloc(layout)\n");
+#endif
+		return NULL;
+	}
 
-	DryRunState st;
-	memset(&st, 0, sizeof(st));
-	st.L = L;
-	st.width = width;
-	st.stream_cursor = input;
+	L->allocator = config->allocator;
+	layout_configure(L, width, config);
+	return L;
+}
 
-	if (pool_init(&st.scratch, TEX_LAYOUT_SCRATCH_SIZE) != 0)
+static TeX_Layout* layout_start(TeX_Layout* L, TeX_Formatter* f)
+{
+	tex_metrics_init(L);
+
+	if (format_resume(L, f) != 0)
 	{
-		TEX_SET_ERROR(L, TEX_ERR_OOM, "Failed to initialize scratch pool", 0);
-#if defined(__TICE__)
-		dbg_printf("[tex] tex_format OOM pool_init(scratch,%u)\n", (unsigned)TEX_LAYOUT_SCRATCH_SIZE);
-#endif
-		free(L);
+		tex_mem_free(L->allocator, L, sizeof(TeX_Layout));
 		return NULL;
 	}
 
-	TeX_Stream stream;
-	tex_stream_init(&stream, input, -1);
+	return L;
+}
 
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+TeX_Layout* tex_format_begin(const char* input, int len, int width, const TeX_Config* config)
+{
+	if (!input || width <= 0 || !config)
+		return NULL;
+
+	TeX_Layout* L = layout_create(width, config);
+	if (!L)
+		return NULL;
+
+	// the source is only ever read, it may point straight into an archived variable
+	L->source = input;
+	L->source_len = len < 0 ? (int)strlen(input) : len;
+	return layout_start(L, NULL);
+}
+
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+TeX_Layout* tex_format_packed(const void* data, int size, int width, const TeX_Config* config)
+{
+	TeX_PackedSource packed;
+	if (!data || width <= 0 || !config || tex_source_open(&packed, (const uint8_t*)data, size) != 0)
+		return NULL;
+
+	TeX_Layout* L = layout_create(width, config);
+	if (!L)
+		return NULL;
+
+	L->source = NULL;
+	L->source_len = packed.raw_len;
+	L->packed = packed;
+	return tex_format_end(layout_start(L, NULL));
+}
+
+int tex_format_step(TeX_Layout* layout, int budget)
+{
+	if (!layout || !layout->job)
+		return 0;
+
+	TexFormatJob* job = layout->job;
+	DryRunState* S = &job->st;
 	TeX_Token t;
-	while (tex_stream_next(&stream, &t, &st.scratch, L))
+	for (int i = 0; i < budget; i++)
 	{
-		st.stream_cursor = stream.cursor;
-
-		switch (t.type)
+		int had_error = TEX_HAS_ERROR(layout);
+		const char* tok_begin = job->stream.cursor;
+		if (!tex_stream_next(&job->stream, &t, S->scratch, layout))
 		{
-		case T_NEWLINE:
-			// For blank lines (no content), set default font height before finalize
-			if (!st.has_content && st.line_asc == 0 && st.line_desc == 0)
-			{
-				st.line_asc = tex_metrics_asc(FONTROLE_MAIN);
-				st.line_desc = tex_metrics_desc(FONTROLE_MAIN);
-			}
-			finalize_line(&st);
-			pool_reset(&st.scratch);
-			break;
+			if (job->stream.cursor >= job->stream.end && format_next_block(layout))
+				continue;
+			format_finish(layout);
+			return 0;
+		}
+		S->tok_start = job->base_offset + (int)(tok_begin - job->base);
+		S->tok_end = job->base_offset + (int)(job->stream.cursor - job->base);
+		S->cost += S->tok_end - S->tok_start;
+		if (S->para_start && t.type != T_NEWLINE && !S->probe)
+			maybe_record_heading(S, tok_begin, job->stream.end);
+		S->para_start = t.type == T_NEWLINE;
+		if (t.aux & TEX_TOKEN_AUX_UNCLOSED_MATH)
+			S->provisional = 1;
+		// a text or space run reaching the end of input may still grow
+		S->tok_final = t.type == T_NEWLINE || t.type == T_MATH_DISPLAY || t.type == T_MATH_INLINE ||
+		               job->stream.cursor < job->stream.end || job_has_more_blocks(job, layout);
+		format_token(S, &t);
+		if (!had_error && TEX_HAS_ERROR(layout))
+			layout->error_offset = S->tok_start;
+	}
 
-		case T_SPACE:
-			st.pending_space = 1;
-			pool_reset(&st.scratch);
-			break;
+	return 1;
+}
 
-		case T_TEXT:
-			{
-				int text_w = tex_metrics_text_width_n(t.start, t.len, FONTROLE_MAIN);
-				int text_asc = tex_metrics_asc(FONTROLE_MAIN);
-				int text_desc = tex_metrics_desc(FONTROLE_MAIN);
+TeX_Layout* tex_format_end(TeX_Layout* layout)
+{
+	while (tex_format_step(layout, INT_MAX))
+	{
+	}
+	return layout;
+}
 
-				if (st.pending_space && st.has_content)
-				{
-					int space_w = tex_metrics_text_width_n(" ", 1, FONTROLE_MAIN);
-					if (check_wrap(&st, space_w + text_w))
-					{
-						finalize_line(&st);
-					}
-					else
-					{
-						add_content(&st, space_w, text_asc, text_desc);
-					}
-				}
-				st.pending_space = 0;
+TeX_Layout* tex_format(const char* input, int width, const TeX_Config* config)
+{
+	return tex_format_end(tex_format_begin(input, -1, width, config));
+}
 
-				if (check_wrap(&st, text_w))
-				{
-					finalize_line(&st);
-				}
-				add_content(&st, text_w, text_asc, text_desc);
-			}
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+TeX_Layout* tex_format_n(const char* input, int len, int width, const TeX_Config* config)
+{
+	return tex_format_end(tex_format_begin(input, len, width, config));
+}
 
-			pool_reset(&st.scratch);
-			break;
+int tex_append(TeX_Layout* layout, const char* source, int len)
+{
+	if (!layout || !source)
+		return -1;
 
-		case T_MATH_INLINE:
-			{
-				NodeRef start_node = (NodeRef)st.scratch.node_count;
-				NodeRef ref = tex_parse_math(t.start, t.len, &st.scratch, L);
-				if (ref != NODE_NULL)
-				{
-					Node* n = pool_get_node(&st.scratch, ref);
-					n->flags &= (uint8_t)~TEX_FLAG_MATHF_DISPLAY;
-					tex_measure_range(&st.scratch, start_node, (NodeRef)st.scratch.node_count);
+	if (layout->packed.data)
+	{
+		TEX_SET_ERROR(layout, TEX_ERR_INPUT, "Packed layouts cannot be appended to", 0);
+		return -1;
+	}
+	if (len < 0)
+		len = (int)strlen(source);
+	if (len < layout->resume_offset)
+	{
+		TEX_SET_ERROR(layout, TEX_ERR_INPUT, "Appended source is shorter than the formatted text", len);
+		return -1;
+	}
 
-					if (st.pending_space && st.has_content)
-					{
-						int space_w = tex_metrics_text_width_n(" ", 1, FONTROLE_MAIN);
-						if (check_wrap(&st, space_w + n->w))
-						{
-							finalize_line(&st);
-						}
-						else
-						{
-							add_content(&st, space_w, n->asc, n->desc);
-						}
-					}
-					st.pending_space = 0;
+	// the buffer may have moved, checkpoints and the resume point are offsets so only the base changes
+	layout->source = source;
+	layout->source_len = len;
+	layout->revision = ++g_layout_revision;
 
-					if (check_wrap(&st, n->w))
-					{
-						finalize_line(&st);
-					}
-					add_content(&st, n->w, n->asc, n->desc);
-				}
-				pool_reset(&st.scratch);
-			}
-			break;
+	tex_metrics_init(layout);
+	if (format_resume(layout, NULL) != 0)
+		return -1;
 
-		case T_MATH_DISPLAY:
-			{
-				finalize_line(&st);
+	tex_format_end(layout);
+	return 0;
+}
 
-				NodeRef start_node = (NodeRef)st.scratch.node_count;
-				NodeRef ref = tex_parse_math(t.start, t.len, &st.scratch, L);
-				if (ref != NODE_NULL)
-				{
-					Node* n = pool_get_node(&st.scratch, ref);
-					n->flags |= TEX_FLAG_MATHF_DISPLAY;
-					tex_measure_range(&st.scratch, start_node, (NodeRef)st.scratch.node_count);
-					add_content(&st, n->w, n->asc, n->desc);
-					finalize_line(&st);
-				}
-				pool_reset(&st.scratch);
-			}
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+TeX_Formatter* tex_formatter_create(size_t scratch_size, size_t max_scratch_size, const TeX_Allocator* allocator)
+{
+	TeX_Formatter* f = (TeX_Formatter*)tex_mem_calloc(allocator, sizeof(TeX_Formatter));
+	if (!f)
+		return NULL;
+
+	f->allocator = allocator;
+	if (scratch_size == 0)
+		scratch_size = TEX_LAYOUT_SCRATCH_SIZE;
+	scratch_size = TEX_MIN(scratch_size, TEX_LAYOUT_SCRATCH_LIMIT);
+	if (pool_init_alloc(&f->scratch, scratch_size, allocator) != 0)
+	{
+		tex_mem_free(allocator, f, sizeof(TeX_Formatter));
+		return NULL;
+	}
+	f->max_scratch = TEX_CLAMP(max_scratch_size, scratch_size, TEX_LAYOUT_SCRATCH_LIMIT);
+	return f;
+}
+
+void tex_formatter_destroy(TeX_Formatter* f)
+{
+	if (!f)
+		return;
+	pool_free(&f->scratch);
+	tex_mem_free(f->allocator, f->block_buf, f->block_buf_size);
+	tex_mem_free(f->allocator, f, sizeof(TeX_Formatter));
+}
+
+size_t tex_formatter_scratch_size(TeX_Formatter* f) { return f ? f->scratch.capacity : 0; }
+
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+TeX_Layout* tex_formatter_format(TeX_Formatter* f, const char* input, int len, int width, const TeX_Config* config)
+{
+	if (!input || width <= 0 || !config)
+		return NULL;
+
+	TeX_Layout* L = layout_create(width, config);
+	if (!L)
+		return NULL;
+
+	L->source = input;
+	L->source_len = len < 0 ? (int)strlen(input) : len;
+	return tex_format_end(layout_start(L, f));
+}
+
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+int tex_format_into(TeX_Formatter* f, TeX_Layout* layout, const char* input, int len, int width,
+                    const TeX_Config* config)
+{
+	if (!layout || !input || width <= 0 || !config)
+		return -1;
+
+	// drop an unfinished dry run, the checkpoint array is kept and refilled
+	job_free(layout->job);
+	layout->job = NULL;
+	layout_configure(layout, width, config);
+	layout->source = input;
+	layout->source_len = len < 0 ? (int)strlen(input) : len;
+
+	tex_metrics_init(layout);
+	if (format_resume(layout, f) != 0)
+		return -1;
+
+	tex_format_end(layout);
+	return 0;
+}
+
+// last checkpoint at or before a source offset ({0, 0} if none)
+static TeX_Checkpoint checkpoint_before_offset(const TeX_Layout* L, int offset)
+{
+	TeX_Checkpoint cur;
+	const uint8_t* p;
+	checkpoint_seek(L, 1, offset, &p, &cur);
+	TeX_Checkpoint prev = cur;
+	const uint8_t* end = L->checkpoints + L->checkpoint_bytes;
+	while (p < end)
+	{
+		checkpoint_next(&p, &cur);
+		if (cur.src_offset > offset)
 			break;
+		prev = cur;
+	}
+	return prev;
+}
+
+// measure the lines after a checkpoint on a throwaway copy of the layout until the probe matches
+// a checkpoint span is bounded by TEX_CHECKPOINT_COST, so is the replay
+// the copy starts without the layout's error and raises it again where the dry run did, formulas after
+// that point were measured with the error set
+static void replay_lines(TeX_Formatter* f, TeX_Layout* L, TeX_Checkpoint from, TexLineProbe* probe)
+{
+	TeX_Layout tmp = *L;
+	memset(&tmp.error, 0, sizeof(tmp.error));
+	tmp.cfg.error_callback = NULL; // errors were reported by the dry run already
+	tmp.checkpoints = NULL;
+	tmp.checkpoint_bytes = 0;
+	tmp.checkpoint_capacity = 0;
+	tmp.checkpoint_count = 0;
+	tmp.checkpoint_anchors = NULL;
+	tmp.checkpoint_anchor_capacity = 0;
+	tmp.outline = NULL;
+	tmp.outline_count = 0;
+	tmp.outline_capacity = 0;
+	tmp.job = NULL;
+	tmp.resume_offset = from.src_offset;
+	tmp.resume_y = from.y_pos;
 
-		case T_EOF:
+	probe->line = from;
+	probe->found = 0;
+	tex_metrics_init(&tmp);
+	if (format_resume(&tmp, f) != 0)
+		return;
+
+	tmp.job->st.probe = probe;
+	int next = from.src_offset; // start of the next token
+	for (;;)
+	{
+		if (L->error_offset >= 0 && next >= L->error_offset && tmp.error.code == TEX_OK)
+			tmp.error = L->error;
+		if (probe->found || !tex_format_step(&tmp, 1))
 			break;
-		}
+		next = tmp.job->st.tok_end;
 	}
+	job_free(tmp.job);
+}
+
+int tex_formatter_offset_to_y(TeX_Formatter* f, TeX_Layout* layout, int offset)
+{
+	if (!layout)
+		return -1;
 
-	finalize_line(&st);
+	TexLineProbe probe = { -1, TEX_CLAMP(offset, 0, layout->source_len), { 0, 0 }, 0 };
+	replay_lines(f, layout, checkpoint_before_offset(layout, probe.target_offset), &probe);
+	return probe.line.y_pos;
+}
 
-	pool_free(&st.scratch);
+int tex_formatter_y_to_offset(TeX_Formatter* f, TeX_Layout* layout, int y)
+{
+	if (!layout)
+		return -1;
+	if (layout->total_height <= 0)
+		return 0;
 
-	return L;
+	TexLineProbe probe = { TEX_CLAMP(y, 0, layout->total_height - 1), 0, { 0, 0 }, 0 };
+	TeX_Checkpoint at;
+	tex_checkpoint_find(layout, probe.target_y, &at, NULL);
+	replay_lines(f, layout, at, &probe);
+	return probe.line.src_offset;
+}
+
+int tex_offset_to_y(TeX_Layout* layout, int offset) { return tex_formatter_offset_to_y(NULL, layout, offset); }
+
+int tex_y_to_offset(TeX_Layout* layout, int y) { return tex_formatter_y_to_offset(NULL, layout, y); }
+
+int tex_outline_count(TeX_Layout* layout) { return layout ? layout->outline_count : 0; }
+
+int tex_outline_get(TeX_Layout* layout, int index, int* src_offset, int* y)
+{
+	if (!layout || index < 0 || index >= layout->outline_count)
+		return -1;
+	if (src_offset)
+		*src_offset = layout->outline[index].src_offset;
+	if (y)
+		*y = layout->outline[index].y_pos;
+	return 0;
 }
 
 int tex_get_total_height(TeX_Layout* layout)
@@ -284,8 +1055,12 @@ void tex_free(TeX_Layout* layout)
 	if (!layout)
 		return;
 
-	free(layout->checkpoints);
-	free(layout);
+	job_free(layout->job);
+	tex_mem_free(layout->allocator, layout->checkpoints, (size_t)layout->checkpoint_capacity);
+	tex_mem_free(layout->allocator, layout->checkpoint_anchors,
+	             (size_t)layout->checkpoint_anchor_capacity * sizeof(TexCheckpointAnchor));
+	tex_mem_free(layout->allocator, layout->outline, (size_t)layout->outline_capacity * sizeof(TeX_Checkpoint));
+	tex_mem_free(layout->allocator, layout, sizeof(TeX_Layout));
 }
 
 TeX_Error tex_get_last_error(TeX_Layout* layout)
@@ -1,4 +1,5 @@
 #include "tex_measure.h"
+#include <string.h>
 #include "tex_internal.h"
 #include "tex_metrics.h"
 #include "tex_util.h"
@@ -133,7 +134,7 @@ static void aggregate_list(UnifiedPool* pool, ListId head, int* out_w, int* out_
 	*out_desc = desc;
 }
 
-static void measure_node(UnifiedPool* pool, Node* n)
+void tex_measure_node(UnifiedPool* pool, Node* n)
 {
 	FontRole role = (n->flags & TEX_FLAG_SCRIPT) ? FONTROLE_SCRIPT : FONTROLE_MAIN;
 
@@ -414,53 +415,39 @@ static void measure_node(UnifiedPool* pool, Node* n)
 		break;
 	case N_MATRIX:
 		{
-			int16_t col_widths[TEX_MATRIX_MAX_DIMS] = { 0 };
-			int16_t row_ascs[TEX_MATRIX_MAX_DIMS] = { 0 };
-			int16_t row_descs[TEX_MATRIX_MAX_DIMS] = { 0 };
-
-			uint8_t rows = n->data.matrix.rows;
-			uint8_t cols = n->data.matrix.cols;
-
-			if (rows > TEX_MATRIX_MAX_DIMS)
-				rows = TEX_MATRIX_MAX_DIMS;
-			if (cols > TEX_MATRIX_MAX_DIMS)
-				cols = TEX_MATRIX_MAX_DIMS;
-			if (cols == 0)
-				cols = 1;
-
-			// ollect metrics from all cells
-			uint8_t cell_idx = 0;
-			for (ListId bid = n->data.matrix.cells; bid != LIST_NULL;)
+			int rows = n->data.matrix.rows;
+			int cols = n->data.matrix.cols;
+			int16_t* col_widths = matrix_grid(pool, n);
+			if (!col_widths)
 			{
-				TexListBlock* block = pool_get_list_block(pool, bid);
-				if (!block)
-					break;
+				n->w = n->asc = n->desc = 0;
+				break;
+			}
+			int16_t* row_ascs = col_widths + cols;
+			int16_t* row_descs = row_ascs + rows;
+			NodeRef* cells = matrix_cells(col_widths, n);
+			memset(col_widths, 0, (size_t)(cols + 2 * rows) * sizeof(int16_t));
 
-				for (uint16_t i = 0; i < block->count; i++)
+			// collect metrics from all cells, kept in the grid for draw
+			for (int r = 0; r < rows; r++)
+			{
+				for (int c = 0; c < cols; c++)
 				{
-					uint8_t r = (uint8_t)(cell_idx / cols);
-					uint8_t c = (uint8_t)(cell_idx % cols);
-					if (r >= rows)
-						break;
-
-					Node* cell = pool_get_node(pool, block->items[i]);
-					if (cell)
-					{
-						if (cell->w > col_widths[c])
-							col_widths[c] = cell->w;
-						if (cell->asc > row_ascs[r])
-							row_ascs[r] = cell->asc;
-						if (cell->desc > row_descs[r])
-							row_descs[r] = cell->desc;
-					}
-					cell_idx++;
+					Node* cell = pool_get_node(pool, cells[r * cols + c]);
+					if (!cell)
+						continue;
+					if (cell->w > col_widths[c])
+						col_widths[c] = cell->w;
+					if (cell->asc > row_ascs[r])
+						row_ascs[r] = cell->asc;
+					if (cell->desc > row_descs[r])
+						row_descs[r] = cell->desc;
 				}
-				bid = block->next;
 			}
 
 			// sum up dimensions
 			int16_t total_w = 0;
-			for (uint8_t c = 0; c < cols; c++)
+			for (int c = 0; c < cols; c++)
 				TEX_COORD_ASSIGN(total_w, total_w + col_widths[c]);
 			if (cols > 1)
 				TEX_COORD_ASSIGN(total_w, total_w + (cols - 1) * TEX_MATRIX_COL_SPACING);
@@ -475,7 +462,7 @@ static void measure_node(UnifiedPool* pool, Node* n)
 			}
 
 			int16_t total_h = 0;
-			for (uint8_t r = 0; r < rows; r++)
+			for (int r = 0; r < rows; r++)
 				TEX_COORD_ASSIGN(total_h, total_h + row_ascs[r] + row_descs[r]);
 			if (rows > 1)
 				TEX_COORD_ASSIGN(total_h, total_h + (rows - 1) * TEX_MATRIX_ROW_SPACING);
@@ -498,7 +485,7 @@ static void measure_node(UnifiedPool* pool, Node* n)
 		}
 		break;
 	default:
-		TEX_ASSERT(0 && "Unknown NodeType in measure_node");
+		TEX_ASSERT(0 && "Unknown NodeType in tex_measure_node");
 		break;
 	}
 }
@@ -513,7 +500,7 @@ void tex_measure_range(UnifiedPool* pool, NodeRef start, NodeRef end)
 		Node* n = pool_get_node(pool, i);
 		if (n)
 		{
-			measure_node(pool, n);
+			tex_measure_node(pool, n);
 		}
 	}
 }
@@ -12,4 +12,7 @@ typedef enum
 // Measure nodes in range [start, end) linearly, deriving role from TEX_FLAG_SCRIPT
 void tex_measure_range(UnifiedPool* pool, NodeRef start, NodeRef end);
 
+// Measure one node whose children are already measured
+void tex_measure_node(UnifiedPool* pool, Node* n);
+
 #endif // TEX_TEX_MEASURE_H
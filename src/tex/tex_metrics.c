@@ -1,42 +1,103 @@
 #include "tex_metrics.h"
 #include <limits.h>
 #include <string.h>
+#include "tex_font_tables.h"
 #include "tex_fonts.h"
 #include <fontlibc.h>
 
+#define TEX_PACK_NAME_MAX 8 // TI variable names are at most 8 characters
+
 typedef struct
 {
 	int16_t main_asc, main_desc;
 	int16_t script_asc, script_desc;
+	int16_t math_axis; // main font x-height
 	fontlib_font_t* mf;
 	fontlib_font_t* sf;
 	int use_fontlib;
+	char pack[TEX_PACK_NAME_MAX + 1]; // pack the fonts and g_reserved_nodes were loaded from
+	const uint8_t* widths[2]; // generated width table per role when the loaded font matches it, else NULL
+	unsigned char first_printable;
 } TexMetricsState;
 
 static TexMetricsState g_state;
 
-FontRole g_tex_metrics_current_role = (FontRole)-1;
+const void* g_tex_active_font = NULL;
+
+void tex_font_cache_invalidate(void) { tex_metrics_reset(); }
 
 void tex_metrics_reset(void)
 {
 	memset(&g_state, 0, sizeof(g_state));
 	g_state.use_fontlib = 0;
-	g_tex_metrics_current_role = (FontRole)-1; // force first SetFont
+	g_tex_active_font = NULL; // force first SetFont
 }
 
 int16_t tex_metrics_math_axis(void)
 {
-	return g_state.mf ? (int16_t)g_state.mf->x_height : 0;
+	return g_state.math_axis;
+}
+
+// stamp of a loaded font, computed like perform_header() in tools/process_fonts.py
+static uint32_t font_stamp(fontlib_font_t* font)
+{
+	uint8_t bytes[7 + TEX_FONT_TABLES_PROBE_COUNT] = {
+		TEX_FONT_TABLES_VERSION, font->height, font->baseline_height, font->x_height, font->first_glyph,
+		font->total_glyphs, font->italic_space_adjust,
+	};
+
+	fontlib_SetFont(font, (fontlib_load_options_t)0);
+	g_tex_active_font = font;
+	for (int i = 0; i < TEX_FONT_TABLES_PROBE_COUNT; i++)
+		bytes[7 + i] = (uint8_t)fontlib_GetGlyphWidth((char)tex_font_tables_probes[i]);
+
+	// FNV-1a
+	uint32_t h = 0x811C9DC5u;
+	for (size_t i = 0; i < sizeof(bytes); i++)
+	{
+		h ^= bytes[i];
+		h *= 0x01000193u;
+	}
+	return h;
+}
+
+static const uint8_t* match_font_table(fontlib_font_t* font, uint32_t stamp, const uint8_t* widths)
+{
+	return (font && font_stamp(font) == stamp) ? widths : NULL;
+}
+
+static const uint8_t* role_widths(FontRole role) { return g_state.widths[role == FONTROLE_SCRIPT ? 1 : 0]; }
+
+// width of a run from a generated table, same rules as fontlib_GetStringWidthL
+static int16_t table_text_width(const uint8_t* widths, const char* s, int len)
+{
+	int w = 0;
+	for (int i = 0; i < len && s[i]; i++)
+	{
+		unsigned char c = (unsigned char)s[i];
+		if (c >= g_state.first_printable)
+			w += widths[c];
+	}
+	return (int16_t)w;
 }
 
 #include "tex_internal.h"
 void tex_metrics_init(struct TeX_Layout* layout)
 {
+	const char* pack_main = layout ? layout->cfg.pack : NULL;
+	const char* key = pack_main ? pack_main : "";
+
+	// fonts and flyweight metrics only change with the pack, formatting many small layouts reuses them
+	if (g_state.use_fontlib && strncmp(g_state.pack, key, sizeof(g_state.pack)) == 0)
+	{
+		tex_metrics_invalidate_font_state();
+		g_state.first_printable = (unsigned char)fontlib_GetFirstPrintableCodePoint();
+		return;
+	}
+
 	tex_metrics_reset();
 	TexFontHandles fh;
 
-	const char* pack_main = layout ? layout->cfg.pack : NULL;
-
 	int result = tex_fonts_load(pack_main, NULL, &fh);
 
 	if (result)
@@ -47,9 +108,27 @@ void tex_metrics_init(struct TeX_Layout* layout)
 		g_state.script_desc = (int16_t)(fh.script_height - fh.script_baseline);
 		g_state.mf = (fontlib_font_t*)fh.main_font;
 		g_state.sf = (fontlib_font_t*)fh.script_font;
+		g_state.math_axis = g_state.mf ? (int16_t)g_state.mf->x_height : 0;
 		g_state.use_fontlib = 1;
-		g_tex_metrics_current_role = (FontRole)-1; // reset cache after (re)load
+		// stock packs measure from compiled tables, no fontlib calls after this point
+		g_state.widths[0] = match_font_table(g_state.mf, TEX_FONT_TABLES_MAIN_STAMP, tex_font_tables_main_widths);
+		g_state.widths[1] = match_font_table(g_state.sf, TEX_FONT_TABLES_SCRIPT_STAMP, tex_font_tables_script_widths);
+		if (g_state.widths[0])
+		{
+			g_state.main_asc = TEX_FONT_TABLES_MAIN_BASELINE;
+			g_state.main_desc = TEX_FONT_TABLES_MAIN_HEIGHT - TEX_FONT_TABLES_MAIN_BASELINE;
+			g_state.math_axis = TEX_FONT_TABLES_MAIN_X_HEIGHT;
+		}
+		if (g_state.widths[1])
+		{
+			g_state.script_asc = TEX_FONT_TABLES_SCRIPT_BASELINE;
+			g_state.script_desc = TEX_FONT_TABLES_SCRIPT_HEIGHT - TEX_FONT_TABLES_SCRIPT_BASELINE;
+		}
+		g_state.first_printable = (unsigned char)fontlib_GetFirstPrintableCodePoint();
+		tex_metrics_invalidate_font_state(); // reset cache after (re)load
 		tex_reserved_init();
+		strncpy(g_state.pack, key, TEX_PACK_NAME_MAX);
+		g_state.pack[TEX_PACK_NAME_MAX] = '\0';
 	}
 	else
 	{
@@ -73,6 +152,8 @@ int16_t tex_metrics_desc(FontRole role)
 
 int16_t tex_metrics_text_width(const char* s, FontRole role)
 {
+	if (role_widths(role))
+		return s ? table_text_width(role_widths(role), s, INT_MAX) : 0;
 	if (g_state.use_fontlib && g_state.mf && g_state.sf)
 	{
 		// ensure font is active (cached)
@@ -80,9 +161,9 @@ int16_t tex_metrics_text_width(const char* s, FontRole role)
 		{
 			return 0;
 		}
-		if (g_tex_metrics_current_role != role)
+		fontlib_font_t* font = (role == FONTROLE_SCRIPT) ? g_state.sf : g_state.mf;
+		if (g_tex_active_font != font)
 		{
-			fontlib_font_t* font = (role == FONTROLE_SCRIPT) ? g_state.sf : g_state.mf;
 #if defined(__TICE__)
 			if (!fontlib_SetFont(font, (fontlib_load_options_t)0))
 			{
@@ -91,7 +172,7 @@ int16_t tex_metrics_text_width(const char* s, FontRole role)
 #else
 			fontlib_SetFont(font, (fontlib_load_options_t)0);
 #endif
-			g_tex_metrics_current_role = role;
+			g_tex_active_font = font;
 		}
 		return (int16_t)fontlib_GetStringWidth(s ? s : "");
 	}
@@ -103,17 +184,19 @@ int16_t tex_metrics_text_width(const char* s, FontRole role)
 // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
 int16_t tex_metrics_text_width_n(const char* s, int len, FontRole role)
 {
+	if (role_widths(role))
+		return (s && len > 0) ? table_text_width(role_widths(role), s, len) : 0;
 	if (g_state.use_fontlib && g_state.mf && g_state.sf)
 	{
 		if (((role == FONTROLE_SCRIPT) ? g_state.sf : g_state.mf) == NULL)
 			return 0;
-		if (g_tex_metrics_current_role != role)
+		fontlib_font_t* font = (role == FONTROLE_SCRIPT) ? g_state.sf : g_state.mf;
+		if (g_tex_active_font != font)
 		{
-			fontlib_font_t* font = (role == FONTROLE_SCRIPT) ? g_state.sf : g_state.mf;
 			if (!fontlib_SetFont(font, (fontlib_load_options_t)0))
 				return 0;
 			fontlib_SetFont(font, (fontlib_load_options_t)0);
-			g_tex_metrics_current_role = role;
+			g_tex_active_font = font;
 		}
 		if (!s || len <= 0)
 			return 0;
@@ -130,6 +213,8 @@ int16_t tex_metrics_text_width_n(const char* s, int len, FontRole role)
 // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
 int16_t tex_metrics_glyph_width(unsigned int glyph, FontRole role)
 {
+	if (role_widths(role))
+		return role_widths(role)[glyph & 0xFF];
 	if (g_state.use_fontlib && g_state.mf && g_state.sf)
 	{
 		char ch[2];
@@ -139,12 +224,11 @@ int16_t tex_metrics_glyph_width(unsigned int glyph, FontRole role)
 		if (((role == FONTROLE_SCRIPT) ? g_state.sf : g_state.mf) == NULL)
 			return 0;
 
-		if (g_tex_metrics_current_role != role)
+		fontlib_font_t* font = (role == FONTROLE_SCRIPT) ? g_state.sf : g_state.mf;
+		if (g_tex_active_font != font)
 		{
-			fontlib_font_t* font = (role == FONTROLE_SCRIPT) ? g_state.sf : g_state.mf;
 			fontlib_SetFont(font, (fontlib_load_options_t)0);
-
-			g_tex_metrics_current_role = role;
+			g_tex_active_font = font;
 		}
 
 		// HACK: set threshold to 1
@@ -164,33 +248,21 @@ Node g_reserved_nodes[TEX_RESERVED_COUNT];
 
 void tex_reserved_init(void)
 {
-	// main role glyphs (0-127)
-	for (int i = 0; i < 128; i++)
+	// main role glyphs (0-255), then script role glyphs (256-511)
+	for (int i = 0; i < TEX_RESERVED_COUNT; i++)
 	{
 		Node* n = &g_reserved_nodes[i];
+		FontRole role = (i < TEX_RESERVED_CODES) ? FONTROLE_MAIN : FONTROLE_SCRIPT;
+		uint16_t code = (uint16_t)(i % TEX_RESERVED_CODES);
 		n->type = N_GLYPH;
-		n->flags = 0;
-		n->data.glyph = (uint16_t)i;
-
-		n->w = tex_metrics_glyph_width((unsigned int)i, FONTROLE_MAIN);
-		n->asc = tex_metrics_asc(FONTROLE_MAIN);
-		n->desc = tex_metrics_desc(FONTROLE_MAIN);
-	}
-
-	// script role glyphs (128-255)
-	for (int i = 128; i < TEX_RESERVED_COUNT; i++)
-	{
-		Node* n = &g_reserved_nodes[i];
-		n->type = N_GLYPH;
-		n->flags = TEX_FLAG_SCRIPT;
-
-		// back to ASCII (e.g., 128 -> 0) for the actual glyph code
-		uint16_t ascii_code = (uint16_t)(i - 128);
-		n->data.glyph = ascii_code;
+		n->flags = (role == FONTROLE_SCRIPT) ? TEX_FLAG_SCRIPT : 0;
+		n->data.glyph = code;
 
-		n->w = tex_metrics_glyph_width((unsigned int)ascii_code, FONTROLE_SCRIPT);
-		n->asc = tex_metrics_asc(FONTROLE_SCRIPT);
-		n->desc = tex_metrics_desc(FONTROLE_SCRIPT);
+		// same metrics as measure_glyph, big operators keep the main font inside scripts
+		FontRole metric_role = tex_is_big_operator(code) ? FONTROLE_MAIN : role;
+		n->w = tex_metrics_glyph_width(code, metric_role);
+		n->asc = tex_metrics_asc(metric_role);
+		n->desc = tex_metrics_desc(metric_role);
 	}
 }
 
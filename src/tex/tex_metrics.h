@@ -27,10 +27,10 @@ static inline int tex_node_is_big_operator(const Node* node)
 // forward declaration
 struct TeX_Layout;
 
-// initialize metrics using layout
+// initialize metrics using layout, a no-op while the layout's font pack is already loaded
 void tex_metrics_init(struct TeX_Layout* layout);
 
-// explicit reset to host constants (used by tests/host builds implicitly)
+// explicit reset to host constants (used by tests/host builds implicitly), forgets the loaded pack
 void tex_metrics_reset(void);
 
 int16_t tex_metrics_math_axis(void);
@@ -44,8 +44,9 @@ int16_t tex_metrics_text_width(const char* s, FontRole role);
 int16_t tex_metrics_text_width_n(const char* s, int len, FontRole role);
 int16_t tex_metrics_glyph_width(unsigned int glyph, FontRole role);
 
-extern FontRole g_tex_metrics_current_role;
-static inline void tex_metrics_invalidate_font_state(void) { g_tex_metrics_current_role = (FontRole)-1; }
+// font last passed to fontlib_SetFont, shared by measuring and drawing so neither trusts a stale font
+extern const void* g_tex_active_font;
+static inline void tex_metrics_invalidate_font_state(void) { g_tex_active_font = NULL; }
 
 void tex_reserved_init(void);
 
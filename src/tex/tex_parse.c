@@ -38,38 +38,57 @@ typedef struct
 	const char* end;
 } MLex;
 
+typedef struct PFrame PFrame;
+typedef struct PStackChunk PStackChunk;
+
 typedef struct
 {
 	MLex lx;
-	int depth;
+	const char* base; // start of the formula, node spans are relative to it
 	UnifiedPool* pool; // pool for node and string allocation
 	TeX_Layout* L; // for error reporting only
 	uint8_t current_role; // FONTROLE_MAIN=0 or FONTROLE_SCRIPT=1 for tagging
+	uint8_t measure; // measure every node as soon as its children are complete
+	uint8_t size_only; // fold lists into their metrics and release finished subtrees (implies measure)
+	int nodes; // nodes the full tree holds (size_only releases most of them)
+	PStackChunk* chunk; // stack chunk holding the top frame, the first one while the stack is empty
+	StringId chunk_id;
+	int top; // frames on the stack
+	int budget; // frames the stack may grow to
+	NodeRef ret; // value handed back by the last finished frame (ListId of LIST_MATH and LIST_RIGHT)
 } Parser;
 
 typedef struct
 {
 	ListId head; // first block (LIST_NULL if empty)
-	ListId tail_id; // last block id
-	TexListBlock* tail_block; // cached pointer to tail block (for fast append)
+	ListId tail_id; // last block id (ids only, builders live in parser frames)
+	uint8_t folding; // size only: the list holds one node summing the metrics of the pushed items
+	PoolMark mark; // size only: pool state after that node, each pushed item is released back to it
 } ListBuilder;
 
 static void lb_init(ListBuilder* lb)
 {
 	lb->head = LIST_NULL;
 	lb->tail_id = LIST_NULL;
-	lb->tail_block = NULL;
+	lb->folding = 0;
 }
 
-static void lb_push(Parser* p, ListBuilder* lb, NodeRef item)
+// a list that is only aggregated (groups, formulas, \left..\right), folded when parsing for size only
+static void lb_init_folded(Parser* p, ListBuilder* lb)
 {
-	if (item == NODE_NULL)
-		return;
+	lb_init(lb);
+	lb->folding = p->size_only;
+	lb->mark = pool_mark(p->pool);
+}
+
+static void lb_append(Parser* p, ListBuilder* lb, NodeRef item)
+{
+	TexListBlock* tail = pool_get_list_block(p->pool, lb->tail_id);
 
 	// Need a new block?
-	if (lb->tail_block == NULL || lb->tail_block->count >= TEX_LIST_BLOCK_CAP)
+	if (tail == NULL || tail->count >= tail->cap)
 	{
-		ListId new_id = pool_alloc_list_block(p->pool);
+		ListId new_id = pool_alloc_list_block(p->pool, tail);
 		if (new_id == LIST_NULL)
 		{
 			TEX_SET_ERROR(p->L, TEX_ERR_OOM, "Failed to allocate list block", 0);
@@ -88,27 +107,60 @@ static void lb_push(Parser* p, ListBuilder* lb, NodeRef item)
 		}
 		else
 		{
-			TexListBlock* prev_tail = lb->tail_block;
-			if (prev_tail == NULL && lb->tail_id != LIST_NULL)
-				prev_tail = pool_get_list_block(p->pool, lb->tail_id);
-			if (prev_tail == NULL)
+			if (tail == NULL)
 			{
 				TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "List builder state corrupted", 0);
 				return;
 			}
-			prev_tail->next = new_id;
+			tail->next = new_id;
 		}
 		lb->tail_id = new_id;
-		lb->tail_block = new_block;
+		tail = new_block;
 	}
 
 	// Append item to current block
-	if (lb->tail_block == NULL)
-	{
-		TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "List builder has no tail block", 0);
+	tail->items[tail->count++] = item;
+}
+
+// add a measured item to the running metrics and release its subtree, the first item allocates the sum node
+static void lb_fold(Parser* p, ListBuilder* lb, NodeRef item)
+{
+	Node* n = pool_get_node(p->pool, item);
+	if (!n)
 		return;
+	int16_t w = n->w, asc = n->asc, desc = n->desc;
+	pool_release(p->pool, lb->mark);
+
+	if (lb->head == LIST_NULL)
+	{
+		NodeRef ref = pool_alloc_node(p->pool);
+		if (ref == NODE_NULL)
+		{
+			TEX_SET_ERROR(p->L, TEX_ERR_OOM, "Failed to allocate parse node", 0);
+			return;
+		}
+		pool_get_node(p->pool, ref)->type = N_MATH;
+		lb_append(p, lb, ref);
+		lb->mark = pool_mark(p->pool);
 	}
-	lb->tail_block->items[lb->tail_block->count++] = item;
+	TexListBlock* tail = pool_get_list_block(p->pool, lb->tail_id);
+	if (!tail)
+		return;
+
+	Node* sum = pool_get_node(p->pool, tail->items[0]);
+	TEX_COORD_ASSIGN(sum->w, sum->w + w);
+	sum->asc = TEX_MAX(sum->asc, asc);
+	sum->desc = TEX_MAX(sum->desc, desc);
+}
+
+static void lb_push(Parser* p, ListBuilder* lb, NodeRef item)
+{
+	if (item == NODE_NULL)
+		return;
+	if (lb->folding)
+		lb_fold(p, lb, item);
+	else
+		lb_append(p, lb, item);
 }
 
 static NodeRef new_node(Parser* p, NodeType t)
@@ -124,10 +176,37 @@ static NodeRef new_node(Parser* p, NodeType t)
 		TEX_SET_ERROR(p->L, TEX_ERR_OOM, "Failed to allocate parse node", 0);
 		return NODE_NULL;
 	}
+	p->nodes++;
 	Node* n = pool_get_node(p->pool, ref);
 	n->type = (uint8_t)t;
 	if (p->current_role != 0)
 		n->flags |= TEX_FLAG_SCRIPT;
+	node_set_span(n, (int)(p->lx.cur - p->base), 0); // refined by mark_span once the construct is consumed
+	return ref;
+}
+
+// source span [start, start + len) of a node, flyweight glyphs are shared and carry none
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static NodeRef set_span(Parser* p, NodeRef ref, const char* start, int len)
+{
+	if (ref == NODE_NULL || TEX_IS_RESERVED_REF(ref) || !start)
+		return ref;
+	node_set_span(pool_get_node(p->pool, ref), (int)(start - p->base), len);
+	return ref;
+}
+
+// span from start to the end of the last consumed token
+static NodeRef mark_span(Parser* p, NodeRef ref, const char* start)
+{
+	return set_span(p, ref, start, (int)(p->lx.cur - start));
+}
+
+// called once a node and all of its children are filled in, measures it while it is still hot
+// flyweight glyphs are measured once at startup
+static NodeRef finish_node(Parser* p, NodeRef ref)
+{
+	if (p->measure && ref != NODE_NULL && !TEX_IS_RESERVED_REF(ref) && !TEX_HAS_ERROR(p->L))
+		tex_measure_node(p->pool, pool_get_node(p->pool, ref));
 	return ref;
 }
 
@@ -147,25 +226,25 @@ static NodeRef make_text(Parser* p, const char* s, size_t len)
 	Node* n = pool_get_node(p->pool, ref);
 	n->data.text.sid = sid;
 	n->data.text.len = (uint16_t)len;
-	return ref;
+	return finish_node(p, ref);
 }
 
 static NodeRef make_glyph(Parser* p, uint16_t code)
 {
-	if (code < 128)
+	if (code < TEX_RESERVED_CODES)
 	{
-		uint16_t offset = (p->current_role == FONTROLE_SCRIPT) ? 128 : 0;
+		uint16_t offset = (p->current_role == FONTROLE_SCRIPT) ? TEX_RESERVED_CODES : 0;
 		return (NodeRef)(TEX_RESERVED_BASE + offset + code);
 	}
 
-	// fallback: alloc a new dynamic node for extended characters (Greek, etc)
+	// fallback: alloc a new dynamic node for codes outside the flyweight table
 	NodeRef ref = new_node(p, N_GLYPH);
 	if (ref == NODE_NULL)
 		return NODE_NULL;
 
 	Node* n = pool_get_node(p->pool, ref);
 	n->data.glyph = code;
-	return ref;
+	return finish_node(p, ref);
 }
 // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
 static NodeRef make_multiop(Parser* p, uint8_t count, uint8_t op_type)
@@ -176,7 +255,7 @@ static NodeRef make_multiop(Parser* p, uint8_t count, uint8_t op_type)
 	Node* n = pool_get_node(p->pool, ref);
 	n->data.multiop.count = count;
 	n->data.multiop.op_type = op_type;
-	return ref;
+	return finish_node(p, ref);
 }
 
 static void ml_init(MLex* lx, const char* s, int len)
@@ -274,8 +353,12 @@ static MToken ml_next(MLex* lx)
 }
 
 // ------------------
-// recursive descent
+// explicit stack
 // ------------------
+// constructs that nest (lists, scripts, commands taking arguments) are frames on a stack kept in the pool
+// rather than C calls, so nesting costs pool memory (up to TeX_Config.parse_stack_frames) instead of C stack.
+// A frame runs until it needs a nested argument, pushes the argument's frame and is resumed at its stage
+// with the argument's value in Parser.ret; a begin_* helper returns 0 when the value was there at once
 
 static MToken ml_peek(MLex* lx)
 {
@@ -283,11 +366,165 @@ static MToken ml_peek(MLex* lx)
 	return ml_next(&tmp);
 }
 
-static NodeRef parse_list_core(Parser* p, int stop_on_right);
-static NodeRef parse_math_list(Parser* p);
-static NodeRef parse_atom(Parser* p);
-static NodeRef parse_command(Parser* p, const char* name, int len);
-static NodeRef parse_auto_delim(Parser* p);
+typedef enum
+{
+	PF_LIST,
+	PF_SCRIPTS,
+	PF_CMD
+} PFrameKind;
+
+// where a list ends and what it returns
+typedef enum
+{
+	LIST_MATH, // formula up to '}' or the end (ListId)
+	LIST_RIGHT, // \left content, also ends at \right (ListId)
+	LIST_GROUP, // { ... } (N_MATH)
+	LIST_BRACKET, // [ ... ] of \sqrt (N_MATH, NODE_NULL when empty)
+	LIST_CELL // matrix cell up to & \\ or \end (its only item, N_MATH of several, NODE_NULL when empty)
+} ListMode;
+
+// commands whose arguments nest
+typedef enum
+{
+	CMD_ACCENT,
+	CMD_FRAC,
+	CMD_BINOM,
+	CMD_SQRT,
+	CMD_BRACE,
+	CMD_LIM,
+	CMD_LEFT,
+	CMD_MATRIX
+} CmdKind;
+
+// applied to a frame's value before it is handed back
+#define RET_SPAN 0x01 // span from the frame start to the last consumed token
+#define RET_SCRIPTS 0x02 // attach the ^ and _ that follow
+
+struct PFrame
+{
+	uint8_t kind; // PFrameKind
+	uint8_t mode; // ListMode or CmdKind
+	uint8_t stage; // where the frame resumes, 0 when pushed
+	uint8_t ret; // RET_* flags
+	uint8_t role; // current_role to restore once the argument being parsed returns
+	const char* start; // span start of the value, scripts attach from here
+	union
+	{
+		struct
+		{
+			ListBuilder lb;
+			const char* run_start; // pending run of contiguous characters
+			int run_len;
+			uint16_t item_count; // cells return their only item as is
+			NodeRef first_item;
+		} list;
+		struct
+		{
+			NodeRef base, sub, sup;
+		} scripts;
+		struct
+		{
+			NodeRef a, b; // arguments parsed so far
+			NodeRef ref; // node allocated ahead of its argument (\lim, braces)
+			uint8_t code; // accent, brace or left delimiter
+		} cmd;
+		struct
+		{
+			ListBuilder lb; // cells in row order
+			int row, col, max_cols;
+			uint8_t delim;
+			uint8_t col_separators;
+		} matrix;
+	} u;
+};
+
+// frames are chained in chunks like list blocks. Chunks never move, so a frame stays where it is while
+// its arguments are pushed, and the chain stays with the pool for the next parse (UnifiedPool.stack)
+struct PStackChunk
+{
+	StringId prev, next; // neighbouring chunks (STRING_NULL at either end)
+	PFrame frames[TEX_PARSE_STACK_CHUNK];
+};
+
+// frames hold pointers, chunk blocks are aligned for them
+static PStackChunk* stack_chunk(UnifiedPool* pool, StringId id)
+{
+	uintptr_t at = (uintptr_t)(pool->slab + id);
+	uintptr_t align = sizeof(void*);
+	return (PStackChunk*)(void*)(pool->slab + id + (align - at % align) % align);
+}
+
+// append a chunk to the chain. While parsing for size only it lies under the marks of the open lists,
+// which are lowered so a fold does not free it
+static StringId new_chunk(Parser* p, StringId prev)
+{
+	UnifiedPool* pool = p->pool;
+	StringId id = pool_alloc_block(pool, tex_parse_stack_chunk_size());
+	if (id == STRING_NULL)
+	{
+		TEX_SET_ERROR(p->L, TEX_ERR_OOM, "Failed to allocate parse stack", p->top);
+		return STRING_NULL;
+	}
+	PStackChunk* chunk = stack_chunk(pool, id);
+	chunk->prev = prev;
+	chunk->next = STRING_NULL;
+	if (prev == STRING_NULL)
+		pool->stack = id;
+	else
+		stack_chunk(pool, prev)->next = id;
+	pool->stack_low = id;
+
+	StringId cid = pool->stack;
+	for (int i = 0; i < p->top; i++)
+	{
+		if (i > 0 && i % TEX_PARSE_STACK_CHUNK == 0)
+			cid = stack_chunk(pool, cid)->next;
+		PFrame* f = &stack_chunk(pool, cid)->frames[i % TEX_PARSE_STACK_CHUNK];
+		if (f->kind == PF_LIST && f->u.list.lb.folding && f->u.list.lb.mark.string_cursor > id)
+			f->u.list.lb.mark.string_cursor = id;
+	}
+	return id;
+}
+
+static PFrame* top_frame(Parser* p) { return &p->chunk->frames[(p->top - 1) % TEX_PARSE_STACK_CHUNK]; }
+
+static PFrame* push_frame(Parser* p, PFrameKind kind, uint8_t mode, uint8_t ret, const char* start)
+{
+	if (p->top >= p->budget)
+	{
+		TEX_SET_ERROR(p->L, TEX_ERR_DEPTH, "Maximum nesting depth exceeded", p->top + 1);
+		return NULL;
+	}
+	if (!p->chunk || (p->top > 0 && p->top % TEX_PARSE_STACK_CHUNK == 0))
+	{
+		// the next chunk is reused from an earlier parse when the chain has one
+		StringId id = p->chunk ? p->chunk->next : STRING_NULL;
+		if (id == STRING_NULL)
+			id = new_chunk(p, p->chunk ? p->chunk_id : STRING_NULL);
+		if (id == STRING_NULL)
+			return NULL;
+		p->chunk_id = id;
+		p->chunk = stack_chunk(p->pool, id);
+	}
+	p->top++;
+	PFrame* f = top_frame(p);
+	memset(f, 0, sizeof(*f));
+	f->kind = (uint8_t)kind;
+	f->mode = mode;
+	f->ret = ret;
+	f->start = start;
+	return f;
+}
+
+static void pop_frame(Parser* p)
+{
+	p->top--;
+	if (p->top > 0 && p->top % TEX_PARSE_STACK_CHUNK == 0)
+	{
+		p->chunk_id = p->chunk->prev;
+		p->chunk = stack_chunk(p->pool, p->chunk_id);
+	}
+}
 
 static NodeRef wrap_group_list(Parser* p, ListId list_head)
 {
@@ -296,7 +533,7 @@ static NodeRef wrap_group_list(Parser* p, ListId list_head)
 		return NODE_NULL;
 	Node* n = pool_get_node(p->pool, ref);
 	n->data.list.head = list_head;
-	return ref;
+	return finish_node(p, ref);
 }
 
 static inline int is_script_marker(MTokenKind kind) { return kind == M_CARET || kind == M_UNDER; }
@@ -319,12 +556,12 @@ static void flush_char_run(Parser* p, const char* run_start, int run_len, int sc
 		if (run_len > 1)
 		{
 			NodeRef txt = make_text(p, run_start, (size_t)(run_len - 1));
-			lb_push(p, lb, txt);
+			lb_push(p, lb, set_span(p, txt, run_start, run_len - 1));
 		}
 		// last character becomes the script base (not appended yet)
 		if (out_script_base)
 		{
-			*out_script_base = make_glyph(p, (uint8_t)run_start[run_len - 1]);
+			*out_script_base = set_span(p, make_glyph(p, (uint8_t)run_start[run_len - 1]), run_start + run_len - 1, 1);
 		}
 	}
 	else
@@ -338,556 +575,328 @@ static void flush_char_run(Parser* p, const char* run_start, int run_len, int sc
 		{
 			ref = make_text(p, run_start, (size_t)run_len);
 		}
-		lb_push(p, lb, ref);
+		lb_push(p, lb, set_span(p, ref, run_start, run_len));
 	}
 }
 
-static NodeRef parse_script_arg(Parser* p);
-
-static NodeRef attach_scripts(Parser* p, NodeRef base)
+// copy the parsed cells into the matrix grid block, metrics are left for measure
+static StringId alloc_matrix_grid(Parser* p, ListId cells, int rows, int cols)
 {
-	if (base == NODE_NULL)
-		return NODE_NULL;
-	NodeRef sub = NODE_NULL;
-	NodeRef sup = NODE_NULL;
-	int again = 1;
-	while (again)
+	StringId grid = pool_alloc_block(p->pool, matrix_grid_size(rows, cols));
+	if (grid == STRING_NULL)
 	{
-		again = 0;
-		MToken k = ml_peek(&p->lx);
-		if (k.kind == M_CARET)
-		{
-			(void)ml_next(&p->lx);
-			if (sup == NODE_NULL)
-			{
-				uint8_t saved_role = p->current_role;
-				p->current_role = 1; // FONTROLE_SCRIPT
-				sup = parse_script_arg(p);
-				p->current_role = saved_role;
-			}
-			if (sup == NODE_NULL && !TEX_HAS_ERROR(p->L))
-			{
-				TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Missing argument for superscript/subscript", 0);
-				return NODE_NULL;
-			}
-			again = 1;
-		}
-		else if (k.kind == M_UNDER)
-		{
-			(void)ml_next(&p->lx);
-			if (sub == NODE_NULL)
-			{
-				uint8_t saved_role = p->current_role;
-				p->current_role = 1; // FONTROLE_SCRIPT
-				sub = parse_script_arg(p);
-				p->current_role = saved_role;
-			}
-			if (sub == NODE_NULL && !TEX_HAS_ERROR(p->L))
-			{
-				TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Missing argument for superscript/subscript", 0);
-				return NODE_NULL;
-			}
-			again = 1;
-		}
+		TEX_SET_ERROR(p->L, TEX_ERR_OOM, "Failed to allocate matrix grid", rows * cols);
+		return STRING_NULL;
 	}
-	if (sub != NODE_NULL || sup != NODE_NULL)
+	int16_t* metrics = (int16_t*)(p->pool->slab + grid);
+	NodeRef* out = (NodeRef*)(metrics + cols + 2 * rows);
+	int count = 0;
+	for (ListId bid = cells; bid != LIST_NULL;)
 	{
-		NodeRef ref = new_node(p, N_SCRIPT);
-		if (ref == NODE_NULL)
-			return NODE_NULL;
-		Node* s = pool_get_node(p->pool, ref);
-		s->data.script.base = base;
-		s->data.script.sub = sub;
-		s->data.script.sup = sup;
-		return ref;
+		TexListBlock* block = pool_get_list_block(p->pool, bid);
+		if (!block)
+			break;
+		for (uint16_t i = 0; i < block->count && count < rows * cols; i++)
+			out[count++] = block->items[i];
+		bid = block->next;
 	}
-	return base;
+	while (count < rows * cols)
+		out[count++] = NODE_NULL;
+	return grid;
 }
 
-static NodeRef parse_group(Parser* p)
+static DelimType parse_delim_type(Parser* p)
 {
-	// assumes next token is '{'
-	(void)ml_next(&p->lx);
-
-	// depth guard
-	p->depth++;
-	if (p->depth > TEX_PARSE_MAX_DEPTH)
-	{
-		TEX_SET_ERROR(p->L, TEX_ERR_DEPTH, "Maximum nesting depth exceeded in group", p->depth);
-		p->depth--;
-		return NODE_NULL;
-	}
-
-	ListBuilder lb;
-	lb_init(&lb);
-
-	// pending run of contiguous characters
-	const char* run_start = NULL;
-	int run_len = 0;
-
-	while (1)
+	MToken t = ml_next(&p->lx);
+	if (t.kind == M_CHAR)
 	{
-		MToken pk = ml_peek(&p->lx);
-		if (pk.kind == M_RBRACE || pk.kind == M_EOF)
+		switch (*t.start)
 		{
-			if (pk.kind == M_RBRACE)
-				(void)ml_next(&p->lx); // consume '}'
-			break;
-		}
-		if (TEX_HAS_ERROR(p->L))
+		case '(':
+		case ')':
+			return DELIM_PAREN;
+		case '[':
+		case ']':
+			return DELIM_BRACKET;
+		case '|':
+			return DELIM_VERT;
+		case '.':
+			return DELIM_NONE;
+		default:
 			break;
-
-		if (pk.kind == M_CHAR)
-		{
-			// accumulate character
-			if (run_len == 0)
-			{
-				run_start = pk.start;
-				run_len = 1;
-			}
-			else if (pk.start == run_start + run_len)
-			{
-				run_len++;
-			}
-			else
-			{
-				flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-				run_start = pk.start;
-				run_len = 1;
-			}
-			ml_next(&p->lx);
-
-			MToken next = ml_peek(&p->lx);
-			if (is_script_marker(next.kind))
-			{
-				NodeRef base = NODE_NULL;
-				flush_char_run(p, run_start, run_len, 1, &lb, &base);
-				run_start = NULL;
-				run_len = 0;
-
-				if (base != NODE_NULL)
-				{
-					base = attach_scripts(p, base);
-					lb_push(p, &lb, base);
-				}
-			}
 		}
-		else if (is_script_marker(pk.kind))
+	}
+	else if (t.kind == M_LBRACKET || t.kind == M_RBRACKET)
+	{
+		return DELIM_BRACKET;
+	}
+	else if (t.kind == M_CMD)
+	{
+		if (t.len == 1 && (*t.start == '{' || *t.start == '}'))
+			return DELIM_BRACE;
+		if (t.len == 4 && strncmp(t.start, "vert", 4) == 0)
+			return DELIM_VERT;
+		if (t.len == 5)
 		{
-			flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-			run_start = NULL;
-			run_len = 0;
-
-			ml_next(&p->lx);
-			NodeRef n = make_glyph(p, (pk.kind == M_CARET) ? '^' : '_');
-			lb_push(p, &lb, n);
+			if (strncmp(t.start, "lceil", 5) == 0 || strncmp(t.start, "rceil", 5) == 0)
+				return DELIM_CEIL;
 		}
-		else
+		else if (t.len == 6)
 		{
-			flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-			run_start = NULL;
-			run_len = 0;
-
-			NodeRef it = parse_atom(p);
-			if (TEX_HAS_ERROR(p->L))
+			switch (*t.start)
+			{
+			case 'l':
+				if (strncmp(t.start, "lbrace", 6) == 0)
+					return DELIM_BRACE;
+				if (strncmp(t.start, "langle", 6) == 0)
+					return DELIM_ANGLE;
+				if (strncmp(t.start, "lfloor", 6) == 0)
+					return DELIM_FLOOR;
 				break;
-			if (it == NODE_NULL)
+			case 'r':
+				if (strncmp(t.start, "rbrace", 6) == 0)
+					return DELIM_BRACE;
+				if (strncmp(t.start, "rangle", 6) == 0)
+					return DELIM_ANGLE;
+				if (strncmp(t.start, "rfloor", 6) == 0)
+					return DELIM_FLOOR;
+				break;
+			default:
+				TEX_ASSERT(0 && "Unexpected first character in 6-char delimiter command");
 				break;
-
-			MToken next = ml_peek(&p->lx);
-			if (is_script_marker(next.kind))
-			{
-				it = attach_scripts(p, it);
 			}
-
-			lb_push(p, &lb, it);
 		}
 	}
-
-	flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-
-	p->depth--;
-	return wrap_group_list(p, lb.head);
+	return DELIM_NONE;
 }
 
-// parse an optional bracketed argument [ ... ]; returns NODE_NULL if not present
-static NodeRef parse_optional_bracket_arg(Parser* p)
+static const struct
 {
-	MToken pk = ml_peek(&p->lx);
-	if (pk.kind != M_LBRACKET)
-		return NODE_NULL;
-
-	// consume '['
-	(void)ml_next(&p->lx);
+	const char* str;
+	int len;
+} g_func_text[] = {
+	{ NULL, 0 }, // 0 (unused)
+	{ "sin", 3 }, // SYMC_FUNC_SIN
+	{ "cos", 3 }, // SYMC_FUNC_COS
+	{ "tan", 3 }, // SYMC_FUNC_TAN
+	{ "ln", 2 }, // SYMC_FUNC_LN
+	{ "lim", 3 }, // SYMC_FUNC_LIM
+	{ "log", 3 }, // SYMC_FUNC_LOG
+	{ "exp", 3 }, // SYMC_FUNC_EXP
+	{ "min", 3 }, // SYMC_FUNC_MIN
+	{ "max", 3 }, // SYMC_FUNC_MAX
+	{ "sup", 3 }, // SYMC_FUNC_SUP
+	{ "inf", 3 }, // SYMC_FUNC_INF
+	{ "det", 3 }, // SYMC_FUNC_DET
+	{ "gcd", 3 }, // SYMC_FUNC_GCD
+	{ "deg", 3 }, // SYMC_FUNC_DEG
+	{ "dim", 3 }, // SYMC_FUNC_DIM
+	{ "sec", 3 }, // SYMC_FUNC_SEC
+	{ "csc", 3 }, // SYMC_FUNC_CSC
+	{ "cot", 3 }, // SYMC_FUNC_COT
+	{ "arcsin", 6 }, // SYMC_FUNC_ARCSIN
+	{ "arccos", 6 }, // SYMC_FUNC_ARCCOS
+	{ "arctan", 6 }, // SYMC_FUNC_ARCTAN
+	{ "sinh", 4 }, // SYMC_FUNC_SINH
+	{ "cosh", 4 }, // SYMC_FUNC_COSH
+	{ "tanh", 4 }, // SYMC_FUNC_TANH
+	{ "arg", 3 }, // SYMC_FUNC_ARG
+	{ "ker", 3 }, // SYMC_FUNC_KER
+	{ "Pr", 2 }, // SYMC_FUNC_PR
+	{ "hom", 3 }, // SYMC_FUNC_HOM
+	{ "lg", 2 }, // SYMC_FUNC_LG
+	{ "coth", 4 }, // SYMC_FUNC_COTH
+};
+static const int func_names_count = (int)(sizeof(g_func_text) / sizeof(g_func_text[0]));
 
-	// depth guard
-	p->depth++;
-	if (p->depth > TEX_PARSE_MAX_DEPTH)
+static NodeRef parse_text_arg(Parser* p)
+{
+	// expect opening brace
+	MToken t = ml_peek(&p->lx);
+	if (t.kind != M_LBRACE)
 	{
-		TEX_SET_ERROR(p->L, TEX_ERR_DEPTH, "Maximum nesting depth exceeded in bracket arg", p->depth);
-		p->depth--;
+		TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "expected '{' after \\text", 0);
 		return NODE_NULL;
 	}
 
-	ListBuilder lb;
-	lb_init(&lb);
+	// consume '{'
+	ml_next(&p->lx);
 
-	// pending character run
-	const char* run_start = NULL;
-	int run_len = 0;
+	// scan raw content until '}' handling escapes
+	const char* start = p->lx.cur;
+	const char* cur = start;
+	int needs_unescape = 0;
 
-	while (1)
+	while (cur < p->lx.end)
 	{
-		MToken pk2 = ml_peek(&p->lx);
-		if (pk2.kind == M_RBRACKET)
+		if (*cur == '}')
 		{
-			(void)ml_next(&p->lx); // consume ']'
-			break;
-		}
-		if (pk2.kind == M_EOF)
-		{
-			TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Unclosed '[' in optional argument", 0);
-			p->depth--;
-			return NODE_NULL;
+			break; // found closing brace
 		}
-		if (TEX_HAS_ERROR(p->L))
-			break;
-
-		if (pk2.kind == M_CHAR)
+		if (*cur == '\\')
 		{
-			if (run_len == 0)
-			{
-				run_start = pk2.start;
-				run_len = 1;
-			}
-			else if (pk2.start == run_start + run_len)
-			{
-				run_len++;
-			}
-			else
+			needs_unescape = 1;
+			// skip next char (escape sequence)
+			if (cur + 1 < p->lx.end)
 			{
-				flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-				run_start = pk2.start;
-				run_len = 1;
+				cur += 2;
+				continue;
 			}
-			ml_next(&p->lx);
+		}
+		cur++;
+	}
 
-			MToken next = ml_peek(&p->lx);
-			if (is_script_marker(next.kind))
-			{
-				NodeRef base = NODE_NULL;
-				flush_char_run(p, run_start, run_len, 1, &lb, &base);
-				run_start = NULL;
-				run_len = 0;
+	if (cur >= p->lx.end)
+	{
+		TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Unclosed \\text argument", 0);
+		return NODE_NULL;
+	}
 
-				if (base != NODE_NULL)
-				{
-					base = attach_scripts(p, base);
-					lb_push(p, &lb, base);
-				}
-			}
-		}
-		else if (is_script_marker(pk2.kind))
-		{
-			flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-			run_start = NULL;
-			run_len = 0;
+	// length of the segment inside { ... }
+	int raw_len = (int)(cur - start);
 
-			ml_next(&p->lx);
-			NodeRef n = make_glyph(p, (pk2.kind == M_CARET) ? '^' : '_');
-			lb_push(p, &lb, n);
+	// create N_TEXT node
+	NodeRef ref = new_node(p, N_TEXT);
+	if (ref == NODE_NULL)
+		return NODE_NULL;
+	Node* n = pool_get_node(p->pool, ref);
+
+	if (needs_unescape)
+	{
+		// allocate unescaped length directly in pool then overwrite with correct content
+		int ulen = tex_util_unescaped_len(start, raw_len);
+		StringId sid = pool_alloc_string(p->pool, start, (size_t)ulen);
+		if (sid == STRING_NULL)
+		{
+			TEX_SET_ERROR(p->L, TEX_ERR_OOM, "OOM parsing \\text", 0);
+			return NODE_NULL;
 		}
-		else
+		// overwrite dummy copy with unescaped content
+		char* buf = (char*)(p->pool->slab + sid);
+		tex_util_copy_unescaped(buf, start, raw_len);
+		n->data.text.sid = sid;
+		n->data.text.len = (uint16_t)ulen;
+	}
+	else
+	{
+		// allocate copy in pool (strings must be in pool for serialization)
+		StringId sid = pool_alloc_string(p->pool, start, (size_t)raw_len);
+		if (sid == STRING_NULL)
 		{
-			flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-			run_start = NULL;
-			run_len = 0;
-
-			NodeRef item = parse_atom(p);
-			if (TEX_HAS_ERROR(p->L))
-			{
-				p->depth--;
-				return NODE_NULL;
-			}
-			if (item == NODE_NULL)
-				break;
-
-			lb_push(p, &lb, item);
+			TEX_SET_ERROR(p->L, TEX_ERR_OOM, "OOM parsing \\text", 0);
+			return NODE_NULL;
 		}
+		n->data.text.sid = sid;
+		n->data.text.len = (uint16_t)raw_len;
 	}
 
-	flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-
-	p->depth--;
-
-	// treat empty [] as no index
-	if (lb.head == LIST_NULL)
-		return NODE_NULL;
+	// manually advance lexer past the processed text and the closing '}'
+	p->lx.cur = cur + 1;
 
-	return wrap_group_list(p, lb.head);
+	return finish_node(p, ref);
 }
 
-// parse one atom without absorbing trailing ^/_ scripts
-static NodeRef parse_atom_noscript(Parser* p)
+// a base followed by ^ or _ gets a scripts frame, anything else is handed back as is
+static int begin_scripts(Parser* p, NodeRef base, const char* start)
 {
-	MToken t = ml_peek(&p->lx);
-	if (t.kind == M_LBRACE)
-		return parse_group(p);
-	if (t.kind == M_CMD)
-	{
-		(void)ml_next(&p->lx);
-		return parse_command(p, t.start, t.len);
-	}
-	if (t.kind == M_CHAR)
-	{
-		(void)ml_next(&p->lx);
-		return make_glyph(p, (uint8_t)*t.start);
-	}
-	if (t.kind == M_LBRACKET || t.kind == M_RBRACKET)
-	{
-		(void)ml_next(&p->lx);
-		// treat [ and ] as standard ASCII glyphs here
-		return make_glyph(p, (t.kind == M_LBRACKET) ? '[' : ']');
-	}
-	if (t.kind == M_CARET || t.kind == M_UNDER)
+	p->ret = base;
+	if (base == NODE_NULL || !is_script_marker(ml_peek(&p->lx).kind))
+		return 0;
+	PFrame* f = push_frame(p, PF_SCRIPTS, 0, 0, start);
+	if (!f)
 	{
-		(void)ml_next(&p->lx);
-		return make_glyph(p, (t.kind == M_CARET) ? '^' : '_');
+		p->ret = NODE_NULL;
+		return 0;
 	}
-	if (t.kind == M_RBRACE || t.kind == M_EOF)
-		return NODE_NULL;
-	(void)ml_next(&p->lx);
-	TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Unexpected token in math expression", 0);
-	return NODE_NULL;
+	f->u.scripts.base = base;
+	f->u.scripts.sub = NODE_NULL;
+	f->u.scripts.sup = NODE_NULL;
+	return 1;
 }
 
-static NodeRef parse_script_arg(Parser* p)
+static int deliver(Parser* p, NodeRef value, uint8_t ret, const char* start)
 {
-	MToken pk = ml_peek(&p->lx);
-	if (pk.kind == M_LBRACE)
-		return parse_group(p);
-	return parse_atom_noscript(p);
+	if (ret & RET_SPAN)
+		value = mark_span(p, value, start);
+	if (ret & RET_SCRIPTS)
+		return begin_scripts(p, value, start);
+	p->ret = value;
+	return 0;
 }
 
-// parse one matrix cell until delimiter (&, \\) or \end
-// returns NODE_NULL for empty cell, single NodeRef for singleitem cell,
-// or N_MATH wrapper for multiitem cell (memory optimization)
-static NodeRef parse_matrix_cell(Parser* p)
+// pop the top frame, its value goes to the frame below (through a scripts frame when ^ or _ follow)
+static void frame_return(Parser* p, NodeRef value)
 {
-	ListBuilder lb;
-	lb_init(&lb);
-
-	const char* run_start = NULL;
-	int run_len = 0;
-	int item_count = 0;
-	NodeRef first_item = NODE_NULL;
+	PFrame* f = top_frame(p);
+	uint8_t ret = f->ret;
+	const char* start = f->start;
+	pop_frame(p);
+	(void)deliver(p, value, ret, start);
+}
 
-	while (1)
+static int begin_list(Parser* p, ListMode mode, uint8_t ret)
+{
+	const char* start = NULL;
+	if (mode == LIST_GROUP)
 	{
-		MToken pk = ml_peek(&p->lx);
-
-		// stop on cell/row delimiters or environment end
-		if (pk.kind == M_AMPERSAND || pk.kind == M_DOUBLE_BACKSLASH || pk.kind == M_EOF || pk.kind == M_RBRACE)
-			break;
-
-		if (pk.kind == M_CMD && pk.len == 3 && strncmp(pk.start, "end", 3) == 0)
-			break;
-
-		if (TEX_HAS_ERROR(p->L))
-			break;
-
-		if (pk.kind == M_CHAR)
-		{
-			if (run_len == 0)
-			{
-				run_start = pk.start;
-				run_len = 1;
-			}
-			else if (pk.start == run_start + run_len)
-			{
-				run_len++;
-			}
-			else
-			{
-				flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-				if (item_count == 0 && lb.head != LIST_NULL)
-				{
-					TexListBlock* blk = pool_get_list_block(p->pool, lb.head);
-					if (blk && blk->count > 0)
-						first_item = blk->items[0];
-				}
-				item_count++;
-				run_start = pk.start;
-				run_len = 1;
-			}
-			ml_next(&p->lx);
-
-			MToken next = ml_peek(&p->lx);
-			if (is_script_marker(next.kind))
-			{
-				NodeRef base = NODE_NULL;
-				flush_char_run(p, run_start, run_len, 1, &lb, &base);
-				run_start = NULL;
-				run_len = 0;
-				if (base != NODE_NULL)
-				{
-					base = attach_scripts(p, base);
-					lb_push(p, &lb, base);
-					if (item_count == 0)
-						first_item = base;
-					item_count++;
-				}
-			}
-		}
-		else if (is_script_marker(pk.kind))
-		{
-			flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-			if (run_len > 0)
-			{
-				if (item_count == 0 && lb.head != LIST_NULL)
-				{
-					TexListBlock* blk = pool_get_list_block(p->pool, lb.head);
-					if (blk && blk->count > 0)
-						first_item = blk->items[0];
-				}
-				item_count++;
-			}
-			run_start = NULL;
-			run_len = 0;
-			ml_next(&p->lx);
-			NodeRef n = make_glyph(p, (pk.kind == M_CARET) ? '^' : '_');
-			lb_push(p, &lb, n);
-			if (item_count == 0)
-				first_item = n;
-			item_count++;
-		}
-		else
-		{
-			flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-			if (run_len > 0)
-			{
-				if (item_count == 0 && lb.head != LIST_NULL)
-				{
-					TexListBlock* blk = pool_get_list_block(p->pool, lb.head);
-					if (blk && blk->count > 0)
-						first_item = blk->items[0];
-				}
-				item_count++;
-			}
-			run_start = NULL;
-			run_len = 0;
-			NodeRef n = parse_atom(p);
-			if (n == NODE_NULL || TEX_HAS_ERROR(p->L))
-				break;
-			lb_push(p, &lb, n);
-			if (item_count == 0)
-				first_item = n;
-			item_count++;
-		}
+		// assumes next token is '{'
+		start = ml_next(&p->lx).start;
 	}
-
-	// flush any remaining characters
-	if (run_len > 0)
+	else if (mode == LIST_BRACKET)
 	{
-		flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-		if (item_count == 0 && lb.head != LIST_NULL)
-		{
-			TexListBlock* blk = pool_get_list_block(p->pool, lb.head);
-			if (blk && blk->count > 0)
-				first_item = blk->items[0];
-		}
-		item_count++;
+		// optional argument, NODE_NULL if not present
+		p->ret = NODE_NULL;
+		if (ml_peek(&p->lx).kind != M_LBRACKET)
+			return 0;
+		(void)ml_next(&p->lx); // consume '['
+		start = p->lx.cur;
+	}
+	else if (mode == LIST_CELL)
+	{
+		start = ml_peek(&p->lx).start;
 	}
 
-	// return directly if single item
-	if (item_count == 0)
-		return NODE_NULL;
-	if (item_count == 1)
-		return first_item;
-
-	// wrap in N_MATH
-	return wrap_group_list(p, lb.head);
+	PFrame* f = push_frame(p, PF_LIST, (uint8_t)mode, ret, start);
+	if (!f)
+	{
+		p->ret = NODE_NULL;
+		return 0;
+	}
+	// cells are gathered into the matrix grid, every other list is only aggregated
+	if (mode == LIST_CELL)
+		lb_init(&f->u.list.lb);
+	else
+		lb_init_folded(p, &f->u.list.lb);
+	f->u.list.first_item = NODE_NULL;
+	return 1;
 }
 
-// parse matrix body until \end, returns N_MATRIX node
-static NodeRef parse_matrix_env(Parser* p, DelimType delim_type)
+static int begin_cmd(Parser* p, CmdKind cmd, uint8_t code, uint8_t ret, const char* start)
 {
-	// IMPORTANT: parse all cells FIRST, then allocate the matrix node
-	// this makes sure cells are allocated before the matrix in the node pool,
-	// so when tex_measure_range iterates in allocation order, cells are
-	// measured before the matrix reads their dimensions
-
-	ListBuilder lb;
-	lb_init(&lb);
-
-	int row = 0;
-	int col = 0;
-	int max_cols = 0;
-
-	while (1)
+	PFrame* f = push_frame(p, PF_CMD, (uint8_t)cmd, ret, start);
+	if (!f)
 	{
-		MToken pk = ml_peek(&p->lx);
-		if (pk.kind == M_EOF)
-		{
-			TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Unclosed matrix environment", 0);
-			break;
-		}
-
-		if (pk.kind == M_CMD && pk.len == 3 && strncmp(pk.start, "end", 3) == 0)
-			break;
-
-
-		NodeRef cell = parse_matrix_cell(p);
-		lb_push(p, &lb, cell);
-		col++;
-
-		pk = ml_peek(&p->lx);
-		if (pk.kind == M_AMPERSAND)
-		{
-			ml_next(&p->lx); // consume &
-			// continue to next cell
-		}
-		else if (pk.kind == M_DOUBLE_BACKSLASH)
-		{
-			ml_next(&p->lx); // consume row separator
-			if (col > max_cols)
-				max_cols = col;
-			col = 0;
-			row++;
-		}
-		else
-		{
-			// end of env or error
-			if (col > max_cols)
-				max_cols = col;
-			row++;
-			break;
-		}
+		p->ret = NODE_NULL;
+		return 0;
 	}
-
-	// NOW allocate the matrix node (after all cells have been parsed/allocated)
-	NodeRef ref = new_node(p, N_MATRIX);
-	if (ref == NODE_NULL)
-		return NODE_NULL;
-
-	Node* n = pool_get_node(p->pool, ref);
-	n->data.matrix.delim_type = (uint8_t)delim_type;
-	n->data.matrix.cells = lb.head;
-	n->data.matrix.rows = (uint8_t)row;
-	n->data.matrix.cols = (uint8_t)max_cols;
-
-	return ref;
+	f->u.cmd.code = code;
+	f->u.cmd.a = NODE_NULL;
+	f->u.cmd.b = NODE_NULL;
+	f->u.cmd.ref = NODE_NULL;
+	return 1;
 }
 
-// parse \begin{env} ... \end{env}
-static NodeRef parse_environment(Parser* p)
+// \begin{env}, the matrix body is parsed by a CMD_MATRIX frame
+static int begin_environment(Parser* p, uint8_t ret, const char* start)
 {
+	p->ret = NODE_NULL;
+
 	// expect opening brace
 	MToken t = ml_peek(&p->lx);
 	if (t.kind != M_LBRACE)
 	{
 		TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "expected '{' after \\begin", 0);
-		return NODE_NULL;
+		return 0;
 	}
 	ml_next(&p->lx);
 
@@ -900,7 +909,7 @@ static NodeRef parse_environment(Parser* p)
 	if (ml_at_end(&p->lx))
 	{
 		TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Unclosed environment name", 0);
-		return NODE_NULL;
+		return 0;
 	}
 	++p->lx.cur; // consume '}'
 
@@ -956,7 +965,7 @@ static NodeRef parse_environment(Parser* p)
 				else if (c == '|')
 				{
 					// separator after previous column (if any columns exist)
-					if (col_count > 0 && col_count <= 8)
+					if (col_count > 0 && col_count <= TEX_MATRIX_MAX_SEPARATORS)
 					{
 						col_separators |= (uint8_t)(1 << (col_count - 1));
 					}
@@ -972,282 +981,38 @@ static NodeRef parse_environment(Parser* p)
 	if (!is_matrix)
 	{
 		// unknown
-		return make_text(p, name_start, (size_t)name_len);
-	}
-
-	// parse matrix body
-	NodeRef matrix = parse_matrix_env(p, delim);
-
-	// set column separators if any (for array environment)
-	if (matrix != NODE_NULL && col_separators != 0)
-	{
-		Node* n = pool_get_node(p->pool, matrix);
-		n->data.matrix.col_separators = col_separators;
-	}
-
-	// consume \end{...}
-	MToken end_tok = ml_peek(&p->lx);
-	if (end_tok.kind == M_CMD && end_tok.len == 3 && strncmp(end_tok.start, "end", 3) == 0)
-	{
-		ml_next(&p->lx); // consume \end
-
-		MToken brace = ml_peek(&p->lx);
-		if (brace.kind == M_LBRACE)
-		{
-			ml_next(&p->lx);
-
-			// skip to closing }
-			while (!ml_at_end(&p->lx) && *p->lx.cur != '}')
-				++p->lx.cur;
-			if (!ml_at_end(&p->lx))
-				++p->lx.cur; // consume }
-		}
+		return deliver(p, make_text(p, name_start, (size_t)name_len), ret, start);
 	}
 
-	return matrix;
+	PFrame* f = push_frame(p, PF_CMD, CMD_MATRIX, ret, start);
+	if (!f)
+		return 0;
+	lb_init(&f->u.matrix.lb);
+	f->u.matrix.delim = (uint8_t)delim;
+	f->u.matrix.col_separators = col_separators;
+	return 1;
 }
 
-
-static DelimType parse_delim_type(Parser* p)
+// a command, ret and start apply to its value
+static int begin_command(Parser* p, const char* name, int len, uint8_t ret, const char* start)
 {
-	MToken t = ml_next(&p->lx);
-	if (t.kind == M_CHAR)
+	SymbolDesc d;
+	memset(&d, 0, sizeof(d));
+	int found = texsym_find(name, (size_t)len, &d);
+
+	if (!found)
 	{
-		switch (*t.start)
-		{
-		case '(':
-		case ')':
-			return DELIM_PAREN;
-		case '[':
-		case ']':
-			return DELIM_BRACKET;
-		case '|':
-			return DELIM_VERT;
-		case '.':
-			return DELIM_NONE;
-		default:
-			break;
-		}
+		return deliver(p, make_text(p, name, (size_t)len), ret, start);
 	}
-	else if (t.kind == M_LBRACKET || t.kind == M_RBRACKET)
-	{
-		return DELIM_BRACKET;
-	}
-	else if (t.kind == M_CMD)
-	{
-		if (t.len == 1 && (*t.start == '{' || *t.start == '}'))
-			return DELIM_BRACE;
-		if (t.len == 4 && strncmp(t.start, "vert", 4) == 0)
-			return DELIM_VERT;
-		if (t.len == 5)
-		{
-			if (strncmp(t.start, "lceil", 5) == 0 || strncmp(t.start, "rceil", 5) == 0)
-				return DELIM_CEIL;
-		}
-		else if (t.len == 6)
-		{
-			switch (*t.start)
-			{
-			case 'l':
-				if (strncmp(t.start, "lbrace", 6) == 0)
-					return DELIM_BRACE;
-				if (strncmp(t.start, "langle", 6) == 0)
-					return DELIM_ANGLE;
-				if (strncmp(t.start, "lfloor", 6) == 0)
-					return DELIM_FLOOR;
-				break;
-			case 'r':
-				if (strncmp(t.start, "rbrace", 6) == 0)
-					return DELIM_BRACE;
-				if (strncmp(t.start, "rangle", 6) == 0)
-					return DELIM_ANGLE;
-				if (strncmp(t.start, "rfloor", 6) == 0)
-					return DELIM_FLOOR;
-				break;
-			default:
-				TEX_ASSERT(0 && "Unexpected first character in 6-char delimiter command");
-				break;
-			}
-		}
-	}
-	return DELIM_NONE;
-}
-
-// parse \left <delim> ... \right <delim> construct
-static NodeRef parse_auto_delim(Parser* p)
-{
-	DelimType l_type = parse_delim_type(p);
-
-	NodeRef content = parse_list_core(p, 1);
-
-	MToken t = ml_peek(&p->lx);
-	if (t.kind == M_CMD && t.len == 5 && strncmp(t.start, "right", 5) == 0)
-	{
-		ml_next(&p->lx);
-	}
-	else
-	{
-		TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Unbalanced \\left - missing \\right", 0);
-		return NODE_NULL;
-	}
-
-	DelimType r_type = parse_delim_type(p);
-
-	NodeRef ref = new_node(p, N_AUTO_DELIM);
-	if (ref == NODE_NULL)
-		return NODE_NULL;
-	Node* n = pool_get_node(p->pool, ref);
-	n->data.auto_delim.content = content;
-	n->data.auto_delim.left_type = (uint8_t)l_type;
-	n->data.auto_delim.right_type = (uint8_t)r_type;
-	return ref;
-}
-
-static const struct
-{
-	const char* str;
-	int len;
-} g_func_text[] = {
-	{ NULL, 0 }, // 0 (unused)
-	{ "sin", 3 }, // SYMC_FUNC_SIN
-	{ "cos", 3 }, // SYMC_FUNC_COS
-	{ "tan", 3 }, // SYMC_FUNC_TAN
-	{ "ln", 2 }, // SYMC_FUNC_LN
-	{ "lim", 3 }, // SYMC_FUNC_LIM
-	{ "log", 3 }, // SYMC_FUNC_LOG
-	{ "exp", 3 }, // SYMC_FUNC_EXP
-	{ "min", 3 }, // SYMC_FUNC_MIN
-	{ "max", 3 }, // SYMC_FUNC_MAX
-	{ "sup", 3 }, // SYMC_FUNC_SUP
-	{ "inf", 3 }, // SYMC_FUNC_INF
-	{ "det", 3 }, // SYMC_FUNC_DET
-	{ "gcd", 3 }, // SYMC_FUNC_GCD
-	{ "deg", 3 }, // SYMC_FUNC_DEG
-	{ "dim", 3 }, // SYMC_FUNC_DIM
-	{ "sec", 3 }, // SYMC_FUNC_SEC
-	{ "csc", 3 }, // SYMC_FUNC_CSC
-	{ "cot", 3 }, // SYMC_FUNC_COT
-	{ "arcsin", 6 }, // SYMC_FUNC_ARCSIN
-	{ "arccos", 6 }, // SYMC_FUNC_ARCCOS
-	{ "arctan", 6 }, // SYMC_FUNC_ARCTAN
-	{ "sinh", 4 }, // SYMC_FUNC_SINH
-	{ "cosh", 4 }, // SYMC_FUNC_COSH
-	{ "tanh", 4 }, // SYMC_FUNC_TANH
-	{ "arg", 3 }, // SYMC_FUNC_ARG
-	{ "ker", 3 }, // SYMC_FUNC_KER
-	{ "Pr", 2 }, // SYMC_FUNC_PR
-	{ "hom", 3 }, // SYMC_FUNC_HOM
-	{ "lg", 2 }, // SYMC_FUNC_LG
-	{ "coth", 4 }, // SYMC_FUNC_COTH
-};
-static const int func_names_count = (int)(sizeof(g_func_text) / sizeof(g_func_text[0]));
-
-static NodeRef parse_text_arg(Parser* p)
-{
-	// expect opening brace
-	MToken t = ml_peek(&p->lx);
-	if (t.kind != M_LBRACE)
-	{
-		TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "expected '{' after \\text", 0);
-		return NODE_NULL;
-	}
-
-	// consume '{'
-	ml_next(&p->lx);
-
-	// scan raw content until '}' handling escapes
-	const char* start = p->lx.cur;
-	const char* cur = start;
-	int needs_unescape = 0;
-
-	while (cur < p->lx.end)
-	{
-		if (*cur == '}')
-		{
-			break; // found closing brace
-		}
-		if (*cur == '\\')
-		{
-			needs_unescape = 1;
-			// skip next char (escape sequence)
-			if (cur + 1 < p->lx.end)
-			{
-				cur += 2;
-				continue;
-			}
-		}
-		cur++;
-	}
-
-	if (cur >= p->lx.end)
-	{
-		TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Unclosed \\text argument", 0);
-		return NODE_NULL;
-	}
-
-	// length of the segment inside { ... }
-	int raw_len = (int)(cur - start);
-
-	// create N_TEXT node
-	NodeRef ref = new_node(p, N_TEXT);
-	if (ref == NODE_NULL)
-		return NODE_NULL;
-	Node* n = pool_get_node(p->pool, ref);
-
-	if (needs_unescape)
-	{
-		// allocate unescaped length directly in pool then overwrite with correct content
-		int ulen = tex_util_unescaped_len(start, raw_len);
-		StringId sid = pool_alloc_string(p->pool, start, (size_t)ulen);
-		if (sid == STRING_NULL)
-		{
-			TEX_SET_ERROR(p->L, TEX_ERR_OOM, "OOM parsing \\text", 0);
-			return NODE_NULL;
-		}
-		// overwrite dummy copy with unescaped content
-		char* buf = (char*)(p->pool->slab + sid);
-		tex_util_copy_unescaped(buf, start, raw_len);
-		n->data.text.sid = sid;
-		n->data.text.len = (uint16_t)ulen;
-	}
-	else
-	{
-		// allocate copy in pool (strings must be in pool for serialization)
-		StringId sid = pool_alloc_string(p->pool, start, (size_t)raw_len);
-		if (sid == STRING_NULL)
-		{
-			TEX_SET_ERROR(p->L, TEX_ERR_OOM, "OOM parsing \\text", 0);
-			return NODE_NULL;
-		}
-		n->data.text.sid = sid;
-		n->data.text.len = (uint16_t)raw_len;
-	}
-
-	// manually advance lexer past the processed text and the closing '}'
-	p->lx.cur = cur + 1;
-
-	return ref;
-}
-
-static NodeRef parse_command(Parser* p, const char* name, int len)
-{
-	SymbolDesc d;
-	memset(&d, 0, sizeof(d));
-	int found = texsym_find(name, (size_t)len, &d);
-
-	if (!found)
-	{
-		return make_text(p, name, (size_t)len);
-	}
-	switch (d.kind)
+	switch (d.kind)
 	{
 	case SYM_GLYPH:
-		return make_glyph(p, d.code);
+		return deliver(p, make_glyph(p, d.code), ret, start);
 	case SYM_SPACE:
 		{
 			NodeRef ref = new_node(p, N_SPACE);
 			if (ref == NODE_NULL)
-				return NODE_NULL;
+				return deliver(p, NODE_NULL, ret, start);
 			Node* sp = pool_get_node(p->pool, ref);
 			int16_t w = 0;
 			if (d.code == SYMC_THINSPACE)
@@ -1269,21 +1034,10 @@ static NodeRef parse_command(Parser* p, const char* name, int len)
 				w = 0;
 			}
 			sp->data.space.width = w;
-			return ref;
+			return deliver(p, finish_node(p, ref), ret, start);
 		}
 	case SYM_ACCENT:
 		{
-			NodeRef base = NODE_NULL;
-			MToken pk = ml_peek(&p->lx);
-			if (pk.kind == M_LBRACE)
-				base = parse_group(p);
-			else
-				base = parse_atom(p);
-			NodeRef ref = new_node(p, N_OVERLAY);
-			if (ref == NODE_NULL)
-				return NODE_NULL;
-			Node* ov = pool_get_node(p->pool, ref);
-			ov->data.overlay.base = base;
 			// Map code -> AccentType
 			uint8_t at = 0;
 			if (d.code == SYMC_ACC_VEC)
@@ -1302,145 +1056,40 @@ static NodeRef parse_command(Parser* p, const char* name, int len)
 				at = ACC_UNDERLINE;
 			else if (d.code == SYMC_ACC_TILDE)
 				at = ACC_TILDE;
-			ov->data.overlay.type = at;
-			return ref;
+			return begin_cmd(p, CMD_ACCENT, at, ret, start);
 		}
 	case SYM_STRUCT:
 		{
 			if (d.code == SYMC_BEGIN)
 			{
-				return parse_environment(p);
+				return begin_environment(p, ret, start);
 			}
 			if (d.code == SYMC_END)
 			{
 				// orphan \end without matching \begin
 				TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Unexpected \\end without \\begin", 0);
-				return NODE_NULL;
+				return deliver(p, NODE_NULL, ret, start);
 			}
 			if (d.code == SYMC_TEXT)
 			{
-				return parse_text_arg(p);
+				return deliver(p, parse_text_arg(p), ret, start);
 			}
 			if (d.code == SYMC_FRAC)
 			{
-				// \frac{num}{den} - both args are script context
-				uint8_t saved_role = p->current_role;
-				p->current_role = 1; // FONTROLE_SCRIPT
-				NodeRef num = NODE_NULL;
-				NodeRef den = NODE_NULL;
-				if (ml_peek(&p->lx).kind == M_LBRACE)
-					num = parse_group(p);
-				else
-					num = parse_atom(p);
-				if (ml_peek(&p->lx).kind == M_LBRACE)
-					den = parse_group(p);
-				else
-					den = parse_atom(p);
-				p->current_role = saved_role;
-				NodeRef ref = new_node(p, N_FRAC);
-				if (ref == NODE_NULL)
-					return NODE_NULL;
-				Node* f = pool_get_node(p->pool, ref);
-				f->data.frac.num = num;
-				f->data.frac.den = den;
-				return ref;
+				return begin_cmd(p, CMD_FRAC, 0, ret, start);
 			}
 			if (d.code == SYMC_BINOM)
 			{
-				uint8_t saved_role = p->current_role;
-				p->current_role = 1; // FONTROLE_SCRIPT
-				NodeRef num = NODE_NULL;
-				NodeRef den = NODE_NULL;
-				if (ml_peek(&p->lx).kind == M_LBRACE)
-					num = parse_group(p);
-				else
-					num = parse_atom(p);
-				if (ml_peek(&p->lx).kind == M_LBRACE)
-					den = parse_group(p);
-				else
-					den = parse_atom(p);
-				p->current_role = saved_role;
-
-				ListBuilder lb;
-				lb_init(&lb);
-				lb_push(p, &lb, num);
-				lb_push(p, &lb, den);
-
-				NodeRef ref = new_node(p, N_MATRIX);
-				if (ref == NODE_NULL)
-					return NODE_NULL;
-				Node* n = pool_get_node(p->pool, ref);
-				n->data.matrix.delim_type = (uint8_t)DELIM_PAREN;
-				n->data.matrix.cells = lb.head;
-				n->data.matrix.rows = 2;
-				n->data.matrix.cols = 1;
-				n->data.matrix.col_separators = 0;
-				return ref;
+				return begin_cmd(p, CMD_BINOM, 0, ret, start);
 			}
-			else if (d.code == SYMC_SQRT)
+			if (d.code == SYMC_SQRT)
 			{
-				// index is script context
-				uint8_t saved_role = p->current_role;
-				p->current_role = 1; // FONTROLE_SCRIPT
-				NodeRef index = parse_optional_bracket_arg(p);
-				p->current_role = saved_role;
-				if (TEX_HAS_ERROR(p->L))
-					return NODE_NULL;
-
-				// radicand inherits current role
-				NodeRef rad = NODE_NULL;
-				MToken pk2 = ml_peek(&p->lx);
-				if (pk2.kind == M_LBRACE)
-				{
-					rad = parse_group(p);
-				}
-				else if (pk2.kind == M_EOF || pk2.kind == M_RBRACE)
-				{
-					TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Missing argument for \\sqrt", 0);
-					return NODE_NULL;
-				}
-				else
-				{
-					rad = parse_atom(p);
-				}
-				if (TEX_HAS_ERROR(p->L))
-					return NODE_NULL;
-				NodeRef ref = new_node(p, N_SQRT);
-				if (ref == NODE_NULL)
-					return NODE_NULL;
-				Node* s = pool_get_node(p->pool, ref);
-				s->data.sqrt.rad = rad;
-				s->data.sqrt.index = index; // NODE_NULL if not provided
-				return ref;
+				return begin_cmd(p, CMD_SQRT, 0, ret, start);
 			}
-			else if (d.code == SYMC_OVERBRACE || d.code == SYMC_UNDERBRACE)
+			if (d.code == SYMC_OVERBRACE || d.code == SYMC_UNDERBRACE)
 			{
-				NodeRef content = NODE_NULL;
-				MToken pk = ml_peek(&p->lx);
-				if (pk.kind == M_LBRACE)
-					content = parse_group(p);
-				else
-					content = parse_atom(p);
-
-				NodeRef ref = new_node(p, N_SPANDECO);
-				if (ref == NODE_NULL)
-					return NODE_NULL;
-				Node* n = pool_get_node(p->pool, ref);
-				n->data.spandeco.content = content;
-				n->data.spandeco.label = NODE_NULL;
-				n->data.spandeco.deco_type = (d.code == SYMC_OVERBRACE) ? DECO_OVERBRACE : DECO_UNDERBRACE;
-
-				// ^ for overbrace, _ for underbrace, label is script context
-				MToken k = ml_peek(&p->lx);
-				if ((d.code == SYMC_OVERBRACE && k.kind == M_CARET) || (d.code == SYMC_UNDERBRACE && k.kind == M_UNDER))
-				{
-					(void)ml_next(&p->lx);
-					uint8_t saved_role = p->current_role;
-					p->current_role = 1; // FONTROLE_SCRIPT
-					n->data.spandeco.label = parse_script_arg(p);
-					p->current_role = saved_role;
-				}
-				return ref;
+				uint8_t deco = (d.code == SYMC_OVERBRACE) ? DECO_OVERBRACE : DECO_UNDERBRACE;
+				return begin_cmd(p, CMD_BRACE, deco, ret, start);
 			}
 			break;
 		}
@@ -1449,22 +1098,7 @@ static NodeRef parse_command(Parser* p, const char* name, int len)
 			// functions render as upright text, lim is special with under-limit
 			if (d.code == SYMC_FUNC_LIM)
 			{
-				NodeRef ref = new_node(p, N_FUNC_LIM);
-				if (ref == NODE_NULL)
-					return NODE_NULL;
-				Node* lim = pool_get_node(p->pool, ref);
-				// optional under-limit
-				MToken pk = ml_peek(&p->lx);
-				if (pk.kind == M_UNDER)
-				{
-					(void)ml_next(&p->lx);
-					uint8_t saved_role = p->current_role;
-					p->current_role = 1; // FONTROLE_SCRIPT
-					NodeRef arg = parse_script_arg(p);
-					p->current_role = saved_role;
-					lim->data.func_lim.limit = arg;
-				}
-				return ref;
+				return begin_cmd(p, CMD_LIM, 0, ret, start);
 			}
 
 			if (d.code > 0 && d.code < func_names_count)
@@ -1475,18 +1109,18 @@ static NodeRef parse_command(Parser* p, const char* name, int len)
 				{
 					NodeRef ref = new_node(p, N_TEXT);
 					if (ref == NODE_NULL)
-						return NODE_NULL;
+						return deliver(p, NODE_NULL, ret, start);
 					Node* n = pool_get_node(p->pool, ref);
 					// for function names, allocate in pool
 					StringId sid = pool_alloc_string(p->pool, g_func_text[d.code].str, (size_t)g_func_text[d.code].len);
 					if (sid == STRING_NULL)
 					{
 						TEX_SET_ERROR(p->L, TEX_ERR_OOM, "OOM allocating function name", 0);
-						return NODE_NULL;
+						return deliver(p, NODE_NULL, ret, start);
 					}
 					n->data.text.sid = sid;
 					n->data.text.len = (uint16_t)g_func_text[d.code].len;
-					return ref;
+					return deliver(p, finish_node(p, ref), ret, start);
 				}
 			}
 			break;
@@ -1518,164 +1152,691 @@ static NodeRef parse_command(Parser* p, const char* name, int len)
 				op_type = MULTIOP_OINT;
 			}
 
-			return make_multiop(p, count, op_type);
+			return deliver(p, make_multiop(p, count, op_type), ret, start);
 		}
 	case SYM_DELIM_MOD:
 		{
 			if (len == 4 && strncmp(name, "left", 4) == 0)
 			{
-				return parse_auto_delim(p);
+				return begin_cmd(p, CMD_LEFT, 0, ret, start);
 			}
 			// Orphan \right is an error
 			TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Unexpected \\right without \\left", 0);
-			return NODE_NULL;
+			return deliver(p, NODE_NULL, ret, start);
 		}
 	case SYM_NONE:
 		break;
 	}
 	// fallback to literal text
-	return make_text(p, name, (size_t)len);
+	return deliver(p, make_text(p, name, (size_t)len), ret, start);
 }
 
-static NodeRef parse_atom(Parser* p)
+// one atom, with the ^ and _ that follow it when scripts is set
+static int begin_atom(Parser* p, int scripts)
 {
+	uint8_t attach = scripts ? RET_SCRIPTS : 0;
 	MToken t = ml_peek(&p->lx);
 	if (t.kind == M_LBRACE)
 	{
-		return attach_scripts(p, parse_group(p));
+		return begin_list(p, LIST_GROUP, attach);
 	}
 	if (t.kind == M_CMD)
 	{
 		(void)ml_next(&p->lx);
-		return attach_scripts(p, parse_command(p, t.start, t.len));
+		return begin_command(p, t.start, t.len, RET_SPAN | attach, t.start - 1); // include the backslash
 	}
 	if (t.kind == M_CHAR)
 	{
 		(void)ml_next(&p->lx);
-		NodeRef n = make_glyph(p, (uint8_t)*t.start);
-		return attach_scripts(p, n);
+		return deliver(p, make_glyph(p, (uint8_t)*t.start), RET_SPAN | attach, t.start);
 	}
 	if (t.kind == M_LBRACKET || t.kind == M_RBRACKET)
 	{
 		(void)ml_next(&p->lx);
-		NodeRef n = make_glyph(p, (t.kind == M_LBRACKET) ? '[' : ']');
-		return attach_scripts(p, n);
+		// treat [ and ] as standard ASCII glyphs here
+		return deliver(p, make_glyph(p, (t.kind == M_LBRACKET) ? '[' : ']'), attach, t.start);
 	}
+	p->ret = NODE_NULL;
 	if (t.kind == M_CARET || t.kind == M_UNDER)
 	{
 		(void)ml_next(&p->lx);
-		NodeRef n = make_glyph(p, (t.kind == M_CARET) ? '^' : '_');
-		return n;
+		p->ret = make_glyph(p, (t.kind == M_CARET) ? '^' : '_');
+		return 0;
 	}
-	if (t.kind == M_RBRACE)
+	if (t.kind == M_RBRACE || t.kind == M_EOF)
 	{
 		// caller handles '}'
-		return NODE_NULL;
+		return 0;
 	}
-	if (t.kind == M_EOF)
-		return NODE_NULL;
-
 	(void)ml_next(&p->lx);
 	TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Unexpected token in math expression", 0);
-	return NODE_NULL;
+	return 0;
 }
 
-static ListId parse_list_core(Parser* p, int stop_on_right)
+// argument of a command: a group, or a single atom with its scripts
+static int begin_arg(Parser* p)
 {
-	ListBuilder lb;
-	lb_init(&lb);
+	if (ml_peek(&p->lx).kind == M_LBRACE)
+		return begin_list(p, LIST_GROUP, 0);
+	return begin_atom(p, 1);
+}
 
-	// pending run of contiguous ASCII characters
-	const char* run_start = NULL;
-	int run_len = 0;
+// argument of ^ and _: a group, or a single atom
+static int begin_script_arg(Parser* p)
+{
+	if (ml_peek(&p->lx).kind == M_LBRACE)
+		return begin_list(p, LIST_GROUP, 0);
+	return begin_atom(p, 0);
+}
 
-	while (1)
+// cells return their only item as is, a character run counts as one item once flushed
+static void count_item(Parser* p, PFrame* f, NodeRef item)
+{
+	if (f->mode != LIST_CELL)
+		return;
+	if (f->u.list.item_count == 0)
+	{
+		if (item == NODE_NULL && f->u.list.lb.head != LIST_NULL)
+		{
+			TexListBlock* blk = pool_get_list_block(p->pool, f->u.list.lb.head);
+			if (blk && blk->count > 0)
+				item = blk->items[0];
+		}
+		f->u.list.first_item = item;
+	}
+	f->u.list.item_count++;
+}
+
+static void flush_run(Parser* p, PFrame* f)
+{
+	flush_char_run(p, f->u.list.run_start, f->u.list.run_len, 0, &f->u.list.lb, NULL);
+	if (f->u.list.run_len > 0)
+		count_item(p, f, NODE_NULL);
+	f->u.list.run_start = NULL;
+	f->u.list.run_len = 0;
+}
+
+static int list_ends(Parser* p, PFrame* f, MToken pk)
+{
+	switch (f->mode)
+	{
+	case LIST_GROUP:
+		if (pk.kind == M_RBRACE)
+			(void)ml_next(&p->lx); // consume '}'
+		return pk.kind == M_RBRACE || pk.kind == M_EOF;
+	case LIST_BRACKET:
+		if (pk.kind == M_RBRACKET)
+			(void)ml_next(&p->lx); // consume ']'
+		else if (pk.kind == M_EOF)
+			TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Unclosed '[' in optional argument", 0);
+		return pk.kind == M_RBRACKET || pk.kind == M_EOF;
+	case LIST_CELL:
+		// stop on cell/row delimiters or environment end
+		if (pk.kind == M_AMPERSAND || pk.kind == M_DOUBLE_BACKSLASH)
+			return 1;
+		if (pk.kind == M_CMD && pk.len == 3 && strncmp(pk.start, "end", 3) == 0)
+			return 1;
+		return pk.kind == M_EOF || pk.kind == M_RBRACE;
+	case LIST_RIGHT:
+		if (pk.kind == M_CMD && pk.len == 5 && strncmp(pk.start, "right", 5) == 0)
+			return 1;
+		return pk.kind == M_EOF || pk.kind == M_RBRACE;
+	default:
+		return pk.kind == M_EOF || pk.kind == M_RBRACE;
+	}
+}
+
+// value of a finished list
+static void list_return(Parser* p, PFrame* f)
+{
+	ListId head = f->u.list.lb.head;
+	const char* start = f->start;
+	switch (f->mode)
+	{
+	case LIST_GROUP:
+		frame_return(p, mark_span(p, wrap_group_list(p, head), start));
+		return;
+	case LIST_BRACKET:
+		// treat empty [] as no index, the span covers the content only, like a formula it starts at its first item
+		if (head == LIST_NULL)
+			frame_return(p, NODE_NULL);
+		else
+			frame_return(p, set_span(p, wrap_group_list(p, head), start, (int)(p->lx.cur - start) - 1));
+		return;
+	case LIST_CELL:
+		// NODE_NULL for an empty cell, a single item as is, N_MATH wrapper for several (memory optimization)
+		if (f->u.list.item_count == 0)
+			frame_return(p, NODE_NULL);
+		else if (f->u.list.item_count == 1)
+			frame_return(p, f->u.list.first_item);
+		else
+			frame_return(p, mark_span(p, wrap_group_list(p, head), start));
+		return;
+	default:
+		frame_return(p, (NodeRef)head);
+		return;
+	}
+}
+
+// items up to the end of the list, character runs are gathered into text nodes
+static void step_list(Parser* p, PFrame* f)
+{
+	if (f->stage != 0)
+	{
+		// a scripted character or an atom returned, nothing ends the list
+		f->stage = 0;
+		if (p->ret == NODE_NULL)
+		{
+			flush_run(p, f);
+			list_return(p, f);
+			return;
+		}
+		lb_push(p, &f->u.list.lb, p->ret);
+		count_item(p, f, p->ret);
+	}
+
+	while (!TEX_HAS_ERROR(p->L))
 	{
 		MToken pk = ml_peek(&p->lx);
-		if (pk.kind == M_EOF || pk.kind == M_RBRACE)
-			break;
-		// Stop when we encounter \right (if stop_on_right is set)
-		if (stop_on_right && pk.kind == M_CMD && pk.len == 5 && strncmp(pk.start, "right", 5) == 0)
-			break;
-		if (TEX_HAS_ERROR(p->L))
+		if (list_ends(p, f, pk))
 			break;
 
 		if (pk.kind == M_CHAR)
 		{
 			// accumulate character into pending run
-			if (run_len == 0)
+			if (f->u.list.run_len == 0)
 			{
-				run_start = pk.start;
-				run_len = 1;
+				f->u.list.run_start = pk.start;
+				f->u.list.run_len = 1;
 			}
-			else if (pk.start == run_start + run_len)
+			else if (pk.start == f->u.list.run_start + f->u.list.run_len)
 			{
 				// contiguous in source buffer
-				run_len++;
+				f->u.list.run_len++;
 			}
 			else
 			{
 				// noncontiguous: flush current run, start new one
-				flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-				run_start = pk.start;
-				run_len = 1;
+				flush_run(p, f);
+				f->u.list.run_start = pk.start;
+				f->u.list.run_len = 1;
 			}
 			ml_next(&p->lx); // consume the character token
 
-			// check if a script marker follows this character
-			MToken next = ml_peek(&p->lx);
-			if (is_script_marker(next.kind))
+			// script follows: flush run with last char as script base
+			if (is_script_marker(ml_peek(&p->lx).kind))
 			{
-				// script follows: flush run with last char as script base
 				NodeRef base = NODE_NULL;
-				flush_char_run(p, run_start, run_len, 1, &lb, &base);
-				run_start = NULL;
-				run_len = 0;
-
-				// attach scripts to the base glyph
-				if (base != NODE_NULL)
-				{
-					base = attach_scripts(p, base);
-					lb_push(p, &lb, base);
-				}
+				const char* base_start = f->u.list.run_start + f->u.list.run_len - 1;
+				flush_char_run(p, f->u.list.run_start, f->u.list.run_len, 1, &f->u.list.lb, &base);
+				f->u.list.run_start = NULL;
+				f->u.list.run_len = 0;
+				if (base == NODE_NULL)
+					continue;
+
+				f->stage = 1;
+				if (begin_scripts(p, base, base_start))
+					return;
+				f->stage = 0;
+				lb_push(p, &f->u.list.lb, p->ret);
+				count_item(p, f, p->ret);
 			}
-			// else: continue accumulating
 		}
 		else if (is_script_marker(pk.kind))
 		{
 			// script marker without preceding character (standalone ^ or _)
-			flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-			run_start = NULL;
-			run_len = 0;
-
+			flush_run(p, f);
 			ml_next(&p->lx);
 			NodeRef n = make_glyph(p, (pk.kind == M_CARET) ? '^' : '_');
-			lb_push(p, &lb, n);
+			lb_push(p, &f->u.list.lb, n);
+			count_item(p, f, n);
 		}
 		else
 		{
 			// other token
-			flush_char_run(p, run_start, run_len, 0, &lb, NULL);
-			run_start = NULL;
-			run_len = 0;
+			flush_run(p, f);
+			f->stage = 2;
+			if (begin_atom(p, 1))
+				return;
+			f->stage = 0;
+			if (TEX_HAS_ERROR(p->L) || p->ret == NODE_NULL)
+				break;
+			lb_push(p, &f->u.list.lb, p->ret);
+			count_item(p, f, p->ret);
+		}
+	}
+
+	if (TEX_HAS_ERROR(p->L))
+		return;
+	flush_run(p, f);
+	list_return(p, f);
+}
 
-			NodeRef n = parse_atom(p);
-			if (TEX_HAS_ERROR(p->L) || n == NODE_NULL)
+// ^ and _ after a base, each script once
+static void step_scripts(Parser* p, PFrame* f)
+{
+	if (f->stage != 0)
+	{
+		// a script argument returned
+		p->current_role = f->role;
+		if (f->stage == 1)
+			f->u.scripts.sup = p->ret;
+		else
+			f->u.scripts.sub = p->ret;
+		f->stage = 0;
+		if (p->ret == NODE_NULL)
+		{
+			TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Missing argument for superscript/subscript", 0);
+			return;
+		}
+	}
+
+	MToken k = ml_peek(&p->lx);
+	while (is_script_marker(k.kind))
+	{
+		(void)ml_next(&p->lx);
+		NodeRef* script = (k.kind == M_CARET) ? &f->u.scripts.sup : &f->u.scripts.sub;
+		if (*script == NODE_NULL)
+		{
+			f->role = p->current_role;
+			p->current_role = 1; // FONTROLE_SCRIPT
+			f->stage = (k.kind == M_CARET) ? 1 : 2;
+			if (begin_script_arg(p))
+				return;
+			p->current_role = f->role;
+			f->stage = 0;
+			*script = p->ret;
+		}
+		if (*script == NODE_NULL)
+		{
+			TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Missing argument for superscript/subscript", 0);
+			return;
+		}
+		k = ml_peek(&p->lx);
+	}
+
+	NodeRef ref = new_node(p, N_SCRIPT);
+	if (ref == NODE_NULL)
+		return;
+	Node* s = pool_get_node(p->pool, ref);
+	s->data.script.base = f->u.scripts.base;
+	s->data.script.sub = f->u.scripts.sub;
+	s->data.script.sup = f->u.scripts.sup;
+	frame_return(p, finish_node(p, mark_span(p, ref, f->start)));
+}
+
+static void step_accent(Parser* p, PFrame* f)
+{
+	if (f->stage == 0)
+	{
+		f->stage = 1;
+		if (begin_arg(p))
+			return;
+	}
+	NodeRef base = p->ret;
+	NodeRef ref = new_node(p, N_OVERLAY);
+	if (ref == NODE_NULL)
+		return;
+	Node* ov = pool_get_node(p->pool, ref);
+	ov->data.overlay.base = base;
+	ov->data.overlay.type = f->u.cmd.code;
+	frame_return(p, finish_node(p, ref));
+}
+
+// \frac{num}{den} and \binom{n}{k}, both args are script context
+static void step_frac(Parser* p, PFrame* f)
+{
+	if (f->stage == 0)
+	{
+		f->role = p->current_role;
+		p->current_role = 1; // FONTROLE_SCRIPT
+		f->stage = 1;
+		if (begin_arg(p))
+			return;
+	}
+	if (f->stage == 1)
+	{
+		f->u.cmd.a = p->ret;
+		f->stage = 2;
+		if (begin_arg(p))
+			return;
+	}
+	NodeRef num = f->u.cmd.a;
+	NodeRef den = p->ret;
+	p->current_role = f->role;
+
+	if (f->mode == CMD_FRAC)
+	{
+		NodeRef ref = new_node(p, N_FRAC);
+		if (ref == NODE_NULL)
+			return;
+		Node* n = pool_get_node(p->pool, ref);
+		n->data.frac.num = num;
+		n->data.frac.den = den;
+		frame_return(p, finish_node(p, ref));
+		return;
+	}
+
+	ListBuilder lb;
+	lb_init(&lb);
+	lb_push(p, &lb, num);
+	lb_push(p, &lb, den);
+
+	StringId grid = alloc_matrix_grid(p, lb.head, 2, 1);
+	NodeRef ref = new_node(p, N_MATRIX);
+	if (ref == NODE_NULL)
+		return;
+	Node* n = pool_get_node(p->pool, ref);
+	n->data.matrix.delim_type = (uint8_t)DELIM_PAREN;
+	n->data.matrix.grid = grid;
+	n->data.matrix.rows = 2;
+	n->data.matrix.cols = 1;
+	n->data.matrix.col_separators = 0;
+	frame_return(p, finish_node(p, ref));
+}
+
+static void step_sqrt(Parser* p, PFrame* f)
+{
+	if (f->stage == 0)
+	{
+		// index is script context
+		f->role = p->current_role;
+		p->current_role = 1; // FONTROLE_SCRIPT
+		f->stage = 1;
+		if (begin_list(p, LIST_BRACKET, 0))
+			return;
+	}
+	if (f->stage == 1)
+	{
+		f->u.cmd.a = p->ret;
+		p->current_role = f->role;
+		if (TEX_HAS_ERROR(p->L))
+			return;
+
+		// radicand inherits current role
+		MToken pk = ml_peek(&p->lx);
+		if (pk.kind == M_EOF || pk.kind == M_RBRACE)
+		{
+			TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Missing argument for \\sqrt", 0);
+			return;
+		}
+		f->stage = 2;
+		int nested = (pk.kind == M_LBRACE) ? begin_list(p, LIST_GROUP, 0) : begin_atom(p, 1);
+		if (nested)
+			return;
+	}
+	NodeRef rad = p->ret;
+	NodeRef ref = new_node(p, N_SQRT);
+	if (ref == NODE_NULL)
+		return;
+	Node* s = pool_get_node(p->pool, ref);
+	s->data.sqrt.rad = rad;
+	s->data.sqrt.index = f->u.cmd.a; // NODE_NULL if not provided
+	frame_return(p, finish_node(p, ref));
+}
+
+// \overbrace and \underbrace, the node is allocated ahead of its label
+static void step_brace(Parser* p, PFrame* f)
+{
+	if (f->stage == 0)
+	{
+		f->stage = 1;
+		if (begin_arg(p))
+			return;
+	}
+	if (f->stage == 1)
+	{
+		NodeRef content = p->ret;
+		NodeRef ref = new_node(p, N_SPANDECO);
+		if (ref == NODE_NULL)
+			return;
+		Node* n = pool_get_node(p->pool, ref);
+		n->data.spandeco.content = content;
+		n->data.spandeco.label = NODE_NULL;
+		n->data.spandeco.deco_type = f->u.cmd.code;
+		f->u.cmd.ref = ref;
+
+		// ^ for overbrace, _ for underbrace, label is script context
+		MToken k = ml_peek(&p->lx);
+		if ((f->u.cmd.code == DECO_OVERBRACE && k.kind == M_CARET) ||
+		    (f->u.cmd.code == DECO_UNDERBRACE && k.kind == M_UNDER))
+		{
+			(void)ml_next(&p->lx);
+			f->role = p->current_role;
+			p->current_role = 1; // FONTROLE_SCRIPT
+			f->stage = 2;
+			if (begin_script_arg(p))
+				return;
+		}
+		else
+		{
+			frame_return(p, finish_node(p, ref));
+			return;
+		}
+	}
+	p->current_role = f->role;
+	pool_get_node(p->pool, f->u.cmd.ref)->data.spandeco.label = p->ret;
+	frame_return(p, finish_node(p, f->u.cmd.ref));
+}
+
+// \lim with an optional under-limit
+static void step_lim(Parser* p, PFrame* f)
+{
+	if (f->stage == 0)
+	{
+		NodeRef ref = new_node(p, N_FUNC_LIM);
+		if (ref == NODE_NULL)
+			return;
+		f->u.cmd.ref = ref;
+		if (ml_peek(&p->lx).kind != M_UNDER)
+		{
+			frame_return(p, finish_node(p, ref));
+			return;
+		}
+		(void)ml_next(&p->lx);
+		f->role = p->current_role;
+		p->current_role = 1; // FONTROLE_SCRIPT
+		f->stage = 1;
+		if (begin_script_arg(p))
+			return;
+	}
+	p->current_role = f->role;
+	pool_get_node(p->pool, f->u.cmd.ref)->data.func_lim.limit = p->ret;
+	frame_return(p, finish_node(p, f->u.cmd.ref));
+}
+
+// \left <delim> ... \right <delim>
+static void step_left(Parser* p, PFrame* f)
+{
+	if (f->stage == 0)
+	{
+		f->u.cmd.code = (uint8_t)parse_delim_type(p);
+		f->stage = 1;
+		if (begin_list(p, LIST_RIGHT, 0))
+			return;
+	}
+	NodeRef content = p->ret;
+
+	MToken t = ml_peek(&p->lx);
+	if (t.kind == M_CMD && t.len == 5 && strncmp(t.start, "right", 5) == 0)
+	{
+		ml_next(&p->lx);
+	}
+	else
+	{
+		TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Unbalanced \\left - missing \\right", 0);
+		return;
+	}
+
+	DelimType r_type = parse_delim_type(p);
+
+	NodeRef ref = new_node(p, N_AUTO_DELIM);
+	if (ref == NODE_NULL)
+		return;
+	Node* n = pool_get_node(p->pool, ref);
+	n->data.auto_delim.content = content;
+	n->data.auto_delim.left_type = f->u.cmd.code;
+	n->data.auto_delim.right_type = (uint8_t)r_type;
+	frame_return(p, finish_node(p, ref));
+}
+
+// matrix body until \end, cells are parsed FIRST and the N_MATRIX node allocated after them,
+// so when tex_measure_range iterates in allocation order, cells are measured before the matrix
+static void step_matrix(Parser* p, PFrame* f)
+{
+	int done = 0;
+	while (!done)
+	{
+		if (f->stage == 0)
+		{
+			MToken pk = ml_peek(&p->lx);
+			if (pk.kind == M_EOF)
+			{
+				TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Unclosed matrix environment", 0);
+				return;
+			}
+			if (pk.kind == M_CMD && pk.len == 3 && strncmp(pk.start, "end", 3) == 0)
 				break;
-			lb_push(p, &lb, n);
+
+			f->stage = 1;
+			if (begin_list(p, LIST_CELL, 0))
+				return;
+			if (TEX_HAS_ERROR(p->L))
+				return;
+		}
+		f->stage = 0;
+		lb_push(p, &f->u.matrix.lb, p->ret);
+		f->u.matrix.col++;
+
+		MToken pk = ml_peek(&p->lx);
+		if (pk.kind == M_AMPERSAND)
+		{
+			ml_next(&p->lx); // consume &
+		}
+		else
+		{
+			if (pk.kind == M_DOUBLE_BACKSLASH)
+				ml_next(&p->lx); // consume row separator
+			else
+				done = 1; // end of env or error
+			if (f->u.matrix.col > f->u.matrix.max_cols)
+				f->u.matrix.max_cols = f->u.matrix.col;
+			f->u.matrix.col = 0;
+			f->u.matrix.row++;
+		}
+	}
+
+	int row = f->u.matrix.row;
+	int max_cols = f->u.matrix.max_cols;
+	if (row > TEX_MATRIX_MAX_DIMS || max_cols > TEX_MATRIX_MAX_DIMS)
+	{
+		TEX_SET_ERROR(p->L, TEX_ERR_PARSE, "Matrix has too many rows or columns", TEX_MAX(row, max_cols));
+		return;
+	}
+	StringId grid = alloc_matrix_grid(p, f->u.matrix.lb.head, row, max_cols);
+
+	NodeRef ref = new_node(p, N_MATRIX);
+	if (ref == NODE_NULL)
+		return;
+
+	Node* n = pool_get_node(p->pool, ref);
+	n->data.matrix.delim_type = f->u.matrix.delim;
+	n->data.matrix.grid = grid;
+	n->data.matrix.rows = (uint8_t)row;
+	n->data.matrix.cols = (uint8_t)max_cols;
+	n->data.matrix.col_separators = f->u.matrix.col_separators;
+
+	// consume \end{...}
+	MToken end_tok = ml_peek(&p->lx);
+	if (end_tok.kind == M_CMD && end_tok.len == 3 && strncmp(end_tok.start, "end", 3) == 0)
+	{
+		ml_next(&p->lx); // consume \end
+
+		MToken brace = ml_peek(&p->lx);
+		if (brace.kind == M_LBRACE)
+		{
+			ml_next(&p->lx);
+
+			// skip to closing }
+			while (!ml_at_end(&p->lx) && *p->lx.cur != '}')
+				++p->lx.cur;
+			if (!ml_at_end(&p->lx))
+				++p->lx.cur; // consume }
 		}
 	}
 
-	// flush any remaining accumulated characters
-	flush_char_run(p, run_start, run_len, 0, &lb, NULL);
+	frame_return(p, finish_node(p, ref));
+}
+
+static void step_cmd(Parser* p, PFrame* f)
+{
+	switch (f->mode)
+	{
+	case CMD_ACCENT:
+		step_accent(p, f);
+		break;
+	case CMD_FRAC:
+	case CMD_BINOM:
+		step_frac(p, f);
+		break;
+	case CMD_SQRT:
+		step_sqrt(p, f);
+		break;
+	case CMD_BRACE:
+		step_brace(p, f);
+		break;
+	case CMD_LIM:
+		step_lim(p, f);
+		break;
+	case CMD_LEFT:
+		step_left(p, f);
+		break;
+	default:
+		step_matrix(p, f);
+		break;
+	}
+}
 
-	return lb.head;
+// resume the top frame until the stack is empty, the outermost list's value is left in p->ret.
+// Every step either pushes a frame, returns its value to the frame below or leaves an error,
+// so the formula could be paused between two steps; on error the stack is dropped
+static void run(Parser* p)
+{
+	while (p->top > 0)
+	{
+		if (TEX_HAS_ERROR(p->L))
+		{
+			p->top = 0;
+			p->ret = NODE_NULL;
+			return;
+		}
+		PFrame* f = top_frame(p);
+		if (f->kind == PF_LIST)
+			step_list(p, f);
+		else if (f->kind == PF_SCRIPTS)
+			step_scripts(p, f);
+		else
+			step_cmd(p, f);
+	}
 }
 
-static ListId parse_math_list(Parser* p) { return parse_list_core(p, 0); }
+size_t tex_parse_stack_chunk_size(void) { return sizeof(PStackChunk) + sizeof(void*) - 1; }
 
-NodeRef tex_parse_math(const char* input, int len, UnifiedPool* pool, TeX_Layout* layout)
+// frames the stack may hold, TeX_Config.parse_stack_frames or the default
+static int stack_budget(const TeX_Layout* L)
 {
+	int frames = L ? L->cfg.parse_stack_frames : 0;
+	if (frames <= 0)
+		return TEX_PARSE_STACK_FRAMES;
+	return TEX_MIN(frames, INT16_MAX);
+}
+
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static NodeRef parse_root(const char* input, int len, UnifiedPool* pool, TeX_Layout* layout, uint8_t measure,
+                          uint8_t size_only, int* node_count)
+{
+	if (node_count)
+		*node_count = 0;
 	if (!pool)
 		return NODE_NULL;
 
@@ -1685,17 +1846,32 @@ NodeRef tex_parse_math(const char* input, int len, UnifiedPool* pool, TeX_Layout
 			TEX_SET_ERROR(layout, TEX_ERR_INPUT, "NULL input to math parser", 0);
 		return NODE_NULL;
 	}
+	// nodes are only allocated with a layout to report errors to
+	if (!layout || TEX_HAS_ERROR(layout))
+		return NODE_NULL;
 	if (len < 0)
 		len = (int)strlen(input);
 
 	Parser p;
 	ml_init(&p.lx, input, len);
-	p.depth = 0;
+	p.base = input;
 	p.pool = pool;
 	p.L = layout;
 	p.current_role = 0; // FONTROLE_MAIN
-
-	ListId seq = parse_math_list(&p);
+	p.measure = measure;
+	p.size_only = size_only;
+	p.nodes = 0;
+	p.ret = NODE_NULL;
+
+	// the stack chunks of an earlier formula are reused while the pool still holds them
+	p.chunk_id = pool->stack;
+	p.chunk = (pool->stack != STRING_NULL) ? stack_chunk(pool, pool->stack) : NULL;
+	p.top = 0;
+	p.budget = stack_budget(layout);
+
+	if (begin_list(&p, LIST_MATH, 0))
+		run(&p);
+	ListId seq = (ListId)p.ret;
 	if (TEX_HAS_ERROR(layout))
 	{
 		return NODE_NULL;
@@ -1707,5 +1883,23 @@ NodeRef tex_parse_math(const char* input, int len, UnifiedPool* pool, TeX_Layout
 
 	Node* root_node = pool_get_node(pool, root);
 	root_node->data.list.head = seq;
-	return root;
+	node_set_span(root_node, 0, len);
+	if (node_count)
+		*node_count = p.nodes;
+	return finish_node(&p, root);
+}
+
+NodeRef tex_parse_math(const char* input, int len, UnifiedPool* pool, TeX_Layout* layout)
+{
+	return parse_root(input, len, pool, layout, 0, 0, NULL);
+}
+
+NodeRef tex_parse_math_measured(const char* input, int len, UnifiedPool* pool, TeX_Layout* layout)
+{
+	return parse_root(input, len, pool, layout, 1, 0, NULL);
+}
+
+NodeRef tex_parse_math_size(const char* input, int len, UnifiedPool* pool, TeX_Layout* layout, int* node_count)
+{
+	return parse_root(input, len, pool, layout, 1, 1, node_count);
 }
@@ -15,6 +15,19 @@ extern "C" {
 // returns the root N_MATH node ref on success, NODE_NULL on error.
 NodeRef tex_parse_math(const char* input, int len, UnifiedPool* pool, TeX_Layout* layout);
 
+// Same as tex_parse_math, measuring each node as soon as its children are complete
+// (nodes are touched once while still hot, callers skip tex_measure_range)
+NodeRef tex_parse_math_measured(const char* input, int len, UnifiedPool* pool, TeX_Layout* layout);
+
+// Same as tex_parse_math_measured for callers that only need the box of the formula (the dry run):
+// groups and lists are folded into their metrics as they are parsed and finished subtrees are released,
+// so the pool holds about one node per open nesting level. Only the root's w/asc/desc are meaningful.
+// node_count (may be NULL) receives the number of nodes the full tree would have allocated
+NodeRef tex_parse_math_size(const char* input, int len, UnifiedPool* pool, TeX_Layout* layout, int* node_count);
+
+// pool bytes one chunk of TEX_PARSE_STACK_CHUNK parser frames takes, the pool keeps it between parses
+size_t tex_parse_stack_chunk_size(void);
+
 #ifdef __cplusplus
 }
 #endif
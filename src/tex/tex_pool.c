@@ -1,6 +1,6 @@
 #include "tex_pool.h"
-#include <stdlib.h>
 #include <string.h>
+#include "tex_alloc.h"
 #include "tex_internal.h"
 #if defined(__TICE__)
 #include <debug.h>
@@ -13,12 +13,14 @@ static void update_peak(UnifiedPool* pool)
 		pool->peak_used = used;
 }
 
-int pool_init(UnifiedPool* pool, size_t total_size)
+int pool_init(UnifiedPool* pool, size_t total_size) { return pool_init_alloc(pool, total_size, NULL); }
+
+int pool_init_alloc(UnifiedPool* pool, size_t total_size, const TeX_Allocator* allocator)
 {
 	if (!pool || total_size == 0)
 		return -1;
 
-	pool->slab = (uint8_t*)malloc(total_size);
+	pool->slab = (uint8_t*)tex_mem_alloc(allocator, total_size);
 	if (!pool->slab) {
 #if defined(__TICE__)
 		dbg_printf("[tex] pool_init OOM size=%u\n", (unsigned)total_size);
@@ -30,6 +32,22 @@ int pool_init(UnifiedPool* pool, size_t total_size)
 	pool->peak_used = 0;
 	pool->alloc_count = 0;
 	pool->reset_count = 0;
+	pool->allocator = allocator;
+	pool_reset(pool);
+	return 0;
+}
+
+int pool_init_buffer(UnifiedPool* pool, uint8_t* buffer, size_t total_size)
+{
+	if (!pool || !buffer || total_size == 0)
+		return -1;
+
+	pool->slab = buffer;
+	pool->capacity = total_size;
+	pool->peak_used = 0;
+	pool->alloc_count = 0;
+	pool->reset_count = 0;
+	pool->allocator = NULL;
 	pool_reset(pool);
 	return 0;
 }
@@ -38,7 +56,7 @@ void pool_free(UnifiedPool* pool)
 {
 	if (pool && pool->slab)
 	{
-		free(pool->slab);
+		tex_mem_free(pool->allocator, pool->slab, pool->capacity);
 		pool->slab = NULL;
 		pool->capacity = 0;
 		pool->node_count = 0;
@@ -52,6 +70,8 @@ void pool_reset(UnifiedPool* pool)
 	{
 		pool->node_count = 0;
 		pool->string_cursor = pool->capacity;
+		pool->stack = STRING_NULL;
+		pool->stack_low = STRING_NULL;
 		pool->reset_count++;
 	}
 }
@@ -93,9 +113,9 @@ NodeRef pool_alloc_node(UnifiedPool* pool)
 	return ref;
 }
 
-StringId pool_alloc_string(UnifiedPool* pool, const char* src, size_t len)
+StringId pool_alloc_string_space(UnifiedPool* pool, size_t len)
 {
-	if (!pool || !pool->slab || !src)
+	if (!pool || !pool->slab)
 		return STRING_NULL;
 
 	size_t size_needed = len + 1; // + null terminator
@@ -113,42 +133,86 @@ StringId pool_alloc_string(UnifiedPool* pool, const char* src, size_t len)
 	// alloc downward
 	pool->string_cursor -= size_needed;
 	pool->alloc_count++;
-
-	char* dst = (char*)(pool->slab + pool->string_cursor);
-	memcpy(dst, src, len); // NOLINT(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
-	dst[len] = '\0';
+	pool->slab[pool->string_cursor + len] = '\0';
 
 	update_peak(pool);
 	return (StringId)pool->string_cursor;
 }
 
-ListId pool_alloc_list_block(UnifiedPool* pool)
+StringId pool_alloc_string(UnifiedPool* pool, const char* src, size_t len)
+{
+	if (!src)
+		return STRING_NULL;
+
+	StringId sid = pool_alloc_string_space(pool, len);
+	if (sid == STRING_NULL)
+		return STRING_NULL;
+
+	char* dst = (char*)(pool->slab + sid);
+	memcpy(dst, src, len); // NOLINT(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
+	return sid;
+}
+
+StringId pool_alloc_block(UnifiedPool* pool, size_t size)
 {
 	if (!pool || !pool->slab)
-		return LIST_NULL;
+		return STRING_NULL;
 
-	size_t block_size = sizeof(TexListBlock);
 	size_t node_boundary = pool->node_count * sizeof(Node);
 
 	// align string_cursor down to 2 byte boundary before allocation
 	size_t aligned_cursor = pool->string_cursor & ~((size_t)1);
 
 	// check if we have room
-	if (aligned_cursor < block_size || (aligned_cursor - block_size) < node_boundary)
-		return LIST_NULL;
+	if (aligned_cursor < size || (aligned_cursor - size) < node_boundary)
+		return STRING_NULL;
 
-	if (aligned_cursor - block_size > 0xFFFE)
-		return LIST_NULL;
+	if (aligned_cursor - size > 0xFFFE)
+		return STRING_NULL;
 
 	// allocate downward
-	pool->string_cursor = aligned_cursor - block_size;
+	pool->string_cursor = aligned_cursor - size;
 	pool->alloc_count++;
 
-	TexListBlock* block = (TexListBlock*)(pool->slab + pool->string_cursor);
+	update_peak(pool);
+	return (StringId)pool->string_cursor;
+}
+
+ListId pool_alloc_list_block(UnifiedPool* pool, const TexListBlock* tail)
+{
+	int cap = !tail ? 1 : (tail->cap == 1 ? 4 : TEX_LIST_BLOCK_CAP);
+	StringId id = pool_alloc_block(pool, sizeof(TexListBlock) + (size_t)cap * sizeof(NodeRef));
+	if (id == STRING_NULL)
+		return LIST_NULL;
+
+	TexListBlock* block = (TexListBlock*)(pool->slab + id);
 	block->next = LIST_NULL;
 	block->count = 0;
+	block->cap = (uint8_t)cap;
 	// items are left uninitialized (count=0 means none are valid)
+	return (ListId)id;
+}
 
-	update_peak(pool);
-	return (ListId)pool->string_cursor;
+PoolMark pool_mark(const UnifiedPool* pool)
+{
+	PoolMark mark = { 0, 0 };
+	if (pool)
+	{
+		mark.node_count = pool->node_count;
+		mark.string_cursor = pool->string_cursor;
+	}
+	return mark;
+}
+
+void pool_release(UnifiedPool* pool, PoolMark mark)
+{
+	if (!pool || mark.node_count > pool->node_count || mark.string_cursor < pool->string_cursor)
+		return;
+	pool->node_count = mark.node_count;
+	pool->string_cursor = mark.string_cursor;
+	if (pool->stack != STRING_NULL && pool->stack_low < pool->string_cursor)
+	{
+		pool->stack = STRING_NULL;
+		pool->stack_low = STRING_NULL;
+	}
 }
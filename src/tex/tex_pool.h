@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include "tex_types.h"
 
 struct Node;
 
@@ -18,21 +19,25 @@ typedef uint16_t StringId;
 typedef uint16_t ListId;
 #define LIST_NULL ((ListId)0xFFFF)
 
-// reserved node range for flyweight ASCII glyphs (256 preinitialized nodes)
-// NodeRef values 0xFD00-0xFDFF are "reserved" refs that map to static g_reserved_nodes[]
+// reserved node range for flyweight glyphs, one preinitialized node per glyph code and FontRole
+// NodeRef values 0xFD00-0xFEFF are "reserved" refs that map to static g_reserved_nodes[]
+// (main role codes first, then script role codes)
 #define TEX_RESERVED_BASE ((NodeRef)0xFD00)
-#define TEX_RESERVED_COUNT 256
+#define TEX_RESERVED_CODES 256
+#define TEX_RESERVED_COUNT (TEX_RESERVED_CODES * 2)
 #define TEX_IS_RESERVED_REF(ref) ((ref) >= TEX_RESERVED_BASE && (ref) < (TEX_RESERVED_BASE + TEX_RESERVED_COUNT))
 #define TEX_RESERVED_INDEX(ref) ((ref) - TEX_RESERVED_BASE)
 
-// chunked list block, holds up to 16 NodeRefs, linked to next block
+// chunked list block linked to the next block, sized by class: the first block of a list holds 1 NodeRef,
+// the second 4, every later one TEX_LIST_BLOCK_CAP (most child lists hold one to three items)
 #define TEX_LIST_BLOCK_CAP 16
 
 typedef struct TexListBlock
 {
 	ListId next; // offset to next block (LIST_NULL if none)
-	uint16_t count; // items used in this block (0..TEX_LIST_BLOCK_CAP)
-	NodeRef items[TEX_LIST_BLOCK_CAP]; // Node references
+	uint8_t count; // items used in this block (0..cap)
+	uint8_t cap; // items the block was allocated for (1, 4 or TEX_LIST_BLOCK_CAP)
+	NodeRef items[]; // Node references
 } TexListBlock;
 
 typedef struct UnifiedPool
@@ -44,11 +49,26 @@ typedef struct UnifiedPool
 	size_t peak_used;
 	size_t alloc_count;
 	size_t reset_count;
+	const TeX_Allocator* allocator; // slab came from this allocator (NULL = malloc)
+	StringId stack; // first chunk of the math parser's frame stack, kept for the next parse (STRING_NULL if none)
+	StringId stack_low; // last chunk allocated, the stack is dropped once a release frees it
 } UnifiedPool;
 
+typedef struct
+{
+	size_t node_count;
+	size_t string_cursor;
+} PoolMark;
+
 // initialize with a malloc'd buffer of total_size. returns 0 on success, -1 on failure
 int pool_init(UnifiedPool* pool, size_t total_size);
 
+// same as pool_init with the slab taken from allocator (NULL = malloc)
+int pool_init_alloc(UnifiedPool* pool, size_t total_size, const TeX_Allocator* allocator);
+
+// initialize over caller owned memory (no allocation, do not pool_free). returns 0 on success, -1 on failure
+int pool_init_buffer(UnifiedPool* pool, uint8_t* buffer, size_t total_size);
+
 // free the internal slab
 void pool_free(UnifiedPool* pool);
 
@@ -61,11 +81,22 @@ NodeRef pool_alloc_node(UnifiedPool* pool);
 // allocate len bytes + 1 null terminator. returns byte offset ID, or STRING_NULL on OOM
 StringId pool_alloc_string(UnifiedPool* pool, const char* src, size_t len);
 
+// same as pool_alloc_string, the caller fills the len bytes
+StringId pool_alloc_string_space(UnifiedPool* pool, size_t len);
+
 // get current bytes used in pool (nodes from bottom + strings from top)
 size_t pool_get_used(UnifiedPool* pool);
 
-// alloc one zero initialized list block in string region. returns LIST_NULL on OOM
-ListId pool_alloc_list_block(UnifiedPool* pool);
+// alloc an empty list block in string region to follow tail (NULL for the first block of a list),
+// one size class larger than tail. returns LIST_NULL on OOM
+ListId pool_alloc_list_block(UnifiedPool* pool, const TexListBlock* tail);
+
+// alloc size uninitialized bytes in string region, 2 byte aligned. returns byte offset ID, or STRING_NULL on OOM
+StringId pool_alloc_block(UnifiedPool* pool, size_t size);
+
+// current cursors, pool_release frees every node, string and block allocated after the mark
+PoolMark pool_mark(const UnifiedPool* pool);
+void pool_release(UnifiedPool* pool, PoolMark mark);
 
 
 #endif // TEX_TEX_POOL_H
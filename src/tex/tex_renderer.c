@@ -1,25 +1,45 @@
 #include "tex_renderer.h"
-#include <stdlib.h>
 #include <string.h>
 #include "tex.h"
+#include "tex_alloc.h"
 
 TeX_Renderer* tex_renderer_create(void) { return tex_renderer_create_sized(TEX_RENDERER_DEFAULT_SLAB_SIZE); }
 
-TeX_Renderer* tex_renderer_create_sized(size_t slab_size)
+TeX_Renderer* tex_renderer_create_sized(size_t slab_size) { return tex_renderer_create_multi(slab_size, 1); }
+
+TeX_Renderer* tex_renderer_create_multi(size_t slab_size, int slot_count)
+{
+	return tex_renderer_create_alloc(slab_size, slot_count, NULL);
+}
+
+TeX_Renderer* tex_renderer_create_alloc(size_t slab_size, int slot_count, const TeX_Allocator* allocator)
 {
-	TeX_Renderer* r = (TeX_Renderer*)calloc(1, sizeof(TeX_Renderer));
+	if (slot_count < 1 || slot_count > TEX_RENDERER_MAX_SLOTS)
+		return NULL;
+
+	// keep every slot slice aligned for nodes and list blocks
+	size_t slot_size = (slab_size / (size_t)slot_count) & ~((size_t)3);
+	if (slot_size == 0)
+		return NULL;
+
+	TeX_Renderer* r = (TeX_Renderer*)tex_mem_calloc(allocator, sizeof(TeX_Renderer));
 	if (!r)
 		return NULL;
-	if (pool_init(&r->pool, slab_size) != 0)
+
+	r->allocator = allocator;
+	r->slot_count = slot_count;
+	r->slab_size = slot_size * (size_t)slot_count;
+	r->slots = (TeX_RenderSlot*)tex_mem_calloc(allocator, (size_t)slot_count * sizeof(TeX_RenderSlot));
+	r->slab = (uint8_t*)tex_mem_alloc(allocator, r->slab_size);
+	if (!r->slots || !r->slab)
 	{
-		free(r);
+		tex_renderer_destroy(r);
 		return NULL;
 	}
 
-	r->line_count = 0;
-	r->window_y_start = 0;
-	r->window_y_end = 0;
-	r->cached_layout = NULL;
+	r->clock = 0;
+	for (int i = 0; i < slot_count; i++)
+		pool_init_buffer(&r->slots[i].pool, r->slab + slot_size * (size_t)i, slot_size);
 
 	return r;
 }
@@ -29,8 +49,9 @@ void tex_renderer_destroy(TeX_Renderer* r)
 	if (!r)
 		return;
 
-	pool_free(&r->pool);
-	free(r);
+	tex_mem_free(r->allocator, r->slots, (size_t)r->slot_count * sizeof(TeX_RenderSlot));
+	tex_mem_free(r->allocator, r->slab, r->slab_size);
+	tex_mem_free(r->allocator, r, sizeof(TeX_Renderer));
 }
 
 void tex_renderer_invalidate(TeX_Renderer* r)
@@ -38,36 +59,85 @@ void tex_renderer_invalidate(TeX_Renderer* r)
 	if (!r)
 		return;
 
-	pool_reset(&r->pool);
-	r->line_count = 0;
-	r->window_y_start = 0;
-	r->window_y_end = 0;
-	r->cached_layout = NULL;
+	for (int i = 0; i < r->slot_count; i++)
+	{
+		TeX_RenderSlot* slot = &r->slots[i];
+		pool_reset(&slot->pool);
+		slot->line_count = 0;
+		slot->window_y_start = 0;
+		slot->window_y_end = 0;
+		slot->cached_layout = NULL;
+		slot->cached_revision = 0;
+		slot->frames = NULL;
+		slot->frame_cap = 0;
+	}
+}
+
+TeX_RenderSlot* tex_renderer_acquire_slot(TeX_Renderer* r, struct TeX_Layout* layout)
+{
+	TeX_RenderSlot* victim = &r->slots[0];
+	for (int i = 0; i < r->slot_count; i++)
+	{
+		TeX_RenderSlot* slot = &r->slots[i];
+		if (slot->cached_layout == layout && slot->cached_revision == layout->revision)
+		{
+			victim = slot;
+			break;
+		}
+		// empty slots first, then the least recently drawn
+		if (victim->cached_layout && (!slot->cached_layout || slot->last_used < victim->last_used))
+			victim = slot;
+	}
+
+	if (victim->cached_layout != layout || victim->cached_revision != layout->revision)
+		victim->cached_layout = NULL;
+
+	victim->last_used = ++r->clock;
+	return victim;
 }
 
 // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
 void tex_renderer_get_stats(TeX_Renderer* r, size_t* peak_used, size_t* capacity, size_t* alloc_count,
                             size_t* reset_count)
 {
-	if (!r)
+	size_t peak = 0, allocs = 0, resets = 0;
+	if (r)
 	{
-		if (peak_used)
-			*peak_used = 0;
-		if (capacity)
-			*capacity = 0;
-		if (alloc_count)
-			*alloc_count = 0;
-		if (reset_count)
-			*reset_count = 0;
-		return;
+		for (int i = 0; i < r->slot_count; i++)
+		{
+			peak += r->slots[i].pool.peak_used;
+			allocs += r->slots[i].pool.alloc_count;
+			resets += r->slots[i].pool.reset_count;
+		}
 	}
 
 	if (peak_used)
-		*peak_used = r->pool.peak_used;
+		*peak_used = peak;
 	if (capacity)
-		*capacity = r->pool.capacity;
+		*capacity = r ? r->slab_size : 0;
 	if (alloc_count)
-		*alloc_count = r->pool.alloc_count;
+		*alloc_count = allocs;
 	if (reset_count)
-		*reset_count = r->pool.reset_count;
+		*reset_count = resets;
+}
+
+void tex_renderer_get_stack_stats(TeX_Renderer* r, size_t* peak_depth, size_t* peak_bytes, size_t* overflow_count)
+{
+	size_t depth = 0, overflows = 0;
+	if (r)
+	{
+		for (int i = 0; i < r->slot_count; i++)
+		{
+			if ((size_t)r->slots[i].frame_peak > depth)
+				depth = (size_t)r->slots[i].frame_peak;
+			overflows += (size_t)r->slots[i].frame_overflows;
+		}
+	}
+
+	if (peak_depth)
+		*peak_depth = depth;
+	if (peak_bytes)
+		*peak_bytes = depth * sizeof(TexDrawFrame);
+	if (overflow_count)
+		*overflow_count = overflows;
 }
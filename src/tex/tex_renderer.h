@@ -10,23 +10,97 @@ extern "C" {
 
 #define TEX_RENDERER_DEFAULT_SLAB_SIZE ((size_t)40 * 1024)
 #define TEX_RENDERER_MAX_LINES 64
-#define TEX_RENDERER_PADDING 240
+#define TEX_RENDERER_MAX_SLOTS 16
+// hydration padding above and below the visible band is one band height, never less than this
+#define TEX_RENDERER_MIN_PADDING 40
+// distinct delimiter sprites per hydrated window; shapes of fewer lines or more pixels stay lines
+#define TEX_RENDERER_MAX_SPRITES 8
+#define TEX_SPRITE_MIN_LINES 4
+#define TEX_SPRITE_MAX_BYTES 1024
+#define TEX_SPRITE_HBRACE 0x80 // sprite kind of \overbrace and \underbrace
 
 struct TeX_Layout;
 
-typedef struct TeX_Renderer
+// display list op, recorded at hydration with x from the layout origin and y from window_y_start
+typedef struct
+{
+	uint8_t type; // TexDrawOpType
+	uint8_t role; // FontRole of text and glyphs
+	int16_t x1, y1; // text/glyph top left, rule/line start, dot/ellipse center
+	int16_t x2, y2; // line end, ellipse radii, width of text/glyphs/rules in x2
+	uint16_t data; // glyph, or StringId of the text
+	uint16_t len; // text length
+} TexDisplayOp;
+
+// one node on the draw walk's explicit stack, resumed at step until the node has no child left
+typedef struct
 {
-	UnifiedPool pool; // the slab for transient allocations
+	NodeRef ref;
+	int16_t x, bl; // node origin and baseline
+	uint8_t role; // FontRole the node is drawn with
+	uint8_t step; // 0 until entered, then the node type's next step
+	uint16_t i; // item in the list block, or matrix cell
+	union
+	{
+		ListId block; // list block being walked
+		int16_t left; // matrix cell area left edge
+	} at;
+	int16_t pen_x, pen_y; // where the next list item or matrix cell goes
+	uint16_t seen; // children reached so far, a hit test tells flyweight hits apart by it
+} TexDrawFrame;
+
+// stretchy delimiter rasterized once per window and blitted on every draw
+typedef struct
+{
+	uint8_t kind; // DelimType, or TEX_SPRITE_HBRACE
+	uint8_t side; // left delimiter, brace over
+	int16_t size; // delimiter height, brace width
+	uint8_t color; // palette index the sprite was drawn in
+	uint8_t transparent;
+	StringId sprite; // gfx_sprite_t in the pool
+} TexSpriteEntry;
+
+// one hydrated window, its pool is a view into a slice of the renderer slab
+typedef struct TeX_RenderSlot
+{
+	UnifiedPool pool; // transient allocations for this window (not owned)
 	TeX_Line lines[TEX_RENDERER_MAX_LINES]; // fixed array for visible lines
 	int line_count; // number of lines in current window
 	int window_y_start; // top of currently loaded window
 	int window_y_end; // bottom of currently loaded window
+	TexDisplayOp* ops; // display list of the window in the pool, NULL when it did not fit (nodes are drawn)
+	int op_count;
+	TexSpriteEntry sprites[TEX_RENDERER_MAX_SPRITES]; // sprites the display list blits
+	int sprite_count;
+	TexDrawFrame* frames; // draw walk stack in the pool, as deep as the window needs (NULL before recording)
+	int frame_cap;
+	int frame_peak; // deepest walk since the renderer was created
+	int frame_overflows; // subtrees skipped because the walk stack was full
+	const char* text; // source text of the window (layout source or decompressed blocks in the pool)
+	int text_offset; // source offset of text[0]
+	int text_len;
 	struct TeX_Layout* cached_layout; // layout currently hydrated (for hit check)
+	unsigned cached_revision; // revision of cached_layout when hydrated
+	unsigned last_used; // renderer clock at last draw (LRU eviction)
+} TeX_RenderSlot;
+
+typedef struct TeX_Renderer
+{
+	uint8_t* slab; // the slab for transient allocations, split evenly between slots
+	size_t slab_size;
+	TeX_RenderSlot* slots;
+	int slot_count;
+	unsigned clock; // bumped on every draw
+	const TeX_Allocator* allocator; // owns the renderer, its slots and slab
 } TeX_Renderer;
 
-// invalidate cached window (forces rehydration on next draw)
+// invalidate cached windows (forces rehydration on next draw)
 void tex_renderer_invalidate(TeX_Renderer* r);
 
+// slot holding the window for layout, evicting the least recently used one on a miss
+// the returned slot is stamped as used; its cached_layout is cleared when it was evicted
+TeX_RenderSlot* tex_renderer_acquire_slot(TeX_Renderer* r, struct TeX_Layout* layout);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,133 @@
+// SPDX-License-Identifier: AGPL-3.0-only
+#include "tex_source.h"
+
+#include <string.h>
+
+static int read_u16(const uint8_t* p) { return (int)p[0] | ((int)p[1] << 8); }
+
+static long read_u32(const uint8_t* p)
+{
+	return (long)p[0] | ((long)p[1] << 8) | ((long)p[2] << 16) | ((long)p[3] << 24);
+}
+
+static const uint8_t* entry(const TeX_PackedSource* src, int block)
+{
+	return src->data + TEX_SOURCE_HEADER_SIZE + (size_t)block * TEX_SOURCE_ENTRY_SIZE;
+}
+
+static int block_data_offset(const TeX_PackedSource* src, int block) { return (int)read_u32(entry(src, block) + 4); }
+
+int tex_source_open(TeX_PackedSource* src, const uint8_t* data, int size)
+{
+	if (!src || !data || size < TEX_SOURCE_HEADER_SIZE || memcmp(data, TEX_SOURCE_MAGIC, 4) != 0)
+		return -1;
+
+	src->data = data;
+	src->size = size;
+	src->raw_len = (int)read_u32(data + 4);
+	src->block_count = read_u16(data + 8);
+	src->max_block = read_u16(data + 10);
+
+	long table_end = TEX_SOURCE_HEADER_SIZE + ((long)src->block_count + 1) * TEX_SOURCE_ENTRY_SIZE;
+	if (src->raw_len < 0 || table_end > size)
+		return -1;
+
+	// offsets must grow monotonically and stay inside the data, decoding relies on it
+	int prev_raw = 0;
+	int prev_data = (int)table_end;
+	for (int i = 0; i <= src->block_count; i++)
+	{
+		int raw = tex_source_block_start(src, i);
+		int at = block_data_offset(src, i);
+		if (raw < prev_raw || raw - prev_raw > src->max_block || at < prev_data || at > size)
+			return -1;
+		prev_raw = raw;
+		prev_data = at;
+	}
+	if (prev_raw != src->raw_len || tex_source_block_start(src, 0) != 0)
+		return -1;
+
+	return 0;
+}
+
+int tex_source_block_start(const TeX_PackedSource* src, int block) { return (int)read_u32(entry(src, block)); }
+
+int tex_source_block_at(const TeX_PackedSource* src, int offset)
+{
+	int lo = 0, hi = src->block_count;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (tex_source_block_start(src, mid) <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo > 0) ? (lo - 1) : 0;
+}
+
+int tex_source_decode(const TeX_PackedSource* src, int block, char* dst)
+{
+	if (block < 0 || block >= src->block_count)
+		return -1;
+
+	const uint8_t* in = src->data + block_data_offset(src, block);
+	const uint8_t* in_end = src->data + block_data_offset(src, block + 1);
+	int raw_len = tex_source_block_start(src, block + 1) - tex_source_block_start(src, block);
+	int out = 0;
+
+	while (out < raw_len)
+	{
+		if (in >= in_end)
+			return -1;
+		int c = *in++;
+		if (c < 0x80)
+		{
+			int n = c + 1;
+			if (n > raw_len - out || n > (int)(in_end - in))
+				return -1;
+			memcpy(dst + out, in, (size_t)n);
+			in += n;
+			out += n;
+		}
+		else
+		{
+			int n = (c & 0x7F) + 3;
+			if (in_end - in < 2)
+				return -1;
+			int dist = read_u16(in);
+			in += 2;
+			if (dist <= 0 || dist > out || n > raw_len - out)
+				return -1;
+			// byte by byte, matches may overlap their own output
+			for (int i = 0; i < n; i++, out++)
+				dst[out] = dst[out - dist];
+		}
+	}
+	return raw_len;
+}
+
+const char* tex_source_window(const TeX_PackedSource* src, UnifiedPool* pool, int start, int end)
+{
+	if (!src->data || start < 0 || end > src->raw_len || start > end)
+		return NULL;
+	if (start == end)
+		return "";
+
+	int first = tex_source_block_at(src, start);
+	int last = tex_source_block_at(src, end - 1) + 1;
+	int base = tex_source_block_start(src, first);
+	int span = tex_source_block_start(src, last) - base;
+
+	StringId sid = pool_alloc_string_space(pool, (size_t)span);
+	if (sid == STRING_NULL)
+		return NULL;
+
+	char* buf = (char*)(pool->slab + sid);
+	for (int b = first; b < last; b++)
+	{
+		if (tex_source_decode(src, b, buf + (tex_source_block_start(src, b) - base)) < 0)
+			return NULL;
+	}
+	return buf + (start - base);
+}
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#ifndef TEX_TEX_SOURCE_H
+#define TEX_TEX_SOURCE_H
+
+#include <stdint.h>
+#include "tex_pool.h"
+
+// Block compressed source (written by tools/pack_source.py), all integers little endian:
+//   "TXZ1"  u32 raw_len  u16 block_count  u16 max_block
+//   (block_count + 1) x { u32 raw_offset  u32 data_offset }   last entry is the end sentinel
+//   block data, data_offset is relative to the start of the header
+// Blocks are compressed independently and only split the text between tokens,
+// so a block or any run of consecutive blocks can be tokenized on its own.
+//
+// Block codec, one control byte per op:
+//   0x00-0x7F  literal run of (c + 1) bytes
+//   0x80-0xFF  match of (c & 0x7F) + 3 bytes, u16 distance back into the block follows
+#define TEX_SOURCE_MAGIC "TXZ1"
+#define TEX_SOURCE_HEADER_SIZE 12
+#define TEX_SOURCE_ENTRY_SIZE 8
+
+typedef struct
+{
+	const uint8_t* data; // NULL for plain text sources
+	int size;
+	int raw_len;
+	int block_count;
+	int max_block; // largest decompressed block in bytes
+} TeX_PackedSource;
+
+// validate the header and block table. returns 0 on success, -1 if data is not a packed source
+int tex_source_open(TeX_PackedSource* src, const uint8_t* data, int size);
+
+// raw offset where block starts (block == block_count gives raw_len)
+int tex_source_block_start(const TeX_PackedSource* src, int block);
+
+// index of the block holding raw offset
+int tex_source_block_at(const TeX_PackedSource* src, int offset);
+
+// decompress one block into dst (at least max_block bytes). returns its raw length, -1 if corrupt
+int tex_source_decode(const TeX_PackedSource* src, int block, char* dst);
+
+// decompress the blocks covering raw [start, end) into the pool's string region
+// returns a pointer to the text at start, NULL on OOM or corrupt data
+const char* tex_source_window(const TeX_PackedSource* src, UnifiedPool* pool, int start, int end);
+
+#endif // TEX_TEX_SOURCE_H
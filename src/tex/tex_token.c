@@ -178,6 +178,7 @@ int tex_stream_next(TeX_Stream* s, TeX_Token* out, UnifiedPool* pool, TeX_Layout
 			{
 				return 0;
 			}
+			out->aux = TEX_TOKEN_AUX_UNCLOSED_MATH;
 			s->cursor = p;
 			return 1;
 		}
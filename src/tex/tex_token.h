@@ -18,6 +18,9 @@ typedef enum
 	T_EOF
 } TokenType;
 
+// aux flag: T_TEXT produced by a '$' with no closing delimiter (yet)
+#define TEX_TOKEN_AUX_UNCLOSED_MATH 0x01
+
 typedef struct
 {
 	TokenType type;
@@ -1,6 +1,7 @@
 #ifndef TEX_TEX_TYPES_H
 #define TEX_TEX_TYPES_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -16,6 +17,30 @@ typedef struct
 	int v;
 } TexBaseline;
 
+// ================================
+// viewport
+// ================================
+// screen rectangle a layout is drawn into; only this band is hydrated and drawn
+typedef struct
+{
+	int x;
+	int y;
+	int w;
+	int h;
+} TeX_Viewport;
+
+// ================================
+// hit testing
+// ================================
+// node under a screen point (tex_hit_test)
+typedef struct
+{
+	int src_offset; // source range of the node, a formula covers the text between its '$' signs
+	int src_len;
+	int x, y, w, h; // node box in screen coordinates
+	int depth; // 0 for a word or formula on the line, +1 per level inside a formula
+} TeX_HitResult;
+
 // ================================
 // error codes
 // ================================
@@ -37,6 +62,21 @@ typedef enum
 // file/line: source location (NULL/0 in release builds)
 typedef void (*TeX_ErrorLogFn)(void* userdata, int level, const char* msg, const char* file, int line);
 
+// ================================
+// allocator
+// ================================
+// hooks for engine heap allocations (layouts, checkpoints, scratch pools, renderer slabs, documents)
+// sizes are passed back to realloc/free so arenas and counters need no headers of their own.
+// realloc may be NULL, it is then emulated with alloc + copy + free. Returned memory must be
+// suitably aligned for any type (like malloc)
+typedef struct
+{
+	void* (*alloc)(void* userdata, size_t size);
+	void* (*realloc)(void* userdata, void* ptr, size_t old_size, size_t new_size);
+	void (*free)(void* userdata, void* ptr, size_t size);
+	void* userdata;
+} TeX_Allocator;
+
 // ================================
 // configuration
 // ================================
@@ -47,6 +87,9 @@ typedef struct
 	const char* font_pack;
 	TeX_ErrorLogFn error_callback;
 	void* error_userdata;
+	const TeX_Allocator* allocator; // NULL = malloc/free, must outlive every layout formatted with it
+	const char* outline_marker; // paragraphs starting with this text are indexed as headings (NULL = no outline)
+	int parse_stack_frames; // nested math parser frames allowed, deeper formulas are TEX_ERR_DEPTH (0 = default 65)
 } TeX_Config;
 
 #ifdef __cplusplus
@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: AGPL-3.0-only
+#include <stdio.h>
+#include "tex/tex.h"
+
+static int g_fail = 0;
+
+static void expect(int cond, const char* msg)
+{
+	if (!cond)
+	{
+		fprintf(stderr, "[FAIL] %s\n", msg);
+		g_fail++;
+	}
+}
+
+static TeX_Layout* make_layout(char* buf)
+{
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts" };
+	return tex_format(buf, 120, &cfg);
+}
+
+static void test_document_heights(void)
+{
+	char b0[] = "One";
+	char b1[] = "Two\nlines";
+	char b2[] = "Three $x^2$";
+	TeX_Document* doc = tex_document_create();
+	expect(doc != NULL, "tex_document_create");
+	if (!doc)
+		return;
+
+	TeX_Layout* l0 = make_layout(b0);
+	TeX_Layout* l1 = make_layout(b1);
+	TeX_Layout* l2 = make_layout(b2);
+	int h0 = tex_get_total_height(l0);
+	int h1 = tex_get_total_height(l1);
+	int h2 = tex_get_total_height(l2);
+
+	expect(tex_document_append(doc, l0, 10, 5, NULL) == 0, "append first");
+	expect(tex_document_append(doc, l2, 10, 5, NULL) == 1, "append second");
+	expect(tex_document_insert(doc, 1, l1, 10, 5, NULL) == 1, "insert in the middle");
+	expect(tex_document_count(doc) == 3, "count after insert");
+	expect(tex_document_get_layout(doc, 1) == l1, "inserted layout lands at its index");
+
+	int total = h0 + h1 + h2 + 3 * 15;
+	expect(tex_document_total_height(doc) == total, "total height includes padding");
+	expect(tex_document_entry_y(doc, 0) == 0, "first entry at 0");
+	expect(tex_document_entry_y(doc, 1) == h0 + 15, "second entry after first");
+	expect(tex_document_entry_y(doc, 2) == h0 + h1 + 30, "third entry after second");
+	expect(tex_document_index_at(doc, h0 + 14) == 0, "index_at inside first entry");
+	expect(tex_document_index_at(doc, h0 + 15) == 1, "index_at on second entry top");
+	expect(tex_document_index_at(doc, total + 100) == 2, "index_at clamps past the end");
+
+	tex_document_remove(doc, 1);
+	expect(tex_document_count(doc) == 2, "count after remove");
+	expect(tex_document_get_layout(doc, 1) == l2, "remove shifts later entries");
+	expect(tex_document_total_height(doc) == h0 + h2 + 30, "total height after remove");
+
+	tex_document_destroy(doc);
+}
+
+static void test_document_many(void)
+{
+	static char bufs[500][16];
+	TeX_Document* doc = tex_document_create();
+	if (!doc)
+	{
+		expect(0, "tex_document_create");
+		return;
+	}
+
+	for (int i = 0; i < 500; i++)
+	{
+		snprintf(bufs[i], sizeof(bufs[i]), (i % 3) ? "msg %d" : "msg\n%d", i);
+		// alternate front and back inserts to exercise rebalancing
+		int index = (i % 2) ? 0 : tex_document_count(doc);
+		tex_document_insert(doc, index, make_layout(bufs[i]), 2, 2, NULL);
+	}
+	expect(tex_document_count(doc) == 500, "500 entries");
+
+	// prefix sums must agree with a linear walk
+	int y = 0;
+	int ok = 1;
+	for (int i = 0; i < 500; i++)
+	{
+		if (tex_document_entry_y(doc, i) != y || tex_document_index_at(doc, y) != i)
+			ok = 0;
+		y += tex_get_total_height(tex_document_get_layout(doc, i)) + 4;
+	}
+	expect(ok, "entry_y/index_at agree with linear walk");
+	expect(tex_document_total_height(doc) == y, "total height matches linear walk");
+
+	tex_document_destroy(doc);
+}
+
+static void count_entry(void* userdata, int index, void* entry_userdata, int x, int y)
+{
+	(void)index;
+	(void)entry_userdata;
+	(void)x;
+	(void)y;
+	(*(int*)userdata)++;
+}
+
+// entries whose padding alone is on screen get their callback but no renderer slot
+static void test_document_draw_padding(void)
+{
+	char b0[] = "First";
+	char b1[] = "Second";
+	TeX_Document* doc = tex_document_create();
+	TeX_Renderer* r = tex_renderer_create_multi(16 * 1024, 2);
+	TeX_Layout* l0 = make_layout(b0);
+	TeX_Layout* l1 = make_layout(b1);
+	if (!doc || !r || !l0 || !l1)
+	{
+		expect(0, "padding draw setup");
+		tex_renderer_destroy(r);
+		tex_document_destroy(doc);
+		return;
+	}
+	tex_document_append(doc, l0, 40, 40, NULL);
+	tex_document_append(doc, l1, 40, 40, NULL);
+	int h0 = tex_get_total_height(l0);
+
+	size_t resets[2] = { 0, 0 };
+	int entries = 0;
+	TeX_Viewport pane = { 0, 0, 100, 20 };
+	tex_renderer_get_stats(r, NULL, NULL, NULL, &resets[0]);
+	// the first entry's bottom padding alone, then the second entry's top padding alone
+	tex_document_draw(doc, r, 0, 40 + h0 + 10, &pane, count_entry, &entries);
+	tex_document_draw(doc, r, 0, 40 + h0 + 40 + 10, &pane, count_entry, &entries);
+	tex_renderer_get_stats(r, NULL, NULL, NULL, &resets[1]);
+	expect(entries == 2, "padding-only entries still get their callback");
+	expect(resets[1] == resets[0], "padding-only entries are not hydrated");
+
+	// the layout itself on screen is drawn
+	tex_document_draw(doc, r, 0, 40, &pane, NULL, NULL);
+	tex_renderer_get_stats(r, NULL, NULL, NULL, &resets[1]);
+	expect(resets[1] == resets[0] + 1, "a visible entry is hydrated");
+
+	tex_renderer_destroy(r);
+	tex_document_destroy(doc);
+}
+
+int main(void)
+{
+	test_document_heights();
+	test_document_many();
+	test_document_draw_padding();
+	if (g_fail == 0)
+	{
+		printf("test_document: PASS\n");
+		return 0;
+	}
+	printf("test_document: FAIL (%d)\n", g_fail);
+	return 1;
+}
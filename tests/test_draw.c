@@ -83,6 +83,179 @@ static void test_sqrt_head_and_bar(void)
 	tex_free(L);
 }
 
+static void test_replay_translates(void)
+{
+	char buf[] = "Let $\\frac{a}{bb} + \\sqrt{x}$ be\n$$\\lim_{n} \\bar{y}$$\n";
+	TeX_Config cfg = {
+		.color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts", .error_callback = test_error_cb, .error_userdata = NULL
+	};
+	TeX_Layout* L = tex_format(buf, 200, &cfg);
+	expect(L != NULL, "format returns layout for replay test");
+
+	static TexDrawOp first[1024];
+	static TexDrawOp moved[1024];
+	tex_draw_log_reset();
+	tex_draw(g_renderer, L, 0, 0, 0);
+	int n = tex_draw_log_get(first, 1024);
+	expect(n > 0, "first draw logs ops");
+
+	// same window, the display list is replayed 7 right and 20 down
+	tex_draw_log_reset();
+	tex_draw(g_renderer, L, 7, 20, 0);
+	int m = tex_draw_log_get(moved, 1024);
+	expect(m == n, "replay draws the same ops");
+
+	int same = 1;
+	int texts = 0;
+	for (int i = 0; i < n && i < m; ++i)
+	{
+		const TexDrawOp* a = &first[i];
+		const TexDrawOp* b = &moved[i];
+		same &= a->type == b->type && b->x1 == a->x1 + 7 && b->y1 == a->y1 + 20 && b->glyph == a->glyph &&
+		        b->role == a->role && b->w == a->w && b->h == a->h && b->text_len == a->text_len;
+		if (a->type == DOP_LINE)
+			same &= b->x2 == a->x2 + 7 && b->y2 == a->y2 + 20;
+		if (a->type == DOP_TEXT)
+		{
+			same &= a->text && b->text && memcmp(a->text, b->text, (size_t)a->text_len) == 0;
+			if (a->text_len == 3 && memcmp(a->text, "lim", 3) == 0)
+				++texts;
+		}
+	}
+	expect(same, "replayed ops are translated copies");
+	expect(texts == 1, "lim is recorded as text");
+	tex_free(L);
+}
+
+static void test_adjacent_glyphs_merge(void)
+{
+	char buf[] = "$xy2 + z$";
+	TeX_Config cfg = {
+		.color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts", .error_callback = test_error_cb, .error_userdata = NULL
+	};
+	TeX_Layout* L = tex_format(buf, 200, &cfg);
+	tex_draw_log_reset();
+	tex_draw(g_renderer, L, 0, 0, 0);
+	TexDrawOp ops[16];
+	int n = tex_draw_log_get(ops, 16);
+	// five atoms, one string draw
+	expect(n == 1 && ops[0].type == DOP_TEXT && ops[0].text_len == 5 && memcmp(ops[0].text, "xy2+z", 5) == 0,
+	       "adjacent atoms draw as one text run");
+	tex_free(L);
+
+	// a gap ends the run
+	char spaced[] = "$x \\quad y$";
+	L = tex_format(spaced, 200, &cfg);
+	tex_draw_log_reset();
+	tex_draw(g_renderer, L, 0, 0, 0);
+	n = tex_draw_log_get(ops, 16);
+	expect(n == 2, "spaced atoms draw separately");
+	tex_free(L);
+}
+
+static void test_delimiters_blit_sprites(void)
+{
+	char buf[] = "$\\left( \\frac{a}{\\frac{b}{c}} \\right) = \\left( \\frac{a}{\\frac{b}{c}} \\right)$";
+	TeX_Config cfg = {
+		.color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts", .error_callback = test_error_cb, .error_userdata = NULL
+	};
+	TeX_Layout* L = tex_format(buf, 200, &cfg);
+	tex_draw_log_reset();
+	tex_draw(g_renderer, L, 0, 0, 0);
+	expect(count_type(DOP_SPRITE) == 4, "tall parens draw as sprites");
+	expect(count_type(DOP_LINE) == 0, "no paren curve segments are drawn");
+
+	TexDrawOp ops[64];
+	int n = tex_draw_log_get(ops, 64);
+	int left_w = -1, left_h = -1, same = 1;
+	for (int i = 0; i < n; ++i)
+	{
+		if (ops[i].type != DOP_SPRITE)
+			continue;
+		if (left_w < 0)
+		{
+			left_w = ops[i].w;
+			left_h = ops[i].h;
+		}
+		same &= ops[i].w == left_w && ops[i].h == left_h;
+	}
+	expect(same && left_h > 0, "equal delimiters share a sprite size");
+	tex_free(L);
+}
+
+static void test_walk_stack_stats(void)
+{
+	char buf[] = "$\\frac{1}{\\frac{2}{\\frac{3}{\\frac{4}{\\frac{5}{\\frac{6}{x}}}}}}$";
+	TeX_Config cfg = {
+		.color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts", .error_callback = test_error_cb, .error_userdata = NULL
+	};
+	TeX_Layout* L = tex_format(buf, 200, &cfg);
+	expect(L != NULL, "format returns layout for stack test");
+
+	TeX_Renderer* r = tex_renderer_create();
+	size_t depth = 1, bytes = 1, overflows = 1;
+	tex_renderer_get_stack_stats(r, &depth, &bytes, &overflows);
+	expect(depth == 0 && bytes == 0 && overflows == 0, "fresh renderer has no walk stack use");
+
+	tex_draw_log_reset();
+	tex_draw(r, L, 0, 0, 0);
+	expect(count_type(DOP_RULE) == 6, "every nested fraction draws its rule");
+	tex_renderer_get_stack_stats(r, &depth, &bytes, &overflows);
+	expect(depth >= 6, "walk stack is as deep as the nesting");
+	expect(bytes >= depth, "walk stack size is reported in bytes");
+	expect(overflows == 0, "walk stack holds the whole formula");
+
+	// a replay does not walk nodes, the peak is unchanged
+	size_t again = 0;
+	tex_draw(r, L, 0, 0, 0);
+	tex_renderer_get_stack_stats(r, &again, NULL, NULL);
+	expect(again == depth, "replay keeps the walk stack peak");
+
+	tex_renderer_destroy(r);
+	tex_free(L);
+}
+
+// a slab with room for the tree but not its walk stack leaves subtrees out, which the layout reports
+static void test_walk_stack_overflow(void)
+{
+	char buf[2048] = "Deep $";
+	for (int i = 0; i < 24; i++)
+		strcat(buf, "\\frac{1}{");
+	strcat(buf, "x");
+	for (int i = 0; i < 24; i++)
+		strcat(buf, "}");
+	strcat(buf, "$ end");
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts" };
+
+	int silent = 0, overflowed = 0, formatted = 1;
+	for (size_t slab = 2048; slab <= 12 * 1024; slab += 64)
+	{
+		TeX_Layout* L = tex_format(buf, 300, &cfg);
+		TeX_Renderer* r = tex_renderer_create_sized(slab);
+		if (!L || !r || tex_get_last_error(L) != TEX_OK)
+		{
+			formatted = 0;
+			tex_renderer_destroy(r);
+			tex_free(L);
+			break;
+		}
+		tex_draw(r, L, 0, 0, 0);
+		size_t overflows = 0;
+		tex_renderer_get_stack_stats(r, NULL, NULL, &overflows);
+		if (overflows > 0)
+		{
+			overflowed++;
+			if (tex_get_last_error(L) != TEX_ERR_OOM)
+				silent++;
+		}
+		tex_renderer_destroy(r);
+		tex_free(L);
+	}
+	expect(formatted, "deep formula formats for the overflow test");
+	expect(overflowed > 0, "some slab size holds the tree but not its walk stack");
+	expect(silent == 0, "a skipped subtree sets TEX_ERR_OOM on the layout");
+}
+
 static void test_viewport_culling(void)
 {
 	char buf[] = "line1\nline2\nline3\nline4\nline5\nline6\nline7\nline8\nline9\n";
@@ -99,6 +272,32 @@ static void test_viewport_culling(void)
 	tex_free(L);
 }
 
+// text crossing a pane's side edges keeps only the glyphs inside it
+static void test_viewport_clipping(void)
+{
+	char buf[] = "abcdefghijklmnopqrstuvwxyzab $x^2 + y$";
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts" };
+	TeX_Layout* L = tex_format(buf, 300, &cfg);
+	expect(L != NULL, "format returns layout for clipping test");
+	TeX_Viewport pane = { 30, 0, 20, 40 };
+	tex_draw_log_reset();
+	tex_draw_viewport(g_renderer, L, 0, 0, 0, &pane);
+
+	TexDrawOp ops[256];
+	int n = tex_draw_log_get(ops, 256);
+	int text = 0, inside = 1;
+	for (int i = 0; i < n; i++)
+	{
+		if (ops[i].type != DOP_TEXT && ops[i].type != DOP_GLYPH)
+			continue;
+		text++;
+		inside &= ops[i].x1 >= pane.x && ops[i].x2 <= pane.x + pane.w;
+	}
+	expect(text > 0, "a pane over the middle of a text run draws part of it");
+	expect(inside, "text drawn in a pane stays inside its side edges");
+	tex_free(L);
+}
+
 int main(void)
 {
 	g_renderer = tex_renderer_create();
@@ -111,7 +310,13 @@ int main(void)
 	test_frac_draws_rule();
 	test_overlay_bar_draws_line();
 	test_sqrt_head_and_bar();
+	test_replay_translates();
+	test_adjacent_glyphs_merge();
+	test_delimiters_blit_sprites();
+	test_walk_stack_stats();
+	test_walk_stack_overflow();
 	test_viewport_culling();
+	test_viewport_clipping();
 
 	tex_renderer_destroy(g_renderer);
 
@@ -6,7 +6,11 @@
 // TODO: Update tests to use a renderer to trigger rehydration, then inspect lines.
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "tex/tex.h"
+#include "tex/tex_internal.h"
+#include "tex/tex_parse.h"
 
 static int g_fail = 0;
 
@@ -69,11 +73,793 @@ static void test_format_multiline(void)
 	tex_free(L);
 }
 
+static void test_renderer_multi_slots(void)
+{
+	char b0[] = "First $x^2$";
+	char b1[] = "Second message";
+	char b2[] = "Third $\\frac{a}{b}$";
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts" };
+	TeX_Layout* L[3] = { tex_format(b0, 100, &cfg), tex_format(b1, 100, &cfg), tex_format(b2, 100, &cfg) };
+	TeX_Renderer* r = tex_renderer_create_multi(12 * 1024, 4);
+	if (!L[0] || !L[1] || !L[2] || !r)
+	{
+		fprintf(stderr, "[FAIL] multi-slot setup failed\n");
+		g_fail++;
+		goto done;
+	}
+
+	// first frame hydrates every layout, later frames must hit
+	for (int i = 0; i < 3; i++)
+		tex_draw(r, L[i], 0, i * 40, 0);
+	size_t resets_first = 0;
+	tex_renderer_get_stats(r, NULL, NULL, NULL, &resets_first);
+	for (int frame = 0; frame < 3; frame++)
+		for (int i = 0; i < 3; i++)
+			tex_draw(r, L[i], 0, i * 40, 0);
+	size_t resets_after = 0;
+	tex_renderer_get_stats(r, NULL, NULL, NULL, &resets_after);
+	if (resets_after != resets_first)
+	{
+		fprintf(stderr, "[FAIL] multi-slot renderer rehydrated cached layouts (%u -> %u)\n", (unsigned)resets_first,
+		        (unsigned)resets_after);
+		g_fail++;
+	}
+
+done:
+	tex_renderer_destroy(r);
+	for (int i = 0; i < 3; i++)
+		tex_free(L[i]);
+}
+
+// each slot holds a whole window, a screen of formula-dense paragraphs takes about 6KB (README, renderer budget)
+static void test_renderer_multi_paragraphs(void)
+{
+	char buf[4][1024];
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts" };
+	TeX_Layout* L[4];
+	for (int i = 0; i < 4; i++)
+	{
+		buf[i][0] = '\0';
+		for (int p = 0; p < 6; p++)
+			strcat(buf[i], "The sum $\\sum_{k=1}^{n} \\frac{1}{k^2}$ converges and the matrix "
+			               "$\\begin{pmatrix} a & b \\\\ c & d \\end{pmatrix}$ is invertible when its "
+			               "determinant is not zero.\n");
+		L[i] = tex_format(buf[i], 300, &cfg);
+	}
+	TeX_Renderer* r = tex_renderer_create_multi(32 * 1024, 4);
+	TeX_Renderer* tight = tex_renderer_create_multi(32 * 1024, 8);
+	if (!L[0] || !L[1] || !L[2] || !L[3] || !r || !tight)
+	{
+		fprintf(stderr, "[FAIL] multi-paragraph setup failed\n");
+		g_fail++;
+		goto done;
+	}
+
+	// the second frame draws every layout from its kept window
+	size_t resets[2] = { 0, 0 }, overflows = 0;
+	for (int frame = 0; frame < 2; frame++)
+	{
+		for (int i = 0; i < 4; i++)
+			tex_draw(r, L[i], 0, i * 60, 0);
+		tex_renderer_get_stats(r, NULL, NULL, NULL, &resets[frame]);
+	}
+	tex_renderer_get_stack_stats(r, NULL, NULL, &overflows);
+	for (int i = 0; i < 4; i++)
+	{
+		if (tex_get_last_error(L[i]) != TEX_OK)
+		{
+			fprintf(stderr, "[FAIL] 8KB slot could not hold a formula-dense window: %s\n", tex_get_error_message(L[i]));
+			g_fail++;
+		}
+	}
+	if (resets[1] != resets[0] || overflows != 0)
+	{
+		fprintf(stderr, "[FAIL] multi-paragraph windows were not kept (%u -> %u resets, %u overflows)\n",
+		        (unsigned)resets[0], (unsigned)resets[1], (unsigned)overflows);
+		g_fail++;
+	}
+
+	// a slot below the budget says so instead of drawing part of the window
+	tex_draw(tight, L[0], 0, 0, 0);
+	if (tex_get_last_error(L[0]) != TEX_ERR_OOM)
+	{
+		fprintf(stderr, "[FAIL] 4KB slot drew a formula-dense window without reporting OOM\n");
+		g_fail++;
+	}
+
+done:
+	tex_renderer_destroy(tight);
+	tex_renderer_destroy(r);
+	for (int i = 0; i < 4; i++)
+		tex_free(L[i]);
+}
+
+static void test_format_stepped(void)
+{
+	char buf[] = "Line one\nLine two with $x^2$\n$$\\frac{a}{b}$$\nLine four";
+	char ref_buf[sizeof(buf)];
+	for (size_t i = 0; i < sizeof(buf); i++)
+		ref_buf[i] = buf[i];
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts" };
+
+	TeX_Layout* ref = tex_format(ref_buf, 100, &cfg);
+	TeX_Layout* L = tex_format_begin(buf, -1, 100, &cfg);
+	if (!ref || !L)
+	{
+		fprintf(stderr, "[FAIL] tex_format_begin returned NULL\n");
+		g_fail++;
+		tex_free(ref);
+		tex_free(L);
+		return;
+	}
+
+	// partial results must be usable and never shrink
+	int steps = 0;
+	int prev_h = 0;
+	while (tex_format_step(L, 2))
+	{
+		int h = tex_get_total_height(L);
+		if (h < prev_h)
+		{
+			fprintf(stderr, "[FAIL] stepped height shrank (%d -> %d)\n", prev_h, h);
+			g_fail++;
+		}
+		prev_h = h;
+		steps++;
+	}
+	tex_format_end(L);
+
+	if (steps < 2)
+	{
+		fprintf(stderr, "[FAIL] small budget should take several steps (%d)\n", steps);
+		g_fail++;
+	}
+	if (tex_get_total_height(L) != tex_get_total_height(ref))
+	{
+		fprintf(stderr, "[FAIL] stepped height %d != one-shot height %d\n", tex_get_total_height(L),
+		        tex_get_total_height(ref));
+		g_fail++;
+	}
+	tex_free(ref);
+	tex_free(L);
+}
+
+static void test_append_matches_format(void)
+{
+	static const char text[] = "Streaming reply with words that wrap at the edge, inline $x^2 + \\frac{1}{2}$ math\n"
+	                           "$$\\sum_{i=0}^{n} i = \\frac{n(n+1)}{2}$$\n"
+	                           "then an escaped \\$ sign and $\\sqrt{a}$ done.\n\nLast paragraph $y$ here";
+	const int n = (int)sizeof(text) - 1;
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts" };
+
+	char stream[sizeof(text)];
+	char prefix[sizeof(text)];
+	stream[0] = '\0';
+	TeX_Layout* L = tex_format(stream, 90, &cfg);
+	if (!L)
+	{
+		fprintf(stderr, "[FAIL] tex_format of empty stream returned NULL\n");
+		g_fail++;
+		return;
+	}
+
+	// every prefix, including ones ending inside an unclosed '$', must measure like a one-shot format
+	int mismatches = 0;
+	for (int len = 1; len <= n; len += 3)
+	{
+		for (int i = 0; i < len; i++)
+			stream[i] = prefix[i] = text[i];
+		stream[len] = prefix[len] = '\0';
+
+		tex_append(L, stream, len);
+		TeX_Layout* ref = tex_format(prefix, 90, &cfg);
+		if (!ref || tex_get_total_height(ref) != tex_get_total_height(L))
+			mismatches++;
+		tex_free(ref);
+	}
+	if (mismatches)
+	{
+		fprintf(stderr, "[FAIL] tex_append height differs from tex_format for %d prefixes\n", mismatches);
+		g_fail++;
+	}
+	tex_free(L);
+}
+
+static void test_format_unterminated(void)
+{
+	// archived AppVar data is read in place and has no terminator, the heap copy lets ASan catch overreads
+	static const char text[] = "Area $\\pi r^2$ of a circle\n$$\\frac{1}{2}$$ and words that wrap past the edge";
+	const int n = (int)sizeof(text) - 1;
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts" };
+
+	char* data = (char*)malloc((size_t)n);
+	if (!data)
+		return;
+	memcpy(data, text, (size_t)n);
+
+	TeX_Layout* ref = tex_format(text, 90, &cfg);
+	TeX_Layout* L = tex_format_n(data, n, 90, &cfg);
+	TeX_Renderer* r = tex_renderer_create();
+	if (!ref || !L || !r)
+	{
+		fprintf(stderr, "[FAIL] tex_format_n setup returned NULL\n");
+		g_fail++;
+	}
+	else
+	{
+		if (tex_get_total_height(L) != tex_get_total_height(ref))
+		{
+			fprintf(stderr, "[FAIL] tex_format_n height differs from tex_format\n");
+			g_fail++;
+		}
+		tex_draw(r, L, 0, 0, 0);
+	}
+	tex_renderer_destroy(r);
+	tex_free(L);
+	tex_free(ref);
+	free(data);
+}
+
+static void test_font_cache(void)
+{
+	char buf[] = "Cached $x^2 + \\frac{a}{b}$ metrics";
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts" };
+
+	// the second format reuses the loaded pack, invalidating forces a reload, all must agree
+	TeX_Layout* a = tex_format(buf, 100, &cfg);
+	TeX_Layout* b = tex_format(buf, 100, &cfg);
+	tex_font_cache_invalidate();
+	TeX_Layout* c = tex_format(buf, 100, &cfg);
+	if (!a || !b || !c || tex_get_total_height(a) != tex_get_total_height(b) ||
+	    tex_get_total_height(a) != tex_get_total_height(c))
+	{
+		fprintf(stderr, "[FAIL] cached font metrics change layout height\n");
+		g_fail++;
+	}
+	tex_free(a);
+	tex_free(b);
+	tex_free(c);
+}
+
+static void count_errors(void* userdata, int level, const char* msg, const char* file, int line)
+{
+	(void)msg;
+	(void)file;
+	(void)line;
+	if (level == 2)
+		(*(int*)userdata)++;
+}
+
+static void test_formatter_scratch(void)
+{
+	char buf[1024] = "Lead text $x$ then ";
+	for (int i = 0; i < 12; i++)
+		strcat(buf, "$\\frac{a_1 + b^2}{\\sqrt{c_3 + d}} + \\sum_{i=0}^{n} x_i$ ");
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts" };
+
+	// the dry run keeps one parse stack chunk and about one node per nesting level, long flat formulas fit a small
+	// pool (256 bytes of nodes and blocks next to the stack)
+	size_t small = tex_parse_stack_chunk_size() + 256;
+	TeX_Formatter* f = tex_formatter_create(small, 0, NULL);
+	TeX_Layout* L = f ? tex_formatter_format(f, buf, -1, 120, &cfg) : NULL;
+	TeX_Layout* ref = tex_format(buf, 120, &cfg);
+	if (!ref || !L || tex_get_last_error(L) != TEX_OK || tex_get_total_height(L) != tex_get_total_height(ref))
+	{
+		fprintf(stderr, "[FAIL] flat formulas do not fit a small scratch pool\n");
+		g_fail++;
+	}
+	tex_free(ref);
+	tex_free(L);
+	tex_formatter_destroy(f);
+
+	strcat(buf, "$");
+	for (int i = 0; i < 12; i++)
+		strcat(buf, "\\frac{1}{");
+	strcat(buf, "x");
+	for (int i = 0; i < 12; i++)
+		strcat(buf, "}");
+	strcat(buf, "$");
+
+	// a formula nested deeper than the scratch pool holds grows it and is measured the same as with the default pool
+	// the OOM that triggered the growth never reaches the error callback
+	int reported = 0;
+	ref = tex_format(buf, 120, &cfg);
+	f = tex_formatter_create(small, 16 * 1024, NULL);
+	TeX_Config counted = cfg;
+	counted.error_callback = count_errors;
+	counted.error_userdata = &reported;
+	L = f ? tex_formatter_format(f, buf, -1, 120, &counted) : NULL;
+	if (!ref || !L || tex_get_last_error(L) != TEX_OK || tex_get_total_height(L) != tex_get_total_height(ref) ||
+	    tex_formatter_scratch_size(f) <= small || reported != 0)
+	{
+		fprintf(stderr, "[FAIL] formatter scratch pool does not grow to fit a formula\n");
+		g_fail++;
+	}
+
+	// reformatting into the same layout reuses it and matches a fresh format
+	const char* other = "Other $\\frac{1}{2}$ text\nwith a second line";
+	TeX_Layout* ref2 = tex_format(other, 90, &cfg);
+	if (!L || tex_format_into(f, L, other, -1, 90, &cfg) != 0 || tex_get_last_error(L) != TEX_OK ||
+	    tex_get_total_height(L) != tex_get_total_height(ref2))
+	{
+		fprintf(stderr, "[FAIL] tex_format_into does not match tex_format\n");
+		g_fail++;
+	}
+	tex_formatter_destroy(f);
+
+	// a pool that may not grow reports the offset of the formula that did not fit, once
+	f = tex_formatter_create(small, 0, NULL);
+	if (f && L && tex_format_into(f, L, buf, -1, 120, &counted) == 0)
+	{
+		const char* first_big = strstr(buf, "$\\frac{1}");
+		if (tex_get_last_error(L) != TEX_ERR_OOM || tex_get_error_value(L) != (int)(first_big - buf) || reported != 1)
+		{
+			fprintf(stderr, "[FAIL] scratch OOM does not name the formula offset (err %d val %d)\n",
+			        (int)tex_get_last_error(L), tex_get_error_value(L));
+			g_fail++;
+		}
+	}
+	else
+	{
+		fprintf(stderr, "[FAIL] formatter without growth setup\n");
+		g_fail++;
+	}
+	tex_formatter_destroy(f);
+	tex_free(L);
+	tex_free(ref);
+	tex_free(ref2);
+}
+
+typedef struct
+{
+	int allocs;
+	int frees;
+	long live;
+	long peak; // most bytes live at once
+} AllocCounter;
+
+static void* counting_alloc(void* userdata, size_t size)
+{
+	AllocCounter* c = (AllocCounter*)userdata;
+	c->allocs++;
+	c->live += (long)size;
+	if (c->live > c->peak)
+		c->peak = c->live;
+	return malloc(size);
+}
+
+static void counting_free(void* userdata, void* ptr, size_t size)
+{
+	AllocCounter* c = (AllocCounter*)userdata;
+	c->frees++;
+	c->live -= (long)size;
+	free(ptr);
+}
+
+static void test_allocator_hooks(void)
+{
+	AllocCounter counter = { 0, 0, 0, 0 };
+	TeX_Allocator alloc = { counting_alloc, NULL, counting_free, &counter };
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts", .allocator = &alloc };
+
+	char buf[2048] = "";
+	for (int i = 0; i < 20; i++)
+		strcat(buf, "Line of text $\\frac{a}{b} + x^2$ and more words\n");
+
+	TeX_Document* doc = tex_document_create_alloc(&alloc);
+	TeX_Renderer* r = tex_renderer_create_alloc(8 * 1024, 2, &alloc);
+	TeX_Layout* L = tex_format(buf, 120, &cfg);
+	TeX_Formatter* f = tex_formatter_create(0, 0, &alloc);
+	if (!doc || !r || !L || !f || tex_document_append(doc, L, 0, 0, NULL) < 0)
+	{
+		fprintf(stderr, "[FAIL] allocator hook setup\n");
+		g_fail++;
+		return;
+	}
+	tex_document_append(doc, tex_formatter_format(f, buf, -1, 100, &cfg), 4, 4, NULL);
+
+	// steady state drawing takes nothing from the allocator
+	int before = counter.allocs;
+	TeX_Viewport vp = { 0, 0, 320, 240 };
+	for (int scroll = 0; scroll < tex_document_total_height(doc); scroll += 60)
+		tex_document_draw(doc, r, 0, scroll, &vp, NULL, NULL);
+	if (counter.allocs != before)
+	{
+		fprintf(stderr, "[FAIL] drawing allocated %d times\n", counter.allocs - before);
+		g_fail++;
+	}
+
+	// position lookups borrow the formatter's scratch instead of allocating one each
+	int same = 1;
+	for (int off = 0; off < (int)strlen(buf); off += 37)
+		same &= tex_formatter_offset_to_y(f, L, off) == tex_offset_to_y(L, off);
+	counter.peak = counter.live;
+	for (int y = 0; y < tex_get_total_height(L); y += 9)
+		tex_formatter_y_to_offset(f, L, y);
+	if (!same || counter.peak - counter.live > 1024)
+	{
+		fprintf(stderr, "[FAIL] formatter lookups allocated a scratch pool per lookup\n");
+		g_fail++;
+	}
+
+	tex_formatter_destroy(f);
+	tex_renderer_destroy(r);
+	tex_document_destroy(doc);
+	if (counter.allocs == 0 || counter.allocs != counter.frees || counter.live != 0)
+	{
+		fprintf(stderr, "[FAIL] allocator hooks unbalanced (allocs %d frees %d live %ld)\n", counter.allocs,
+		        counter.frees, counter.live);
+		g_fail++;
+	}
+}
+
+static void test_checkpoint_spacing(void)
+{
+	static char plain[16384];
+	static char dense[16384];
+	plain[0] = dense[0] = '\0';
+	for (int i = 0; i < 150; i++)
+	{
+		strcat(plain, "Plain words fill this line\n");
+		strcat(dense, "$\\frac{a^2}{b_1} + \\sqrt{x_i}$ $\\sum_{k=0}^{n} k$\n");
+	}
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts" };
+
+	TeX_Layout* P = tex_format(plain, 200, &cfg);
+	TeX_Layout* D = tex_format(dense, 200, &cfg);
+	if (!P || !D)
+	{
+		fprintf(stderr, "[FAIL] checkpoint layouts\n");
+		g_fail++;
+		tex_free(P);
+		tex_free(D);
+		return;
+	}
+
+	// plain text is only split by pixel distance, formulas by their parse cost, and tables are shrunk to fit
+	int plain_px = tex_get_total_height(P) / (P->checkpoint_count + 1);
+	int dense_px = tex_get_total_height(D) / (D->checkpoint_count + 1);
+	if (plain_px < TEX_CHECKPOINT_INTERVAL / 2 || dense_px >= plain_px)
+	{
+		fprintf(stderr, "[FAIL] checkpoint spacing plain %dpx dense %dpx\n", plain_px, dense_px);
+		g_fail++;
+	}
+	if (P->checkpoint_bytes > P->checkpoint_count * 4 || P->checkpoint_capacity != P->checkpoint_bytes)
+	{
+		fprintf(stderr, "[FAIL] checkpoint table not compact (%d entries, %d bytes, %d capacity)\n",
+		        P->checkpoint_count, P->checkpoint_bytes, P->checkpoint_capacity);
+		g_fail++;
+	}
+
+	int anchors = (D->checkpoint_count + TEX_CHECKPOINT_ANCHOR_EVERY - 1) / TEX_CHECKPOINT_ANCHOR_EVERY;
+	if (D->checkpoint_count <= 2 * TEX_CHECKPOINT_ANCHOR_EVERY || D->checkpoint_anchor_capacity != anchors)
+	{
+		fprintf(stderr, "[FAIL] checkpoint anchors (%d entries, %d anchors)\n", D->checkpoint_count,
+		        D->checkpoint_anchor_capacity);
+		g_fail++;
+	}
+
+	// every y maps to the checkpoint span containing it, and the next span starts where this one ends
+	int ok = 1;
+	for (int y = 0; y < tex_get_total_height(D); y += 7)
+	{
+		TeX_Checkpoint at, next, again, after;
+		int index = tex_checkpoint_find(D, y, &at, &next);
+		if (at.y_pos > y || next.y_pos <= y || at.src_offset > next.src_offset ||
+		    next.src_offset - at.src_offset > TEX_CHECKPOINT_COST)
+			ok = 0;
+		if (index + 1 < D->checkpoint_count &&
+		    (tex_checkpoint_find(D, next.y_pos, &after, NULL) != index + 1 || after.y_pos != next.y_pos ||
+		     after.src_offset != next.src_offset))
+			ok = 0;
+		if (index >= 0 && (tex_checkpoint_find(D, at.y_pos, &again, NULL) != index ||
+		                   again.src_offset != at.src_offset))
+			ok = 0;
+		// offset lookups seek the same anchors by source offset
+		if (index >= 0 && tex_offset_to_y(D, at.src_offset) != at.y_pos)
+			ok = 0;
+	}
+	if (!ok)
+	{
+		fprintf(stderr, "[FAIL] tex_checkpoint_find spans\n");
+		g_fail++;
+	}
+	tex_free(P);
+	tex_free(D);
+}
+
+static void test_offset_lookup(void)
+{
+	static char buf[16384];
+	buf[0] = '\0';
+	for (int i = 0; i < 40; i++)
+	{
+		char para[256];
+		snprintf(para, sizeof(para),
+		         "# Section %d\nSome words that wrap around the narrow width $x_%d^2 + \\frac{a}{b}$ and on.\n\n", i,
+		         i);
+		strcat(buf, para);
+	}
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts", .outline_marker = "# " };
+	TeX_Layout* L = tex_format(buf, 100, &cfg);
+	if (!L)
+	{
+		fprintf(stderr, "[FAIL] offset lookup layout\n");
+		g_fail++;
+		return;
+	}
+
+	if (tex_outline_count(L) != 40)
+	{
+		fprintf(stderr, "[FAIL] outline has %d headings, expected 40\n", tex_outline_count(L));
+		g_fail++;
+	}
+
+	// headings start lines, both lookups land exactly on them
+	int ok = 1;
+	for (int i = 0; i < tex_outline_count(L); i++)
+	{
+		int off = -1, y = -1;
+		tex_outline_get(L, i, &off, &y);
+		if (strncmp(buf + off, "# Section", 9) != 0 || tex_offset_to_y(L, off) != y || tex_y_to_offset(L, y) != off ||
+		    tex_y_to_offset(L, y + 1) != off)
+			ok = 0;
+	}
+	if (!ok)
+	{
+		fprintf(stderr, "[FAIL] heading offsets and y positions disagree\n");
+		g_fail++;
+	}
+
+	// any offset maps into the line that starts at or before it, in document order
+	ok = 1;
+	int prev_y = 0;
+	int len = (int)strlen(buf);
+	for (int off = 0; off < len; off += 13)
+	{
+		int y = tex_offset_to_y(L, off);
+		int start = tex_y_to_offset(L, y);
+		if (y < prev_y || start > off || tex_offset_to_y(L, start) != y)
+			ok = 0;
+		prev_y = y;
+	}
+	if (!ok || tex_outline_get(L, 40, NULL, NULL) == 0 || tex_offset_to_y(L, len + 100) > tex_get_total_height(L))
+	{
+		fprintf(stderr, "[FAIL] offset/y lookups are not consistent\n");
+		g_fail++;
+	}
+	tex_free(L);
+}
+
+static void test_parse_stack_budget(void)
+{
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts" };
+	// \frac nesting takes two parser frames per level, more than the default budget holds
+	char buf[1024] = "$";
+	for (int i = 0; i < TEX_PARSE_MAX_DEPTH + 8; ++i)
+		strcat(buf, "\\frac{1}{");
+	strcat(buf, "x");
+	for (int i = 0; i < TEX_PARSE_MAX_DEPTH + 8; ++i)
+		strcat(buf, "}");
+	strcat(buf, "$");
+
+	int ok = 1;
+	TeX_Layout* L = tex_format(buf, 160, &cfg);
+	ok = ok && L && tex_get_last_error(L) == TEX_ERR_DEPTH;
+	tex_free(L);
+
+	// a larger budget takes the same formula, and it draws within it
+	cfg.parse_stack_frames = 2 * TEX_PARSE_MAX_DEPTH + 20;
+	L = tex_format(buf, 160, &cfg);
+	TeX_Renderer* r = tex_renderer_create();
+	ok = ok && L && r && tex_get_last_error(L) == TEX_OK && tex_get_total_height(L) > 0;
+	if (L && r)
+		tex_draw(r, L, 0, 0, 0);
+	ok = ok && L && tex_get_last_error(L) == TEX_OK;
+	tex_renderer_destroy(r);
+	tex_free(L);
+	if (!ok)
+	{
+		fprintf(stderr, "[FAIL] parse_stack_frames does not bound nesting\n");
+		g_fail++;
+	}
+
+	// a budget of one frame still parses flat formulas
+	cfg.parse_stack_frames = 1;
+	L = tex_format("$a + b$", 160, &cfg);
+	ok = L && tex_get_last_error(L) == TEX_OK;
+	tex_free(L);
+	L = tex_format("$a + {b}$", 160, &cfg);
+	ok = ok && L && tex_get_last_error(L) == TEX_ERR_DEPTH && tex_get_error_value(L) == 2;
+	tex_free(L);
+	if (!ok)
+	{
+		fprintf(stderr, "[FAIL] a one frame parse budget\n");
+		g_fail++;
+	}
+}
+
+// lookups replay lines the way the dry run measured them, before and after a formula that raised an error
+static void test_offset_lookup_error(void)
+{
+	static char buf[16384];
+	buf[0] = '\0';
+	for (int i = 0; i < 30; i++)
+	{
+		char para[512];
+		snprintf(para, sizeof(para), "# Section %d\nWords that wrap around the narrow width $x_%d^2 + \\frac{a}{b}$.\n\n",
+		         i, i);
+		strcat(buf, para);
+		if (i == 12)
+		{
+			strcat(buf, "Deep $");
+			for (int d = 0; d < 40; d++)
+				strcat(buf, "\\frac{1}{");
+			strcat(buf, "x");
+			for (int d = 0; d < 40; d++)
+				strcat(buf, "}");
+			strcat(buf, "$ here.\n\n");
+		}
+	}
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts", .outline_marker = "# " };
+	TeX_Layout* L = tex_format(buf, 100, &cfg);
+	if (!L || tex_get_last_error(L) != TEX_ERR_DEPTH || tex_outline_count(L) != 30)
+	{
+		fprintf(stderr, "[FAIL] offset lookup error layout\n");
+		g_fail++;
+		tex_free(L);
+		return;
+	}
+
+	// twice: with the dry run's error, then with one raised after formatting (which the replay ignores)
+	for (int pass = 0; pass < 2; pass++)
+	{
+		int ok = 1;
+		for (int i = 0; i < tex_outline_count(L); i++)
+		{
+			int off = -1, y = -1;
+			tex_outline_get(L, i, &off, &y);
+			if (tex_offset_to_y(L, off) != y || tex_y_to_offset(L, y) != off)
+				ok = 0;
+		}
+		if (!ok || tex_get_last_error(L) != (pass ? TEX_ERR_INPUT : TEX_ERR_DEPTH))
+		{
+			fprintf(stderr, "[FAIL] lookups disagree with headings on a layout with an error (pass %d)\n", pass);
+			g_fail++;
+		}
+
+		if (pass == 0)
+		{
+			TeX_Config deep = cfg;
+			deep.parse_stack_frames = 128;
+			tex_format_into(NULL, L, buf, -1, 100, &deep);
+			tex_append(L, buf, 1); // shorter than the formatted text: TEX_ERR_INPUT after the dry run
+		}
+	}
+	tex_free(L);
+}
+
+static void test_hit_test(void)
+{
+	char buf[] = "Let $a+b^{2}+\\frac{x}{y}-c_1$ end";
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts" };
+	TeX_Layout* L = tex_format(buf, 300, &cfg);
+	TeX_Renderer* r = tex_renderer_create();
+	if (!L || !r)
+	{
+		fprintf(stderr, "[FAIL] hit test setup failed\n");
+		g_fail++;
+		goto done;
+	}
+	tex_draw(r, L, 0, 20, 0);
+
+	// sweep the line: every glyph of the formula is found with its own one character span
+	const char* want = "Le+2xy-1";
+	int found[8] = { 0 };
+	int ok = 1;
+	for (int py = 20; py < 20 + tex_get_total_height(L); py++)
+	{
+		for (int px = 0; px < 300; px++)
+		{
+			TeX_HitResult h;
+			if (tex_hit_test(r, L, 0, 20, 0, px, py, &h) != 0)
+			{
+				ok = 0;
+				continue;
+			}
+			if (h.src_offset < 0 || h.src_offset + h.src_len > (int)strlen(buf))
+				ok = 0;
+			if (h.depth > 0 && (px < h.x || px >= h.x + h.w || py < h.y || py >= h.y + h.h))
+				ok = 0;
+			if (h.depth == 0 && h.src_offset == 0 && h.src_len == 3)
+				found[0] = 1;
+			for (int i = 2; i < 8 && h.src_len == 1; i++)
+				if (buf[h.src_offset] == want[i])
+					found[i] = 1;
+			if (h.src_len == 1 && buf[h.src_offset] == '+' && h.src_offset > 7)
+				found[1] = 1; // the second '+' is not mistaken for the first
+		}
+	}
+	for (int i = 0; i < 8; i++)
+		ok = ok && found[i];
+	TeX_HitResult h;
+	if (!ok || tex_hit_test(r, L, 0, 20, 0, 10, 10, &h) == 0 ||
+	    tex_hit_test(r, L, 0, 20, 0, 10, 20 + tex_get_total_height(L), &h) == 0)
+	{
+		fprintf(stderr, "[FAIL] hit test spans\n");
+		g_fail++;
+	}
+
+done:
+	tex_renderer_destroy(r);
+	tex_free(L);
+}
+
+// the hit path is the draw walk's frame stack, a point reaches nodes nested deeper than the default parse budget
+static void test_hit_test_deep(void)
+{
+	char buf[1024] = "$";
+	for (int i = 0; i < 40; i++)
+		strcat(buf, "\\frac{1}{");
+	strcat(buf, "x");
+	for (int i = 0; i < 40; i++)
+		strcat(buf, "}");
+	strcat(buf, "$");
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts", .parse_stack_frames = 200 };
+	TeX_Layout* L = tex_format(buf, 300, &cfg);
+	TeX_Renderer* r = tex_renderer_create();
+	if (!L || !r || tex_get_last_error(L) != TEX_OK)
+	{
+		fprintf(stderr, "[FAIL] deep hit test setup failed\n");
+		g_fail++;
+		goto done;
+	}
+	tex_draw(r, L, 0, 0, 0);
+
+	int deepest = -1, found_x = 0;
+	for (int py = 0; py < tex_get_total_height(L); py++)
+	{
+		for (int px = 0; px < 300; px++)
+		{
+			TeX_HitResult h;
+			if (tex_hit_test(r, L, 0, 0, 0, px, py, &h) != 0)
+				continue;
+			if (h.depth > deepest)
+				deepest = h.depth;
+			if (h.src_len == 1 && buf[h.src_offset] == 'x')
+				found_x = 1;
+		}
+	}
+	if (!found_x || deepest <= TEX_PARSE_STACK_FRAMES)
+	{
+		fprintf(stderr, "[FAIL] deep hit test stopped at depth %d\n", deepest);
+		g_fail++;
+	}
+
+done:
+	tex_renderer_destroy(r);
+	tex_free(L);
+}
+
 int main(void)
 {
 	test_format_basic();
 	test_format_with_math();
 	test_format_multiline();
+	test_renderer_multi_slots();
+	test_renderer_multi_paragraphs();
+	test_format_stepped();
+	test_append_matches_format();
+	test_format_unterminated();
+	test_font_cache();
+	test_formatter_scratch();
+	test_parse_stack_budget();
+	test_allocator_hooks();
+	test_checkpoint_spacing();
+	test_offset_lookup();
+	test_offset_lookup_error();
+	test_hit_test();
+	test_hit_test_deep();
 	if (g_fail == 0)
 	{
 		printf("test_layout: PASS\n");
@@ -174,12 +174,128 @@ static void test_matrix_metrics(void)
 	expect(mx2 && mx2->type == N_MATRIX, "plain matrix parsed");
 	expect(mx2->w >= 0, "plain matrix has non-negative width");
 
+	// 20x18, past the old 16x16 cap: every row and column is measured and kept in the grid
 	pool_free(&pool);
+	pool_init(&pool, 32768);
+	char big[1024] = "\\begin{matrix}";
+	for (int r = 0; r < 20; r++)
+	{
+		for (int c = 0; c < 18; c++)
+			strcat(big, c ? "&x" : "x");
+		strcat(big, r < 19 ? "\\\\" : "\\end{matrix}");
+	}
+	NodeRef r3_ref = tex_parse_math(big, (int)strlen(big), &pool, &L);
+	Node* r3 = pool_get_node(&pool, r3_ref);
+	assert(r3 && "r3 should not be NULL");
+	Node* mx3 = pool_get_node(&pool, list_first_item(&pool, r3->data.list.head));
+	assert(mx3 && mx3->type == N_MATRIX);
+	tex_measure_range(&pool, 0, (NodeRef)pool.node_count);
+	expect(mx3->data.matrix.rows == 20 && mx3->data.matrix.cols == 18, "large matrix keeps its size");
+	int16_t* col_w = matrix_grid(&pool, mx3);
+	expect(col_w != NULL, "matrix grid allocated");
+	if (col_w)
+	{
+		int16_t* row_asc = col_w + 18;
+		int16_t* row_desc = row_asc + 20;
+		expect(col_w[17] == col_w[0] && row_asc[19] == row_asc[0] && row_desc[19] == row_desc[0],
+		       "last row and column are measured");
+		expect(mx3->asc + mx3->desc == 20 * (row_asc[0] + row_desc[0]) + 19 * TEX_MATRIX_ROW_SPACING,
+		       "height covers all rows");
+		NodeRef* cells = matrix_cells(col_w, mx3);
+		expect(cells[20 * 18 - 1] != NODE_NULL, "last cell is in the grid");
+	}
+
+	pool_free(&pool);
+}
+
+// fused measuring gives the two-pass metrics, and a later pass over the tree changes nothing
+static void test_fused_measure(void)
+{
+	static const char* const forms[] = {
+		"x^2 + \\frac{a}{b_1}",
+		"\\sqrt[3]{\\alpha + \\left( \\frac{1}{2} \\right)}",
+		"\\begin{array}{c|c} a & \\hat{b} \\\\ \\text{c d} & \\iint \\end{array}",
+		"\\binom{n}{k} \\quad \\overbrace{x+y}^{n} \\sin x",
+		"\\lim_{\\frac{a}{b}} \\overbrace{a+b}^{\\frac{1}{2}}",
+	};
+	for (size_t f = 0; f < sizeof(forms) / sizeof(forms[0]); f++)
+	{
+		TeX_Layout L = { 0 };
+		UnifiedPool two, fused;
+		pool_init(&two, 8192);
+		pool_init(&fused, 8192);
+		int len = (int)strlen(forms[f]);
+		NodeRef r1 = tex_parse_math(forms[f], len, &two, &L);
+		tex_measure_range(&two, 0, (NodeRef)two.node_count);
+		NodeRef r2 = tex_parse_math_measured(forms[f], len, &fused, &L);
+		expect(r1 != NODE_NULL && r2 != NODE_NULL && two.node_count == fused.node_count, "fused parse same tree");
+
+		int16_t w[64], asc[64], desc[64];
+		int count = (int)fused.node_count;
+		if (count > 64)
+			count = 64;
+		int same = 1;
+		for (int i = 0; i < count; i++)
+		{
+			Node* a = pool_get_node(&two, (NodeRef)i);
+			Node* b = pool_get_node(&fused, (NodeRef)i);
+			w[i] = b->w;
+			asc[i] = b->asc;
+			desc[i] = b->desc;
+			same = same && a->w == b->w && a->asc == b->asc && a->desc == b->desc;
+		}
+		// limits and brace labels are allocated after their parent, a linear pass measures the parent too early
+		if (f + 1 < sizeof(forms) / sizeof(forms[0]))
+			expect(same, "fused metrics match two-pass");
+		else
+			expect(!same, "fused measures limits before their parent");
+
+		tex_measure_range(&fused, 0, (NodeRef)fused.node_count);
+		int stable = 1;
+		for (int i = 0; i < count; i++)
+		{
+			Node* b = pool_get_node(&fused, (NodeRef)i);
+			stable = stable && w[i] == b->w && asc[i] == b->asc && desc[i] == b->desc;
+		}
+		expect(stable, "fused metrics are final");
+
+		// size only parsing keeps the root box and counts the nodes it did not keep
+		UnifiedPool size;
+		pool_init(&size, 8192);
+		int nodes = 0;
+		NodeRef r3 = tex_parse_math_size(forms[f], len, &size, &L, &nodes);
+		Node* a = pool_get_node(&fused, r2);
+		Node* b = pool_get_node(&size, r3);
+		expect(a && b && a->w == b->w && a->asc == b->asc && a->desc == b->desc, "size only root box matches");
+		expect(nodes == (int)fused.node_count && size.node_count < fused.node_count, "size only releases nodes");
+		pool_free(&size);
+		pool_free(&two);
+		pool_free(&fused);
+	}
+
+	// a long flat formula needs one parse stack chunk and a few nodes, however many terms it has
+	size_t small = tex_parse_stack_chunk_size() + 512;
+	size_t peak[2] = { 0, 0 };
+	int ok = 1;
+	for (int run = 0; run < 2; run++)
+	{
+		char big[2048] = "";
+		for (int i = 0; i < (run ? 40 : 4); i++)
+			strcat(big, "\\frac{a_1}{\\sqrt{b}} + ");
+		TeX_Layout L = { 0 };
+		UnifiedPool size;
+		pool_init(&size, small);
+		NodeRef root = tex_parse_math_size(big, (int)strlen(big), &size, &L, NULL);
+		ok = ok && root != NODE_NULL && L.error.code == TEX_OK;
+		peak[run] = size.peak_used;
+		pool_free(&size);
+	}
+	expect(ok && peak[1] == peak[0] && peak[0] < small, "flat formula fits a small pool");
 }
 
 int main(void)
 {
-	// Initialize flyweight reserved nodes for ASCII glyphs
+	// Initialize flyweight reserved nodes for glyphs
 	tex_reserved_init();
 	test_glyph_widths();
 	test_fraction_metrics();
@@ -187,6 +303,7 @@ int main(void)
 	test_sqrt_metrics();
 	test_lim_metrics();
 	test_matrix_metrics();
+	test_fused_measure();
 	if (g_fail == 0)
 	{
 		printf("test_measure: PASS\n");
@@ -152,6 +152,39 @@ static void test_lim_and_bigops(void)
 	pool_free(&pool);
 }
 
+static void test_extended_flyweights(void)
+{
+	TeX_Layout L = { 0 };
+	UnifiedPool pool;
+	pool_init(&pool, 8192);
+	char buf[] = "\\alpha\\beta^{\\gamma}";
+	NodeRef r_ref = tex_parse_math(buf, (int)strlen(buf), &pool, &L);
+	Node* r = pool_get_node(&pool, r_ref);
+	assert(r && "root should not be NULL");
+
+	// Greek letters are shared glyph nodes in both roles, only the script and its group are allocated
+	NodeRef alpha = list_first_item(&pool, r->data.list.head);
+	assert_true_int(TEX_IS_RESERVED_REF(alpha), "main role Greek letter is a flyweight");
+	Node* a = pool_get_node(&pool, alpha);
+	assert_true_int(a && a->type == N_GLYPH && a->data.glyph >= 128 && a->flags == 0, "flyweight holds the glyph code");
+
+	TexListBlock* block = pool_get_list_block(&pool, r->data.list.head);
+	NodeRef script_ref = NODE_NULL;
+	for (; block && script_ref == NODE_NULL; block = pool_get_list_block(&pool, block->next))
+		for (uint16_t i = 0; i < block->count; i++)
+			if (pool_get_node(&pool, block->items[i])->type == N_SCRIPT)
+				script_ref = block->items[i];
+	Node* sc = pool_get_node(&pool, script_ref);
+	assert(sc && "beta^{gamma} should be a script");
+	assert_true_int(TEX_IS_RESERVED_REF(sc->data.script.base), "script base is a flyweight");
+	Node* sup = pool_get_node(&pool, sc->data.script.sup);
+	NodeRef gamma = (sup && sup->type == N_MATH) ? list_first_item(&pool, sup->data.list.head) : sc->data.script.sup;
+	Node* g = pool_get_node(&pool, gamma);
+	assert_true_int(TEX_IS_RESERVED_REF(gamma) && g && (g->flags & TEX_FLAG_SCRIPT), "script role flyweight");
+	assert_true_int(pool.node_count <= 3, "no nodes allocated for plain glyphs");
+	pool_free(&pool);
+}
+
 static void test_auto_delim(void)
 {
 	TeX_Layout L = { 0 };
@@ -283,13 +316,14 @@ static void test_matrix(void)
 
 int main(void)
 {
-	// Initialize flyweight reserved nodes for ASCII glyphs
+	// Initialize flyweight reserved nodes for glyphs
 	tex_reserved_init();
 
 	test_frac();
 	test_scripts();
 	test_overlays();
 	test_lim_and_bigops();
+	test_extended_flyweights();
 	test_auto_delim();
 	test_matrix();
 	if (g_fail == 0)
@@ -63,6 +63,47 @@ static void test_pool_string_alloc(void)
 	pool_free(&pool);
 }
 
+static void test_pool_block_alloc(void)
+{
+	UnifiedPool pool;
+	pool_init(&pool, 1024);
+
+	// odd cursor after a 4 byte string, the block is aligned down
+	pool_alloc_string(&pool, "abcd", 4);
+	expect(pool.string_cursor == 1019, "string leaves an odd cursor");
+	StringId b = pool_alloc_block(&pool, 100);
+	expect(b == 918, "block aligned to 2 bytes below the string");
+	expect(pool.string_cursor == 918, "string_cursor moved to the block");
+
+	// blocks never overlap nodes
+	expect(pool_alloc_block(&pool, 919) == STRING_NULL, "oversized block fails");
+	expect(pool.string_cursor == 918, "failed block leaves the cursor");
+
+	pool_free(&pool);
+}
+
+static void test_pool_list_size_classes(void)
+{
+	UnifiedPool pool;
+	pool_init(&pool, 1024);
+
+	// a list grows 1, 4, then 16 items per block, the block costs only its header and items
+	ListId first = pool_alloc_list_block(&pool, NULL);
+	TexListBlock* b1 = pool_get_list_block(&pool, first);
+	expect(b1 && b1->cap == 1 && b1->count == 0 && b1->next == LIST_NULL, "first block holds one item");
+	expect(pool.string_cursor == 1024 - 6, "single item block is 6 bytes");
+
+	size_t before = pool.string_cursor;
+	TexListBlock* b2 = pool_get_list_block(&pool, pool_alloc_list_block(&pool, b1));
+	expect(b2 && b2->cap == 4 && before - pool.string_cursor == 12, "second block holds four items");
+
+	TexListBlock* b3 = pool_get_list_block(&pool, pool_alloc_list_block(&pool, b2));
+	TexListBlock* b4 = pool_get_list_block(&pool, pool_alloc_list_block(&pool, b3));
+	expect(b3 && b4 && b3->cap == TEX_LIST_BLOCK_CAP && b4->cap == TEX_LIST_BLOCK_CAP, "later blocks are full size");
+
+	pool_free(&pool);
+}
+
 static void test_pool_collision(void)
 {
 	UnifiedPool pool;
@@ -121,6 +162,32 @@ static void test_pool_reset(void)
 	pool_free(&pool);
 }
 
+static void test_pool_mark_release(void)
+{
+	UnifiedPool pool;
+	pool_init(&pool, 2048);
+
+	NodeRef kept = pool_alloc_node(&pool);
+	StringId kept_str = pool_alloc_string(&pool, "keep", 4);
+	PoolMark mark = pool_mark(&pool);
+	pool_alloc_node(&pool);
+	pool_alloc_list_block(&pool, NULL);
+	pool_alloc_string(&pool, "drop", 4);
+
+	// everything after the mark is freed, the next allocations reuse its space
+	pool_release(&pool, mark);
+	expect(pool.node_count == 1 && pool.string_cursor == mark.string_cursor, "release rolls back both cursors");
+	expect(pool_alloc_node(&pool) == (NodeRef)(kept + 1), "node after release reuses the slot");
+	expect(strcmp(pool_get_string(&pool, kept_str), "keep") == 0, "allocation before the mark survives");
+
+	// a mark from before a reset is ignored
+	pool_reset(&pool);
+	pool_release(&pool, mark);
+	expect(pool.node_count == 0 && pool.string_cursor == 2048, "stale mark is ignored");
+
+	pool_free(&pool);
+}
+
 static void test_pool_invalid_access(void)
 {
 	UnifiedPool pool;
@@ -140,8 +207,11 @@ int main(void)
 {
 	test_pool_basic_alloc();
 	test_pool_string_alloc();
+	test_pool_block_alloc();
+	test_pool_list_size_classes();
 	test_pool_collision();
 	test_pool_reset();
+	test_pool_mark_release();
 	test_pool_invalid_access();
 
 	if (g_fail == 0)
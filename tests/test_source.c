@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: AGPL-3.0-only
+#include <stdio.h>
+#include <string.h>
+
+#include "tex/tex.h"
+#include "tex/tex_internal.h"
+#include "tex/tex_source.h"
+
+static int g_fail = 0;
+
+static void expect(int cond, const char* msg)
+{
+	if (!cond)
+	{
+		fprintf(stderr, "[FAIL] %s\n", msg);
+		g_fail++;
+	}
+}
+
+static char g_text[8192];
+static uint8_t g_packed[16384];
+
+static void put_u16(uint8_t* p, int v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t* p, int v)
+{
+	put_u16(p, v);
+	put_u16(p + 2, v >> 16);
+}
+
+// greedy reference encoder for the block codec, same format as tools/pack_source.py
+static int encode_block(const char* raw, int n, uint8_t* out)
+{
+	int o = 0;
+	int lit = 0;
+	for (int p = 0; p <= n; p++)
+	{
+		int best = 0, dist = 0;
+		for (int c = 0; p < n && c < p; c++)
+		{
+			int k = 0;
+			while (k < 0x7F + 3 && p + k < n && raw[c + k] == raw[p + k])
+				k++;
+			if (k > best)
+			{
+				best = k;
+				dist = p - c;
+			}
+		}
+		if (lit > 0 && (best >= 3 || lit == 0x80 || p == n))
+		{
+			out[o++] = (uint8_t)(lit - 1);
+			memcpy(out + o, raw + p - lit, (size_t)lit);
+			o += lit;
+			lit = 0;
+		}
+		if (p == n)
+			break;
+		if (best >= 3)
+		{
+			out[o++] = (uint8_t)(0x80 | (best - 3));
+			put_u16(out + o, dist);
+			o += 2;
+			p += best - 1;
+		}
+		else
+		{
+			lit++;
+		}
+	}
+	return o;
+}
+
+// pack text with a block boundary after every newline that is at least block_size bytes past the last one
+static int pack_text(const char* text, int block_size)
+{
+	int len = (int)strlen(text);
+	int ends[256];
+	int count = 0;
+	int start = 0;
+	for (int i = 0; i < len; i++)
+	{
+		if (text[i] == '\n' && i + 1 - start >= block_size)
+		{
+			ends[count++] = i + 1;
+			start = i + 1;
+		}
+	}
+	if (start < len || count == 0)
+		ends[count++] = len;
+
+	int max_block = 0;
+	int at = TEX_SOURCE_HEADER_SIZE + (count + 1) * TEX_SOURCE_ENTRY_SIZE;
+	start = 0;
+	for (int b = 0; b <= count; b++)
+	{
+		uint8_t* e = g_packed + TEX_SOURCE_HEADER_SIZE + b * TEX_SOURCE_ENTRY_SIZE;
+		put_u32(e, start);
+		put_u32(e + 4, at);
+		if (b == count)
+			break;
+		if (ends[b] - start > max_block)
+			max_block = ends[b] - start;
+		at += encode_block(text + start, ends[b] - start, g_packed + at);
+		start = ends[b];
+	}
+
+	memcpy(g_packed, TEX_SOURCE_MAGIC, 4);
+	put_u32(g_packed + 4, len);
+	put_u16(g_packed + 8, count);
+	put_u16(g_packed + 10, max_block);
+	return at;
+}
+
+static void build_text(void)
+{
+	g_text[0] = '\0';
+	for (int i = 0; i < 30; i++)
+	{
+		char para[256];
+		snprintf(para, sizeof(para),
+		         "Paragraph %d repeats the same words so the codec finds matches, $x_%d^2 + y^2$ inline.\n"
+		         "$$\\frac{a_%d}{b} = \\sqrt{c}$$\n\n",
+		         i, i, i);
+		strcat(g_text, para);
+	}
+}
+
+static void test_source_blocks(void)
+{
+	build_text();
+	int size = pack_text(g_text, 300);
+
+	TeX_PackedSource src;
+	expect(tex_source_open(&src, g_packed, size) == 0, "tex_source_open accepts packed data");
+	expect(src.raw_len == (int)strlen(g_text), "raw length");
+	expect(src.block_count > 4, "text splits into several blocks");
+	expect(size < src.raw_len, "repetitive text compresses");
+
+	char block[4096];
+	int ok = 1;
+	for (int b = 0; b < src.block_count; b++)
+	{
+		int start = tex_source_block_start(&src, b);
+		int n = tex_source_decode(&src, b, block);
+		if (n != tex_source_block_start(&src, b + 1) - start || memcmp(block, g_text + start, (size_t)n) != 0)
+			ok = 0;
+		if (tex_source_block_at(&src, start) != b)
+			ok = 0;
+	}
+	expect(ok, "every block decodes to its slice of the text");
+
+	UnifiedPool pool;
+	if (pool_init(&pool, 4096) == 0)
+	{
+		const char* w = tex_source_window(&src, &pool, 500, 900);
+		expect(w && memcmp(w, g_text + 500, 400) == 0, "window spanning blocks matches the text");
+		pool_free(&pool);
+	}
+
+	expect(tex_source_open(&src, (const uint8_t*)g_text, (int)strlen(g_text)) != 0, "plain text is rejected");
+	expect(tex_source_open(&src, g_packed, TEX_SOURCE_HEADER_SIZE + 4) != 0, "truncated table is rejected");
+}
+
+static void test_packed_layout(void)
+{
+	build_text();
+	int size = pack_text(g_text, 300);
+	TeX_Config cfg = { .color_fg = 1, .color_bg = 255, .font_pack = "TeXFonts" };
+
+	TeX_Layout* ref = tex_format(g_text, 120, &cfg);
+	TeX_Layout* L = tex_format_packed(g_packed, size, 120, &cfg);
+	TeX_Renderer* r = tex_renderer_create();
+	if (!ref || !L || !r)
+	{
+		expect(0, "packed layout setup");
+	}
+	else
+	{
+		expect(tex_get_total_height(L) == tex_get_total_height(ref), "packed height matches plain format");
+		for (int scroll = 0; scroll < tex_get_total_height(L); scroll += 150)
+			tex_draw(r, L, 0, 0, scroll);
+		expect(tex_get_last_error(L) == TEX_OK, "drawing a packed layout decompresses its windows");
+		int same = 1;
+		for (int off = 0; off < (int)strlen(g_text); off += 97)
+			same &= tex_offset_to_y(L, off) == tex_offset_to_y(ref, off);
+		expect(same, "packed offset lookups replay from inside a block");
+		TeX_Formatter* f = tex_formatter_create(0, 0, NULL);
+		same = f != NULL;
+		for (int y = 0; y < tex_get_total_height(L); y += 41)
+			same &= tex_formatter_y_to_offset(f, L, y) == tex_y_to_offset(ref, y);
+		expect(same, "packed lookups replay in a formatter's scratch and block buffer");
+		tex_formatter_destroy(f);
+		expect(tex_append(L, g_text, -1) != 0, "tex_append rejects packed layouts");
+	}
+	tex_renderer_destroy(r);
+	tex_free(L);
+	tex_free(ref);
+
+	put_u32(g_packed + TEX_SOURCE_HEADER_SIZE + TEX_SOURCE_ENTRY_SIZE, (int)strlen(g_text) + 1);
+	expect(tex_format_packed(g_packed, size, 120, &cfg) == NULL, "corrupt block table returns NULL");
+}
+
+int main(void)
+{
+	test_source_blocks();
+	test_packed_layout();
+	if (g_fail == 0)
+	{
+		printf("test_source: PASS\n");
+		return 0;
+	}
+	printf("test_source: FAIL (%d)\n", g_fail);
+	return 1;
+}
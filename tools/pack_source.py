@@ -0,0 +1,188 @@
+# SPDX-License-Identifier: AGPL-3.0-only
+"""Pack a libtexce source document into independently compressed blocks.
+
+The output is read by tex_format_packed(). Blocks are split between tokens
+(preferably after a newline) so the engine can tokenize any run of blocks on
+its own, and each block is compressed with a small LZ codec that the
+calculator decodes in a few bytes of code. See src/tex/tex_source.h for the
+format.
+
+Usage: python3 tools/pack_source.py input.txt output.bin [--block 1024]
+Convert output.bin into an AppVar with convbin to ship it.
+"""
+import argparse
+import struct
+
+MAGIC = b"TXZ1"
+MIN_MATCH = 3
+MAX_MATCH = 0x7F + MIN_MATCH
+MAX_LITERAL = 0x80
+MAX_DIST = 0xFFFF
+ESCAPE_CHARS = b"\\${}"
+
+
+# =============================================================================
+# TOKEN BOUNDARIES (mirrors tex_stream_next in src/tex/tex_token.c)
+# =============================================================================
+
+def find_math_end(data, p, display):
+    while p < len(data) and data[p] != 0:
+        c = data[p]
+        if c == ord("\\"):
+            if p + 1 < len(data) and data[p + 1] != 0:
+                p += 2
+                continue
+            break
+        if c == ord("$"):
+            if not display:
+                return p
+            if p + 1 < len(data) and data[p + 1] == ord("$"):
+                return p
+        p += 1
+    return -1
+
+
+def scan_text(data, p):
+    while p < len(data) and data[p] not in (0, ord(" "), ord("\n"), ord("$")):
+        if data[p] == ord("\\") and p + 1 < len(data) and data[p + 1] in ESCAPE_CHARS:
+            p += 2
+        else:
+            p += 1
+    return p
+
+
+def token_boundaries(data):
+    """Yield (offset, after_newline) for every position where a token ends."""
+    p = 0
+    while p < len(data) and data[p] != 0:
+        c = data[p]
+        newline = False
+        if c == ord("\n"):
+            p += 1
+            newline = True
+        elif c == ord(" "):
+            while p < len(data) and data[p] == ord(" "):
+                p += 1
+        elif c == ord("$"):
+            display = p + 1 < len(data) and data[p + 1] == ord("$")
+            after_open = p + (2 if display else 1)
+            close = find_math_end(data, after_open, display)
+            if close >= 0:
+                p = close + (2 if display else 1)
+            else:
+                p = scan_text(data, p + 1)
+        else:
+            p = scan_text(data, p)
+        yield p, newline
+
+
+def split_blocks(data, block_size):
+    """Return block end offsets, cutting after newlines where possible."""
+    ends = []
+    start = 0
+    best_any = best_newline = -1
+    for pos, newline in token_boundaries(data):
+        if pos - start > block_size and (best_newline > start or best_any > start):
+            cut = best_newline if best_newline > start else best_any
+            ends.append(cut)
+            start = cut
+        best_any = pos
+        if newline:
+            best_newline = pos
+    if start < len(data) or not ends:
+        ends.append(len(data))
+    return ends
+
+
+# =============================================================================
+# BLOCK CODEC
+# =============================================================================
+
+def compress_block(raw):
+    out = bytearray()
+    literals = bytearray()
+    heads = {}
+
+    def flush_literals():
+        for i in range(0, len(literals), MAX_LITERAL):
+            chunk = literals[i:i + MAX_LITERAL]
+            out.append(len(chunk) - 1)
+            out.extend(chunk)
+        literals.clear()
+
+    p = 0
+    while p < len(raw):
+        best_len = best_dist = 0
+        key = bytes(raw[p:p + MIN_MATCH])
+        if len(key) == MIN_MATCH:
+            for cand in reversed(heads.get(key, [])[-32:]):
+                dist = p - cand
+                if dist > MAX_DIST:
+                    break
+                n = 0
+                while n < MAX_MATCH and p + n < len(raw) and raw[cand + n] == raw[p + n]:
+                    n += 1
+                if n > best_len:
+                    best_len, best_dist = n, dist
+        step = best_len if best_len >= MIN_MATCH else 1
+        for q in range(p, min(p + step, len(raw) - MIN_MATCH + 1)):
+            heads.setdefault(bytes(raw[q:q + MIN_MATCH]), []).append(q)
+        if best_len >= MIN_MATCH:
+            flush_literals()
+            out.append(0x80 | (best_len - MIN_MATCH))
+            out.extend(struct.pack("<H", best_dist))
+        else:
+            literals.append(raw[p])
+        p += step
+    flush_literals()
+    return bytes(out)
+
+
+def pack(data, block_size):
+    ends = split_blocks(data, block_size)
+    blocks = []
+    start = 0
+    for end in ends:
+        blocks.append(data[start:end])
+        start = end
+    if len(blocks) > 0xFFFF:
+        raise SystemExit("too many blocks, use a larger --block")
+
+    max_block = max((len(b) for b in blocks), default=0)
+    if max_block > 0xFFFF:
+        raise SystemExit("a single token is longer than 65535 bytes")
+
+    table_size = 12 + (len(blocks) + 1) * 8
+    payload = bytearray()
+    table = bytearray()
+    raw_offset = 0
+    for b in blocks:
+        table += struct.pack("<II", raw_offset, table_size + len(payload))
+        payload += compress_block(b)
+        raw_offset += len(b)
+    table += struct.pack("<II", raw_offset, table_size + len(payload))
+
+    header = MAGIC + struct.pack("<IHH", len(data), len(blocks), max_block)
+    return header + table + payload
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Pack a libtexce document into compressed blocks")
+    parser.add_argument("input", help="source text (UTF-8 bytes are stored as is)")
+    parser.add_argument("output", help="packed output file")
+    parser.add_argument("--block", type=int, default=1024,
+                        help="target decompressed block size in bytes (default 1024)")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+    packed = pack(data, max(args.block, 64))
+    with open(args.output, "wb") as f:
+        f.write(packed)
+
+    print(f"{args.input}: {len(data)} -> {len(packed)} bytes "
+          f"({len(packed) * 100 // max(len(data), 1)}%)")
+
+
+if __name__ == "__main__":
+    main()
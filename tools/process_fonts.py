@@ -2,7 +2,6 @@ import argparse
 import os
 import shutil
 import subprocess
-from PIL import Image
 
 # =============================================================================
 # 1. CONFIGURATION & SYMBOL MAP
@@ -15,6 +14,12 @@ BMP_RED_LINE_Y = 15  # The row index of the red baseline in the BMP cell
 
 TOOLS_DIR = os.path.dirname(os.path.abspath(__file__))
 ROOT_DIR = os.path.dirname(TOOLS_DIR)
+TABLES_HEADER = os.path.join(ROOT_DIR, "src", "tex", "tex_font_tables.h")
+
+# Metrics tables format version, part of the stamp the engine checks against the loaded packs
+TABLES_VERSION = 1
+# Glyphs whose widths go into the stamp (the engine reads them with fontlib_GetGlyphWidth)
+STAMP_PROBES = [0x30, 0x41, 0x57, 0x69, 0x6D, 0x7E, 0x80, 0x96, 0xBC]
 
 # Low-Index Math Symbols (0x01 - 0x10)
 # These replace the old cursor definitions
@@ -205,6 +210,8 @@ def get_math_axis_height(img, cell_x, cell_y, profile):
 # =============================================================================
 
 def perform_export():
+    from PIL import Image  # only the export step reads BMPs
+
     print("--- STARTING EXPORT ---")
     
     for key, p in PROFILES.items():
@@ -275,6 +282,81 @@ def perform_export():
         print(f"  -> Wrote {p['out_txt']}")
     print("--- EXPORT COMPLETE ---")
 
+# =============================================================================
+# 3.5. OPERATION: GENERATE METRICS HEADER (from the exported .txt)
+# =============================================================================
+
+def read_font_txt(path):
+    header = {}
+    widths = {}
+    code = None
+    with open(path, "r", encoding="utf-8") as f:
+        for line in f:
+            key, sep, value = line.partition(":")
+            if not sep:
+                continue
+            value = value.strip()
+            if key == "Code point":
+                code = int(value)
+            elif key == "Width" and code is not None:
+                widths[code] = int(value)
+                code = None
+            elif key in ("Height", "Baseline", "x-height"):
+                header[key] = int(value)
+    return header, widths
+
+def fnv1a(data):
+    h = 0x811C9DC5
+    for b in data:
+        h = ((h ^ (b & 0xFF)) * 0x01000193) & 0xFFFFFFFF
+    return h
+
+def perform_header():
+    print("--- GENERATING METRICS HEADER ---")
+    lines = [
+        "// SPDX-License-Identifier: AGPL-3.0-only",
+        "// Generated by tools/process_fonts.py, do not edit.",
+        "// Glyph metrics of the stock font packs, used instead of fontlib queries when the loaded",
+        "// packs produce the same stamp (see tex_metrics.c). Included by tex_metrics.c only.",
+        "",
+        "#ifndef TEX_TEX_FONT_TABLES_H",
+        "#define TEX_TEX_FONT_TABLES_H",
+        "",
+        "#include <stdint.h>",
+        "",
+        f"#define TEX_FONT_TABLES_VERSION {TABLES_VERSION}",
+        f"#define TEX_FONT_TABLES_PROBE_COUNT {len(STAMP_PROBES)}",
+        "static const uint8_t tex_font_tables_probes[TEX_FONT_TABLES_PROBE_COUNT] = { "
+        + ", ".join(f"0x{p:02X}" for p in STAMP_PROBES) + " };",
+    ]
+
+    for key, p in PROFILES.items():
+        header, widths = read_font_txt(p["out_txt"])
+        first = min(widths)
+        total = max(widths) - first + 1
+        table = [widths.get(i, 0) if i >= first else 0 for i in range(256)]
+        stamp = fnv1a([TABLES_VERSION, header["Height"], header["Baseline"], header["x-height"], first, total, 0]
+                      + [table[c] for c in STAMP_PROBES])
+        name = key.upper()
+        lines += [
+            "",
+            f"// {p['pack_name']} ({p['display_name']})",
+            f"#define TEX_FONT_TABLES_{name}_HEIGHT {header['Height']}",
+            f"#define TEX_FONT_TABLES_{name}_BASELINE {header['Baseline']}",
+            f"#define TEX_FONT_TABLES_{name}_X_HEIGHT {header['x-height']}",
+            f"#define TEX_FONT_TABLES_{name}_STAMP 0x{stamp:08X}u",
+            f"static const uint8_t tex_font_tables_{key}_widths[256] = {{",
+        ]
+        for row in range(0, 256, 16):
+            lines.append("\t" + ", ".join(str(w) for w in table[row:row + 16]) + ",")
+        lines.append("};")
+        print(f"  {p['pack_name']}: stamp 0x{stamp:08X}")
+
+    lines += ["", "#endif // TEX_TEX_FONT_TABLES_H", ""]
+    with open(TABLES_HEADER, "w", encoding="utf-8") as f:
+        f.write("\n".join(lines))
+    print(f"  -> Wrote {TABLES_HEADER}")
+
 # =============================================================================
 # 4. OPERATION: BUILD 8XV
 # =============================================================================
@@ -338,6 +420,9 @@ if __name__ == "__main__":
     # Command: Export
     parser_exp = subparsers.add_parser("export", help="Convert BMPs to .txt for convfont")
     
+    # Command: Header
+    parser_hdr = subparsers.add_parser("header", help="Generate src/tex/tex_font_tables.h from the .txt files")
+
     # Command: Build
     parser_build = subparsers.add_parser("build", help="Convert .txt to .8xv using convfont/convbin")
     parser_build.add_argument("--outdir", default="assets", help="Output directory for .8xv files")
@@ -352,10 +437,15 @@ if __name__ == "__main__":
     
     if args.command == "export":
         perform_export()
+        perform_header()
+
+    elif args.command == "header":
+        perform_header()
 
     elif args.command == "build":
         perform_build(args.outdir, args.keep_bin)
 
     elif args.command == "all":
         perform_export()
+        perform_header()
         perform_build(args.outdir, args.keep_bin)